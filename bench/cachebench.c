@@ -0,0 +1,497 @@
+// Macro definition required for using clock_gettime(), getopt_long() and malloc_usable_size()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../src/toolbox.h"
+#include "../src/metrics.h"
+#include "../src/file_cache.h"
+
+// Benchmark of the cache building, over a synthetic document root
+//
+// The document root is generated according to the given number of files,
+// size distribution, directory fan-out and compressibility; the cache is then built
+// from it, and the build time, the memory usage and the size of the metadata
+// (File and Folder structures, names, paths, types, pointer arrays) are reported
+
+// -----------------------------------------------------------------------------
+
+typedef enum SizeDistribution {
+    DISTRIBUTION_FIXED,      // All the files have the minimum size
+    DISTRIBUTION_UNIFORM,
+    DISTRIBUTION_LOG_UNIFORM // As many small files as large ones, per order of magnitude
+} SizeDistribution;
+
+typedef struct DocRootParameters {
+    char*            root_path;
+    bool             keep_root;
+
+    int              nb_files;
+    int              nb_files_per_folder;
+    int              fan_out;         // Number of subfolders of a non-leaf folder
+
+    SizeDistribution distribution;
+    int              min_file_size;
+    int              max_file_size;
+    double           compressibility; // Fraction of the content made of repeated text
+
+    off_t            cache_size;
+    unsigned int     seed;
+
+    char*            label;
+    char*            output_path;
+} DocRootParameters;
+
+// Statistics computed on the generated files, or on the cache
+typedef struct CacheStatistics {
+    int      nb_files;
+    int      nb_folders;
+    int      nb_loaded_files;
+
+    uint64_t source_bytes;          // Size of the files on the disk
+    uint64_t payload_bytes;         // Size of the cached contents
+    uint64_t metadata_bytes;        // Size requested to the allocator for the structures
+    uint64_t allocated_metadata_bytes; // Size actually allocated (including padding)
+} CacheStatistics;
+
+#define DEFAULT_NB_FILES            1000
+#define DEFAULT_NB_FILES_PER_FOLDER 32
+#define DEFAULT_FAN_OUT             4
+#define DEFAULT_MIN_FILE_SIZE       256
+#define DEFAULT_MAX_FILE_SIZE       65536
+#define DEFAULT_COMPRESSIBILITY     0.5
+#define DEFAULT_CACHE_SIZE          1000000000 // bytes
+
+#define CONTENT_BLOCK_SIZE          64
+
+static const char _repeated_text[] =
+    "<p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+    "eiusmod tempor incididunt ut labore et dolore magna aliqua.</p>\n";
+
+// -----------------------------------------------------------------------------
+// DOCUMENT ROOT GENERATION
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return a pseudo-random number in [0, 1)
+static double _getRandomFraction ()
+{
+    return (double) rand() / ((double) RAND_MAX + 1.0);
+}
+
+int getRandomFileSize (const DocRootParameters* parameters)
+{
+    int min_size = parameters->min_file_size;
+    int max_size = parameters->max_file_size;
+
+    switch (parameters->distribution)
+    {
+        case DISTRIBUTION_UNIFORM:
+            return min_size + (int) (_getRandomFraction() * (max_size - min_size + 1));
+
+        case DISTRIBUTION_LOG_UNIFORM:
+            return (int) exp(log(min_size)
+                            + _getRandomFraction() * (log(max_size) - log(min_size)));
+
+        case DISTRIBUTION_FIXED:
+        default:
+            return min_size;
+    }
+}
+
+// Each block of the content is either some repeated text, or random bytes
+void fillSyntheticContent (char* content, const int size, const double compressibility)
+{
+    int text_offset = 0;
+
+    for (int i = 0; i < size; i += CONTENT_BLOCK_SIZE)
+    {
+        int  block_size   = MIN(CONTENT_BLOCK_SIZE, size - i);
+        bool is_text      = _getRandomFraction() < compressibility;
+
+        for (int j = 0; j < block_size; j++)
+        {
+            if (is_text)
+            {
+                content[i + j] = _repeated_text[text_offset];
+                text_offset    = (text_offset + 1) % (sizeof(_repeated_text) - 1);
+            }
+            else
+                content[i + j] = (char) rand();
+        }
+    }
+}
+
+void writeSyntheticFile (const char* path, const int size, const double compressibility,
+                         char* content_buffer)
+{
+    fillSyntheticContent(content_buffer, size, compressibility);
+
+    int file_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file_fd < 0)
+        handleErrorAndExit("open() failed in writeSyntheticFile()");
+
+    int nb_bytes_written = 0;
+    while (nb_bytes_written < size)
+    {
+        int return_value = write(file_fd, content_buffer + nb_bytes_written,
+                                 size - nb_bytes_written);
+        if (return_value < 0)
+            handleErrorAndExit("write() failed in writeSyntheticFile()");
+
+        nb_bytes_written += return_value;
+    }
+
+    close(file_fd);
+}
+
+// Folders are filled in breadth-first order: a folder only gets subfolders
+// once it is full, and as long as files remain to be generated
+void generateDocRoot (const DocRootParameters* parameters, CacheStatistics* statistics)
+{
+    int    max_nb_folders = parameters->nb_files / parameters->nb_files_per_folder
+                          + parameters->fan_out + 1;
+    char** folder_paths   = malloc(max_nb_folders * sizeof(char*));
+    char*  content_buffer = malloc(parameters->max_file_size);
+    if (folder_paths == NULL || content_buffer == NULL)
+        handleErrorAndExit("malloc() failed in generateDocRoot()");
+
+    folder_paths[0]  = getFreshStringCopy(parameters->root_path);
+    int nb_folders   = 1;
+    int nb_files     = 0;
+    char path[MAX_PATH_LENGTH];
+
+    if (mkdir(parameters->root_path, 0755) < 0)
+        handleErrorAndExit("mkdir() failed in generateDocRoot()");
+
+    for (int i = 0; i < nb_folders && nb_files < parameters->nb_files; i++)
+    {
+        for (int j = 0; j < parameters->nb_files_per_folder && nb_files < parameters->nb_files; j++)
+        {
+            int size = getRandomFileSize(parameters);
+
+            snprintf(path, MAX_PATH_LENGTH, "%s/file_%d.html", folder_paths[i], nb_files);
+            writeSyntheticFile(path, size, parameters->compressibility, content_buffer);
+
+            statistics->source_bytes += size;
+            nb_files++;
+        }
+
+        for (int j = 0; j < parameters->fan_out && nb_files < parameters->nb_files
+                                                && nb_folders < max_nb_folders; j++)
+        {
+            snprintf(path, MAX_PATH_LENGTH, "%s/folder_%d", folder_paths[i], nb_folders);
+            if (mkdir(path, 0755) < 0)
+                handleErrorAndExit("mkdir() failed in generateDocRoot()");
+
+            folder_paths[nb_folders] = getFreshStringCopy(path);
+            nb_folders++;
+        }
+    }
+
+    for (int i = 0; i < nb_folders; i++)
+        free(folder_paths[i]);
+    free(folder_paths);
+    free(content_buffer);
+}
+
+// Remove the generated document root (its content was only generated by this program)
+void removeDocRoot (const char* root_path)
+{
+    char* execvp_argv[] = { "rm", "-Rf", (char*) root_path, NULL };
+
+    pid_t child_pid = fork();
+    if (child_pid < 0)
+        handleErrorAndExit("fork() failed in removeDocRoot()");
+
+    if (child_pid == 0)
+    {
+        execvp("rm", execvp_argv);
+        handleErrorAndExit("exec() failed in removeDocRoot()");
+    }
+
+    waitpid(child_pid, NULL, 0);
+}
+
+// -----------------------------------------------------------------------------
+// MEASUREMENTS
+// -----------------------------------------------------------------------------
+
+// Return the current resident set size of the process, in bytes
+uint64_t getResidentSetSize ()
+{
+    FILE* statm_file = fopen("/proc/self/statm", "r");
+    if (statm_file == NULL)
+        return 0;
+
+    unsigned long nb_pages    = 0;
+    unsigned long nb_resident = 0;
+    if (fscanf(statm_file, "%lu %lu", &nb_pages, &nb_resident) != 2)
+        nb_resident = 0;
+
+    fclose(statm_file);
+    return (uint64_t) nb_resident * sysconf(_SC_PAGESIZE);
+}
+
+// Internal version only!
+// Count a block allocated for the cache structures
+static void _countMetadata (CacheStatistics* statistics, void* block, const size_t size)
+{
+    if (block == NULL)
+        return;
+
+    statistics->metadata_bytes           += size;
+    statistics->allocated_metadata_bytes += malloc_usable_size(block);
+}
+
+// All the structures of the folders and files are in the arena of the cache:
+// the arena blocks are the allocated metadata, and the part of them in use the requested one
+void measureCacheMetadata (const FileCache* cache, CacheStatistics* statistics)
+{
+    _countMetadata(statistics, (void*) cache, sizeof(FileCache));
+    _countMetadata(statistics, cache->arena, sizeof(Arena));
+
+    statistics->metadata_bytes           += cache->arena->nb_bytes_used;
+    statistics->allocated_metadata_bytes += cache->arena->nb_bytes_reserved;
+}
+
+void recursivelyMeasureFolder (const Folder* folder, CacheStatistics* statistics)
+{
+    statistics->nb_folders++;
+
+    for (int i = 0; i < folder->nb_files; i++)
+    {
+        File* file = folder->files[i];
+        statistics->nb_files++;
+
+        if (file->state != STATE_NOT_LOADED)
+        {
+            statistics->nb_loaded_files++;
+            statistics->payload_bytes += file->size;
+        }
+    }
+
+    for (int i = 0; i < folder->nb_subfolders; i++)
+        recursivelyMeasureFolder(folder->subfolders[i], statistics);
+}
+
+// -----------------------------------------------------------------------------
+// RESULTS
+// -----------------------------------------------------------------------------
+
+char* getSizeDistributionAsString (const SizeDistribution distribution)
+{
+    switch (distribution)
+    {
+        case DISTRIBUTION_FIXED:
+            return "fixed";
+        case DISTRIBUTION_UNIFORM:
+            return "uniform";
+        case DISTRIBUTION_LOG_UNIFORM:
+            return "log-uniform";
+
+        default:
+            return "unknown";
+    }
+}
+
+void writeResults (const DocRootParameters* parameters, const CacheStatistics* generated,
+                   const CacheStatistics* cached, const double build_time,
+                   const uint64_t rss_before, const uint64_t rss_after)
+{
+    FILE* output = stdout;
+    if (parameters->output_path != NULL)
+    {
+        output = fopen(parameters->output_path, "a");
+        if (output == NULL)
+            handleErrorAndExit("fopen() failed in writeResults()");
+    }
+
+    int      nb_files  = MAX(cached->nb_files, 1);
+    uint64_t rss_delta = rss_after > rss_before ? rss_after - rss_before : 0;
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"label\": \"%s\",\n", parameters->label != NULL ? parameters->label : "");
+    fprintf(output, "  \"files\": %d,\n", cached->nb_files);
+    fprintf(output, "  \"folders\": %d,\n", cached->nb_folders);
+    fprintf(output, "  \"files_per_folder\": %d,\n", parameters->nb_files_per_folder);
+    fprintf(output, "  \"fan_out\": %d,\n", parameters->fan_out);
+    fprintf(output, "  \"size_distribution\": \"%s\",\n",
+            getSizeDistributionAsString(parameters->distribution));
+    fprintf(output, "  \"min_file_size\": %d,\n", parameters->min_file_size);
+    fprintf(output, "  \"max_file_size\": %d,\n", parameters->max_file_size);
+    fprintf(output, "  \"compressibility\": %.2f,\n", parameters->compressibility);
+    fprintf(output, "  \"cache_size\": %lld,\n", (long long) parameters->cache_size);
+    fprintf(output, "  \"loaded_files\": %d,\n", cached->nb_loaded_files);
+    fprintf(output, "  \"build_time_s\": %.3f,\n", build_time);
+    fprintf(output, "  \"build_time_per_file_us\": %.1f,\n", build_time * 1e6 / nb_files);
+    fprintf(output, "  \"source_bytes\": %llu,\n", (unsigned long long) generated->source_bytes);
+    fprintf(output, "  \"payload_bytes\": %llu,\n", (unsigned long long) cached->payload_bytes);
+    fprintf(output, "  \"metadata_bytes\": %llu,\n", (unsigned long long) cached->metadata_bytes);
+    fprintf(output, "  \"allocated_metadata_bytes\": %llu,\n",
+            (unsigned long long) cached->allocated_metadata_bytes);
+    fprintf(output, "  \"metadata_bytes_per_file\": %.1f,\n",
+            (double) cached->allocated_metadata_bytes / nb_files);
+    fprintf(output, "  \"payload_bytes_per_file\": %.1f,\n",
+            (double) cached->payload_bytes / nb_files);
+    fprintf(output, "  \"rss_before_bytes\": %llu,\n", (unsigned long long) rss_before);
+    fprintf(output, "  \"rss_after_bytes\": %llu,\n", (unsigned long long) rss_after);
+    fprintf(output, "  \"rss_per_file\": %.1f\n", (double) rss_delta / nb_files);
+    fprintf(output, "}\n");
+
+    if (output != stdout)
+        fclose(output);
+}
+
+// -----------------------------------------------------------------------------
+// COMMAND LINE
+// -----------------------------------------------------------------------------
+
+void printCachebenchUsageAndExit (const char* program_name)
+{
+    printf("Usage: %s [options]\n"
+           "  --files <n>             number of files (default: %d)\n"
+           "  --files-per-folder <n>  number of files per folder (default: %d)\n"
+           "  --fan-out <n>           number of subfolders per folder (default: %d)\n"
+           "  --distribution <name>   file sizes: fixed, uniform or log-uniform\n"
+           "                          (default: log-uniform)\n"
+           "  --min-size <bytes>      minimum file size (default: %d)\n"
+           "  --max-size <bytes>      maximum file size (default: %d)\n"
+           "  --compressibility <r>   fraction of compressible content, in [0, 1]\n"
+           "                          (default: %.1f)\n"
+           "  --cache-size <bytes>    maximum size of the cache (default: %d)\n"
+           "  --seed <n>              seed of the generator (default: 42)\n"
+           "  --root <dir>            where to generate the files (must not exist)\n"
+           "  --keep                  do not remove the generated files\n"
+           "  --label <label>         label copied in the results\n"
+           "  --output <file>         append the JSON results to a file (default: stdout)\n",
+           program_name, DEFAULT_NB_FILES, DEFAULT_NB_FILES_PER_FOLDER, DEFAULT_FAN_OUT,
+           DEFAULT_MIN_FILE_SIZE, DEFAULT_MAX_FILE_SIZE, DEFAULT_COMPRESSIBILITY,
+           DEFAULT_CACHE_SIZE);
+    exit(EXIT_FAILURE);
+}
+
+void parseDocRootParameters (DocRootParameters* parameters, int argc, char* argv[])
+{
+    memset(parameters, 0, sizeof(DocRootParameters));
+    parameters->nb_files            = DEFAULT_NB_FILES;
+    parameters->nb_files_per_folder = DEFAULT_NB_FILES_PER_FOLDER;
+    parameters->fan_out             = DEFAULT_FAN_OUT;
+    parameters->distribution        = DISTRIBUTION_LOG_UNIFORM;
+    parameters->min_file_size       = DEFAULT_MIN_FILE_SIZE;
+    parameters->max_file_size       = DEFAULT_MAX_FILE_SIZE;
+    parameters->compressibility     = DEFAULT_COMPRESSIBILITY;
+    parameters->cache_size          = DEFAULT_CACHE_SIZE;
+    parameters->seed                = 42;
+
+    const struct option options[] = {
+        { "files",            required_argument, NULL, 'n' },
+        { "files-per-folder", required_argument, NULL, 'F' },
+        { "fan-out",          required_argument, NULL, 'f' },
+        { "distribution",     required_argument, NULL, 'd' },
+        { "min-size",         required_argument, NULL, 'm' },
+        { "max-size",         required_argument, NULL, 'M' },
+        { "compressibility",  required_argument, NULL, 'c' },
+        { "cache-size",       required_argument, NULL, 'C' },
+        { "seed",             required_argument, NULL, 's' },
+        { "root",             required_argument, NULL, 'r' },
+        { "keep",             no_argument,       NULL, 'k' },
+        { "label",            required_argument, NULL, 'l' },
+        { "output",           required_argument, NULL, 'o' },
+        { NULL,               0,                 NULL, 0   }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+            case 'n': parameters->nb_files            = atoi(optarg); break;
+            case 'F': parameters->nb_files_per_folder = atoi(optarg); break;
+            case 'f': parameters->fan_out             = atoi(optarg); break;
+            case 'm': parameters->min_file_size       = atoi(optarg); break;
+            case 'M': parameters->max_file_size       = atoi(optarg); break;
+            case 'c': parameters->compressibility     = atof(optarg); break;
+            case 'C': parameters->cache_size          = atoll(optarg); break;
+            case 's': parameters->seed                = atoi(optarg); break;
+            case 'r': parameters->root_path           = optarg;       break;
+            case 'k': parameters->keep_root           = true;         break;
+            case 'l': parameters->label               = optarg;       break;
+            case 'o': parameters->output_path         = optarg;       break;
+
+            case 'd':
+                if (stringsAreEqual(optarg, "fixed"))
+                    parameters->distribution = DISTRIBUTION_FIXED;
+                else if (stringsAreEqual(optarg, "uniform"))
+                    parameters->distribution = DISTRIBUTION_UNIFORM;
+                else if (stringsAreEqual(optarg, "log-uniform"))
+                    parameters->distribution = DISTRIBUTION_LOG_UNIFORM;
+                else
+                    printCachebenchUsageAndExit(argv[0]);
+                break;
+
+            default:
+                printCachebenchUsageAndExit(argv[0]);
+        }
+    }
+
+    if (parameters->nb_files < 1 || parameters->nb_files_per_folder < 1
+    ||  parameters->fan_out < 1   || parameters->min_file_size < 1
+    ||  parameters->max_file_size < parameters->min_file_size
+    ||  parameters->compressibility < 0 || parameters->compressibility > 1
+    ||  parameters->cache_size < 0)
+        printCachebenchUsageAndExit(argv[0]);
+}
+
+int main (int argc, char* argv[])
+{
+    DocRootParameters parameters;
+    parseDocRootParameters(&parameters, argc, argv);
+
+    char default_root_path[64];
+    if (parameters.root_path == NULL)
+    {
+        snprintf(default_root_path, sizeof(default_root_path), "/tmp/cachebench-%d", getpid());
+        parameters.root_path = default_root_path;
+    }
+
+    srand(parameters.seed);
+
+    CacheStatistics generated;
+    memset(&generated, 0, sizeof(CacheStatistics));
+    generateDocRoot(&parameters, &generated);
+
+    // Measure the cache building
+    uint64_t rss_before = getResidentSetSize();
+    uint64_t start_time = getMonotonicTimeInNanoseconds();
+
+    FileCache* cache = buildCacheFromDisk(parameters.root_path, parameters.cache_size);
+
+    uint64_t end_time  = getMonotonicTimeInNanoseconds();
+    uint64_t rss_after = getResidentSetSize();
+
+    CacheStatistics cached;
+    memset(&cached, 0, sizeof(CacheStatistics));
+    measureCacheMetadata(cache, &cached);
+    recursivelyMeasureFolder(cache->root, &cached);
+
+    writeResults(&parameters, &generated, &cached, (end_time - start_time) / 1e9,
+                 rss_before, rss_after);
+
+    deleteFileCache(cache);
+    if (! parameters.keep_root)
+        removeDocRoot(parameters.root_path);
+
+    return 0;
+}
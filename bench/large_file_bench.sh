@@ -0,0 +1,86 @@
+#!/bin/sh
+# Throughput benchmark of the server on files larger than 2 GB, over loopback.
+# The server is run on a copy of www/ plus a sparse file of several GB (which is
+# too large to be cached, and thus sent with sendfile()); the file is downloaded
+# a few times, and ranges located beyond 2 GB and 4 GB are checked.
+# All the results are gathered in a single JSON object.
+#
+# Environment variables: LARGE_FILE_SIZE_GB, NB_DOWNLOADS, PORT, RESULTS (output file)
+
+set -e
+
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build"
+
+LARGE_FILE_SIZE_GB=${LARGE_FILE_SIZE_GB:-5}
+NB_DOWNLOADS=${NB_DOWNLOADS:-3}
+PORT=${PORT:-4242}
+RESULTS=${RESULTS:-"$BUILD_DIR/bench/large-file-$(date +%Y%m%d-%H%M%S).json"}
+
+LARGE_FILE_SIZE=$((LARGE_FILE_SIZE_GB * 1000000000))
+
+# Build the data directory: the server always serves ./www
+# The large file is sparse: it does not use any disk space, and is read from memory
+WORK_DIR=$(mktemp -d)
+cp -R "$ROOT_DIR/www" "$WORK_DIR/www"
+truncate -s "$LARGE_FILE_SIZE" "$WORK_DIR/www/large.bin"
+printf 'END' | dd of="$WORK_DIR/www/large.bin" bs=1 seek=$((LARGE_FILE_SIZE - 3)) conv=notrunc 2> /dev/null
+
+SERVER_PID=""
+cleanUp () {
+    # The server is killed by the signal: its exit status must not be the one of the script
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && { wait "$SERVER_PID" 2> /dev/null || true; }
+    rm -Rf "$WORK_DIR"
+}
+trap cleanUp EXIT INT TERM
+
+(cd "$WORK_DIR" && exec "$BUILD_DIR/webserver" --quiet > "$WORK_DIR/server.log" 2>&1) &
+SERVER_PID=$!
+
+# Wait for the server to build its cache and to listen
+for i in $(seq 1 100); do
+    if curl -s -o /dev/null "http://127.0.0.1:$PORT/test.html"; then
+        break
+    fi
+    sleep 0.1
+done
+
+URL="http://127.0.0.1:$PORT/large.bin"
+
+# The announced length must be the full one
+CONTENT_LENGTH=$(curl -s -I "$URL" | tr -d '\r' | awk 'tolower($1) == "content-length:" { print $2 }')
+if [ "$CONTENT_LENGTH" != "$LARGE_FILE_SIZE" ]; then
+    echo "Wrong Content-Length: $CONTENT_LENGTH (expected $LARGE_FILE_SIZE)" >&2
+    exit 1
+fi
+
+# Ranges beyond the 32-bit limits must be served (the last bytes are not zeros)
+LAST_BYTES=$(curl -s -r "$((LARGE_FILE_SIZE - 3))-" "$URL")
+RANGE_2GB=$(curl -s -o /dev/null -w '%{http_code} %{size_download}' -r 2200000000-2200000099 "$URL")
+RANGE_4GB=$(curl -s -o /dev/null -w '%{http_code} %{size_download}' -r 4300000000-4300000099 "$URL")
+RANGES_ARE_VALID=false
+if [ "$LAST_BYTES" = "END" ] && [ "$RANGE_2GB" = "206 100" ] \
+&& { [ "$LARGE_FILE_SIZE" -le 4300000099 ] || [ "$RANGE_4GB" = "206 100" ]; }; then
+    RANGES_ARE_VALID=true
+fi
+
+# Full downloads: the downloaded size and the throughput (bytes/s) are measured by curl
+DOWNLOADS=""
+for i in $(seq 1 "$NB_DOWNLOADS"); do
+    echo "Downloading $LARGE_FILE_SIZE_GB GB ($i/$NB_DOWNLOADS)..."
+    DOWNLOAD=$(curl -s -o /dev/null -w '{ "size": %{size_download}, "time_s": %{time_total}, "bytes_per_s": %{speed_download} }' "$URL")
+    DOWNLOADS="$DOWNLOADS${DOWNLOADS:+, }$DOWNLOAD"
+done
+
+mkdir -p "$(dirname "$RESULTS")"
+{
+    echo "{"
+    echo "  \"file_size\": $LARGE_FILE_SIZE,"
+    echo "  \"content_length\": $CONTENT_LENGTH,"
+    echo "  \"ranges_are_valid\": $RANGES_ARE_VALID,"
+    echo "  \"downloads\": [ $DOWNLOADS ]"
+    echo "}"
+} > "$RESULTS"
+
+cat "$RESULTS"
+echo "Results written in $RESULTS"
@@ -0,0 +1,960 @@
+// Macro definition required for using clock_gettime(), getopt_long() and sockets
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../src/toolbox.h"
+#include "../src/metrics.h"
+
+// Multi-threaded HTTP load generator, meant to be run against the server over loopback
+//
+// In closed-loop mode, each connection sends a new (batch of) request(s)
+// as soon as the previous answers have been received
+// In open-loop mode, requests are sent at a fixed rate, whatever the answer times are;
+// latencies are then measured from the time each request *should* have been sent,
+// so that the tails are not hidden by a slow server (coordinated omission)
+//
+// With --new-connections, a new connection is opened for each (batch of) request(s),
+// whose latency then includes the handshake (e.g. to measure the effect of TCP Fast Open)
+//
+// With --unix, the server is reached through a Unix socket instead (see listener.h)
+
+// -----------------------------------------------------------------------------
+
+typedef enum LoadMode {
+    MODE_CLOSED_LOOP,
+    MODE_OPEN_LOOP
+} LoadMode;
+
+// A raw request, which can be sent as is
+typedef struct RequestTemplate {
+    char* name;
+    char* data;
+    int   length;
+    bool  is_head;
+} RequestTemplate;
+
+typedef struct LoadParameters {
+    char*    host;
+    int      port;
+    char*    unix_path; // Unix socket of the server (or NULL: TCP to host and port)
+
+    LoadMode mode;
+    int      nb_threads;
+    int      nb_connections;
+    int      pipeline_depth;
+    double   duration;   // s
+    double   rate;       // requests/s, for all the connections (open-loop only)
+    bool     new_connections; // closed-loop only
+    bool     fast_open;       // Send the first requests in the SYN (TCP Fast Open)
+
+    char*    mix_name;
+    char*    large_path;
+    char*    misc_directory;
+    char*    label;
+    char*    output_path;
+
+    RequestTemplate* templates;
+    int              nb_templates;
+} LoadParameters;
+
+// State of the parsing of the current answer of a connection
+typedef enum AnswerParsingState {
+    PARSING_HEADER,
+    PARSING_BODY,
+    PARSING_CHUNK_SIZE,
+    PARSING_CHUNK_DATA,
+    PARSING_CHUNK_END,
+    PARSING_TRAILER
+} AnswerParsingState;
+
+#define MAX_NB_IN_FLIGHT     64
+#define RECEIVE_BUFFER_SIZE  65536
+#define SEND_BUFFER_SIZE     (MAX_NB_IN_FLIGHT * 8192)
+
+typedef struct Connection {
+    int  fd;
+    bool is_used;              // Some requests have been sent on it
+    bool is_fast_open_pending; // Not connected yet: the first requests open it
+
+    // Requests which have been sent (or queued), but not answered yet
+    uint64_t intended_times[MAX_NB_IN_FLIGHT];
+    uint64_t send_times[MAX_NB_IN_FLIGHT];
+    bool     is_head[MAX_NB_IN_FLIGHT];
+    int      first_in_flight;
+    int      nb_in_flight;
+    int      next_template;
+
+    // Data waiting to be sent
+    char* send_buffer;
+    int   send_buffer_length;
+    int   send_buffer_offset;
+
+    // Data received, but not parsed yet
+    char* receive_buffer;
+    int   receive_buffer_length;
+
+    AnswerParsingState parsing_state;
+    long long          remaining_body_length;
+    int                status_code;
+
+    // Open-loop mode only
+    uint64_t next_intended_time;
+    uint64_t interval;
+} Connection;
+
+typedef struct WorkerResults {
+    LatencyHistogram latency;           // Since the actual sending
+    LatencyHistogram corrected_latency; // Since the intended sending
+
+    uint64_t nb_answers;
+    uint64_t nb_answers_by_class[6];  // 1xx to 5xx (0 for invalid codes)
+    uint64_t nb_errors;
+    uint64_t nb_bytes_received;
+} WorkerResults;
+
+typedef struct Worker {
+    pthread_t       thread;
+    Connection*     connections;
+    int             first_connection;
+    int             nb_connections;
+    LoadParameters* parameters;
+    WorkerResults   results;
+} Worker;
+
+// -----------------------------------------------------------------------------
+
+#define DEFAULT_HOST             "127.0.0.1"
+#define DEFAULT_PORT             4242
+#define DEFAULT_NB_THREADS       2
+#define DEFAULT_NB_CONNECTIONS   16
+#define DEFAULT_DURATION         5.0 // s
+#define DEFAULT_MIX              "hit"
+#define DEFAULT_LARGE_PATH       "/js/jquery-3.2.1.min.js"
+#define DEFAULT_MISC_DIRECTORY   "misc"
+#define DEFAULT_PIPELINE_DEPTH   8   // Only used by the "pipelined" mix
+
+#define POLL_TIMEOUT             10  // ms
+
+// Start time of the run, shared by all the workers
+static uint64_t _start_time = 0;
+static uint64_t _end_time   = 0;
+
+// -----------------------------------------------------------------------------
+// REQUEST TEMPLATES
+// -----------------------------------------------------------------------------
+
+void addRequestTemplate (LoadParameters* parameters, const char* name,
+                         const char* data, const int length)
+{
+    parameters->templates = realloc(parameters->templates,
+                                    (parameters->nb_templates + 1) * sizeof(RequestTemplate));
+    if (parameters->templates == NULL)
+        handleErrorAndExit("realloc() failed in addRequestTemplate()");
+
+    RequestTemplate* template = &parameters->templates[parameters->nb_templates];
+    template->name    = getFreshStringCopy(name);
+    template->length  = length;
+    template->is_head = strncmp(data, "HEAD ", 5) == 0;
+
+    template->data = malloc(length + 1);
+    if (template->data == NULL)
+        handleErrorAndExit("malloc() failed in addRequestTemplate()");
+    memcpy(template->data, data, length);
+    template->data[length] = '\0';
+
+    (parameters->nb_templates)++;
+}
+
+void addSyntheticRequest (LoadParameters* parameters, const char* name,
+                          const char* method, const char* path)
+{
+    char request[4096];
+    int length = snprintf(request, sizeof(request),
+                          "%s %s HTTP/1.1\r\n"
+                          "Host: localhost\r\n"
+                          "Accept-Encoding: gzip\r\n"
+                          "\r\n",
+                          method, path);
+
+    addRequestTemplate(parameters, name, request, length);
+}
+
+// Files of misc/ are hand-written, with bare LF line endings:
+// they are converted to CRLF, and terminated by a blank line if needed
+void addRequestFromFile (LoadParameters* parameters, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        handleErrorAndExit("fopen() failed in addRequestFromFile()");
+
+    char* request = malloc(2 * RECEIVE_BUFFER_SIZE);
+    if (request == NULL)
+        handleErrorAndExit("malloc() failed in addRequestFromFile()");
+
+    int length          = 0;
+    int previous_char   = EOF;
+    int current_char    = fgetc(file);
+    while (current_char != EOF && length < 2 * RECEIVE_BUFFER_SIZE - 4)
+    {
+        if (current_char == '\n' && previous_char != '\r')
+            request[length++] = '\r';
+        request[length++] = current_char;
+
+        previous_char = current_char;
+        current_char  = fgetc(file);
+    }
+    fclose(file);
+
+    // Strip the trailing line endings, and add the final blank line
+    while (length > 0 && (request[length - 1] == '\n' || request[length - 1] == '\r'))
+        length--;
+    memcpy(request + length, "\r\n\r\n", 4);
+    length += 4;
+
+    addRequestTemplate(parameters, extractLastNameOfPath(path), request, length);
+    free(request);
+}
+
+void addRequestMix (LoadParameters* parameters, const char* mix_name)
+{
+    if (stringsAreEqual(mix_name, "hit"))
+        addSyntheticRequest(parameters, "hit", "GET", "/test.html");
+
+    else if (stringsAreEqual(mix_name, "404"))
+        addSyntheticRequest(parameters, "404", "GET", "/this/does/not/exist.html");
+
+    else if (stringsAreEqual(mix_name, "large"))
+        addSyntheticRequest(parameters, "large", "GET", parameters->large_path);
+
+    else if (stringsAreEqual(mix_name, "head"))
+        addSyntheticRequest(parameters, "head", "HEAD", "/test.html");
+
+    else if (stringsAreEqual(mix_name, "pipelined"))
+    {
+        addSyntheticRequest(parameters, "hit", "GET", "/test.html");
+        if (parameters->pipeline_depth <= 1)
+            parameters->pipeline_depth = DEFAULT_PIPELINE_DEPTH;
+    }
+
+    else if (stringsAreEqual(mix_name, "misc"))
+    {
+        const char* file_names[] = { "rq_200", "rq_200_HEAD", "rq_404", "rq_414", "rq_501" };
+        for (unsigned int i = 0; i < sizeof(file_names) / sizeof(char*); i++)
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", parameters->misc_directory, file_names[i]);
+            addRequestFromFile(parameters, path);
+        }
+    }
+
+    else if (stringsAreEqual(mix_name, "mixed"))
+    {
+        addSyntheticRequest(parameters, "hit",   "GET",  "/test.html");
+        addSyntheticRequest(parameters, "hit",   "GET",  "/css/test.css");
+        addSyntheticRequest(parameters, "hit",   "GET",  "/text/lorem1.txt");
+        addSyntheticRequest(parameters, "404",   "GET",  "/this/does/not/exist.html");
+        addSyntheticRequest(parameters, "head",  "HEAD", "/test.html");
+        addSyntheticRequest(parameters, "large", "GET",  parameters->large_path);
+    }
+
+    else
+    {
+        printError("Unknown request mix: %s", mix_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CONNECTIONS
+// -----------------------------------------------------------------------------
+
+// The host is an IPv4 or an IPv6 address
+// Return the length of the address
+socklen_t getServerAddress (const LoadParameters* parameters, struct sockaddr_storage* address)
+{
+    memset(address, 0, sizeof(*address));
+
+    if (parameters->unix_path != NULL)
+    {
+        struct sockaddr_un* unix_address = (struct sockaddr_un*) address;
+        unix_address->sun_family = AF_UNIX;
+        strncpy(unix_address->sun_path, parameters->unix_path, sizeof(unix_address->sun_path) - 1);
+        return sizeof(struct sockaddr_un);
+    }
+
+    struct sockaddr_in6* ipv6_address = (struct sockaddr_in6*) address;
+    if (inet_pton(AF_INET6, parameters->host, &ipv6_address->sin6_addr) == 1)
+    {
+        ipv6_address->sin6_family = AF_INET6;
+        ipv6_address->sin6_port   = htons(parameters->port);
+        return sizeof(struct sockaddr_in6);
+    }
+
+    struct sockaddr_in* ipv4_address = (struct sockaddr_in*) address;
+    ipv4_address->sin_family = AF_INET;
+    ipv4_address->sin_port   = htons(parameters->port);
+    inet_pton(AF_INET, parameters->host, &ipv4_address->sin_addr);
+    return sizeof(struct sockaddr_in);
+}
+
+// Return a connected, non-blocking socket, or -1 on failure
+// With TCP Fast Open, the socket is only connected by its first write (see sendQueuedRequests())
+int openConnection (const LoadParameters* parameters)
+{
+    struct sockaddr_storage address;
+    socklen_t address_length = getServerAddress(parameters, &address);
+
+    int fd = socket(address.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    if (parameters->fast_open)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    int return_value = connect(fd, (struct sockaddr*) &address, address_length);
+
+    if (parameters->unix_path == NULL)
+    {
+        int enabled = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    }
+
+    if (return_value < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+void initConnection (Connection* connection, const LoadParameters* parameters,
+                     const int connection_index)
+{
+    memset(connection, 0, sizeof(Connection));
+
+    connection->fd = openConnection(parameters);
+    if (connection->fd < 0)
+        handleErrorAndExit("connect() failed in initConnection()");
+    connection->is_fast_open_pending = parameters->fast_open;
+
+    connection->send_buffer    = malloc(SEND_BUFFER_SIZE);
+    connection->receive_buffer = malloc(RECEIVE_BUFFER_SIZE);
+    if (connection->send_buffer == NULL || connection->receive_buffer == NULL)
+        handleErrorAndExit("malloc() failed in initConnection()");
+
+    // Spread the templates among the connections
+    connection->next_template = connection_index % parameters->nb_templates;
+    connection->parsing_state = PARSING_HEADER;
+}
+
+// Spread the open-loop schedules of the connections over the first interval
+// Must be called once the start time is known
+void initConnectionSchedule (Connection* connection, const LoadParameters* parameters,
+                             const int connection_index)
+{
+    connection->interval = (uint64_t) (1e9 * parameters->nb_connections / parameters->rate);
+    connection->next_intended_time = _start_time
+                                   + connection->interval * connection_index
+                                   / parameters->nb_connections;
+}
+
+// Drop all the requests in flight, and open a new connection
+void resetConnection (Connection* connection, const LoadParameters* parameters,
+                      WorkerResults* results)
+{
+    results->nb_errors += connection->nb_in_flight;
+
+    close(connection->fd);
+    connection->fd = openConnection(parameters);
+
+    connection->is_used               = false;
+    connection->is_fast_open_pending  = parameters->fast_open;
+    connection->first_in_flight       = 0;
+    connection->nb_in_flight          = 0;
+    connection->send_buffer_length    = 0;
+    connection->send_buffer_offset    = 0;
+    connection->receive_buffer_length = 0;
+    connection->parsing_state         = PARSING_HEADER;
+}
+
+// Queue the next request of the mix, which should have been sent at intended_time
+void queueRequest (Connection* connection, const LoadParameters* parameters,
+                   const uint64_t intended_time, const uint64_t current_time)
+{
+    RequestTemplate* template = &parameters->templates[connection->next_template];
+    connection->next_template = (connection->next_template + 1) % parameters->nb_templates;
+
+    if (connection->send_buffer_length + template->length > SEND_BUFFER_SIZE)
+        return;
+
+    memcpy(connection->send_buffer + connection->send_buffer_length,
+           template->data, template->length);
+    connection->send_buffer_length += template->length;
+
+    int index = (connection->first_in_flight + connection->nb_in_flight) % MAX_NB_IN_FLIGHT;
+    connection->intended_times[index] = intended_time;
+    connection->send_times[index]     = current_time;
+    connection->is_head[index]        = template->is_head;
+
+    (connection->nb_in_flight)++;
+    connection->is_used = true;
+}
+
+// Return false if the connection has failed
+bool sendQueuedRequests (Connection* connection, const LoadParameters* parameters)
+{
+    // The first write of a Fast Open connection sends the SYN: the data is only part of it
+    // if the client has a cookie of the server (otherwise, it is sent once connected)
+    if (connection->is_fast_open_pending && connection->send_buffer_length > 0)
+    {
+        struct sockaddr_storage address;
+        socklen_t address_length = getServerAddress(parameters, &address);
+        int nb_bytes_sent = sendto(connection->fd, connection->send_buffer,
+                                   connection->send_buffer_length, MSG_FASTOPEN,
+                                   (struct sockaddr*) &address, address_length);
+        connection->is_fast_open_pending = false;
+
+        if (nb_bytes_sent < 0)
+            return errno == EINPROGRESS || errno == EAGAIN;
+
+        connection->send_buffer_offset += nb_bytes_sent;
+    }
+
+    while (connection->send_buffer_offset < connection->send_buffer_length)
+    {
+        int nb_bytes_sent = write(connection->fd,
+                                  connection->send_buffer + connection->send_buffer_offset,
+                                  connection->send_buffer_length - connection->send_buffer_offset);
+        if (nb_bytes_sent < 0)
+            return errno == EAGAIN || errno == ENOTCONN;
+
+        connection->send_buffer_offset += nb_bytes_sent;
+    }
+
+    connection->send_buffer_length = 0;
+    connection->send_buffer_offset = 0;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// ANSWERS PARSING
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the index following the next CRLF in the buffer, or -1 if there is none
+static int _findLineEnd (const char* buffer, const int start, const int length)
+{
+    for (int i = start; i < length - 1; i++)
+        if (buffer[i] == '\r' && buffer[i + 1] == '\n')
+            return i + 2;
+
+    return -1;
+}
+
+void recordAnswer (Connection* connection, WorkerResults* results, const uint64_t current_time)
+{
+    int index = connection->first_in_flight;
+
+    // Closed-loop requests are sent when intended, so both latencies are equal
+    recordLatency(&results->latency,
+                  (current_time - connection->send_times[index]) / 1000);
+    recordLatency(&results->corrected_latency,
+                  (current_time - connection->intended_times[index]) / 1000);
+
+    int code_class = connection->status_code / 100;
+    results->nb_answers_by_class[code_class >= 1 && code_class <= 5 ? code_class : 0]++;
+    (results->nb_answers)++;
+
+    connection->first_in_flight = (connection->first_in_flight + 1) % MAX_NB_IN_FLIGHT;
+    (connection->nb_in_flight)--;
+
+    connection->parsing_state = PARSING_HEADER;
+}
+
+// Consume as many answers as possible from the receive buffer
+// Return false if an answer is malformed
+bool parseAnswers (Connection* connection, WorkerResults* results, const uint64_t current_time)
+{
+    char* buffer = connection->receive_buffer;
+    int   length = connection->receive_buffer_length;
+    int   offset = 0;
+
+    while (offset < length)
+    {
+        if (connection->parsing_state == PARSING_HEADER)
+        {
+            if (connection->nb_in_flight == 0)
+                return false;
+
+            // Find the end of the header, and read the few fields of interest
+            int header_end = -1;
+            for (int i = offset; i + 3 < length; i++)
+                if (memcmp(buffer + i, "\r\n\r\n", 4) == 0)
+                {
+                    header_end = i + 4;
+                    break;
+                }
+            if (header_end < 0)
+                break;
+
+            buffer[header_end - 1] = '\0';
+            if (sscanf(buffer + offset, "HTTP/1.%*d %d", &connection->status_code) != 1)
+                return false;
+
+            long long content_length = 0;
+            bool      is_chunked     = false;
+
+            char* line = buffer + offset;
+            while ((line = strstr(line, "\r\n")) != NULL && line + 2 < buffer + header_end)
+            {
+                line += 2;
+                if (strncasecmp(line, "Content-Length:", 15) == 0)
+                    content_length = atoll(line + 15);
+                else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+                    is_chunked = strstr(line, "chunked") != NULL;
+            }
+
+            offset = header_end;
+
+            bool has_no_body = connection->is_head[connection->first_in_flight]
+                            || connection->status_code == 304
+                            || connection->status_code / 100 == 1;
+
+            if (has_no_body || (! is_chunked && content_length == 0))
+                recordAnswer(connection, results, current_time);
+            else if (is_chunked)
+                connection->parsing_state = PARSING_CHUNK_SIZE;
+            else
+            {
+                connection->parsing_state         = PARSING_BODY;
+                connection->remaining_body_length = content_length;
+            }
+        }
+
+        else if (connection->parsing_state == PARSING_BODY
+             ||  connection->parsing_state == PARSING_CHUNK_DATA)
+        {
+            long long nb_bytes = MIN(connection->remaining_body_length, (long long) (length - offset));
+            offset += nb_bytes;
+            connection->remaining_body_length -= nb_bytes;
+
+            if (connection->remaining_body_length > 0)
+                break;
+
+            if (connection->parsing_state == PARSING_BODY)
+                recordAnswer(connection, results, current_time);
+            else
+                connection->parsing_state = PARSING_CHUNK_END;
+        }
+
+        else
+        {
+            // The remaining states are made of lines
+            int line_end = _findLineEnd(buffer, offset, length);
+            if (line_end < 0)
+                break;
+
+            if (connection->parsing_state == PARSING_CHUNK_SIZE)
+            {
+                long long chunk_size = strtoll(buffer + offset, NULL, 16);
+                connection->remaining_body_length = chunk_size;
+                connection->parsing_state = chunk_size == 0
+                                          ? PARSING_TRAILER
+                                          : PARSING_CHUNK_DATA;
+            }
+            else if (connection->parsing_state == PARSING_CHUNK_END)
+                connection->parsing_state = PARSING_CHUNK_SIZE;
+
+            // PARSING_TRAILER: the answer ends with an empty line
+            else if (line_end - offset == 2)
+                recordAnswer(connection, results, current_time);
+
+            offset = line_end;
+        }
+    }
+
+    // Keep the unparsed bytes for later
+    memmove(buffer, buffer + offset, length - offset);
+    connection->receive_buffer_length = length - offset;
+
+    // A single header cannot be larger than the buffer
+    return connection->receive_buffer_length < RECEIVE_BUFFER_SIZE - 1;
+}
+
+// Return false if the connection has been closed or has failed
+bool receiveAnswers (Connection* connection, WorkerResults* results)
+{
+    for (;;)
+    {
+        int nb_bytes_read = read(connection->fd,
+                                 connection->receive_buffer + connection->receive_buffer_length,
+                                 RECEIVE_BUFFER_SIZE - connection->receive_buffer_length - 1);
+        if (nb_bytes_read < 0)
+            return errno == EAGAIN;
+        if (nb_bytes_read == 0)
+            return false;
+
+        results->nb_bytes_received        += nb_bytes_read;
+        connection->receive_buffer_length += nb_bytes_read;
+
+        if (! parseAnswers(connection, results, getMonotonicTimeInNanoseconds()))
+            return false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// WORKERS
+// -----------------------------------------------------------------------------
+
+void* runWorker (void* worker_pointer)
+{
+    Worker*         worker     = worker_pointer;
+    LoadParameters* parameters = worker->parameters;
+    WorkerResults*  results    = &worker->results;
+
+    Connection*    connections = worker->connections;
+    struct pollfd* polled_fds  = calloc(worker->nb_connections, sizeof(struct pollfd));
+    if (polled_fds == NULL)
+        handleErrorAndExit("calloc() failed in runWorker()");
+
+    if (parameters->mode == MODE_OPEN_LOOP)
+        for (int i = 0; i < worker->nb_connections; i++)
+            initConnectionSchedule(&connections[i], parameters, worker->first_connection + i);
+
+    uint64_t current_time = getMonotonicTimeInNanoseconds();
+    while (current_time < _end_time)
+    {
+        // Queue the requests which must be sent
+        for (int i = 0; i < worker->nb_connections; i++)
+        {
+            Connection* connection = &connections[i];
+
+            if (parameters->mode == MODE_CLOSED_LOOP)
+            {
+                if (connection->nb_in_flight == 0)
+                {
+                    // The handshake of the new connection is part of the latency
+                    uint64_t send_time = current_time;
+                    if (parameters->new_connections && connection->is_used)
+                    {
+                        send_time = getMonotonicTimeInNanoseconds();
+                        resetConnection(connection, parameters, results);
+                    }
+
+                    for (int j = 0; j < parameters->pipeline_depth; j++)
+                        queueRequest(connection, parameters, send_time, send_time);
+                }
+            }
+            else
+            {
+                // Late requests are sent anyway (pipelined), unless there are too many
+                while (connection->next_intended_time <= current_time
+                   &&  connection->nb_in_flight < MAX_NB_IN_FLIGHT)
+                {
+                    queueRequest(connection, parameters, connection->next_intended_time, current_time);
+                    connection->next_intended_time += connection->interval;
+                }
+            }
+
+            if (! sendQueuedRequests(connection, parameters))
+                resetConnection(connection, parameters, results);
+
+            polled_fds[i].fd     = connection->fd;
+            polled_fds[i].events = POLLIN
+                                 | (connection->send_buffer_length > 0 ? POLLOUT : 0);
+        }
+
+        int nb_ready_fds = poll(polled_fds, worker->nb_connections, POLL_TIMEOUT);
+        if (nb_ready_fds < 0 && errno != EINTR)
+            handleErrorAndExit("poll() failed in runWorker()");
+
+        for (int i = 0; i < worker->nb_connections && nb_ready_fds > 0; i++)
+        {
+            Connection* connection = &connections[i];
+
+            if (polled_fds[i].revents == 0)
+                continue;
+
+            bool connection_is_alive = true;
+            if (polled_fds[i].revents & POLLOUT)
+                connection_is_alive = sendQueuedRequests(connection, parameters);
+            if (connection_is_alive && (polled_fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                connection_is_alive = receiveAnswers(connection, results);
+
+            if (! connection_is_alive)
+                resetConnection(connection, parameters, results);
+        }
+
+        current_time = getMonotonicTimeInNanoseconds();
+    }
+
+    // Requests still in flight at the end are neither answers nor errors
+    for (int i = 0; i < worker->nb_connections; i++)
+    {
+        close(connections[i].fd);
+        free(connections[i].send_buffer);
+        free(connections[i].receive_buffer);
+    }
+
+    free(polled_fds);
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// RESULTS
+// -----------------------------------------------------------------------------
+
+void writeLatencyObject (FILE* output, const char* name, const LatencyHistogram* latency)
+{
+    fprintf(output,
+            "  \"%s\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+            "\"p999\": %llu, \"p9999\": %llu, \"max\": %llu}",
+            name,
+            latency->total_count > 0 ? (double) latency->total_sum / latency->total_count : 0.0,
+            (unsigned long long) getLatencyPercentile(latency, 50.0),
+            (unsigned long long) getLatencyPercentile(latency, 90.0),
+            (unsigned long long) getLatencyPercentile(latency, 99.0),
+            (unsigned long long) getLatencyPercentile(latency, 99.9),
+            (unsigned long long) getLatencyPercentile(latency, 99.99),
+            (unsigned long long) latency->max);
+}
+
+void writeResults (const LoadParameters* parameters, const WorkerResults* total,
+                   const double elapsed_time)
+{
+    FILE* output = stdout;
+    if (parameters->output_path != NULL)
+    {
+        output = fopen(parameters->output_path, "a");
+        if (output == NULL)
+            handleErrorAndExit("fopen() failed in writeResults()");
+    }
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"label\": \"%s\",\n", parameters->label != NULL ? parameters->label : "");
+    fprintf(output, "  \"mix\": \"%s\",\n", parameters->mix_name);
+    fprintf(output, "  \"mode\": \"%s\",\n",
+            parameters->mode == MODE_OPEN_LOOP ? "open-loop" : "closed-loop");
+    fprintf(output, "  \"threads\": %d,\n", parameters->nb_threads);
+    fprintf(output, "  \"connections\": %d,\n", parameters->nb_connections);
+    fprintf(output, "  \"pipeline_depth\": %d,\n", parameters->pipeline_depth);
+    fprintf(output, "  \"new_connections\": %s,\n", parameters->new_connections ? "true" : "false");
+    fprintf(output, "  \"fast_open\": %s,\n", parameters->fast_open ? "true" : "false");
+    fprintf(output, "  \"transport\": \"%s\",\n", parameters->unix_path != NULL ? "unix" : "tcp");
+    fprintf(output, "  \"target_rate\": %.1f,\n", parameters->mode == MODE_OPEN_LOOP ? parameters->rate : 0.0);
+    fprintf(output, "  \"duration_s\": %.3f,\n", elapsed_time);
+    fprintf(output, "  \"answers\": %llu,\n", (unsigned long long) total->nb_answers);
+    fprintf(output, "  \"errors\": %llu,\n", (unsigned long long) total->nb_errors);
+    fprintf(output, "  \"answers_by_class\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, "
+                    "\"4xx\": %llu, \"5xx\": %llu, \"invalid\": %llu},\n",
+            (unsigned long long) total->nb_answers_by_class[1],
+            (unsigned long long) total->nb_answers_by_class[2],
+            (unsigned long long) total->nb_answers_by_class[3],
+            (unsigned long long) total->nb_answers_by_class[4],
+            (unsigned long long) total->nb_answers_by_class[5],
+            (unsigned long long) total->nb_answers_by_class[0]);
+    fprintf(output, "  \"requests_per_s\": %.1f,\n", total->nb_answers / elapsed_time);
+    fprintf(output, "  \"received_bytes_per_s\": %.1f,\n", total->nb_bytes_received / elapsed_time);
+    writeLatencyObject(output, "latency_us", &total->latency);
+    fprintf(output, ",\n");
+    writeLatencyObject(output, "corrected_latency_us", &total->corrected_latency);
+    fprintf(output, "\n}\n");
+
+    if (output != stdout)
+        fclose(output);
+}
+
+// -----------------------------------------------------------------------------
+// COMMAND LINE
+// -----------------------------------------------------------------------------
+
+void printLoadgenUsageAndExit (const char* program_name)
+{
+    printf("Usage: %s [options]\n"
+           "  --host <ipv4|ipv6>      server address (default: %s)\n"
+           "  --port <port>           server port (default: %d)\n"
+           "  --unix <path>           connect to a Unix socket instead (see listener.h)\n"
+           "  --threads <n>           number of threads (default: %d)\n"
+           "  --connections <n>       number of connections (default: %d)\n"
+           "  --duration <s>          duration of the run (default: %.0f)\n"
+           "  --rate <req/s>          open-loop mode, at the given total rate\n"
+           "                          (closed-loop mode if not given)\n"
+           "  --pipeline <n>          requests sent at once per connection (closed-loop)\n"
+           "  --new-connections       open a new connection for each request (closed-loop)\n"
+           "  --fast-open             send the first requests in the SYN (TCP Fast Open)\n"
+           "  --mix <name>            hit, 404, large, head, pipelined, misc or mixed\n"
+           "                          (default: %s)\n"
+           "  --large-path <path>     target of the \"large\" requests (default: %s)\n"
+           "  --misc-dir <dir>        directory of the rq_* files (default: %s)\n"
+           "  --request-file <file>   replay a raw request (may be repeated, replaces the mix)\n"
+           "  --label <label>         label copied in the results\n"
+           "  --output <file>         append the JSON results to a file (default: stdout)\n",
+           program_name, DEFAULT_HOST, DEFAULT_PORT, DEFAULT_NB_THREADS, DEFAULT_NB_CONNECTIONS,
+           DEFAULT_DURATION, DEFAULT_MIX, DEFAULT_LARGE_PATH, DEFAULT_MISC_DIRECTORY);
+    exit(EXIT_FAILURE);
+}
+
+void parseLoadParameters (LoadParameters* parameters, int argc, char* argv[])
+{
+    memset(parameters, 0, sizeof(LoadParameters));
+    parameters->host           = DEFAULT_HOST;
+    parameters->port           = DEFAULT_PORT;
+    parameters->mode           = MODE_CLOSED_LOOP;
+    parameters->nb_threads     = DEFAULT_NB_THREADS;
+    parameters->nb_connections = DEFAULT_NB_CONNECTIONS;
+    parameters->pipeline_depth = 1;
+    parameters->duration       = DEFAULT_DURATION;
+    parameters->mix_name       = DEFAULT_MIX;
+    parameters->large_path     = DEFAULT_LARGE_PATH;
+    parameters->misc_directory = DEFAULT_MISC_DIRECTORY;
+
+    const struct option options[] = {
+        { "host",            required_argument, NULL, 'h' },
+        { "port",            required_argument, NULL, 'p' },
+        { "unix",            required_argument, NULL, 'U' },
+        { "threads",         required_argument, NULL, 't' },
+        { "connections",     required_argument, NULL, 'c' },
+        { "duration",        required_argument, NULL, 'd' },
+        { "rate",            required_argument, NULL, 'r' },
+        { "pipeline",        required_argument, NULL, 'P' },
+        { "new-connections", no_argument,       NULL, 'N' },
+        { "fast-open",       no_argument,       NULL, 'F' },
+        { "mix",             required_argument, NULL, 'm' },
+        { "large-path",      required_argument, NULL, 'L' },
+        { "misc-dir",        required_argument, NULL, 'M' },
+        { "request-file",    required_argument, NULL, 'f' },
+        { "label",           required_argument, NULL, 'l' },
+        { "output",          required_argument, NULL, 'o' },
+        { NULL,              0,                 NULL, 0   }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+            case 'h': parameters->host            = optarg;       break;
+            case 'p': parameters->port            = atoi(optarg); break;
+            case 'U': parameters->unix_path       = optarg;       break;
+            case 't': parameters->nb_threads      = atoi(optarg); break;
+            case 'c': parameters->nb_connections  = atoi(optarg); break;
+            case 'd': parameters->duration        = atof(optarg); break;
+            case 'P': parameters->pipeline_depth  = atoi(optarg); break;
+            case 'm': parameters->mix_name        = optarg;       break;
+            case 'L': parameters->large_path      = optarg;       break;
+            case 'M': parameters->misc_directory  = optarg;       break;
+            case 'l': parameters->label           = optarg;       break;
+            case 'o': parameters->output_path     = optarg;       break;
+            case 'N': parameters->new_connections = true;         break;
+            case 'F': parameters->fast_open       = true;         break;
+
+            case 'r':
+                parameters->mode = MODE_OPEN_LOOP;
+                parameters->rate = atof(optarg);
+                break;
+
+            case 'f':
+                addRequestFromFile(parameters, optarg);
+                parameters->mix_name = "files";
+                break;
+
+            default:
+                printLoadgenUsageAndExit(argv[0]);
+        }
+    }
+
+    if (parameters->nb_templates == 0)
+        addRequestMix(parameters, parameters->mix_name);
+
+    if (parameters->nb_threads < 1 || parameters->nb_connections < parameters->nb_threads
+    ||  parameters->pipeline_depth < 1 || parameters->pipeline_depth > MAX_NB_IN_FLIGHT
+    ||  parameters->duration <= 0
+    || (parameters->unix_path != NULL && parameters->fast_open)
+    || (parameters->mode == MODE_OPEN_LOOP && (parameters->rate <= 0 || parameters->new_connections)))
+        printLoadgenUsageAndExit(argv[0]);
+}
+
+int main (int argc, char* argv[])
+{
+    LoadParameters parameters;
+    parseLoadParameters(&parameters, argc, argv);
+
+    Worker*     workers     = calloc(parameters.nb_threads, sizeof(Worker));
+    Connection* connections = calloc(parameters.nb_connections, sizeof(Connection));
+    if (workers == NULL || connections == NULL)
+        handleErrorAndExit("calloc() failed in main()");
+
+    // All the connections are established before starting the clock:
+    // connect() may be slow when the server's accept queue is full
+    for (int i = 0; i < parameters.nb_connections; i++)
+        initConnection(&connections[i], &parameters, i);
+
+    _start_time = getMonotonicTimeInNanoseconds();
+    _end_time   = _start_time + (uint64_t) (parameters.duration * 1e9);
+
+    // Spread the connections among the threads
+    int first_connection = 0;
+    for (int i = 0; i < parameters.nb_threads; i++)
+    {
+        workers[i].parameters       = &parameters;
+        workers[i].connections      = connections + first_connection;
+        workers[i].first_connection = first_connection;
+        workers[i].nb_connections   = parameters.nb_connections / parameters.nb_threads
+                                    + (i < parameters.nb_connections % parameters.nb_threads ? 1 : 0);
+        first_connection += workers[i].nb_connections;
+
+        int return_value = pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+        if (return_value != 0)
+            handleErrorAndExit("pthread_create() failed in main()");
+    }
+
+    // Merge the results of all the threads
+    WorkerResults total;
+    memset(&total, 0, sizeof(WorkerResults));
+
+    for (int i = 0; i < parameters.nb_threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+
+        WorkerResults* results = &workers[i].results;
+        addLatencyHistogram(&total.latency, &results->latency);
+        addLatencyHistogram(&total.corrected_latency, &results->corrected_latency);
+
+        total.nb_answers        += results->nb_answers;
+        total.nb_errors         += results->nb_errors;
+        total.nb_bytes_received += results->nb_bytes_received;
+        for (int j = 0; j < 6; j++)
+            total.nb_answers_by_class[j] += results->nb_answers_by_class[j];
+    }
+
+    double elapsed_time = (getMonotonicTimeInNanoseconds() - _start_time) / 1e9;
+    writeResults(&parameters, &total, elapsed_time);
+
+    free(connections);
+    free(workers);
+    return 0;
+}
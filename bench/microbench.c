@@ -0,0 +1,608 @@
+// Macro definition required for using clock_gettime() and perf_event_open()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../src/toolbox.h"
+#include "../src/metrics.h"
+#include "../src/arena.h"
+#include "../src/path_index.h"
+#include "../src/file_cache.h"
+#include "../src/http.h"
+#include "../src/parse_header.h"
+#include "../src/rate_limit.h"
+#include "../src/virtual_hosts.h"
+
+// Microbenchmarks of the hot functions of the server
+// Each benchmark prints one JSON object per line, with the time, the number of
+// allocations and the number of instructions (if perf events are available) per call
+
+// -----------------------------------------------------------------------------
+
+typedef struct BenchmarkResult {
+    uint64_t nb_iterations;
+    double   ns_per_op;
+    double   allocations_per_op;
+    double   instructions_per_op; // < 0 if not available
+} BenchmarkResult;
+
+// A benchmarked operation: it is given its context and the iteration number
+typedef void (*BenchmarkedFunction) (void* context, const uint64_t iteration);
+
+#define MIN_BENCHMARK_DURATION 200000000 // ns
+#define MIN_NB_ITERATIONS      1000
+
+// Synthetic request, similar to the ones sent by browsers
+#define SAMPLE_REQUEST \
+    "GET /css/test.css HTTP/1.1\r\n" \
+    "Host: localhost:4242\r\n" \
+    "Accept: text/css,*/*;q=0.1\r\n" \
+    "Accept-Language: fr-fr\r\n" \
+    "Accept-Encoding: gzip, deflate\r\n" \
+    "Connection: keep-alive\r\n" \
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_12_4) AppleWebKit/603.1.30\r\n" \
+    "Referer: http://localhost:4242/test.html\r\n" \
+    "\r\n"
+
+// Prevents the compiler from removing the benchmarked calls
+static volatile long _sink = 0;
+
+// -----------------------------------------------------------------------------
+// ALLOCATION COUNTING
+// -----------------------------------------------------------------------------
+
+// The allocation functions are replaced by counting wrappers of the glibc ones
+// (this also counts the allocations made inside the C library, e.g. by sscanf())
+static uint64_t _nb_allocations = 0;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t nb_elements, size_t size);
+extern void* __libc_realloc (void* pointer, size_t size);
+
+void* malloc (size_t size)
+{
+    _nb_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc (size_t nb_elements, size_t size)
+{
+    _nb_allocations++;
+    return __libc_calloc(nb_elements, size);
+}
+
+void* realloc (void* pointer, size_t size)
+{
+    _nb_allocations++;
+    return __libc_realloc(pointer, size);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// INSTRUCTION COUNTING
+// -----------------------------------------------------------------------------
+
+// Return a perf event file descriptor counting the user-space instructions
+// of the calling thread, or -1 if perf events are not available
+int openInstructionCounter ()
+{
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+
+    attributes.type           = PERF_TYPE_HARDWARE;
+    attributes.size           = sizeof(attributes);
+    attributes.config         = PERF_COUNT_HW_INSTRUCTIONS;
+    attributes.disabled       = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv     = 1;
+
+    return syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+// -----------------------------------------------------------------------------
+// BENCHMARK RUNNER
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Run a fixed number of iterations, and fill the result
+static void _runIterations (BenchmarkedFunction function, void* context,
+                            const uint64_t nb_iterations, const int counter_fd,
+                            BenchmarkResult* result)
+{
+    uint64_t nb_instructions = 0;
+
+    if (counter_fd >= 0)
+    {
+        ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t nb_allocations_before = _nb_allocations;
+    uint64_t start_time            = getMonotonicTimeInNanoseconds();
+
+    for (uint64_t i = 0; i < nb_iterations; i++)
+        function(context, i);
+
+    uint64_t end_time             = getMonotonicTimeInNanoseconds();
+    uint64_t nb_allocations_after = _nb_allocations;
+
+    if (counter_fd >= 0)
+    {
+        ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter_fd, &nb_instructions, sizeof(nb_instructions)) != sizeof(nb_instructions))
+            nb_instructions = 0;
+    }
+
+    result->nb_iterations       = nb_iterations;
+    result->ns_per_op           = (double) (end_time - start_time) / nb_iterations;
+    result->allocations_per_op  = (double) (nb_allocations_after - nb_allocations_before)
+                                / nb_iterations;
+    result->instructions_per_op = counter_fd >= 0
+                                ? (double) nb_instructions / nb_iterations
+                                : -1.0;
+}
+
+// The number of iterations is doubled until the run lasts long enough
+void runBenchmark (const char* name, const char* parameters,
+                   BenchmarkedFunction function, void* context)
+{
+    static int counter_fd        = -2;
+    if (counter_fd == -2)
+        counter_fd = openInstructionCounter();
+
+    BenchmarkResult result;
+    uint64_t nb_iterations = MIN_NB_ITERATIONS;
+
+    // Warm up caches and branch predictors
+    _runIterations(function, context, MIN_NB_ITERATIONS, counter_fd, &result);
+
+    for (;;)
+    {
+        _runIterations(function, context, nb_iterations, counter_fd, &result);
+        if (result.ns_per_op * nb_iterations >= MIN_BENCHMARK_DURATION)
+            break;
+
+        nb_iterations *= 2;
+    }
+
+    printf("{\"benchmark\": \"%s\", \"parameters\": \"%s\", \"iterations\": %llu, "
+           "\"ns_per_op\": %.2f, \"allocations_per_op\": %.2f, ",
+           name, parameters, (unsigned long long) result.nb_iterations,
+           result.ns_per_op, result.allocations_per_op);
+
+    if (result.instructions_per_op >= 0)
+        printf("\"instructions_per_op\": %.1f}\n", result.instructions_per_op);
+    else
+        printf("\"instructions_per_op\": null}\n");
+
+    fflush(stdout);
+}
+
+// -----------------------------------------------------------------------------
+// HEADER DETECTION AND PARSING
+// -----------------------------------------------------------------------------
+
+typedef struct BufferContext {
+    char* buffer;
+    int   length;
+    int   start_offset;
+} BufferContext;
+
+void benchmarkHeaderDetection (void* context, const uint64_t iteration)
+{
+    BufferContext* buffer_context = context;
+    _sink += bufferContainsFullHttpHeader(buffer_context->buffer,
+                                          buffer_context->start_offset,
+                                          buffer_context->length);
+    (void) iteration;
+}
+
+typedef struct ParsingContext {
+    char*       buffer;
+    HttpHeader* header;
+} ParsingContext;
+
+void benchmarkFirstLineParsing (void* context, const uint64_t iteration)
+{
+    ParsingContext* parsing_context = context;
+
+    initRequestHttpHeader(parsing_context->header);
+    _sink += parseHttpHeaderFirstLine(parsing_context->header, parsing_context->buffer);
+
+    // The target is allocated by the parser, and must be freed by the caller
+    free(parsing_context->header->requestTarget);
+    parsing_context->header->requestTarget = NULL;
+    (void) iteration;
+}
+
+void runParsingBenchmarks ()
+{
+    char request[] = SAMPLE_REQUEST;
+    int  length    = strlen(request);
+
+    // Full header received at once, and header received in two parts
+    BufferContext full_buffer    = { request, length, 0 };
+    BufferContext partial_buffer = { request, length, length / 2 };
+    BufferContext missing_end    = { request, length - 2, 0 };
+
+    runBenchmark("bufferContainsFullHttpHeader", "full", benchmarkHeaderDetection, &full_buffer);
+    runBenchmark("bufferContainsFullHttpHeader", "second_half", benchmarkHeaderDetection, &partial_buffer);
+    runBenchmark("bufferContainsFullHttpHeader", "incomplete", benchmarkHeaderDetection, &missing_end);
+
+    ParsingContext parsing_context = { request, createHttpHeader() };
+    runBenchmark("parseHttpHeaderFirstLine", "sample_request", benchmarkFirstLineParsing, &parsing_context);
+    deleteHttpHeader(parsing_context.header);
+}
+
+// -----------------------------------------------------------------------------
+// CACHE LOOKUP
+// -----------------------------------------------------------------------------
+
+#define NB_LOOKUP_PATHS 1024
+
+typedef struct LookupContext {
+    FileCache* cache;
+    char*      paths[NB_LOOKUP_PATHS];
+} LookupContext;
+
+// Build a synthetic "comb" tree: every folder contains width files and width subfolders,
+// but only one subfolder (at a random position) is not empty
+// The path to this subfolder is written in spine_path
+Folder* buildSyntheticFolder (FileCache* cache, const char* name,
+                              const int width, const int depth, char* spine_path, const int spine_path_max_length)
+{
+    Folder* folder = createEmptyFolder(cache, name, width, depth > 0 ? width : 0);
+
+    char entry_name[MAX_NAME_LENGTH];
+    for (int i = 0; i < width; i++)
+    {
+        File* file = createAndInitFile(cache);
+
+        snprintf(entry_name, MAX_NAME_LENGTH, "file_%d.html", i);
+        setFileNameAndPath(cache, file, entry_name, entry_name);
+        file->type = internFileType(cache, "text/html");
+
+        addFileToFolder(folder, file);
+    }
+
+    if (depth == 0)
+        return folder;
+
+    int spine_index = rand() % width;
+    for (int i = 0; i < width; i++)
+    {
+        snprintf(entry_name, MAX_NAME_LENGTH, "folder_%d", i);
+
+        Folder* subfolder;
+        if (i == spine_index)
+        {
+            appendNameToPath(spine_path, entry_name, spine_path_max_length);
+            subfolder = buildSyntheticFolder(cache, entry_name, width, depth - 1,
+                                             spine_path, spine_path_max_length);
+        }
+        else
+            subfolder = createEmptyFolder(cache, entry_name, 0, 0);
+
+        addSubfolderToFolder(folder, subfolder);
+    }
+
+    return folder;
+}
+
+void benchmarkCacheLookup (void* context, const uint64_t iteration)
+{
+    LookupContext* lookup_context = context;
+    _sink += (long) findFileInCache(lookup_context->cache,
+                                    lookup_context->paths[iteration % NB_LOOKUP_PATHS], NULL);
+}
+
+void runCacheLookupBenchmarks ()
+{
+    const int widths[] = { 4, 32, 256 };
+    const int depths[] = { 0, 2, 5 };
+
+    for (unsigned int i = 0; i < sizeof(widths) / sizeof(int); i++)
+        for (unsigned int j = 0; j < sizeof(depths) / sizeof(int); j++)
+        {
+            int width = widths[i];
+            int depth = depths[j];
+
+            char spine_path[MAX_PATH_LENGTH] = "/";
+
+            LookupContext context;
+            context.cache       = createEmptyFileCache(0);
+            context.cache->root = buildSyntheticFolder(context.cache, "root", width, depth,
+                                                       spine_path, MAX_PATH_LENGTH);
+            indexCacheFiles(context.cache);
+
+            // Hits: random files of the deepest folder
+            for (int k = 0; k < NB_LOOKUP_PATHS; k++)
+            {
+                context.paths[k] = malloc(MAX_PATH_LENGTH);
+                snprintf(context.paths[k], MAX_PATH_LENGTH, "%s/file_%d.html",
+                         spine_path, rand() % width);
+            }
+
+            char parameters[128];
+            snprintf(parameters, sizeof(parameters), "width=%d,depth=%d,hit", width, depth);
+            runBenchmark("findFileInCache", parameters, benchmarkCacheLookup, &context);
+
+            // Misses: unknown files of the deepest folder
+            for (int k = 0; k < NB_LOOKUP_PATHS; k++)
+                snprintf(context.paths[k], MAX_PATH_LENGTH, "%s/missing_%d.html",
+                         spine_path, rand() % width);
+
+            snprintf(parameters, sizeof(parameters), "width=%d,depth=%d,miss", width, depth);
+            runBenchmark("findFileInCache", parameters, benchmarkCacheLookup, &context);
+
+            for (int k = 0; k < NB_LOOKUP_PATHS; k++)
+                free(context.paths[k]);
+            deleteFileCache(context.cache);
+        }
+}
+
+// -----------------------------------------------------------------------------
+// LONGEST-PREFIX MATCHING
+// -----------------------------------------------------------------------------
+
+#define NB_PREFIX_TARGETS 1024
+
+typedef struct PrefixContext {
+    PathIndex* index;
+    char*      targets[NB_PREFIX_TARGETS];
+} PrefixContext;
+
+// Index every directory of a full tree of the given width and depth (e.g. "dir_3/dir_1/"),
+// as a per-directory policy would be: the value of each path is the path itself
+void insertSyntheticDirectories (PathIndex* index, char* path, const int path_length,
+                                 const int width, const int depth)
+{
+    if (depth == 0)
+        return;
+
+    for (int i = 0; i < width; i++)
+    {
+        int length = path_length + snprintf(path + path_length, MAX_PATH_LENGTH - path_length,
+                                            "dir_%d/", i);
+
+        insertInPathIndex(index, path, length, copyStringToArena(index->arena, path));
+        insertSyntheticDirectories(index, path, length, width, depth - 1);
+    }
+
+    path[path_length] = '\0';
+}
+
+// Internal version only!
+// Exit if the longest prefix of the target is not the expected one (NULL for none)
+static void _checkLongestPrefix (const PathIndex* index, const char* target,
+                                 const char* expected_prefix)
+{
+    const char* prefix = findLongestPrefixInPathIndex(index, target);
+    if (prefix == expected_prefix
+    ||  (prefix != NULL && expected_prefix != NULL && strcmp(prefix, expected_prefix) == 0))
+        return;
+
+    printError("Error: the longest prefix of %s is %s instead of %s", target,
+               prefix          != NULL ? prefix          : "(none)",
+               expected_prefix != NULL ? expected_prefix : "(none)");
+    exit(EXIT_FAILURE);
+}
+
+void benchmarkLongestPrefixLookup (void* context, const uint64_t iteration)
+{
+    PrefixContext* prefix_context = context;
+    _sink += (long) findLongestPrefixInPathIndex(prefix_context->index,
+                                                 prefix_context->targets[iteration % NB_PREFIX_TARGETS]);
+}
+
+void runLongestPrefixBenchmarks ()
+{
+    const int width    = 4;
+    const int depths[] = { 1, 3, 6 };
+
+    for (unsigned int i = 0; i < sizeof(depths) / sizeof(int); i++)
+    {
+        int depth = depths[i];
+
+        Arena* arena = createArena(ARENA_DEFAULT_BLOCK_SIZE);
+
+        PrefixContext context;
+        context.index = createPathIndex(arena);
+
+        char path[MAX_PATH_LENGTH] = "";
+        insertSyntheticDirectories(context.index, path, 0, width, depth);
+
+        _checkLongestPrefix(context.index, "/dir_0/index.html", "dir_0/");
+        _checkLongestPrefix(context.index, "/dir_0//dir_9/index.html", "dir_0/");
+        _checkLongestPrefix(context.index, "/dir_0-old/index.html", NULL);
+        _checkLongestPrefix(context.index, "/index.html", NULL);
+
+        // Files of random deepest directories, whose longest prefix is their directory
+        for (int j = 0; j < NB_PREFIX_TARGETS; j++)
+        {
+            int length = 0;
+            for (int k = 0; k < depth; k++)
+                length += snprintf(path + length, MAX_PATH_LENGTH - length,
+                                   "dir_%d/", rand() % width);
+
+            context.targets[j] = malloc(MAX_PATH_LENGTH);
+            snprintf(context.targets[j], MAX_PATH_LENGTH, "/%sindex.html", path);
+            _checkLongestPrefix(context.index, context.targets[j], path);
+        }
+
+        char parameters[128];
+        snprintf(parameters, sizeof(parameters), "width=%d,depth=%d", width, depth);
+        runBenchmark("findLongestPrefixInPathIndex", parameters, benchmarkLongestPrefixLookup, &context);
+
+        for (int j = 0; j < NB_PREFIX_TARGETS; j++)
+            free(context.targets[j]);
+        deleteArena(arena);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// HEADER RENDERING
+// -----------------------------------------------------------------------------
+
+typedef struct RenderingContext {
+    HttpMessage* answer;
+    char*        buffer;
+    int          buffer_max_length;
+} RenderingContext;
+
+void benchmarkHeaderRendering (void* context, const uint64_t iteration)
+{
+    RenderingContext* rendering_context = context;
+    _sink += fillHttpAnswerHeaderBuffer(rendering_context->answer,
+                                        rendering_context->buffer,
+                                        rendering_context->buffer_max_length);
+    (void) iteration;
+}
+
+void runHeaderRenderingBenchmarks ()
+{
+    // A cached, compressed file
+    FileCache* cache = createEmptyFileCache(0);
+    File*      file  = createAndInitFile(cache);
+    setFileNameAndPath(cache, file, "test.html", "./www/test.html");
+    file->size     = 803;
+    file->state    = STATE_LOADED_COMPRESSED;
+    file->encoding = ENCODING_GZIP;
+    file->type     = internFileType(cache, "text/html; charset=utf-8");
+
+    HttpMessage* request = createHttpMessage();
+    initRequestHttpMessage(request);
+    request->header->method = HTTP_GET;
+
+    RenderingContext context;
+    context.answer            = createHttpMessage();
+    context.buffer_max_length = 2048;
+    context.buffer            = malloc(context.buffer_max_length);
+
+    prepareHttpValidAnswer(request, context.answer, file);
+    runBenchmark("fillHttpAnswerHeaderBuffer", "200_cached_file", benchmarkHeaderRendering, &context);
+
+    prepareHttpError(context.answer, HTTP_404);
+    runBenchmark("fillHttpAnswerHeaderBuffer", "404", benchmarkHeaderRendering, &context);
+
+    free(context.buffer);
+    deleteHttpMessage(context.answer);
+    deleteHttpMessage(request);
+    deleteFileCache(cache);
+}
+
+// -----------------------------------------------------------------------------
+// RATE LIMITING
+// -----------------------------------------------------------------------------
+
+#define NB_LIMITED_ADDRESSES 4096
+
+typedef struct RateLimitContext {
+    RateLimiter* limiter;
+    uint32_t     addresses[NB_LIMITED_ADDRESSES];
+    int          nb_addresses;
+} RateLimitContext;
+
+void benchmarkRequestAdmission (void* context, const uint64_t iteration)
+{
+    RateLimitContext* rate_limit_context = context;
+    uint32_t address = rate_limit_context->addresses[iteration % rate_limit_context->nb_addresses];
+
+    // One request per microsecond, as if the clock was read for each request
+    _sink += admitRequest(rate_limit_context->limiter, address, iteration * 1000);
+}
+
+void runRateLimitBenchmarks ()
+{
+    // Few addresses (all remembered), then more addresses than entries (constant recycling)
+    const int nb_addresses[] = { 16, NB_LIMITED_ADDRESSES };
+
+    RateLimitContext context;
+    for (int i = 0; i < NB_LIMITED_ADDRESSES; i++)
+        context.addresses[i] = (uint32_t) rand();
+
+    for (unsigned int i = 0; i < sizeof(nb_addresses) / sizeof(int); i++)
+    {
+        context.limiter      = createRateLimiter(1024, 1000, 1000, RATE_LIMIT_NO_LIMIT);
+        context.nb_addresses = nb_addresses[i];
+
+        char parameters[128];
+        snprintf(parameters, sizeof(parameters), "entries=1024,addresses=%d", nb_addresses[i]);
+        runBenchmark("admitRequest", parameters, benchmarkRequestAdmission, &context);
+
+        deleteRateLimiter(context.limiter);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// VIRTUAL HOSTS
+// -----------------------------------------------------------------------------
+
+#define NB_LOOKED_UP_HOSTS 64
+
+typedef struct VirtualHostContext {
+    VirtualHosts* virtual_hosts;
+    char          hosts[NB_LOOKED_UP_HOSTS][64]; // As in request buffers (with a port)
+} VirtualHostContext;
+
+void benchmarkVirtualHostLookup (void* context, const uint64_t iteration)
+{
+    VirtualHostContext* virtual_host_context = context;
+    const char* host = virtual_host_context->hosts[iteration % NB_LOOKED_UP_HOSTS];
+
+    _sink += (long) findVirtualHostSite(virtual_host_context->virtual_hosts, host);
+}
+
+void runVirtualHostBenchmarks ()
+{
+    // The lookup time should not depend on the number of host names
+    const int nb_host_names[] = { 10, 1000 };
+
+    for (unsigned int i = 0; i < sizeof(nb_host_names) / sizeof(int); i++)
+    {
+        // Each site has two names (e.g. "site-3.example.com,www.site-3.example.com=./www")
+        int   list_length = nb_host_names[i] * 64;
+        char* list        = malloc(list_length);
+        int   offset      = 0;
+        for (int j = 0; j < nb_host_names[i] / 2; j++)
+            offset += snprintf(list + offset, list_length - offset,
+                               "site-%d.example.com,www.site-%d.example.com=./www ", j, j);
+
+        VirtualHostContext context;
+        context.virtual_hosts = parseVirtualHosts(list, "./www");
+        for (int j = 0; j < NB_LOOKED_UP_HOSTS; j++)
+            snprintf(context.hosts[j], sizeof(context.hosts[j]), "WWW.Site-%d.example.com:8080",
+                     rand() % (nb_host_names[i] / 2));
+
+        char parameters[128];
+        snprintf(parameters, sizeof(parameters), "host_names=%d", nb_host_names[i]);
+        runBenchmark("findVirtualHostSite", parameters, benchmarkVirtualHostLookup, &context);
+
+        deleteVirtualHosts(context.virtual_hosts);
+        free(list);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main ()
+{
+    srand(42);
+
+    runParsingBenchmarks();
+    runCacheLookupBenchmarks();
+    runLongestPrefixBenchmarks();
+    runHeaderRenderingBenchmarks();
+    runRateLimitBenchmarks();
+    runVirtualHostBenchmarks();
+
+    return 0;
+}
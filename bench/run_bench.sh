@@ -0,0 +1,81 @@
+#!/bin/sh
+# End-to-end throughput benchmark of the server, over loopback.
+# The server is run on a copy of www/ (plus a file too large to be cached),
+# and the load generator is run once per request mix and loading mode.
+# All the results are gathered in a single JSON array.
+#
+# Environment variables: DURATION (s), THREADS, CONNECTIONS, RATE (open-loop req/s),
+#                        PORT, RESULTS (output file)
+
+set -e
+
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build"
+
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-16}
+RATE=${RATE:-2000}
+PORT=${PORT:-4242}
+RESULTS=${RESULTS:-"$BUILD_DIR/bench/results-$(date +%Y%m%d-%H%M%S).json"}
+
+LARGE_FILE_SIZE_MB=${LARGE_FILE_SIZE_MB:-8}
+
+# Build the data directory: the server always serves ./www
+WORK_DIR=$(mktemp -d)
+cp -R "$ROOT_DIR/www" "$WORK_DIR/www"
+head -c $((LARGE_FILE_SIZE_MB * 1000000)) /dev/urandom > "$WORK_DIR/www/large.bin"
+
+SERVER_PID=""
+cleanUp () {
+    # The server is killed by the signal: its exit status must not be the one of the script
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && { wait "$SERVER_PID" 2> /dev/null || true; }
+    rm -Rf "$WORK_DIR"
+}
+trap cleanUp EXIT INT TERM
+
+(cd "$WORK_DIR" && exec "$BUILD_DIR/webserver" --quiet > "$WORK_DIR/server.log" 2>&1) &
+SERVER_PID=$!
+
+# Wait for the server to build its cache and to listen
+for i in $(seq 1 100); do
+    if curl -s -o /dev/null "http://127.0.0.1:$PORT/test.html"; then
+        break
+    fi
+    sleep 0.1
+done
+
+mkdir -p "$(dirname "$RESULTS")"
+RUN_DIR="$WORK_DIR/runs"
+mkdir -p "$RUN_DIR"
+
+runLoadgen () {
+    NAME=$1
+    shift
+    echo "Running $NAME..."
+    "$BUILD_DIR/loadgen" --port "$PORT" --threads "$THREADS" --connections "$CONNECTIONS" \
+                         --duration "$DURATION" --misc-dir "$ROOT_DIR/misc" --large-path /large.bin \
+                         --label "$NAME" --output "$RUN_DIR/$(printf '%03d' $(ls "$RUN_DIR" | wc -l)).json" "$@"
+}
+
+for MIX in hit 404 head large pipelined misc mixed; do
+    runLoadgen "closed-$MIX" --mix "$MIX"
+done
+
+for MIX in hit mixed; do
+    runLoadgen "open-$MIX" --mix "$MIX" --rate "$RATE"
+done
+
+# Gather all the results in a JSON array
+{
+    echo "["
+    FIRST=1
+    for RUN in "$RUN_DIR"/*.json; do
+        [ $FIRST -eq 1 ] || echo ","
+        FIRST=0
+        cat "$RUN"
+    done
+    echo "]"
+} > "$RESULTS"
+
+echo "Results written in $RESULTS"
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Latency benchmark of the TCP options of the server (see src/socket_options.h), over loopback.
+# The server is restarted with a baseline (all the options disabled, but SO_REUSEADDR),
+# then with each option alone, then with all of them; the load generator is run
+# with keep-alive connections, and with a new connection per request (the handshake
+# is then part of the latency, as for TCP_DEFER_ACCEPT and TCP_FASTOPEN).
+# All the results are gathered in a single JSON array, and their p99 latencies are printed.
+#
+# The server only accepts Fast Open requests if bit 2 of net.ipv4.tcp_fastopen is set
+# (e.g. sysctl -w net.ipv4.tcp_fastopen=3), and busy polling only matters on a real NIC.
+#
+# Environment variables: DURATION (s), THREADS, CONNECTIONS, PORT, RESULTS (output file)
+
+set -e
+
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build"
+
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-16}
+PORT=${PORT:-4242}
+RESULTS=${RESULTS:-"$BUILD_DIR/bench/sockets-$(date +%Y%m%d-%H%M%S).json"}
+
+BASELINE="none,reuse-address"
+OPTIONS="defer-accept fast-open no-delay busy-poll,prefer-busy-poll"
+ALL_OPTIONS="$BASELINE,defer-accept,fast-open,no-delay,busy-poll,prefer-busy-poll"
+
+# Build the data directory: the server always serves ./www
+WORK_DIR=$(mktemp -d)
+cp -R "$ROOT_DIR/www" "$WORK_DIR/www"
+
+SERVER_PID=""
+stopServer () {
+    # The server is killed by the signal: its exit status must not be the one of the script
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && { wait "$SERVER_PID" 2> /dev/null || true; }
+    SERVER_PID=""
+}
+
+cleanUp () {
+    stopServer
+    rm -Rf "$WORK_DIR"
+}
+trap cleanUp EXIT INT TERM
+
+startServer () {
+    (cd "$WORK_DIR" && exec "$BUILD_DIR/webserver" --quiet --socket-options "$1" > "$WORK_DIR/server.log" 2>&1) &
+    SERVER_PID=$!
+
+    # Wait for the server to build its cache and to listen
+    for i in $(seq 1 100); do
+        if curl -s -o /dev/null "http://127.0.0.1:$PORT/test.html"; then
+            break
+        fi
+        sleep 0.1
+    done
+}
+
+mkdir -p "$(dirname "$RESULTS")"
+RUN_DIR="$WORK_DIR/runs"
+mkdir -p "$RUN_DIR"
+
+runLoadgen () {
+    NAME=$1
+    shift
+    echo "Running $NAME..."
+    "$BUILD_DIR/loadgen" --port "$PORT" --threads "$THREADS" --connections "$CONNECTIONS" \
+                         --duration "$DURATION" --mix hit --label "$NAME" \
+                         --output "$RUN_DIR/$(printf '%03d' $(ls "$RUN_DIR" | wc -l)).json" "$@"
+}
+
+runConfiguration () {
+    CONFIGURATION=$1
+    startServer "$2"
+
+    runLoadgen "$CONFIGURATION/keep-alive"
+    if [ "$CONFIGURATION" = "fast-open" ] || [ "$CONFIGURATION" = "all" ]; then
+        runLoadgen "$CONFIGURATION/new-connections" --new-connections --fast-open
+    else
+        runLoadgen "$CONFIGURATION/new-connections" --new-connections
+    fi
+
+    stopServer
+}
+
+runConfiguration "baseline" "$BASELINE"
+for OPTION in $OPTIONS; do
+    runConfiguration "$OPTION" "$BASELINE,$OPTION"
+done
+runConfiguration "all" "$ALL_OPTIONS"
+
+# Gather all the results in a JSON array
+{
+    echo "["
+    FIRST=1
+    for RUN in "$RUN_DIR"/*.json; do
+        [ $FIRST -eq 1 ] || echo ","
+        FIRST=0
+        cat "$RUN"
+    done
+    echo "]"
+} > "$RESULTS"
+
+# Compare the p99 latencies of the runs
+for RUN in "$RUN_DIR"/*.json; do
+    LABEL=$(sed -n 's/.*"label": "\(.*\)".*/\1/p' "$RUN")
+    P99=$(sed -n 's/.*"latency_us": {.*"p99": \([0-9]*\).*/\1/p' "$RUN")
+    printf "%-45s p99 = %s us\n" "$LABEL" "$P99"
+done
+
+echo "Results written in $RESULTS"
@@ -0,0 +1,80 @@
+#!/bin/sh
+# Throughput and latency of the server over loopback TCP and over a Unix socket
+# (e.g. behind a local reverse proxy): a single server listens on both (see listener.h),
+# and the load generator is run against each of them in turn, with the same load.
+# All the results are gathered in a single JSON array.
+#
+# Environment variables: DURATION (s), THREADS, CONNECTIONS, PORT, MIX,
+#                        SOCKET (path of the Unix socket), RESULTS (output file)
+
+set -e
+
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build"
+
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-16}
+PORT=${PORT:-4242}
+MIX=${MIX:-hit}
+RESULTS=${RESULTS:-"$BUILD_DIR/bench/unix-socket-$(date +%Y%m%d-%H%M%S).json"}
+
+# Build the data directory: the server always serves ./www
+WORK_DIR=$(mktemp -d)
+cp -R "$ROOT_DIR/www" "$WORK_DIR/www"
+SOCKET=${SOCKET:-"$WORK_DIR/webserver.sock"}
+
+SERVER_PID=""
+stopServer () {
+    # The server is killed by the signal: its exit status must not be the one of the script
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && { wait "$SERVER_PID" 2> /dev/null || true; }
+    SERVER_PID=""
+}
+
+cleanUp () {
+    stopServer
+    rm -f "$SOCKET"
+    rm -Rf "$WORK_DIR"
+}
+trap cleanUp EXIT INT TERM
+
+(cd "$WORK_DIR" && exec "$BUILD_DIR/webserver" --quiet --listen "tcp4:$PORT unix:$SOCKET" \
+                                               > "$WORK_DIR/server.log" 2>&1) &
+SERVER_PID=$!
+
+# Wait for the server to build its cache and to listen
+for i in $(seq 1 100); do
+    if curl -s -o /dev/null --unix-socket "$SOCKET" "http://localhost/test.html"; then
+        break
+    fi
+    sleep 0.1
+done
+
+mkdir -p "$(dirname "$RESULTS")"
+RUN_DIR="$WORK_DIR/runs"
+mkdir -p "$RUN_DIR"
+
+runTransport () {
+    NAME=$1
+    shift
+    echo "Running $NAME..."
+
+    "$BUILD_DIR/loadgen" "$@" --threads "$THREADS" --connections "$CONNECTIONS" \
+                         --duration "$DURATION" --mix "$MIX" --label "$NAME" \
+                         --output "$RUN_DIR/$NAME.json"
+    sed -n 's/.*"requests_per_s": \([0-9.]*\).*/  requests\/s: \1/p' "$RUN_DIR/$NAME.json"
+}
+
+runTransport "tcp-loopback" --host 127.0.0.1 --port "$PORT"
+runTransport "unix-socket" --unix "$SOCKET"
+
+# Gather all the results in a JSON array
+{
+    echo "["
+    cat "$RUN_DIR/tcp-loopback.json"
+    echo ","
+    cat "$RUN_DIR/unix-socket.json"
+    echo "]"
+} > "$RESULTS"
+
+echo "Results written in $RESULTS"
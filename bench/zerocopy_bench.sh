@@ -0,0 +1,114 @@
+#!/bin/sh
+# CPU cost of the large cached bodies, with and without zero-copy sends (--zerocopy).
+# The server is run on a copy of www/ plus a random (incompressible) file small enough
+# to be cached, which is downloaded by the load generator; the CPU time of the server
+# (user + system, from /proc) is then divided by the number of bytes it has sent.
+# All the results are gathered in a single JSON array.
+#
+# Over loopback, the kernel copies the data anyway (and the server then stops using zero-copy
+# for the connection): the load generator should rather be run on another host (HOST).
+#
+# Environment variables: DURATION (s), THREADS, CONNECTIONS, HOST, PORT,
+#                        CACHED_FILE_SIZE_KB, ZEROCOPY_MIN_SIZE (bytes), RESULTS (output file)
+
+set -e
+
+ROOT_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR="$ROOT_DIR/build"
+
+DURATION=${DURATION:-5}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-16}
+HOST=${HOST:-127.0.0.1}
+PORT=${PORT:-4242}
+CACHED_FILE_SIZE_KB=${CACHED_FILE_SIZE_KB:-1024}
+ZEROCOPY_MIN_SIZE=${ZEROCOPY_MIN_SIZE:-65536}
+RESULTS=${RESULTS:-"$BUILD_DIR/bench/zerocopy-$(date +%Y%m%d-%H%M%S).json"}
+
+CLOCK_TICKS=$(getconf CLK_TCK)
+
+# Build the data directory: the server always serves ./www
+WORK_DIR=$(mktemp -d)
+cp -R "$ROOT_DIR/www" "$WORK_DIR/www"
+head -c $((CACHED_FILE_SIZE_KB * 1000)) /dev/urandom > "$WORK_DIR/www/cached.bin"
+
+SERVER_PID=""
+stopServer () {
+    # The server is killed by the signal: its exit status must not be the one of the script
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2> /dev/null && { wait "$SERVER_PID" 2> /dev/null || true; }
+    SERVER_PID=""
+}
+
+cleanUp () {
+    stopServer
+    rm -Rf "$WORK_DIR"
+}
+trap cleanUp EXIT INT TERM
+
+startServer () {
+    (cd "$WORK_DIR" && exec "$BUILD_DIR/webserver" --quiet "$@" > "$WORK_DIR/server.log" 2>&1) &
+    SERVER_PID=$!
+
+    # Wait for the server to build its cache and to listen
+    for i in $(seq 1 100); do
+        if curl -s -o /dev/null "http://127.0.0.1:$PORT/test.html"; then
+            break
+        fi
+        sleep 0.1
+    done
+}
+
+# CPU time of the server (in clock ticks): fields 14 and 15 of its stat file
+# (after the command name, which is between parentheses)
+getServerCpuTime () {
+    sed 's/.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+mkdir -p "$(dirname "$RESULTS")"
+RUN_DIR="$WORK_DIR/runs"
+mkdir -p "$RUN_DIR"
+
+runConfiguration () {
+    NAME=$1
+    shift
+    echo "Running $NAME..."
+    startServer "$@"
+
+    CPU_TIME_BEFORE=$(getServerCpuTime)
+    "$BUILD_DIR/loadgen" --host "$HOST" --port "$PORT" --threads "$THREADS" --connections "$CONNECTIONS" \
+                         --duration "$DURATION" --mix large --large-path /cached.bin --label "$NAME" \
+                         --output "$RUN_DIR/$NAME.loadgen.json"
+    CPU_TIME_AFTER=$(getServerCpuTime)
+    METRICS=$(curl -s "http://127.0.0.1:$PORT/server-metrics")
+    ZEROCOPY_SENDS=$(echo "$METRICS" | awk '/^webserver_zerocopy_sends_total\{copied="false"\}/ { print $2 }')
+    COPIED_SENDS=$(echo "$METRICS" | awk '/^webserver_zerocopy_sends_total\{copied="true"\}/ { print $2 }')
+
+    stopServer
+
+    BYTES_PER_S=$(sed -n 's/.*"received_bytes_per_s": \([0-9.]*\).*/\1/p' "$RUN_DIR/$NAME.loadgen.json")
+    awk -v name="$NAME" -v ticks="$((CPU_TIME_AFTER - CPU_TIME_BEFORE))" -v clock_ticks="$CLOCK_TICKS" \
+        -v bytes_per_s="$BYTES_PER_S" -v duration="$DURATION" \
+        -v zerocopy_sends="$ZEROCOPY_SENDS" -v copied_sends="$COPIED_SENDS" \
+        'BEGIN {
+             cpu_s = ticks / clock_ticks
+             gb    = bytes_per_s * duration / 1e9
+             format = "{ \"label\": \"%s\", \"bytes_per_s\": %.1f, \"server_cpu_s\": %.2f, \"server_cpu_s_per_gb\": %.4f, "
+             format = format "\"zerocopy_sends\": %d, \"copied_zerocopy_sends\": %d }\n"
+             printf format, name, bytes_per_s, cpu_s, (gb > 0 ? cpu_s / gb : 0), zerocopy_sends, copied_sends
+         }' > "$RUN_DIR/$NAME.json"
+    cat "$RUN_DIR/$NAME.json"
+}
+
+runConfiguration "copy"
+runConfiguration "zerocopy" --zerocopy "$ZEROCOPY_MIN_SIZE"
+
+# Gather all the results in a JSON array
+{
+    echo "["
+    cat "$RUN_DIR/copy.json"
+    echo ","
+    cat "$RUN_DIR/zerocopy.json"
+    echo "]"
+} > "$RESULTS"
+
+echo "Results written in $RESULTS"
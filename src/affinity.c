@@ -0,0 +1,130 @@
+// Macro definition required for using CPU_SET(), sched_setaffinity() and SO_REUSEPORT
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include "toolbox.h"
+#include "affinity.h"
+
+// -----------------------------------------------------------------------------
+// CPUS
+// -----------------------------------------------------------------------------
+
+// Restrict the calling process to the CPUs of the worker (among the ones it is allowed to use)
+// Return false if there is none (e.g. more workers than CPUs): the process is then left as is
+bool pinToWorkerCpus (const int worker_index, const int nb_workers)
+{
+    cpu_set_t allowed_cpus;
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) < 0)
+    {
+        handleError("sched_getaffinity() failed in pinToWorkerCpus()");
+        return false;
+    }
+
+    cpu_set_t worker_cpus;
+    CPU_ZERO(&worker_cpus);
+    for (int cpu = worker_index; cpu < CPU_SETSIZE; cpu += nb_workers)
+        if (CPU_ISSET(cpu, &allowed_cpus))
+            CPU_SET(cpu, &worker_cpus);
+
+    if (CPU_COUNT(&worker_cpus) == 0)
+    {
+        printWarning("Warning: worker %d has no CPU to be pinned to!", worker_index);
+        return false;
+    }
+
+    if (sched_setaffinity(0, sizeof(worker_cpus), &worker_cpus) < 0)
+    {
+        handleError("sched_setaffinity() failed in pinToWorkerCpus()");
+        return false;
+    }
+
+    return true;
+}
+
+// Let the socket bind the same address as the other sockets of the group (e.g. of the workers),
+// and share its clients with them: this must be done before binding it
+void joinSteeringGroup (const int sockfd)
+{
+    int is_enabled = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &is_enabled, sizeof(is_enabled)) < 0)
+        handleErrorAndExit("setsockopt() failed in joinSteeringGroup()");
+}
+
+// The program is shared by the whole SO_REUSEPORT group of the socket: it returns the index
+// of the socket (in the order they started listening) which must accept a new connection,
+// from the CPU on which its SYN is processed
+// If the program cannot be attached, the connections are spread by the usual hash
+void attachCpuSteeringProgram (const int sockfd, const int nb_workers)
+{
+    struct sock_filter instructions[] = {
+        { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K,   0, 0, nb_workers },
+        { BPF_RET | BPF_A,             0, 0, 0 }
+    };
+
+    struct sock_fprog program = {
+        .len    = sizeof(instructions) / sizeof(struct sock_filter),
+        .filter = instructions
+    };
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+        handleError("setsockopt() failed in attachCpuSteeringProgram()");
+}
+
+// -----------------------------------------------------------------------------
+// NUMA NODES
+// -----------------------------------------------------------------------------
+
+// The online nodes are listed as ranges (e.g. "0-1" or "0,2-3"): the last one is the largest
+int getNbNumaNodes ()
+{
+    FILE* file = fopen(NUMA_ONLINE_NODES_PATH, "r");
+    if (file == NULL)
+        return 1;
+
+    char nodes[256];
+    char* success = fgets(nodes, sizeof(nodes), file);
+    fclose(file);
+
+    if (success == NULL)
+        return 1;
+
+    char* last_node = nodes + strcspn(nodes, "\n");
+    while (last_node > nodes && strchr("-,", last_node[-1]) == NULL)
+        last_node--;
+
+    return atoi(last_node) + 1;
+}
+
+// Return the node of the CPU the calling process is running on (or NUMA_UNKNOWN_NODE)
+int getCurrentNumaNode ()
+{
+    unsigned int cpu;
+    unsigned int node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+        return NUMA_UNKNOWN_NODE;
+
+    return node;
+}
+
+// The pages of the memory (which must not have been touched yet) are allocated on the node
+// For shared memory, the policy is attached to the memory itself (for all the processes)
+void bindMemoryToNumaNode (void* address, const size_t size, const int node)
+{
+    if (node >= (int) (8 * sizeof(unsigned long)))
+        return;
+
+    unsigned long node_mask = 1UL << node;
+    if (syscall(SYS_mbind, address, size, MPOL_BIND, &node_mask, 8 * sizeof(node_mask) + 1, 0) < 0)
+        handleError("mbind() failed in bindMemoryToNumaNode()");
+}
@@ -0,0 +1,29 @@
+#ifndef __H_AFFINITY__
+#define __H_AFFINITY__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Placement of the prefork workers on the CPUs and on the NUMA nodes:
+// the i-th worker (out of n) runs on the CPUs c such that c % n == i (one core each
+// if there are as many workers as CPUs), and the i-th listening socket of a SO_REUSEPORT group
+// is chosen for the connections whose SYN is received on such a CPU (i.e. by the NIC queue
+// whose interrupts are handled there): a connection is thus accepted and served on the CPU
+// which received it
+
+#define NUMA_ONLINE_NODES_PATH "/sys/devices/system/node/online"
+
+// Named, useful constants
+#define NUMA_UNKNOWN_NODE -1
+
+// -----------------------------------------------------------------------------
+
+bool pinToWorkerCpus (const int worker_index, const int nb_workers);
+void joinSteeringGroup (const int sockfd);
+void attachCpuSteeringProgram (const int sockfd, const int nb_workers);
+
+int getNbNumaNodes ();
+int getCurrentNumaNode ();
+void bindMemoryToNumaNode (void* address, const size_t size, const int node);
+
+#endif
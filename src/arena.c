@@ -0,0 +1,240 @@
+// Macro definition required for using MAP_ANONYMOUS and mremap()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "toolbox.h"
+#include "affinity.h"
+#include "arena.h"
+
+// The data of a block starts right after its (aligned) header
+#define BLOCK_HEADER_SIZE \
+    ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+#define BLOCK_DATA(block) ((char*) (block) + BLOCK_HEADER_SIZE)
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON ARENA
+// -----------------------------------------------------------------------------
+
+Arena* createArena (const size_t block_size)
+{
+    Arena* new_arena = malloc(sizeof(Arena));
+    if (new_arena == NULL)
+        handleErrorAndExit("malloc() failed in createArena()");
+
+    new_arena->current_block     = NULL;
+    new_arena->block_size        = block_size;
+    new_arena->is_shared         = false;
+    new_arena->replicas          = NULL;
+    new_arena->nb_bytes_used     = 0;
+    new_arena->nb_bytes_reserved = 0;
+    new_arena->nb_blocks         = 0;
+
+    return new_arena;
+}
+
+// Only the blocks are shared: the arena structure itself must not be used by several processes
+Arena* createSharedArena (const size_t block_size)
+{
+    Arena* new_arena = createArena(block_size);
+    new_arena->is_shared = true;
+
+    return new_arena;
+}
+
+// Warning: all the memory allocated from the arena is freed as well!
+void deleteArena (Arena* arena)
+{
+    ArenaBlock* block = arena->current_block;
+    while (block != NULL)
+    {
+        ArenaBlock* previous_block = block->previous;
+        if (arena->is_shared)
+            munmap(block, BLOCK_HEADER_SIZE + block->size);
+        else
+            free(block);
+
+        block = previous_block;
+    }
+
+    // The replicas used by this process (if any) have been moved over the blocks,
+    // and are thus already unmapped
+    ArenaReplica* replica = arena->replicas;
+    while (replica != NULL)
+    {
+        ArenaReplica* next_replica = replica->next;
+        if (replica->copy != NULL)
+            munmap(replica->copy, replica->size);
+        free(replica);
+
+        replica = next_replica;
+    }
+
+    free(arena);
+}
+
+// Make all the blocks of a shared arena read-only (in the calling process only)
+// Nothing can be allocated from the arena afterwards
+void protectArena (Arena* arena)
+{
+    if (! arena->is_shared)
+        return;
+
+    for (ArenaBlock* block = arena->current_block; block != NULL; block = block->previous)
+    {
+        int success = mprotect(block, BLOCK_HEADER_SIZE + block->size, PROT_READ);
+        if (success < 0)
+            handleErrorAndExit("mprotect() failed in protectArena()");
+    }
+}
+
+// Copy all the blocks of a shared arena on each NUMA node (in shared memory as well)
+// Nothing must be allocated from the arena afterwards: the copies would not be updated
+void replicateArena (Arena* arena, const int nb_nodes)
+{
+    if (! arena->is_shared)
+        return;
+
+    for (ArenaBlock* block = arena->current_block; block != NULL; block = block->previous)
+        for (int node = 0; node < nb_nodes; node++)
+        {
+            size_t size = BLOCK_HEADER_SIZE + block->size;
+            void*  copy = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (copy == MAP_FAILED)
+                handleErrorAndExit("mmap() failed in replicateArena()");
+
+            // The pages are allocated (on the node) by the copy
+            bindMemoryToNumaNode(copy, size, node);
+            memcpy(copy, block, size);
+
+            ArenaReplica* new_replica = malloc(sizeof(ArenaReplica));
+            if (new_replica == NULL)
+                handleErrorAndExit("malloc() failed in replicateArena()");
+
+            new_replica->block = block;
+            new_replica->copy  = copy;
+            new_replica->size  = size;
+            new_replica->node  = node;
+            new_replica->next  = arena->replicas;
+            arena->replicas    = new_replica;
+        }
+}
+
+// Replace the blocks by their replicas on the given node (in the calling process only):
+// the pointers to the memory of the arena remain valid, but now read local pages
+void useArenaReplicas (Arena* arena, const int node)
+{
+    for (ArenaReplica* replica = arena->replicas; replica != NULL; replica = replica->next)
+    {
+        if (replica->node != node || replica->copy == NULL)
+            continue;
+
+        void* address = mremap(replica->copy, replica->size, replica->size,
+                               MREMAP_MAYMOVE | MREMAP_FIXED, replica->block);
+        if (address == MAP_FAILED)
+            handleErrorAndExit("mremap() failed in useArenaReplicas()");
+
+        replica->copy = NULL;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// ALLOCATION
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static ArenaBlock* _createArenaBlock (Arena* arena, const size_t size)
+{
+    ArenaBlock* new_block;
+    if (arena->is_shared)
+    {
+        new_block = mmap(NULL, BLOCK_HEADER_SIZE + size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (new_block == MAP_FAILED)
+            handleErrorAndExit("mmap() failed in _createArenaBlock()");
+    }
+    else
+    {
+        new_block = malloc(BLOCK_HEADER_SIZE + size);
+        if (new_block == NULL)
+            handleErrorAndExit("malloc() failed in _createArenaBlock()");
+    }
+
+    new_block->previous      = NULL;
+    new_block->size          = size;
+    new_block->nb_bytes_used = 0;
+
+    arena->nb_bytes_reserved += size;
+    arena->nb_blocks++;
+
+    return new_block;
+}
+
+// Internal version only!
+// The alignment must be a power of two
+static void* _allocateFromArena (Arena* arena, const size_t size, const size_t alignment)
+{
+    ArenaBlock* block = arena->current_block;
+
+    size_t offset = 0;
+    if (block != NULL)
+        offset = (block->nb_bytes_used + alignment - 1) & ~(alignment - 1);
+
+    if (block == NULL || offset + size > block->size)
+    {
+        // Large areas get a block of their own, inserted behind the current one
+        // (whose free space can still be used by the next allocations)
+        if (block != NULL && size > arena->block_size / 4)
+        {
+            ArenaBlock* large_block = _createArenaBlock(arena, size);
+            large_block->previous   = block->previous;
+            block->previous         = large_block;
+
+            block = large_block;
+        }
+        else
+        {
+            ArenaBlock* new_block = _createArenaBlock(arena, MAX(arena->block_size, size));
+            new_block->previous   = block;
+            arena->current_block  = new_block;
+
+            block = new_block;
+        }
+
+        offset = 0;
+    }
+
+    void* area = BLOCK_DATA(block) + offset;
+    arena->nb_bytes_used += offset + size - block->nb_bytes_used;
+    block->nb_bytes_used  = offset + size;
+
+    return area;
+}
+
+// Return a memory area suitably aligned for any structure,
+// which can only be freed with the whole arena
+void* allocateFromArena (Arena* arena, const size_t size)
+{
+    return _allocateFromArena(arena, MAX(size, 1), ARENA_ALIGNMENT);
+}
+
+// Copy length bytes into the arena, and null-terminate them
+char* copyBytesToArena (Arena* arena, const char* bytes, const size_t length)
+{
+    // Strings do not need to be aligned: they are packed together
+    char* copy = _allocateFromArena(arena, length + 1, 1);
+    memcpy(copy, bytes, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+char* copyStringToArena (Arena* arena, const char* string)
+{
+    return copyBytesToArena(arena, string, strlen(string));
+}
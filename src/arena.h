@@ -0,0 +1,60 @@
+#ifndef __H_ARENA__
+#define __H_ARENA__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Structures representing an arena: memory is allocated by bumping a pointer
+// in large blocks, and all of it is freed at once (e.g. with the cache it belongs to)
+// The blocks of a shared arena are mapped in shared memory: processes forked afterwards
+// read (and write) the very same pages, instead of copies of them
+// On NUMA systems, the blocks of a shared arena can be replicated on each node: a process
+// then maps the replicas of its node at the addresses of the blocks (see useArenaReplicas())
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* previous;
+    size_t             size;       // Usable size (after the header)
+    size_t             nb_bytes_used;
+} ArenaBlock;
+
+// Copy of a shared block, whose pages are allocated on a given NUMA node
+typedef struct ArenaReplica {
+    ArenaBlock*          block;
+    void*                copy; // NULL once moved over the block
+    size_t               size;
+    int                  node;
+    struct ArenaReplica* next;
+} ArenaReplica;
+
+typedef struct Arena {
+    ArenaBlock* current_block;
+    size_t      block_size;
+    bool        is_shared;
+
+    ArenaReplica* replicas; // Shared arenas only (NULL if they are not replicated)
+
+    // Statistics
+    size_t nb_bytes_used;     // Sum of the allocated sizes (including alignment)
+    size_t nb_bytes_reserved; // Sum of the block sizes
+    int    nb_blocks;
+} Arena;
+
+// -----------------------------------------------------------------------------
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536 // bytes
+#define ARENA_ALIGNMENT          16    // bytes (enough for any structure)
+
+// -----------------------------------------------------------------------------
+
+Arena* createArena (const size_t block_size);
+Arena* createSharedArena (const size_t block_size);
+void deleteArena (Arena* arena);
+void protectArena (Arena* arena);
+void replicateArena (Arena* arena, const int nb_nodes);
+void useArenaReplicas (Arena* arena, const int node);
+
+void* allocateFromArena (Arena* arena, const size_t size);
+char* copyStringToArena (Arena* arena, const char* string);
+char* copyBytesToArena (Arena* arena, const char* bytes, const size_t length);
+
+#endif
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "toolbox.h"
+#include "arena.h"
+#include "bloom_filter.h"
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON BLOOM FILTER
+// -----------------------------------------------------------------------------
+
+BloomFilter* createBloomFilter (Arena* arena, const int max_nb_elements)
+{
+    BloomFilter* new_filter = allocateFromArena(arena, sizeof(BloomFilter));
+
+    uint64_t nb_bits = BLOOM_FILTER_MIN_NB_BITS;
+    while (nb_bits < (uint64_t) max_nb_elements * BLOOM_FILTER_BITS_PER_ELEMENT)
+        nb_bits *= 2;
+
+    new_filter->words = allocateFromArena(arena, nb_bits / 8);
+    memset(new_filter->words, 0, nb_bits / 8);
+
+    new_filter->nb_bits_mask = nb_bits - 1;
+    new_filter->nb_probes    = BLOOM_FILTER_NB_PROBES;
+
+    return new_filter;
+}
+
+// -----------------------------------------------------------------------------
+// ELEMENTS
+// -----------------------------------------------------------------------------
+
+// The bits of an element are derived from two halves of its hash (double hashing)
+// The second half is odd, so that the probes never repeat over a power-of-two number of bits
+
+void addToBloomFilter (BloomFilter* filter, const uint64_t hash)
+{
+    uint64_t bit   = hash >> 32;
+    uint64_t delta = (hash & 0xFFFFFFFF) | 1;
+
+    for (int i = 0; i < filter->nb_probes; i++)
+    {
+        uint64_t bit_index = bit & filter->nb_bits_mask;
+        filter->words[bit_index / 64] |= (uint64_t) 1 << (bit_index % 64);
+
+        bit += delta;
+    }
+}
+
+// Return false if the element has never been added, and true if it may have been
+bool bloomFilterMayContain (const BloomFilter* filter, const uint64_t hash)
+{
+    uint64_t bit   = hash >> 32;
+    uint64_t delta = (hash & 0xFFFFFFFF) | 1;
+
+    for (int i = 0; i < filter->nb_probes; i++)
+    {
+        uint64_t bit_index = bit & filter->nb_bits_mask;
+        if ((filter->words[bit_index / 64] & ((uint64_t) 1 << (bit_index % 64))) == 0)
+            return false;
+
+        bit += delta;
+    }
+
+    return true;
+}
@@ -0,0 +1,31 @@
+#ifndef __H_BLOOM_FILTER__
+#define __H_BLOOM_FILTER__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "arena.h"
+
+// Structure representing a Bloom filter over 64-bit hashes (of e.g. paths):
+// it tells for sure when an element has never been added, using a few bits per element
+// It is allocated in an arena, and thus freed with it
+
+typedef struct BloomFilter {
+    uint64_t* words;
+    uint64_t  nb_bits_mask; // Number of bits - 1 (it is a power of two)
+    int       nb_probes;
+} BloomFilter;
+
+// -----------------------------------------------------------------------------
+
+// About 1% of false positives with 10 bits per element and 7 probes
+#define BLOOM_FILTER_BITS_PER_ELEMENT 10
+#define BLOOM_FILTER_NB_PROBES        7
+#define BLOOM_FILTER_MIN_NB_BITS      512
+
+// -----------------------------------------------------------------------------
+
+BloomFilter* createBloomFilter (Arena* arena, const int max_nb_elements);
+void addToBloomFilter (BloomFilter* filter, const uint64_t hash);
+bool bloomFilterMayContain (const BloomFilter* filter, const uint64_t hash);
+
+#endif
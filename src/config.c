@@ -0,0 +1,539 @@
+// Macro definition required for using getline()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include "toolbox.h"
+#include "socket_options.h"
+#include "server.h"
+#include "config.h"
+
+// Offset of a parameter in ServParameters
+#define FIELD(name) offsetof(ServParameters, name)
+
+// All the parameters of the server, with the options of the command line listed first
+static const ConfigParameter _parameters[] = {
+    // Name, short name, type, offset, min. and max. values, reloadable, description
+    { "port", 'p', CONFIG_INT, FIELD(port),
+      1, 65535, false, "TCP port of the listening socket (if no listener is given)" },
+    { "lazy", 'l', CONFIG_BOOL, FIELD(lazy_loading),
+      0, 1, false, "Load the contents of the files on first request only" },
+    { "workers", 'w', CONFIG_INT, FIELD(nb_workers),
+      0, INT_MAX, false, "Number of workers sharing the cache (prefork mode if > 0)" },
+    { "affinity", 'a', CONFIG_BOOL, FIELD(cpu_affinity),
+      0, 1, false, "Pin the workers to CPUs, and steer the clients to them" },
+    { "numa", 'n', CONFIG_BOOL, FIELD(numa_replication),
+      0, 1, false, "Copy the cache on each NUMA node" },
+    { "rate-limit", 'r', CONFIG_INT, FIELD(rate_limit_requests),
+      0, INT_MAX, true, "Requests per second of each client address (0: no limit)" },
+    { "socket-options", 's', CONFIG_SOCKET_OPTIONS, FIELD(socket_options),
+      0, 0, true, "TCP options of the listening sockets (see socket_options.h)" },
+    { "zerocopy", 'z', CONFIG_SIZE, FIELD(zerocopy_min_size),
+      0, CONFIG_NO_MAX_VALUE, true, "Minimum size of the cached bodies sent without copy (0: never)" },
+
+    { "listen", CONFIG_NO_SHORT_NAME, CONFIG_STRING, FIELD(listeners),
+      0, 0, false, "Listening sockets, e.g. \"tcp4:80 tcp6:8080 unix:/run/ws.sock\" (see listener.h)" },
+    { "root", CONFIG_NO_SHORT_NAME, CONFIG_STRING, FIELD(root_data_directory),
+      0, 0, false, "Directory of the served files (of the default site)" },
+    { "virtual-hosts", CONFIG_NO_SHORT_NAME, CONFIG_STRING, FIELD(virtual_hosts),
+      0, 0, false, "Sites by Host, e.g. \"a.com,www.a.com=./a:2 b.org=./b\" (see virtual_hosts.h)" },
+    { "queue-length", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(queue_max_length),
+      1, INT_MAX, false, "Connections waiting to be accepted (by default)" },
+    { "max-clients", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(max_nb_clients),
+      1, INT_MAX, true, "Clients connected at once (per worker)" },
+    { "request-buffer-size", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(request_buffer_size),
+      256, INT_MAX, false, "Size of the request buffer of each client (bytes)" },
+    { "header-buffer-size", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(answer_header_buffer_size),
+      HTTP_ANSWER_HEADER_MIN_BUFFER_SIZE, INT_MAX, false, "Size of the answer header buffer of each client (bytes)" },
+    { "cache-size", CONFIG_NO_SHORT_NAME, CONFIG_SIZE, FIELD(cache_max_size),
+      0, CONFIG_NO_MAX_VALUE, false, "Total size of the cached contents, shared by the sites (bytes)" },
+    { "cache-max-file-size", CONFIG_NO_SHORT_NAME, CONFIG_SIZE, FIELD(cache_max_file_size),
+      0, CONFIG_NO_MAX_VALUE, false, "Larger files are never cached (bytes, 0: no limit)" },
+    { "fd-cache-size", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(fd_cache_max_nb_entries),
+      1, INT_MAX, false, "Uncached files kept open at once" },
+    { "io-threads", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(nb_io_threads),
+      1, INT_MAX, false, "Threads loading the contents (with lazy loading)" },
+    { "stream-compression", CONFIG_NO_SHORT_NAME, CONFIG_BOOL, FIELD(stream_compression),
+      0, 1, true, "Compress the uncached text files on the fly" },
+    { "compression-level", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(compression_level),
+      1, 9, true, "Level of the gzip compression (1: fastest, 9: smallest)" },
+    { "compressed-store-size", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(compressed_store_max_size),
+      0, INT_MAX, false, "Total size of the stored compressed outputs (bytes)" },
+    { "compressed-output-size", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(compressed_output_max_size),
+      0, INT_MAX, true, "Larger compressed outputs are not stored (bytes)" },
+    { "high-watermark-clients", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(high_watermark_nb_clients),
+      0, INT_MAX, true, "Clients above which the server is overloaded (0: 7/8 of max-clients)" },
+    { "low-watermark-clients", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(low_watermark_nb_clients),
+      0, INT_MAX, true, "Clients below which the server is not overloaded anymore (0: 3/4 of max-clients)" },
+    { "high-watermark-queue", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(high_watermark_queue_depth),
+      0, INT_MAX, true, "Requests in progress above which the server is overloaded (0: 1/2 of max-clients)" },
+    { "low-watermark-queue", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(low_watermark_queue_depth),
+      0, INT_MAX, true, "Requests in progress below which the server is not overloaded anymore (0: 1/4 of max-clients)" },
+    { "high-watermark-latency", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(high_watermark_latency),
+      0, INT_MAX, true, "Recent latency above which the server is overloaded (us)" },
+    { "low-watermark-latency", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(low_watermark_latency),
+      0, INT_MAX, true, "Recent latency below which the server is not overloaded anymore (us)" },
+    { "retry-after", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(retry_after),
+      0, INT_MAX, true, "Delay advised to the refused clients (s)" },
+    { "rate-limit-entries", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(rate_limit_nb_entries),
+      1, INT_MAX, false, "Client addresses remembered at once" },
+    { "rate-limit-connections", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(rate_limit_connections),
+      0, INT_MAX, true, "Connections of each client address at once (0: no limit)" },
+    { "rate-limit-burst", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(rate_limit_burst),
+      0, INT_MAX, true, "Requests of each client address in a burst (0: as many as per second)" },
+    { "idle-timeout", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(idle_timeout),
+      0, INT_MAX, true, "Kept-alive clients idle for longer are disconnected (s, 0: never)" },
+    { "request-timeout", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(request_timeout),
+      0, INT_MAX, true, "Clients sending a request header for longer are disconnected (s, 0: never)" },
+    { "send-timeout", CONFIG_NO_SHORT_NAME, CONFIG_INT, FIELD(send_timeout),
+      0, INT_MAX, true, "Clients not reading their answer for longer are disconnected (s, 0: never)" }
+};
+
+#define NB_PARAMETERS ((int) (sizeof(_parameters) / sizeof(_parameters[0])))
+
+// Command line of the server, read again when the configuration is reloaded
+static int          _nb_arguments = 0;
+static const char** _arguments    = NULL;
+
+// Set from a signal handler, and handled later in the main loop (or by the prefork master)
+static volatile sig_atomic_t _config_reload_is_requested = false;
+
+// -----------------------------------------------------------------------------
+// PARSING THE VALUES
+// -----------------------------------------------------------------------------
+
+// The command line is kept (it must not be freed), to be parsed again on each reload
+void setConfigCommandLine (const int argc, const char* argv[])
+{
+    _nb_arguments = argc;
+    _arguments    = argv;
+}
+
+// Internal version only!
+static const ConfigParameter* _findParameter (const char* name)
+{
+    for (int i = 0; i < NB_PARAMETERS; i++)
+        if (stringsAreEqual(_parameters[i].name, name))
+            return &_parameters[i];
+
+    return NULL;
+}
+
+// Internal version only!
+static const ConfigParameter* _findParameterByShortName (const char short_name)
+{
+    for (int i = 0; i < NB_PARAMETERS; i++)
+        if (_parameters[i].short_name == short_name)
+            return &_parameters[i];
+
+    return NULL;
+}
+
+// Internal version only!
+// A number may end with a K, M or G suffix (e.g. "64K" for 65536)
+static bool _parseNumber (const char* value, long long* number)
+{
+    char* end = NULL;
+
+    errno   = 0;
+    *number = strtoll(value, &end, 10);
+    if (end == value || errno == ERANGE)
+        return false;
+
+    long long multiplier = 1;
+    switch (toupper((unsigned char) *end))
+    {
+        case 'K': multiplier = 1024LL;               end++; break;
+        case 'M': multiplier = 1024LL * 1024;        end++; break;
+        case 'G': multiplier = 1024LL * 1024 * 1024; end++; break;
+        default:  break;
+    }
+
+    if (*end != '\0' || *number > CONFIG_NO_MAX_VALUE / multiplier)
+        return false;
+
+    *number *= multiplier;
+    return true;
+}
+
+// Internal version only!
+static bool _parseBoolean (const char* value, bool* boolean)
+{
+    if (stringsAreEqual(value, "true") || stringsAreEqual(value, "yes")
+    ||  stringsAreEqual(value, "on")   || stringsAreEqual(value, "1"))
+        *boolean = true;
+    else if (stringsAreEqual(value, "false") || stringsAreEqual(value, "no")
+         ||  stringsAreEqual(value, "off")   || stringsAreEqual(value, "0"))
+        *boolean = false;
+    else
+        return false;
+
+    return true;
+}
+
+// Set the value of the parameter with the given name (a NULL value is only valid for booleans,
+// which are then set to true)
+// Return false (and print an error) if the name or the value is invalid
+bool setConfigParameter (ServParameters* parameters, const char* name, const char* value)
+{
+    const ConfigParameter* parameter = _findParameter(name);
+    if (parameter == NULL)
+    {
+        printError("Unknown parameter: %s", name);
+        return false;
+    }
+
+    if (value == NULL && parameter->type != CONFIG_BOOL)
+    {
+        printError("Missing value for parameter %s", name);
+        return false;
+    }
+
+    void*     field  = (char*) parameters + parameter->offset;
+    long long number = 0;
+
+    switch (parameter->type)
+    {
+        case CONFIG_INT:
+        case CONFIG_SIZE:
+            if (! _parseNumber(value, &number)
+            ||  number < parameter->min_value || number > parameter->max_value)
+            {
+                printError("Invalid value for parameter %s: %s (expected from %lld to %lld)",
+                           name, value, parameter->min_value, parameter->max_value);
+                return false;
+            }
+
+            if (parameter->type == CONFIG_INT)
+                *((int*) field) = (int) number;
+            else
+                *((off_t*) field) = (off_t) number;
+            break;
+
+        case CONFIG_BOOL:
+            if (value == NULL)
+                *((bool*) field) = true;
+            else if (! _parseBoolean(value, (bool*) field))
+            {
+                printError("Invalid value for parameter %s: %s (expected true or false)",
+                           name, value);
+                return false;
+            }
+            break;
+
+        case CONFIG_STRING:
+            free(*((char**) field));
+            *((char**) field) = getFreshStringCopy(value);
+            break;
+
+        case CONFIG_SOCKET_OPTIONS:
+            if (! parseSocketOptions((SocketOptions*) field, value))
+                return false;
+            break;
+    }
+
+    return true;
+}
+
+// Internal version only!
+static void _formatParameterValue (const ConfigParameter* parameter,
+                                   const ServParameters* parameters, char* buffer)
+{
+    const void* field = (const char*) parameters + parameter->offset;
+
+    switch (parameter->type)
+    {
+        case CONFIG_INT:
+            snprintf(buffer, CONFIG_MAX_VALUE_LENGTH, "%d", *((const int*) field));
+            break;
+
+        case CONFIG_SIZE:
+            snprintf(buffer, CONFIG_MAX_VALUE_LENGTH, "%lld", (long long) *((const off_t*) field));
+            break;
+
+        case CONFIG_BOOL:
+            snprintf(buffer, CONFIG_MAX_VALUE_LENGTH, "%s", *((const bool*) field) ? "true" : "false");
+            break;
+
+        case CONFIG_STRING:
+            snprintf(buffer, CONFIG_MAX_VALUE_LENGTH, "%s", *((char* const*) field));
+            break;
+
+        case CONFIG_SOCKET_OPTIONS:
+            formatSocketOptions((const SocketOptions*) field, buffer, CONFIG_MAX_VALUE_LENGTH);
+            break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CONFIGURATION FILE AND COMMAND LINE
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static char* _trimString (char* string)
+{
+    string = consumeLeadingStringWhiteSpace(string);
+
+    int length = strlen(string);
+    while (length > 0 && isspace((unsigned char) string[length - 1]))
+        length--;
+    string[length] = '\0';
+
+    return string;
+}
+
+// Each line of the file sets a parameter ("name = value"), and everything after a '#' is ignored
+// Return false if the file cannot be read, or if a line is invalid (the following ones are
+// then ignored)
+bool loadConfigFile (ServParameters* parameters, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        handleError("fopen() failed in loadConfigFile()");
+        printError("The configuration file %s cannot be read!", path);
+        return false;
+    }
+
+    char*  line        = NULL;
+    size_t line_size   = 0;
+    int    line_number = 0;
+    bool   success     = true;
+
+    while (success && getline(&line, &line_size, file) >= 0)
+    {
+        line_number++;
+
+        char* comment = strchr(line, CONFIG_COMMENT_CHARACTER);
+        if (comment != NULL)
+            *comment = '\0';
+
+        char* name = _trimString(line);
+        if (*name == '\0')
+            continue;
+
+        char* value = strchr(name, '=');
+        if (value == NULL)
+            success = false;
+        else
+        {
+            *value = '\0';
+            success = setConfigParameter(parameters, _trimString(name), _trimString(value + 1));
+        }
+
+        if (! success)
+            printError("Invalid line %d in the configuration file %s!", line_number, path);
+    }
+
+    free(line);
+    fclose(file);
+
+    return success;
+}
+
+// Internal version only!
+// Return the path given with -c (or --config), or NULL if there is none
+static const char* _findConfigFilePath ()
+{
+    const char* path = NULL;
+
+    for (int i = 1; i < _nb_arguments; i++)
+    {
+        if ((stringsAreEqual(_arguments[i], "-c") || stringsAreEqual(_arguments[i], "--config"))
+        &&  i + 1 < _nb_arguments)
+            path = _arguments[++i];
+        else if (strncmp(_arguments[i], "--config=", 9) == 0)
+            path = _arguments[i] + 9;
+    }
+
+    return path;
+}
+
+// Internal version only!
+// Set the parameter of the option at the given position (e.g. "-w 4", "--workers 4",
+// "--workers=4", or "--lazy" for a boolean), and return the number of arguments it spans
+// (0 if it is invalid)
+static int _parseParameterOption (ServParameters* parameters, const int position)
+{
+    const char*            option    = _arguments[position];
+    const ConfigParameter* parameter = NULL;
+
+    char* name  = NULL;
+    char* value = NULL;
+
+    if (strncmp(option, "--", 2) == 0)
+    {
+        name  = getFreshStringCopy(option + 2);
+        value = strchr(name, '=');
+        if (value != NULL)
+        {
+            *value = '\0';
+            value++;
+        }
+
+        parameter = _findParameter(name);
+    }
+    else if (option[0] == '-' && option[1] != '\0' && option[2] == '\0')
+        parameter = _findParameterByShortName(option[1]);
+
+    int nb_arguments = 0;
+    if (parameter != NULL)
+    {
+        // The value of a non-boolean parameter may be the next argument
+        nb_arguments = 1;
+        if (value == NULL && parameter->type != CONFIG_BOOL && position + 1 < _nb_arguments)
+        {
+            value = (char*) _arguments[position + 1];
+            nb_arguments++;
+        }
+
+        if (! setConfigParameter(parameters, parameter->name, value))
+            nb_arguments = 0;
+    }
+    else
+        printError("Unknown option: %s", option);
+
+    free(name);
+    return nb_arguments;
+}
+
+// Set the parameters from the configuration file given with -c (if any), and then from
+// the command line (see setConfigCommandLine()), which also has a few options of its own:
+// -q (or --quiet) disables the debug printing, and -h (or --help) lists the parameters
+// Return false if one of them is invalid (the parameters are then partially set)
+bool loadConfiguration (ServParameters* parameters)
+{
+    const char* config_file_path = _findConfigFilePath();
+    if (config_file_path != NULL && ! loadConfigFile(parameters, config_file_path))
+        return false;
+
+    for (int i = 1; i < _nb_arguments; i++)
+    {
+        if (stringsAreEqual(_arguments[i], "-q") || stringsAreEqual(_arguments[i], "--quiet"))
+            setDebugPrinting(false);
+        else if (stringsAreEqual(_arguments[i], "-h") || stringsAreEqual(_arguments[i], "--help"))
+        {
+            printUsage(_arguments);
+            printConfigParameters();
+            exit(EXIT_SUCCESS);
+        }
+        else if (stringsAreEqual(_arguments[i], "-c") || stringsAreEqual(_arguments[i], "--config"))
+            i++;
+        else if (strncmp(_arguments[i], "--config=", 9) == 0)
+            continue;
+        else
+        {
+            int nb_arguments = _parseParameterOption(parameters, i);
+            if (nb_arguments == 0)
+                return false;
+
+            i += nb_arguments - 1;
+        }
+    }
+
+    return true;
+}
+
+// Load the configuration again (with the same command line), and only apply the new values
+// of the reloadable parameters: the other ones are left unchanged (with a note)
+// Return false if it cannot be loaded (the parameters are then all left unchanged)
+bool reloadConfiguration (ServParameters* parameters)
+{
+    ServParameters* new_parameters = createServParameters();
+    defaultInitServParameters(new_parameters);
+
+    if (! loadConfiguration(new_parameters))
+    {
+        deleteServParameters(new_parameters);
+        return false;
+    }
+
+    // The parameters are compared once adjusted, as the current ones
+    adjustServParameters(new_parameters);
+
+    for (int i = 0; i < NB_PARAMETERS; i++)
+    {
+        const ConfigParameter* parameter = &_parameters[i];
+
+        char current_value[CONFIG_MAX_VALUE_LENGTH];
+        char new_value[CONFIG_MAX_VALUE_LENGTH];
+        _formatParameterValue(parameter, parameters, current_value);
+        _formatParameterValue(parameter, new_parameters, new_value);
+
+        if (stringsAreEqual(current_value, new_value))
+            continue;
+
+        if (! parameter->is_reloadable)
+        {
+            printWarning("Note: %s cannot be changed without restarting (or upgrading) the server!",
+                         parameter->name);
+            continue;
+        }
+
+        // The values are copied as they are (none of the reloadable parameters is a string)
+        size_t field_size = parameter->type == CONFIG_INT  ? sizeof(int)
+                          : parameter->type == CONFIG_SIZE ? sizeof(off_t)
+                          : parameter->type == CONFIG_BOOL ? sizeof(bool)
+                          :                                  sizeof(SocketOptions);
+        memcpy((char*) parameters + parameter->offset,
+               (char*) new_parameters + parameter->offset, field_size);
+
+        printf("%s: %s -> %s\n", parameter->name, current_value, new_value);
+    }
+
+    deleteServParameters(new_parameters);
+    return true;
+}
+
+// List all the parameters, with their default values
+void printConfigParameters ()
+{
+    ServParameters* default_parameters = createServParameters();
+    defaultInitServParameters(default_parameters);
+
+    printf("\nParameters (\"name = value\" in the configuration file, \"--name <value>\" "
+           "on the command line);\nthe ones marked with * are reloaded on SIGHUP:\n");
+
+    for (int i = 0; i < NB_PARAMETERS; i++)
+    {
+        const ConfigParameter* parameter = &_parameters[i];
+
+        char default_value[CONFIG_MAX_VALUE_LENGTH];
+        _formatParameterValue(parameter, default_parameters, default_value);
+
+        char short_name[8] = "";
+        if (parameter->short_name != CONFIG_NO_SHORT_NAME)
+            snprintf(short_name, sizeof(short_name), "-%c,", parameter->short_name);
+
+        printf("  %-4s --%-23s %c %s (default: %s)\n", short_name, parameter->name,
+               parameter->is_reloadable ? '*' : ' ', parameter->description, default_value);
+    }
+
+    deleteServParameters(default_parameters);
+}
+
+// -----------------------------------------------------------------------------
+// RELOADING
+// -----------------------------------------------------------------------------
+
+// Async-signal-safe: only remember that the configuration must be reloaded (e.g. on SIGHUP)
+void requestConfigReload ()
+{
+    _config_reload_is_requested = true;
+}
+
+// Return true (only once) if a reload has been requested
+bool takeConfigReloadRequest ()
+{
+    if (! _config_reload_is_requested)
+        return false;
+
+    _config_reload_is_requested = false;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef __H_CONFIG__
+#define __H_CONFIG__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "server.h"
+
+// Parameters of the server (see ServParameters), set from a configuration file and from the
+// command line (which overrides the file): each parameter has the same name in both,
+// e.g. "workers = 4" in the file, and "--workers 4" (or "--workers=4") on the command line
+// The reloadable parameters are applied again on SIGHUP (see reloadConfiguration()),
+// while the other ones require a restart (or an upgrade, see upgrade.h)
+
+typedef enum ConfigType {
+    CONFIG_INT,           // int (with an optional K, M or G suffix)
+    CONFIG_SIZE,          // off_t (with an optional K, M or G suffix)
+    CONFIG_BOOL,          // true/false, yes/no, on/off or 1/0 (true if none, on the command line)
+    CONFIG_STRING,        // char* (a copy, freed with the parameters)
+    CONFIG_SOCKET_OPTIONS // SocketOptions (see parseSocketOptions())
+} ConfigType;
+
+typedef struct ConfigParameter {
+    const char* name;
+    char        short_name; // Single-letter option of the command line (or CONFIG_NO_SHORT_NAME)
+    ConfigType  type;
+    size_t      offset;     // In ServParameters
+    long long   min_value;  // Numeric parameters only
+    long long   max_value;
+    bool        is_reloadable;
+    const char* description;
+} ConfigParameter;
+
+// -----------------------------------------------------------------------------
+
+#define CONFIG_NO_SHORT_NAME     '\0'
+#define CONFIG_NO_MAX_VALUE      0x7FFFFFFFFFFFFFFFLL
+#define CONFIG_MAX_VALUE_LENGTH  256 // characters (of a formatted value)
+#define CONFIG_COMMENT_CHARACTER '#'
+
+// -----------------------------------------------------------------------------
+
+void setConfigCommandLine (const int argc, const char* argv[]);
+bool setConfigParameter (ServParameters* parameters, const char* name, const char* value);
+bool loadConfigFile (ServParameters* parameters, const char* path);
+bool loadConfiguration (ServParameters* parameters);
+bool reloadConfiguration (ServParameters* parameters);
+void printConfigParameters ();
+
+void requestConfigReload ();
+bool takeConfigReloadRequest ();
+
+#endif
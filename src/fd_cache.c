@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "toolbox.h"
+#include "file_cache.h"
+#include "fd_cache.h"
+
+#define NO_ENTRY_FD -1
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON FD CACHE
+// -----------------------------------------------------------------------------
+
+FdCache* createFdCache (const int max_nb_entries)
+{
+    FdCache* new_cache = malloc(sizeof(FdCache));
+    if (new_cache == NULL)
+        handleErrorAndExit("malloc() failed in createFdCache()");
+
+    new_cache->max_nb_entries = max_nb_entries;
+    new_cache->entries        = calloc(MAX(max_nb_entries, 1), sizeof(FdCacheEntry));
+    if (new_cache->entries == NULL)
+        handleErrorAndExit("calloc() failed in createFdCache()");
+
+    // There are about twice as many buckets as entries
+    new_cache->nb_buckets = 1;
+    while (new_cache->nb_buckets < 2 * max_nb_entries)
+        new_cache->nb_buckets *= 2;
+
+    new_cache->buckets = calloc(new_cache->nb_buckets, sizeof(FdCacheEntry*));
+    if (new_cache->buckets == NULL)
+        handleErrorAndExit("calloc() failed in createFdCache()");
+
+    // All the entries are initially free
+    new_cache->free_entries = NULL;
+    for (int i = max_nb_entries - 1; i >= 0; i--)
+    {
+        new_cache->entries[i].fd             = NO_ENTRY_FD;
+        new_cache->entries[i].next_in_bucket = new_cache->free_entries;
+        new_cache->free_entries              = &new_cache->entries[i];
+    }
+
+    new_cache->least_recently_used = NULL;
+    new_cache->most_recently_used  = NULL;
+
+    return new_cache;
+}
+
+// Warning: the file descriptors still in use are closed as well!
+void deleteFdCache (FdCache* cache)
+{
+    for (int i = 0; i < cache->max_nb_entries; i++)
+        if (cache->entries[i].fd != NO_ENTRY_FD)
+            close(cache->entries[i].fd);
+
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+// -----------------------------------------------------------------------------
+// INTERNAL LISTS HANDLING
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static FdCacheEntry** _getBucket (const FdCache* cache, const File* file)
+{
+    uint64_t hash = (uint64_t) (uintptr_t) file;
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B97F4A7C15ULL;
+
+    return &cache->buckets[(hash >> 32) & (cache->nb_buckets - 1)];
+}
+
+// Internal version only!
+static void _removeFromBucket (FdCache* cache, FdCacheEntry* entry)
+{
+    FdCacheEntry** current_entry = _getBucket(cache, entry->file);
+    while (*current_entry != entry)
+        current_entry = &(*current_entry)->next_in_bucket;
+
+    *current_entry = entry->next_in_bucket;
+}
+
+// Internal version only!
+static void _removeFromUnusedList (FdCache* cache, FdCacheEntry* entry)
+{
+    if (entry->previous_unused != NULL)
+        entry->previous_unused->next_unused = entry->next_unused;
+    else
+        cache->least_recently_used = entry->next_unused;
+
+    if (entry->next_unused != NULL)
+        entry->next_unused->previous_unused = entry->previous_unused;
+    else
+        cache->most_recently_used = entry->previous_unused;
+}
+
+// Internal version only!
+static void _appendToUnusedList (FdCache* cache, FdCacheEntry* entry)
+{
+    entry->previous_unused = cache->most_recently_used;
+    entry->next_unused     = NULL;
+
+    if (cache->most_recently_used != NULL)
+        cache->most_recently_used->next_unused = entry;
+    else
+        cache->least_recently_used = entry;
+
+    cache->most_recently_used = entry;
+}
+
+// Internal version only!
+// Close the file descriptor of an unused entry, and make it free (or delete it if it was allocated)
+static void _freeEntry (FdCache* cache, FdCacheEntry* entry)
+{
+    int return_value = close(entry->fd);
+    if (return_value < 0)
+        handleError("close() failed in _freeEntry()");
+
+    entry->fd   = NO_ENTRY_FD;
+    entry->file = NULL;
+
+    if (entry < cache->entries || entry >= cache->entries + cache->max_nb_entries)
+    {
+        free(entry);
+        return;
+    }
+
+    entry->next_in_bucket = cache->free_entries;
+    cache->free_entries   = entry;
+}
+
+// -----------------------------------------------------------------------------
+// FILE DESCRIPTORS HANDLING
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return true if the file at the path of the entry is still the one which has been opened
+// The path is only checked once per revalidation delay
+static bool _entryIsValid (FdCacheEntry* entry)
+{
+    time_t current_time = time(NULL);
+    if (current_time - entry->last_check_time < FD_CACHE_REVALIDATION_DELAY)
+        return true;
+
+    entry->last_check_time = current_time;
+
+    struct stat file_info;
+    if (stat(entry->file->path, &file_info) < 0)
+        return false;
+
+    return file_info.st_dev   == entry->device
+        && file_info.st_ino   == entry->inode
+        && file_info.st_size  == entry->size
+        && file_info.st_mtime == entry->modification_time;
+}
+
+// Internal version only!
+// Return an entry which can be filled: a free one, the least recently used one,
+// or an allocated (and thus not cached) one if all the cached ones are in use
+static FdCacheEntry* _getAvailableEntry (FdCache* cache)
+{
+    FdCacheEntry* entry = cache->free_entries;
+    if (entry != NULL)
+    {
+        cache->free_entries = entry->next_in_bucket;
+        entry->is_cached    = true;
+        return entry;
+    }
+
+    entry = cache->least_recently_used;
+    if (entry != NULL)
+    {
+        _removeFromUnusedList(cache, entry);
+        _removeFromBucket(cache, entry);
+
+        int return_value = close(entry->fd);
+        if (return_value < 0)
+            handleError("close() failed in _getAvailableEntry()");
+
+        entry->is_cached = true;
+        return entry;
+    }
+
+    entry = malloc(sizeof(FdCacheEntry));
+    if (entry == NULL)
+        handleErrorAndExit("malloc() failed in _getAvailableEntry()");
+
+    entry->is_cached = false;
+    return entry;
+}
+
+// Return an entry whose file descriptor can be used to read the given file
+// (which is opened only if it is not already in the cache, or if it has changed),
+// or NULL if the file cannot be opened
+// The entry must be released once the file descriptor is not used anymore
+FdCacheEntry* acquireFileDescriptor (FdCache* cache, File* file)
+{
+    FdCacheEntry** bucket = _getBucket(cache, file);
+
+    FdCacheEntry* entry = *bucket;
+    while (entry != NULL && entry->file != file)
+        entry = entry->next_in_bucket;
+
+    // If the file has changed, the entry is not cached anymore
+    // (it is freed now if it is not used, or when it is released otherwise)
+    if (entry != NULL && ! _entryIsValid(entry))
+    {
+        _removeFromBucket(cache, entry);
+        entry->is_cached = false;
+
+        if (entry->nb_users == 0)
+        {
+            _removeFromUnusedList(cache, entry);
+            _freeEntry(cache, entry);
+        }
+
+        entry = NULL;
+    }
+
+    if (entry != NULL)
+    {
+        if (entry->nb_users == 0)
+            _removeFromUnusedList(cache, entry);
+
+        entry->nb_users++;
+        return entry;
+    }
+
+    // Otherwise, open the file and remember what has been opened
+    int file_fd = open(file->path, O_RDONLY);
+    if (file_fd < 0)
+    {
+        handleError("open() failed in acquireFileDescriptor()");
+        return NULL;
+    }
+
+    struct stat file_info;
+    if (fstat(file_fd, &file_info) < 0)
+    {
+        handleError("fstat() failed in acquireFileDescriptor()");
+        close(file_fd);
+        return NULL;
+    }
+
+    entry = _getAvailableEntry(cache);
+
+    entry->file              = file;
+    entry->fd                = file_fd;
+    entry->nb_users          = 1;
+    entry->device            = file_info.st_dev;
+    entry->inode             = file_info.st_ino;
+    entry->size              = file_info.st_size;
+    entry->modification_time = file_info.st_mtime;
+    entry->last_check_time   = time(NULL);
+
+    if (entry->is_cached)
+    {
+        entry->next_in_bucket = *bucket;
+        *bucket               = entry;
+    }
+
+    return entry;
+}
+
+// Once unused, a cached entry keeps its file descriptor open, until it is evicted
+void releaseFileDescriptor (FdCache* cache, FdCacheEntry* entry)
+{
+    entry->nb_users--;
+    if (entry->nb_users > 0)
+        return;
+
+    if (entry->is_cached)
+        _appendToUnusedList(cache, entry);
+    else
+        _freeEntry(cache, entry);
+}
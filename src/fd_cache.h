@@ -0,0 +1,59 @@
+#ifndef __H_FD_CACHE__
+#define __H_FD_CACHE__
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "file_cache.h"
+
+// Structures representing a cache of open file descriptors,
+// shared by all the answers sending (uncached) files with sendfile()
+
+typedef struct FdCacheEntry {
+    File* file;     // Key
+    int   fd;
+    int   nb_users; // Number of answers currently using the file descriptor
+
+    // An entry is not cached when the cache was full, or when the file has changed:
+    // its file descriptor is then closed as soon as it is not used anymore
+    bool  is_cached;
+
+    // Identity of the opened file, to detect when it is replaced or modified
+    dev_t  device;
+    ino_t  inode;
+    off_t  size;
+    time_t modification_time;
+    time_t last_check_time;
+
+    struct FdCacheEntry* next_in_bucket;
+
+    // Unused entries form a LRU list (from the least to the most recently used one)
+    struct FdCacheEntry* previous_unused;
+    struct FdCacheEntry* next_unused;
+} FdCacheEntry;
+
+typedef struct FdCache {
+    FdCacheEntry*  entries;
+    int            max_nb_entries;
+    FdCacheEntry*  free_entries; // Linked with next_in_bucket
+
+    FdCacheEntry** buckets;
+    int            nb_buckets;  // Power of two
+
+    FdCacheEntry*  least_recently_used;
+    FdCacheEntry*  most_recently_used;
+} FdCache;
+
+// -----------------------------------------------------------------------------
+
+#define FD_CACHE_REVALIDATION_DELAY 1 // s
+
+// -----------------------------------------------------------------------------
+
+FdCache* createFdCache (const int max_nb_entries);
+void deleteFdCache (FdCache* cache);
+
+FdCacheEntry* acquireFileDescriptor (FdCache* cache, File* file);
+void releaseFileDescriptor (FdCache* cache, FdCacheEntry* entry);
+
+#endif
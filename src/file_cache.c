@@ -9,53 +9,99 @@
 #include <fcntl.h>
 #include "toolbox.h"
 #include "system.h"
+#include "arena.h"
+#include "path_index.h"
+#include "bloom_filter.h"
 #include "file_cache.h"
 
+// -----------------------------------------------------------------------------
+
+// Parameters of the (32-bit FNV-1a) hash function of the names
+#define NAME_HASH_OFFSET_BASIS 2166136261u
+#define NAME_HASH_PRIME        16777619u
+
+// Parameters of the (64-bit FNV-1a) hash function of the paths
+#define PATH_HASH_OFFSET_BASIS 14695981039346656037ull
+#define PATH_HASH_PRIME        1099511628211ull
+
+// If enabled, the contents are loaded on demand (the cache space is reserved when it is built)
+static bool _lazy_loading_is_enabled = false;
+
+// If enabled, the caches are built in shared memory (e.g. before forking workers)
+static bool _shared_memory_is_enabled = false;
+
+// Level of the gzip compression of the cached contents
+static int _compression_level = DEFAULT_GZIP_LEVEL;
+
+// Larger files are never cached (NO_MAX_FILE_SIZE: only the size of the cache is checked)
+static off_t _max_file_size = NO_MAX_FILE_SIZE;
+
 // -----------------------------------------------------------------------------
 // BASIC OPERATIONS ON FILES AND FOLDERS
 // -----------------------------------------------------------------------------
 
-File* createFile ()
+// Hash of a file or folder name, compared before the names themselves
+uint32_t computeNameHash (const char* name, const int name_length)
+{
+    uint32_t hash = NAME_HASH_OFFSET_BASIS;
+    for (int i = 0; i < name_length; i++)
+    {
+        hash ^= (unsigned char) name[i];
+        hash *= NAME_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+// The file is added to the list of the files of the cache
+File* createFile (FileCache* cache)
 {
-    File* new_file = malloc(sizeof(File));
-    if (new_file == NULL)
-        handleErrorAndExit("malloc() failed in createFile()");
+    File* new_file = allocateFromArena(cache->arena, sizeof(File));
+
+    new_file->next_in_cache = cache->files;
+    cache->files = new_file;
 
     return new_file;
 }
 
 void initFile (File* file)
 {
-    file->name    = NULL;
-    file->path    = NULL;
-    file->state   = STATE_NOT_LOADED;
-    file->content = NULL;
-    file->size    = 0;
+    file->name_hash   = 0;
+    file->name_length = 0;
+    file->name        = NULL;
+    file->path        = NULL;
+    file->state       = STATE_NOT_LOADED;
+    file->content     = NULL;
+    file->size        = 0;
 
     file->must_unload = false;
 
-    file->type = malloc(MAX_FILE_TYPE_LENGTH * sizeof(char));
-    if (file->type == NULL)
-        handleErrorAndExit("malloc() failed in initFile()");
-
+    file->type     = NULL;
     file->encoding = ENCODING_NONE;
+
+    file->etag              = NULL;
+    file->last_modified     = NULL;
+    file->modification_time = 0;
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+        file->sidecars[i] = NULL;
+    file->is_negotiated = false;
 }
 
-File* createAndInitFile ()
+File* createAndInitFile (FileCache* cache)
 {
-    File* new_file = createFile();
+    File* new_file = createFile(cache);
     initFile(new_file);
 
     return new_file;
 }
 
-void deleteFile (File* file)
+void setFileNameAndPath (FileCache* cache, File* file, const char* name, const char* path)
 {
-    free(file->name);
-    free(file->content);
-    free(file->type);
-
-    free(file);
+    file->name_length = strlen(name);
+    file->name_hash   = computeNameHash(name, file->name_length);
+    file->name        = copyBytesToArena(cache->arena, name, file->name_length);
+    file->path        = copyStringToArena(cache->arena, path);
 }
 
 char* getFileStateAsString (const FileState state)
@@ -68,12 +114,50 @@ char* getFileStateAsString (const FileState state)
             return "LOADED_RAW";
         case STATE_LOADED_COMPRESSED:
             return "LOADED_COMPRESSED";
+        case STATE_TO_LOAD:
+            return "TO_LOAD";
+        case STATE_LOADING:
+            return "LOADING";
 
         default:
             return "UNKNOWN STATE";
     }
 }
 
+// Name of the encoding, as a HTTP content coding
+char* getFileEncodingName (const FileEncoding encoding)
+{
+    switch (encoding)
+    {
+        case ENCODING_GZIP:
+            return "gzip";
+        case ENCODING_BROTLI:
+            return "br";
+        case ENCODING_ZSTD:
+            return "zstd";
+
+        default:
+            return "identity";
+    }
+}
+
+// Extension of the precompressed versions of files with the given encoding
+char* getFileEncodingExtension (const FileEncoding encoding)
+{
+    switch (encoding)
+    {
+        case ENCODING_GZIP:
+            return ".gz";
+        case ENCODING_BROTLI:
+            return ".br";
+        case ENCODING_ZSTD:
+            return ".zst";
+
+        default:
+            return "";
+    }
+}
+
 void printFile (const File* file, const int indent)
 {
     char indent_space[indent + 1];
@@ -81,16 +165,20 @@ void printFile (const File* file, const int indent)
         indent_space[i] = ' ';
     indent_space[indent] = '\0';
 
-    // Use the right unit (b, kB, MB) for a cleaner file size
+    // Use the right unit (b, kB, MB, GB) for a cleaner file size
     float printed_file_size = file->size > 1000
                             ? file->size > 1000000
-                              ? (float) file->size / 1000000
+                              ? file->size > 1000000000
+                                ? (float) file->size / 1000000000
+                                : (float) file->size / 1000000
                               : (float) file->size / 1000
                             : (float) file->size;
 
     char* file_size_unit = file->size > 1000
                          ? file->size > 1000000
-                           ? "MB"
+                           ? file->size > 1000000000
+                             ? "GB"
+                             : "MB"
                            : "kB"
                          : "b";
 
@@ -99,60 +187,43 @@ void printFile (const File* file, const int indent)
            COLOR_BOLD, COLOR_RESET, getFileStateAsString(file->state),
            COLOR_BOLD, COLOR_RESET, printed_file_size, file_size_unit,
            COLOR_BOLD, COLOR_RESET, file->type);
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+        if (file->sidecars[i] != NULL)
+            printFile(file->sidecars[i], indent + 4);
 }
 
 // -----------------------------------------------------------------------------
 
-Folder* createFolder ()
+Folder* createFolder (FileCache* cache)
 {
-    Folder* new_folder = malloc(sizeof(Folder));
-    if (new_folder == NULL)
-        handleErrorAndExit("malloc() failed in createFolder()");
-
-    return new_folder;
+    return allocateFromArena(cache->arena, sizeof(Folder));
 }
 
-void initEmptyFolder (Folder* folder, char* name,
+void initEmptyFolder (FileCache* cache, Folder* folder, const char* name,
                       const int max_nb_files, const int max_nb_subfolders)
 {
-    folder->name = name;
-    folder->size = 0;
+    folder->name_length = strlen(name);
+    folder->name_hash   = computeNameHash(name, folder->name_length);
+    folder->name        = copyBytesToArena(cache->arena, name, folder->name_length);
+    folder->size        = 0;
 
-    folder->files = malloc(max_nb_files * sizeof(File*));
-    if (folder->files == NULL)
-        handleErrorAndExit("malloc() failed in initEmptyFolder()");
+    folder->files    = allocateFromArena(cache->arena, max_nb_files * sizeof(File*));
     folder->nb_files = 0;
 
-    folder->subfolders = malloc(max_nb_subfolders * sizeof(Folder*));
-    if (folder->subfolders == NULL)
-        handleErrorAndExit("malloc() failed in initEmptyFolder()");
+    folder->subfolders    = allocateFromArena(cache->arena, max_nb_subfolders * sizeof(Folder*));
     folder->nb_subfolders = 0;
 }
 
-Folder* createEmptyFolder (char* name, const int max_nb_files, const int max_nb_subfolders)
+Folder* createEmptyFolder (FileCache* cache, const char* name,
+                           const int max_nb_files, const int max_nb_subfolders)
 {
-    Folder* new_folder = createFolder();
-    initEmptyFolder(new_folder, name, max_nb_files, max_nb_subfolders);
+    Folder* new_folder = createFolder(cache);
+    initEmptyFolder(cache, new_folder, name, max_nb_files, max_nb_subfolders);
 
     return new_folder;
 }
 
-// Warning: RECURSIVELY delete subfolders and files therein!
-void recursivelyDeleteFolder (Folder* folder)
-{
-    free(folder->name);
-    
-    for (int i = 0; i < folder->nb_files; i++)
-        deleteFile(folder->files[i]);
-    free(folder->files);
-
-    for (int i = 0; i < folder->nb_subfolders; i++)
-        recursivelyDeleteFolder(folder->subfolders[i]);
-    free(folder->subfolders);
-
-    free(folder);
-}
-
 void recursivelyPrintFolder (const Folder* folder, const int indent)
 {
     char indent_space[indent + 1];
@@ -174,14 +245,14 @@ void recursivelyPrintFolder (const Folder* folder, const int indent)
 
 // Assumes the files array has free space at nb_files index
 // Returns the new size of the folder
-int addFileToFolder (Folder* folder, File* file)
+off_t addFileToFolder (Folder* folder, File* file)
 {
     // Add the file to the folder
     folder->files[folder->nb_files] = file;
     (folder->nb_files)++;
 
     // Recompute the folder size, and returns it
-    int new_size = folder->size + file->size;
+    off_t new_size = folder->size + file->size;
     folder->size = new_size;
 
     return new_size;
@@ -189,13 +260,13 @@ int addFileToFolder (Folder* folder, File* file)
 
 // Assumes the subfolders array has free space at nb_subfolders index
 // Returns the new size of the folder
-int addSubfolderToFolder (Folder* folder, Folder* subfolder)
+off_t addSubfolderToFolder (Folder* folder, Folder* subfolder)
 {
     folder->subfolders[folder->nb_subfolders] = subfolder;
     (folder->nb_subfolders)++;
 
     // Recompute the folder size, and returns it
-    int new_size = folder->size + subfolder->size;
+    off_t new_size = folder->size + subfolder->size;
     folder->size = new_size;
 
     return new_size;
@@ -214,14 +285,34 @@ FileCache* createFileCache ()
     return new_cache;
 }
 
-void initEmptyFileCache (FileCache* cache, const int max_size)
+void initEmptyFileCache (FileCache* cache, const off_t max_size)
 {
     cache->root     = NULL;
     cache->size     = 0;
     cache->max_size = max_size;
+
+    cache->is_shared  = _shared_memory_is_enabled;
+    cache->arena      = cache->is_shared ? createSharedArena(ARENA_DEFAULT_BLOCK_SIZE)
+                                         : createArena(ARENA_DEFAULT_BLOCK_SIZE);
+    cache->path_index = createPathIndex(cache->arena);
+
+    // The negative cache is written by the lookups: it is never shared
+    cache->path_filter    = createBloomFilter(cache->arena, 0);
+    cache->negative_cache = malloc(NEGATIVE_CACHE_NB_ENTRIES * sizeof(NegativeCacheEntry));
+    if (cache->negative_cache == NULL)
+        handleErrorAndExit("malloc() failed in initEmptyFileCache()");
+
+    clearNegativeCache(cache);
+    cache->files      = NULL;
+    cache->file_types = NULL;
+
+    cache->retired_contents = NULL;
+
+    cache->nb_pins      = 0;
+    cache->pin_end_time = 0;
 }
 
-FileCache* createEmptyFileCache (const int max_size)
+FileCache* createEmptyFileCache (const off_t max_size)
 {
     FileCache* new_cache = createFileCache();
     initEmptyFileCache(new_cache, max_size);
@@ -229,14 +320,54 @@ FileCache* createEmptyFileCache (const int max_size)
     return new_cache;
 }
 
-// Warning: all the file and folder structures of root folder are deleted as well!
+// Warning: all the file and folder structures of the cache are deleted as well!
+// Only the file contents are freed one by one: the metadata is freed with the arena
+// (as well as the contents of a shared cache)
 void deleteFileCache (FileCache* cache)
 {
-    if (cache->root != NULL)
-        recursivelyDeleteFolder(cache->root);
+    if (! cache->is_shared)
+        for (File* file = cache->files; file != NULL; file = file->next_in_cache)
+            if (file->state == STATE_LOADED_RAW || file->state == STATE_LOADED_COMPRESSED)
+                free(file->content);
+
+    RetiredContent* retired = cache->retired_contents;
+    while (retired != NULL)
+    {
+        RetiredContent* next_retired = retired->next;
+        free(retired->content);
+        free(retired);
+        retired = next_retired;
+    }
+
+    free(cache->negative_cache);
+    deleteArena(cache->arena);
     free(cache);
 }
 
+// A cache is pinned by each connection with zero-copy sends of its contents in progress
+// (see zerocopy.h), and unpinned once all of them are completed
+void pinFileCache (FileCache* cache)
+{
+    cache->nb_pins++;
+}
+
+// If the connection is closed before its sends are completed, the kernel may still send them:
+// the cache then stays pinned for a grace period
+void unpinFileCache (FileCache* cache, const uint64_t current_time, const bool sends_are_completed)
+{
+    cache->nb_pins--;
+
+    if (! sends_are_completed)
+        cache->pin_end_time = MAX(cache->pin_end_time,
+                                  current_time + FILE_CACHE_PIN_GRACE_PERIOD * 1000000000ULL);
+}
+
+// The cache must not be deleted (nor its contents reused) while it is pinned
+bool fileCacheIsPinned (const FileCache* cache, const uint64_t current_time)
+{
+    return cache->nb_pins > 0 || current_time < cache->pin_end_time;
+}
+
 void printFileCache (const FileCache* cache)
 {
     printf("\n");
@@ -247,13 +378,31 @@ void printFileCache (const FileCache* cache)
     recursivelyPrintFolder(cache->root, 0);
 }
 
+// Return the copy of the given MIME type shared by all the files of the cache
+char* internFileType (FileCache* cache, const char* type)
+{
+    for (FileType* file_type = cache->file_types; file_type != NULL; file_type = file_type->next)
+        if (stringsAreEqual(file_type->name, type))
+            return file_type->name;
+
+    FileType* new_file_type = allocateFromArena(cache->arena, sizeof(FileType) + strlen(type) + 1);
+    strcpy(new_file_type->name, type);
+
+    new_file_type->next = cache->file_types;
+    cache->file_types   = new_file_type;
+
+    return new_file_type->name;
+}
+
 // -----------------------------------------------------------------------------
 // OPERATIONS ON FILE [CONTENT]
 // -----------------------------------------------------------------------------
 
 // By using standard program "file", guess the type and encoding of a file
-void setFileType (File* file)
+void setFileType (FileCache* cache, File* file)
 {
+    char file_type[MAX_FILE_TYPE_LENGTH];
+
     char* command = "file";
     char* execvp_argv[] = {
             "file",     // Command name (as argv[0])
@@ -264,75 +413,109 @@ void setFileType (File* file)
     };
 
     int filetype_length = runReadableProcess(command, execvp_argv,
-                                             file->type, MAX_FILE_TYPE_LENGTH - 1);
+                                             file_type, MAX_FILE_TYPE_LENGTH - 1);
     
     // Null-terminate the string by replacing the newline sent by 'file'
     // If less than two bytes have been read, print a warning a leave the string empty
     if (filetype_length < 2)
     {
         printWarning("Warning: unable to read a valid filetype of %s", file->path);
-        
-        free(file->type);
         file->type = NULL;
     }
     else
-        file->type[filetype_length - 1] = '\0';
+    {
+        file_type[filetype_length - 1] = '\0';
+        file->type = internFileType(cache, file_type);
+    }
 }
 
 
+// Internal version only!
+// The content is dropped, and the file is left unloaded
+static bool _failFileContentLoading (File* file, const char* reason)
+{
+    printWarning("Warning: %s cannot be loaded (%s)", file->path, reason);
+
+    free(file->content);
+    file->content = NULL;
+    file->state   = STATE_NOT_LOADED;
+
+    return false;
+}
+
 // File path and size must be set before calling this function!
-void setRawFileContent (File* file)
+// Return false if the file cannot be read (entirely) anymore, e.g. if it has been removed
+// since the cache was built: it must then be sent from the disk (or not found)
+bool setRawFileContent (File* file)
 {
     // Buffer where to store the file data
     file->content = malloc(file->size * sizeof(char));
-    if (file->content == NULL)
-        handleErrorAndExit("malloc() failed in setRawFileContent()");
+    if (file->content == NULL && file->size > 0)
+        return _failFileContentLoading(file, "malloc() failed");
 
     // Get the file content from the disk
     int file_fd = open(file->path, O_RDONLY);
     if (file_fd < 0)
-        handleErrorAndExit("open() failed in setRawFileContent()");
+        return _failFileContentLoading(file, "open() failed");
 
-    int nb_bytes_read = 0;
+    off_t nb_bytes_read = 0;
     while (nb_bytes_read < file->size)
     {
-        nb_bytes_read += read(file_fd, file->content, file->size - nb_bytes_read);
-        if (nb_bytes_read < 0)
-            handleErrorAndExit("read() failed in setRawFileContent()");
+        ssize_t current_nb_bytes_read = read(file_fd, file->content + nb_bytes_read,
+                                             file->size - nb_bytes_read);
+        if (current_nb_bytes_read <= 0)
+        {
+            close(file_fd);
+            return _failFileContentLoading(file, "read() failed or file truncated");
+        }
+
+        nb_bytes_read += current_nb_bytes_read;
     }
 
-    int return_value = close(file_fd);
-    if (return_value < 0)
-        handleErrorAndExit("close() failed in setRawFileContent()");
+    close(file_fd);
 
     // Update the file state and encoding
     file->state    = STATE_LOADED_RAW;
     file->encoding = ENCODING_NONE;
+
+    return true;
 }
 
 // By using standard program "gzip", compress the file
 // File path and size must be set before calling this function!
-void setCompressedFileContent (File* file)
+// Return false if the file cannot be read anymore (see setRawFileContent())
+bool setCompressedFileContent (File* file)
 {
+    char level_option[8];
+    snprintf(level_option, sizeof(level_option), "-%d", _compression_level);
+
     char* command = "gzip";
     char* execvp_argv[] = {
-            "gzip",     // Command name (as argv[0])
-            "--stdout", // Output compressed data on stdout
-            file->path, // Path to the file
+            "gzip",       // Command name (as argv[0])
+            "--stdout",   // Output compressed data on stdout
+            level_option, // Compression level
+            file->path,   // Path to the file
             NULL
     };
 
-    // Buffer where to store compressed data, made larger than the normal file size,
-    // in case the compressed data is bigger than the raw one
-    // (TODO: magic 1.2 heuristic here, which should be improved!)
-    int compression_buffer_length = (int) 1.2 * file->size;
+    // Buffer where to store compressed data, as large as the raw file:
+    // compressed data which would not be smaller is useless (and would be truncated)
+    off_t compression_buffer_length = file->size;
     file->content = malloc(compression_buffer_length * sizeof(char));
     if (file->content == NULL)
-        handleErrorAndExit("malloc() failed in setCompressedFileContent()");
+        return _failFileContentLoading(file, "malloc() failed");
 
     // get the compressed file content from 'gzip' output
-    int compressed_data_length = runReadableProcess(command, execvp_argv,
+    off_t compressed_data_length = runReadableProcess(command, execvp_argv,
                                                     file->content, compression_buffer_length);
+
+    // If the file is not compressible enough, cache the raw content instead
+    // (gzip outputs nothing if the file cannot be read: this is then reported by the raw loading)
+    if (compressed_data_length >= compression_buffer_length || compressed_data_length <= 0)
+    {
+        free(file->content);
+        return setRawFileContent(file);
+    }
     
     // Re-dimension the allocated buffer to fit the actual compressed data size
     file->content = realloc(file->content, compressed_data_length);
@@ -341,6 +524,34 @@ void setCompressedFileContent (File* file)
     // Update the file state and encoding
     file->state    = STATE_LOADED_COMPRESSED;
     file->encoding = ENCODING_GZIP;
+
+    return true;
+}
+
+// Load either the raw content of a file or its compressed one (if it is worth it)
+// Precompressed files are loaded as they are, and files with a gzip version
+// are not compressed again (the raw content is kept for clients not accepting gzip)
+// Return false if the file cannot be read anymore (it is then left unloaded)
+bool loadFileContent (File* file)
+{
+    FileEncoding encoding = file->encoding;
+    if (encoding != ENCODING_NONE)
+    {
+        if (! setRawFileContent(file))
+        {
+            file->encoding = encoding;
+            return false;
+        }
+
+        file->state    = STATE_LOADED_COMPRESSED;
+        file->encoding = encoding;
+        return true;
+    }
+
+    if (file->size < MIN_FILE_SIZE_FOR_GZIP || file->sidecars[ENCODING_GZIP] != NULL)
+        return setRawFileContent(file);
+
+    return setCompressedFileContent(file);
 }
 
 // Unload the content of a file
@@ -366,32 +577,242 @@ void removeFileContent (File* file)
     file->state = STATE_NOT_LOADED;
 }
 
+void setCacheLazyLoading (const bool enabled)
+{
+    _lazy_loading_is_enabled = enabled;
+}
+
+// Lazy loading should be disabled: the contents of a shared cache are all loaded when it is built
+void setCacheSharedMemory (const bool enabled)
+{
+    _shared_memory_is_enabled = enabled;
+}
+
+// Only applies to the contents loaded afterwards
+void setCacheCompressionLevel (const int level)
+{
+    _compression_level = level;
+}
+
+void setCacheMaxFileSize (const off_t max_size)
+{
+    _max_file_size = max_size;
+}
+
+// Internal version only!
+static bool _fileCanBeCached (const File* file, const off_t cache_free_space)
+{
+    return file->size <= cache_free_space
+        && (_max_file_size == NO_MAX_FILE_SIZE || file->size <= _max_file_size);
+}
+
+// Return true if the content of the file must be loaded before it can be sent
+bool fileContentIsPending (const File* file)
+{
+    return file->state == STATE_TO_LOAD
+        || file->state == STATE_LOADING;
+}
+
+// Return true if the type of the file suggests it is worth compressing (i.e. text)
+bool fileIsCompressible (const File* file)
+{
+    if (file->type == NULL)
+        return false;
+
+    return strncmp(file->type, "text/", 5) == 0
+        || strstr(file->type, "json")       != NULL
+        || strstr(file->type, "javascript") != NULL
+        || strstr(file->type, "xml")        != NULL;
+}
+
 // Set the file content, which can either be compressed or raw
 // File path and size must be set before calling this function!
-// If the file is too large to be cached, print a warning and return false
+// If the file is too large to be cached (or cannot be read), print a warning and return false
 // Otherwise, return true
-bool setFileContent (File* file, const int cache_free_space)
+bool setFileContent (File* file, const off_t cache_free_space)
 {
     // If the file size is too large, do not load it (and return false)
-    if (file->size > cache_free_space)
+    if (! _fileCanBeCached(file, cache_free_space))
     {
         printWarning("Note: file %s is too large to be cached!", file->path);
         return false;
     }
 
-    // Otherwise, either load the raw content or the compressed one (and return true)
-    if (file->size < MIN_FILE_SIZE_FOR_GZIP)
-        setRawFileContent(file);
-    else
-        setCompressedFileContent(file);
+    // In lazy loading mode, the content is only loaded when the file is first requested
+    // (its raw size is reserved in the cache until then)
+    if (_lazy_loading_is_enabled)
+    {
+        file->state = STATE_TO_LOAD;
+        return true;
+    }
 
-    return true;
+    // Otherwise, load it
+    return loadFileContent(file);
+}
+
+// Internal version only!
+// The entity tag is computed from the inode, size and modification time (like most servers)
+static void _formatEntityTag (const struct stat* file_info, char* etag)
+{
+    snprintf(etag, MAX_VALIDATOR_LENGTH, "\"%llx-%llx-%llx\"",
+             (unsigned long long) file_info->st_ino,
+             (unsigned long long) file_info->st_size,
+             (unsigned long long) file_info->st_mtime);
+}
+
+// Compute the entity tag and the last modification date of the file, once and for all
+void setFileValidators (FileCache* cache, File* file, const struct stat* file_info)
+{
+    char validator[MAX_VALIDATOR_LENGTH];
+
+    _formatEntityTag(file_info, validator);
+    file->etag = copyStringToArena(cache->arena, validator);
+
+    file->modification_time = file_info->st_mtime;
+    strftime(validator, MAX_VALIDATOR_LENGTH, FILE_DATE_FORMAT,
+             gmtime(&file->modification_time));
+    file->last_modified = copyStringToArena(cache->arena, validator);
 }
 
 // Compute and set the required file metadata
-void setFileMetadata (File* file)
+void setFileMetadata (FileCache* cache, File* file, const struct stat* file_info)
+{
+    setFileType(cache, file);
+    setFileValidators(cache, file, file_info);
+
+    // The precompressed versions of the file have the same type
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+        if (file->sidecars[i] != NULL)
+            file->sidecars[i]->type = file->type;
+}
+
+// Internal version only!
+// Drop the cached content of a file (or the space reserved for it) if it has been modified
+// (or removed) on the disk, and refresh its metadata: it is then sent from the disk,
+// unless it can be loaded again (in lazy loading mode)
+// A content being loaded is left as it is, since it is only installed once loaded
+// Return true if the file has been invalidated
+static bool _invalidateFileContent (FileCache* cache, File* file, const FileEncoding encoding)
+{
+    if (file->state == STATE_LOADING)
+        return false;
+
+    struct stat file_info;
+    bool file_exists = stat(file->path, &file_info) == 0 && S_ISREG(file_info.st_mode);
+    if (file_exists && file->etag != NULL)
+    {
+        char etag[MAX_VALIDATOR_LENGTH];
+        _formatEntityTag(&file_info, etag);
+
+        if (stringsAreEqual(etag, file->etag))
+            return false;
+    }
+
+    if (file->state == STATE_LOADED_RAW || file->state == STATE_LOADED_COMPRESSED)
+    {
+        // Answers may still be sending the previous content (see freeUnusedRetiredContents())
+        RetiredContent* retired = malloc(sizeof(RetiredContent));
+        if (retired == NULL)
+            handleErrorAndExit("malloc() failed in _invalidateFileContent()");
+
+        retired->content = file->content;
+        retired->size    = file->size;
+        retired->next    = cache->retired_contents;
+        cache->retired_contents = retired;
+    }
+
+    if (file->state != STATE_NOT_LOADED)
+        cache->size -= file->size;
+
+    file->state       = STATE_NOT_LOADED;
+    file->content     = NULL;
+    file->encoding    = encoding;
+    file->must_unload = true;
+
+    if (! file_exists)
+        return true;
+
+    file->size = file_info.st_size;
+    setFileValidators(cache, file, &file_info);
+
+    if (_lazy_loading_is_enabled && _fileCanBeCached(file, cache->max_size - cache->size))
+    {
+        file->state       = STATE_TO_LOAD;
+        file->must_unload = false;
+        cache->size      += file->size;
+    }
+
+    return true;
+}
+
+// Files visited by an invalidation, and how many of them have been invalidated
+typedef struct InvalidationContext {
+    FileCache* cache;
+    int        nb_invalidated_files;
+} InvalidationContext;
+
+// Internal version only!
+static void _invalidateFile (void* file_pointer, void* context_pointer)
 {
-    setFileType(file);
+    File*                file    = file_pointer;
+    InvalidationContext* context = context_pointer;
+
+    bool is_invalidated = _invalidateFileContent(context->cache, file, ENCODING_NONE);
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+        if (file->sidecars[i] != NULL && _invalidateFileContent(context->cache, file->sidecars[i], i))
+            is_invalidated = true;
+
+    if (is_invalidated)
+        context->nb_invalidated_files++;
+}
+
+// Invalidate the cached contents of the files whose path starts with the given prefix
+// (e.g. "/docs/" for a whole directory, or "/" for all of them) which have been modified
+// (or removed) on the disk since they were cached, e.g. when the configuration is reloaded
+// Return the number of invalidated files (always 0 for a shared cache, which is read-only)
+int invalidateFilesWithPrefix (FileCache* cache, const char* prefix)
+{
+    if (cache->is_shared)
+        return 0;
+
+    InvalidationContext context = { cache, 0 };
+    applyToPathIndexPrefix(cache->path_index, prefix, _invalidateFile, &context);
+
+    return context.nb_invalidated_files;
+}
+
+// Free the invalidated contents which are not sent anymore, i.e. which are not used
+// by any answer (according to the given function), unless the cache is pinned
+// by zero-copy sends which may still read them (see pinFileCache())
+// Return the number of freed contents
+int freeUnusedRetiredContents (FileCache* cache, const uint64_t current_time,
+                               bool (*content_is_used)(const char* content, const off_t size,
+                                                       void* context),
+                               void* context)
+{
+    if (cache->retired_contents == NULL || fileCacheIsPinned(cache, current_time))
+        return 0;
+
+    int              nb_freed_contents = 0;
+    RetiredContent** retired_pointer   = &cache->retired_contents;
+
+    while (*retired_pointer != NULL)
+    {
+        RetiredContent* retired = *retired_pointer;
+        if (content_is_used(retired->content, retired->size, context))
+        {
+            retired_pointer = &retired->next;
+            continue;
+        }
+
+        *retired_pointer = retired->next;
+        free(retired->content);
+        free(retired);
+        nb_freed_contents++;
+    }
+
+    return nb_freed_contents;
 }
 
 // -----------------------------------------------------------------------------
@@ -405,6 +826,71 @@ bool filenameIsSpecial (const char* filename)
         || stringsAreEqual(filename, ".."); 
 }
 
+// Return true if the path is the one of a precompressed version of another file
+// (i.e. it is this file's path followed by the extension of an encoding)
+bool pathIsSidecar (const char* path)
+{
+    int path_length = strlen(path);
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+    {
+        char* extension        = getFileEncodingExtension(i);
+        int   extension_length = strlen(extension);
+        if (path_length <= extension_length
+        ||  strcmp(path + path_length - extension_length, extension) != 0)
+            continue;
+
+        char base_path[MAX_PATH_LENGTH];
+        snprintf(base_path, MAX_PATH_LENGTH, "%.*s", path_length - extension_length, path);
+
+        struct stat file_info;
+        if (stat(base_path, &file_info) == 0 && S_ISREG(file_info.st_mode))
+            return true;
+    }
+
+    return false;
+}
+
+// Look for the precompressed versions of a file (whose path must be set),
+// and attach them to it (their contents are loaded like the one of any file)
+void attachSidecars (FileCache* cache, File* file, off_t* cache_free_space)
+{
+    char sidecar_path[MAX_PATH_LENGTH];
+    char sidecar_name[MAX_NAME_LENGTH];
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+    {
+        char* extension = getFileEncodingExtension(i);
+
+        int path_length = snprintf(sidecar_path, MAX_PATH_LENGTH, "%s%s", file->path, extension);
+        int name_length = snprintf(sidecar_name, MAX_NAME_LENGTH, "%s%s", file->name, extension);
+        if (path_length >= MAX_PATH_LENGTH || name_length >= MAX_NAME_LENGTH)
+            continue;
+
+        struct stat file_info;
+        if (stat(sidecar_path, &file_info) < 0 || ! S_ISREG(file_info.st_mode))
+            continue;
+
+        File* sidecar = createAndInitFile(cache);
+        setFileNameAndPath(cache, sidecar, sidecar_name, sidecar_path);
+
+        sidecar->size          = file_info.st_size;
+        sidecar->encoding      = i;
+        sidecar->is_negotiated = true;
+
+        if (setFileContent(sidecar, *cache_free_space))
+            *cache_free_space -= sidecar->size;
+        else
+            sidecar->must_unload = true;
+
+        // Its type is the one of the file (see setFileMetadata())
+        setFileValidators(cache, sidecar, &file_info);
+
+        file->sidecars[i]   = sidecar;
+        file->is_negotiated = true;
+    }
+}
+
 // This function assumes directory is rewinded (otherwise, some elements may be ignored)
 void countFilesAndFoldersInDirectory (DIR* directory, const char* current_folder_path,
                                       int* nb_files, int* nb_subfolders)
@@ -456,8 +942,8 @@ void countFilesAndFoldersInDirectory (DIR* directory, const char* current_folder
 
 // Fill a Folder structure according tot a DIR one, at current_path
 // If there is no more space in the cache, file content is not loaded
-void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_folder_path,
-                            int* cache_free_space)
+void recursivelyFillFolder (FileCache* cache, DIR* directory, Folder* folder,
+                            const char* current_folder_path, off_t* cache_free_space)
 {
     struct stat file_info;
     char*       current_entry_path = malloc(MAX_PATH_LENGTH * sizeof(char));
@@ -490,20 +976,31 @@ void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_
         if (return_value < 0)
             handleErrorAndExit("stat() failed in recursivelyBuildFolder()");
 
+        // Ignore precompressed versions of files, which are attached to them
+        // (see attachSidecars()) instead of being independent files
+        if (S_ISREG(file_info.st_mode) && pathIsSidecar(current_entry_path))
+        {
+            // Immediately move to the next entry
+            current_entry = readdir(directory);
+            continue;
+        }
+
         // Case 1: current entry is a regular file
         if (S_ISREG(file_info.st_mode))
         {
             // Create and initialize a File structure
             // printf("Creating file with name %s...\n", current_entry_name);
-            File* new_file = createAndInitFile();
+            File* new_file = createAndInitFile(cache);
+            setFileNameAndPath(cache, new_file, current_entry_name, current_entry_path);
 
-            new_file->name = getFreshStringCopy(current_entry_name);
-            new_file->path = getFreshStringCopy(current_entry_path);
             new_file->size = file_info.st_size;
 
             // File (content) must only be unloaded (after reading) if the cache is full
             new_file->must_unload = false;
 
+            // Its precompressed versions (if any) are preferred, and thus cached first
+            attachSidecars(cache, new_file, cache_free_space);
+
             // Attempt to load the file content, and update values accordingly
             bool content_was_loaded = setFileContent(new_file, *cache_free_space);
             if (content_was_loaded)
@@ -512,7 +1009,7 @@ void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_
                 new_file->must_unload = true;
 
             // Set the file metadata
-            setFileMetadata(new_file);
+            setFileMetadata(cache, new_file, &file_info);
 
             // Finally, add the file to the folder
             addFileToFolder(folder, new_file);
@@ -522,7 +1019,8 @@ void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_
         else if (S_ISDIR(file_info.st_mode))
         {
             // Recursively build the subfolder...
-            Folder* new_subfolder = recursivelyBuildFolder(current_entry_path, cache_free_space);
+            Folder* new_subfolder = recursivelyBuildFolder(cache, current_entry_path,
+                                                           cache_free_space);
 
             // ...and add it to the folder which is currently built
             addSubfolderToFolder(folder, new_subfolder);
@@ -532,10 +1030,10 @@ void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_
         current_entry = readdir(directory);
     }
 
-    //free(current_entry_path);
+    free(current_entry_path);
 }
 
-Folder* recursivelyBuildFolder (const char* path, int* cache_free_space)
+Folder* recursivelyBuildFolder (FileCache* cache, const char* path, off_t* cache_free_space)
 {
     // Open the pointed directory to browse it
     DIR* directory = opendir(path);
@@ -551,11 +1049,12 @@ Folder* recursivelyBuildFolder (const char* path, int* cache_free_space)
     // Create an empty Folder structure
     // printf("Creating new folder with %d file(s) and %d subfolder(s)...\n", nb_files, nb_subfolders);
     char*   new_folder_name = extractLastNameOfPath(path);
-    Folder* new_folder      = createEmptyFolder(new_folder_name, nb_files, nb_subfolders);
+    Folder* new_folder      = createEmptyFolder(cache, new_folder_name, nb_files, nb_subfolders);
+    free(new_folder_name);
     
     // Rewind the directory, and fill the Folder structure recursively
     rewinddir(directory);
-    recursivelyFillFolder(directory, new_folder, path, cache_free_space);
+    recursivelyFillFolder(cache, directory, new_folder, path, cache_free_space);
 
     // Finally, close the directory
     int return_value = closedir(directory);
@@ -565,22 +1064,118 @@ Folder* recursivelyBuildFolder (const char* path, int* cache_free_space)
     return new_folder;
 }
 
-FileCache* buildCacheFromDisk (char* root_path, const int max_size)
+// Internal version only!
+// The path of the folder (relative to the root, ending with '/' unless it is the root)
+// is written at the beginning of the buffer
+static void _recursivelyIndexFolder (FileCache* cache, const Folder* folder,
+                                     char* path, const int path_length)
+{
+    for (int i = 0; i < folder->nb_files; i++)
+    {
+        File* file = folder->files[i];
+        if (path_length + file->name_length >= MAX_PATH_LENGTH)
+            continue;
+
+        memcpy(path + path_length, file->name, file->name_length);
+        path[path_length + file->name_length] = '\0';
+
+        insertInPathIndex(cache->path_index, path, path_length + file->name_length, file);
+        addToBloomFilter(cache->path_filter, hashTargetPath(path));
+    }
+
+    for (int i = 0; i < folder->nb_subfolders; i++)
+    {
+        Folder* subfolder = folder->subfolders[i];
+        if (path_length + subfolder->name_length + 1 >= MAX_PATH_LENGTH)
+            continue;
+
+        memcpy(path + path_length, subfolder->name, subfolder->name_length);
+        path[path_length + subfolder->name_length] = '/';
+        _recursivelyIndexFolder(cache, subfolder, path, path_length + subfolder->name_length + 1);
+    }
+}
+
+// Index all the files of the folders of the cache by path
+// (the precompressed versions are not indexed: they are attached to their file)
+// The Bloom filter of the paths is built again, and the negative cache is cleared
+void indexCacheFiles (FileCache* cache)
+{
+    int nb_files = 0;
+    for (File* file = cache->files; file != NULL; file = file->next_in_cache)
+        nb_files++;
+
+    cache->path_filter = createBloomFilter(cache->arena, nb_files);
+    clearNegativeCache(cache);
+
+    char path[MAX_PATH_LENGTH];
+    _recursivelyIndexFolder(cache, cache->root, path, 0);
+}
+
+// Must be called whenever a path is added to the index
+void clearNegativeCache (FileCache* cache)
+{
+    for (int i = 0; i < NEGATIVE_CACHE_NB_ENTRIES; i++)
+        cache->negative_cache[i].is_used = false;
+}
+
+// Internal version only!
+// The contents are copied one by one (the memory used at once is thus not doubled)
+static void _moveFileContentsToArena (FileCache* cache)
+{
+    for (File* file = cache->files; file != NULL; file = file->next_in_cache)
+        if (file->state == STATE_LOADED_RAW || file->state == STATE_LOADED_COMPRESSED)
+        {
+            char* shared_content = allocateFromArena(cache->arena, file->size);
+            memcpy(shared_content, file->content, file->size);
+
+            free(file->content);
+            file->content = shared_content;
+        }
+}
+
+FileCache* buildCacheFromDisk (char* root_path, const off_t max_size)
 {
     // Create a fresh, empty file cache
     FileCache* new_cache = createEmptyFileCache(max_size);
 
     // Build the root folder recursively
-    int cache_free_space = max_size;
-    Folder* root_folder = recursivelyBuildFolder(root_path, &cache_free_space);
+    off_t cache_free_space = max_size;
+    Folder* root_folder = recursivelyBuildFolder(new_cache, root_path, &cache_free_space);
 
     // Set some cache fields
     new_cache->root = root_folder;
     new_cache->size = max_size - cache_free_space;
 
+    // Finally, index the files by path
+    indexCacheFiles(new_cache);
+
+    // The contents of a shared cache are shared as well
+    if (new_cache->is_shared)
+        _moveFileContentsToArena(new_cache);
+
     return new_cache;
 }
 
+// Make the metadata and the contents of a shared cache read-only (in the calling process only),
+// e.g. in each worker: the cache cannot be modified anymore, by mistake or not
+void protectFileCache (FileCache* cache)
+{
+    protectArena(cache->arena);
+}
+
+// Copy the metadata and the contents of a shared cache on each NUMA node (see replicateArena())
+void replicateFileCache (FileCache* cache, const int nb_nodes)
+{
+    replicateArena(cache->arena, nb_nodes);
+}
+
+// Read the copy of a replicated cache on the given node (in the calling process only)
+// This must be done before protecting the cache
+void useFileCacheReplica (FileCache* cache, const int node)
+{
+    useArenaReplicas(cache->arena, node);
+}
+
 // -----------------------------------------------------------------------------
 // FILE FETCHING
 // -----------------------------------------------------------------------------
@@ -589,10 +1184,16 @@ FileCache* buildCacheFromDisk (char* root_path, const int max_size)
 // If not found, returns NOT_FOUND (NULL alias)
 Folder* findSubfolderInFolder (const Folder* folder, const char* subfolder_name)
 {
+    int      name_length = strlen(subfolder_name);
+    uint32_t name_hash   = computeNameHash(subfolder_name, name_length);
+
+    // The hash of the name is compared first, so that the other names are not read
     for (int i = 0; i < folder->nb_subfolders; i++)
     {
         Folder* current_subfolder = folder->subfolders[i];
-        if (stringsAreEqual(subfolder_name, current_subfolder->name))
+        if (current_subfolder->name_hash   == name_hash
+        &&  current_subfolder->name_length == name_length
+        &&  memcmp(current_subfolder->name, subfolder_name, name_length) == 0)
             return current_subfolder;
     }
 
@@ -603,55 +1204,149 @@ Folder* findSubfolderInFolder (const Folder* folder, const char* subfolder_name)
 // If not found, returns NOT_FOUND (NULL alias)
 File* findFileInFolder (const Folder* folder, const char* file_name)
 {
+    int      name_length = strlen(file_name);
+    uint32_t name_hash   = computeNameHash(file_name, name_length);
+
+    // The hash of the name is compared first, so that the other names are not read
     for (int i = 0; i < folder->nb_files; i++)
     {
         File* current_file = folder->files[i];
-        if (stringsAreEqual(file_name, current_file->name))
+        if (current_file->name_hash   == name_hash
+        &&  current_file->name_length == name_length
+        &&  memcmp(current_file->name, file_name, name_length) == 0)
             return current_file;
     }
 
     return NOT_FOUND;
 }
 
-// Find a file from a full path in a file cache
-// If not found, returns NOT_FOUND (NULL alias)
-// If path is longer than MAX_PATH_LENGTH, returns NOT_FOUND
-// If path contains a folder or file name longer than MAX_NAME_LENGTH, returns NOT_FOUND
-File* findFileInCache (const FileCache* cache, char* path)
+// Hash of the path designated by a request target, normalized like in the path index
+// (see advancePathIndexCursor()), including the index file name of a directory
+uint64_t hashTargetPath (const char* target)
+{
+    uint64_t hash          = PATH_HASH_OFFSET_BASIS;
+    char     previous_byte = '/';
+
+    for (; ! targetEndsAt(target); target++)
+    {
+        if (target[0] == '/' && previous_byte == '/')
+            continue;
+
+        hash ^= (unsigned char) target[0];
+        hash *= PATH_HASH_PRIME;
+        previous_byte = target[0];
+    }
+
+    if (previous_byte == '/')
+        for (const char* name = DIRECTORY_INDEX_NAME; name[0] != '\0'; name++)
+        {
+            hash ^= (unsigned char) name[0];
+            hash *= PATH_HASH_PRIME;
+        }
+
+    // Final mixing, since both halves of the hash are used by the Bloom filter
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+// Internal version only!
+// Return true if the normalized path of the target is the given one
+static bool _targetHasPath (const char* target, const char* path)
 {
-    char    next_folder_name[MAX_NAME_LENGTH];
-    Folder* current_folder = cache->root;
+    char previous_byte = '/';
 
-    // Read the remaining path until either '/' or '\0' is found
-    // At most MAX_PATH_LENGTH characters can be read and tested
-    char* remaining_path = path;
+    for (; ! targetEndsAt(target); target++)
+    {
+        if (target[0] == '/' && previous_byte == '/')
+            continue;
 
-    // Start by ignoring all leading '/'
-    while (remaining_path[0] == '/')
-        remaining_path++;
+        if (path[0] != target[0])
+            return false;
+
+        path++;
+        previous_byte = target[0];
+    }
+
+    return path[0] == '\0';
+}
+
+// Internal version only!
+// The normalized path of the target is kept, unless it is too long
+static void _storeInNegativeCache (NegativeCacheEntry* entry, const uint64_t hash,
+                                   const char* target)
+{
+    char previous_byte = '/';
+    int  path_length   = 0;
 
-    for (;;)
+    for (; ! targetEndsAt(target); target++)
     {
-        char* next_remaining_path = strchr(remaining_path, '/');
+        if (target[0] == '/' && previous_byte == '/')
+            continue;
+
+        if (path_length == NEGATIVE_CACHE_MAX_PATH_LENGTH - 1)
+            return;
+
+        entry->path[path_length++] = target[0];
+        previous_byte = target[0];
+    }
+
+    entry->path[path_length] = '\0';
+    entry->hash    = hash;
+    entry->is_used = true;
+}
 
-        // If no '/' was found, try to fetch the file in current folder
-        if (next_remaining_path == NULL)
-            return findFileInFolder(current_folder, remaining_path /* i.e. file name */);
+// Internal version only!
+static File* _findFileInPathIndex (const FileCache* cache, const char* target)
+{
+    PathIndexCursor cursor;
+    initPathIndexCursor(&cursor, cache->path_index);
 
-        // Otherwise, get the current name to use
-        // (it ranges from the first character to the last one before '/')
-        int name_length = (next_remaining_path - remaining_path) / sizeof(char);
-        memcpy(next_folder_name, remaining_path, name_length);
-        next_folder_name[name_length] = '\0';
+    const char* end_of_target = advancePathIndexCursor(&cursor, target, NULL);
+    if (end_of_target == NULL)
+        return NOT_FOUND;
 
-        // Try to move into the right subfolder
-        current_folder = findSubfolderInFolder(current_folder, next_folder_name);
-        if (current_folder == NOT_FOUND)
+    if (end_of_target == target || end_of_target[-1] == '/')
+    {
+        if (advancePathIndexCursor(&cursor, DIRECTORY_INDEX_NAME, NULL) == NULL)
             return NOT_FOUND;
+    }
 
-        // Ignore all leading '/' in the remaining path
-        remaining_path = next_remaining_path;
-        while (remaining_path[0] == '/')
-            remaining_path++;
+    return getPathIndexCursorValue(&cursor);
+}
+
+// Find a file from a request target in a file cache, by matching it byte by byte
+// with the path index (repeated '/' are ignored), until its end (see targetEndsAt())
+// The target can thus be the one of a request line, inside the request buffer
+// The target of a directory (ending with '/') designates its index file
+// Unknown paths are mostly rejected by the Bloom filter of the paths, or by the negative cache
+// If not found, returns NOT_FOUND (NULL alias)
+// The result of the lookup is written in result (unless it is NULL)
+File* findFileInCache (FileCache* cache, const char* target, CacheLookupResult* result)
+{
+    CacheLookupResult lookup_result = LOOKUP_MISS;
+    File*             file          = NOT_FOUND;
+
+    uint64_t            hash  = hashTargetPath(target);
+    NegativeCacheEntry* entry = &cache->negative_cache[hash & (NEGATIVE_CACHE_NB_ENTRIES - 1)];
+
+    if (! bloomFilterMayContain(cache->path_filter, hash))
+        lookup_result = LOOKUP_MISS_FILTERED;
+    else if (entry->is_used && entry->hash == hash && _targetHasPath(target, entry->path))
+        lookup_result = LOOKUP_MISS_NEGATIVE;
+    else
+    {
+        file = _findFileInPathIndex(cache, target);
+        if (file != NOT_FOUND)
+            lookup_result = LOOKUP_HIT;
+        else
+            _storeInNegativeCache(entry, hash, target);
     }
+
+    if (result != NULL)
+        *result = lookup_result;
+
+    return file;
 }
@@ -2,54 +2,135 @@
 #define __H_FILE_CACHE__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "path_index.h"
+#include "bloom_filter.h"
 
 typedef enum FileState {
     STATE_NOT_LOADED,
     STATE_LOADED_RAW,
-    STATE_LOADED_COMPRESSED
+    STATE_LOADED_COMPRESSED,
+    STATE_TO_LOAD, // Lazy loading: the content will be loaded when first requested
+    STATE_LOADING
 } FileState;
 
 typedef enum FileEncoding {
     ENCODING_GZIP,
+    ENCODING_BROTLI,
+    ENCODING_ZSTD,
     ENCODING_NONE
 } FileEncoding;
 
+#define NB_COMPRESSED_ENCODINGS 3 // Encodings before ENCODING_NONE
+
+#define NEGATIVE_CACHE_NB_ENTRIES       256 // Must be a power of two
+#define NEGATIVE_CACHE_MAX_PATH_LENGTH  120 // Longer paths are not kept
+
 // Structures representing files and folders
 // in order to cache them in memory
+// All of them (and their names, paths, types...) are allocated in the arena of their cache
 
 typedef struct File {
-    char*     name;
-    char*     path;
+    // Fields read by the lookups and the answers come first (in the same cache line)
+    uint32_t  name_hash;
+    int       name_length;
     FileState state;
+    off_t     size;
+    char*     content;
+    char*     name;
 
-    char* content;
-    int   size;
-
+    char* path;
     bool  must_unload;
 
-    char*        type;     // MIME type
+    char*        type;     // MIME type (shared by all the files of this type)
     FileEncoding encoding; // Compression format
+
+    // Validators, computed once when the cache is built
+    char*  etag;              // Strong entity tag (including the quotes)
+    char*  last_modified;     // Modification date, in HTTP format
+    time_t modification_time;
+
+    // Precompressed versions found next to the file (e.g. foo.js.br), by encoding
+    // They are not in the folder: they are only sent instead of the file
+    struct File* sidecars[NB_COMPRESSED_ENCODINGS];
+    bool         is_negotiated; // True for a file with sidecars, and for the sidecars
+
+    struct File* next_in_cache; // List of all the files of the cache (sidecars included)
 } File;
 
 typedef struct Folder {
-    char* name;
-    int   size;
+    uint32_t name_hash;
+    int      name_length;
+    char*    name;
 
     struct File** files;
     int    nb_files;
 
     struct Folder** subfolders;
     int      nb_subfolders;
+
+    off_t size;
 } Folder;
 
+// Interned MIME type (each different type is only stored once per cache)
+typedef struct FileType {
+    struct FileType* next;
+    char             name[]; // Null-terminated
+} FileType;
+
+// Recent target which did not designate any file (its path is normalized like in the index)
+typedef struct NegativeCacheEntry {
+    bool     is_used;
+    uint64_t hash; // See hashTargetPath()
+    char     path[NEGATIVE_CACHE_MAX_PATH_LENGTH];
+} NegativeCacheEntry;
+
+typedef enum CacheLookupResult {
+    LOOKUP_HIT,
+    LOOKUP_MISS,          // The path index has been searched
+    LOOKUP_MISS_FILTERED, // Rejected by the Bloom filter
+    LOOKUP_MISS_NEGATIVE  // Found in the negative cache
+} CacheLookupResult;
+
+// Content which has been replaced, but may still be sent by some answers
+typedef struct RetiredContent {
+    char*                  content;
+    off_t                  size;
+    struct RetiredContent* next;
+} RetiredContent;
+
 // Cache structure, containing the above ones
+// Files are found through the path index; the folders only reflect the directories
 
 typedef struct FileCache {
-    Folder* root;
+    Folder*    root;
+    PathIndex* path_index; // All the files, by path (relative to the root)
 
-    int     size;
-    int     max_size;
+    // Misses (e.g. of scanners and broken links) are mostly answered before searching the index
+    BloomFilter*        path_filter;    // All the paths of the index
+    NegativeCacheEntry* negative_cache; // Direct-mapped, by hash
+
+    off_t   size;
+    off_t   max_size;
+
+    Arena*    arena;      // Metadata of this generation of the cache
+    File*     files;      // All the files (see File.next_in_cache)
+    FileType* file_types;
+
+    RetiredContent* retired_contents; // See freeUnusedRetiredContents()
+
+    // Zero-copy sends of the contents which may not be completed yet (in the calling process
+    // only): the pages of a pinned cache must not be freed (see pinFileCache())
+    int      nb_pins;
+    uint64_t pin_end_time; // ns (sends of closed connections may still be in progress)
+
+    // Metadata and contents in shared memory (all in the arena), e.g. for prefork workers
+    bool is_shared;
 } FileCache;
 
 // -----------------------------------------------------------------------------
@@ -61,50 +142,89 @@ typedef struct FileCache {
 #define MAX_FILE_ENCODING_LENGTH 64
 
 #define MIN_FILE_SIZE_FOR_GZIP   64 // bytes
+#define DEFAULT_GZIP_LEVEL       6  // From 1 (fastest) to 9 (smallest), as gzip itself
+#define NO_MAX_FILE_SIZE         0
+
+#define MAX_VALIDATOR_LENGTH     64
+#define FILE_DATE_FORMAT         "%a, %d %b %Y %H:%M:%S GMT" // HTTP-date
+
+#define DIRECTORY_INDEX_NAME     "index.html" // File sent for the path of a directory
 
 #define NOT_FOUND                NULL
 
+// Time during which the orphaned sockets of the kernel may still send (and retransmit) data
+#define FILE_CACHE_PIN_GRACE_PERIOD 120 // s
+
 // -----------------------------------------------------------------------------
 
-File* createFile ();
+uint32_t computeNameHash (const char* name, const int name_length);
+
+File* createFile (FileCache* cache);
 void initFile (File* file);
-File* createAndInitFile ();
-void deleteFile (File* file);
+File* createAndInitFile (FileCache* cache);
+void setFileNameAndPath (FileCache* cache, File* file, const char* name, const char* path);
 char* getFileStateAsString (const FileState state);
+char* getFileEncodingName (const FileEncoding encoding);
+char* getFileEncodingExtension (const FileEncoding encoding);
 void printFile (const File* file, const int indent);
 
-Folder* createFolder ();
-void initEmptyFolder (Folder* folder, char* name,
+Folder* createFolder (FileCache* cache);
+void initEmptyFolder (FileCache* cache, Folder* folder, const char* name,
                       const int max_nb_files, const int max_nb_subfolders);
-Folder* createEmptyFolder (char* name, const int max_nb_files, const int max_nb_subfolders);
-void recursivelyDeleteFolder (Folder* folder);
+Folder* createEmptyFolder (FileCache* cache, const char* name,
+                           const int max_nb_files, const int max_nb_subfolders);
 void recursivelyPrintFolder (const Folder* folder, const int indent);
-int addFileToFolder (Folder* folder, File* file);
-int addSubfolderToFolder (Folder* folder, Folder* subfolder);
+off_t addFileToFolder (Folder* folder, File* file);
+off_t addSubfolderToFolder (Folder* folder, Folder* subfolder);
 
 FileCache* createFileCache ();
-bool initFileCache (FileCache* cache, const int max_size);
-FileCache* createEmptyFileCache (const int max_size);
+void initEmptyFileCache (FileCache* cache, const off_t max_size);
+FileCache* createEmptyFileCache (const off_t max_size);
 void deleteFileCache (FileCache* cache);
 void printFileCache (const FileCache* cache);
-
-void setFileType (File* file);
-void setRawFileContent (File* file);
-void setCompressedFileContent (File* file);
+char* internFileType (FileCache* cache, const char* type);
+void pinFileCache (FileCache* cache);
+void unpinFileCache (FileCache* cache, const uint64_t current_time, const bool sends_are_completed);
+bool fileCacheIsPinned (const FileCache* cache, const uint64_t current_time);
+
+void setFileType (FileCache* cache, File* file);
+bool setRawFileContent (File* file);
+bool setCompressedFileContent (File* file);
+bool loadFileContent (File* file);
 void removeFileContent (File* file);
-bool setFileContent (File* file, const int cache_free_space);
-void setFileMetadata (File* file);
+void setCacheLazyLoading (const bool enabled);
+void setCacheSharedMemory (const bool enabled);
+void setCacheCompressionLevel (const int level);
+void setCacheMaxFileSize (const off_t max_size);
+bool fileContentIsPending (const File* file);
+bool fileIsCompressible (const File* file);
+bool setFileContent (File* file, const off_t cache_free_space);
+void setFileValidators (FileCache* cache, File* file, const struct stat* file_info);
+void setFileMetadata (FileCache* cache, File* file, const struct stat* file_info);
+int invalidateFilesWithPrefix (FileCache* cache, const char* prefix);
+int freeUnusedRetiredContents (FileCache* cache, const uint64_t current_time,
+                               bool (*content_is_used)(const char* content, const off_t size,
+                                                       void* context),
+                               void* context);
 
 bool filenameIsSpecial (const char* filename);
+bool pathIsSidecar (const char* path);
+void attachSidecars (FileCache* cache, File* file, off_t* cache_free_space);
 void countFilesAndFoldersInDirectory (DIR* directory, const char* current_folder_path,
                                       int* nb_files, int* nb_subfolders);
-void recursivelyFillFolder (DIR* directory, Folder* folder, const char* current_folder_path,
-                            int* cache_free_space);
-Folder* recursivelyBuildFolder (const char* path, int* cache_free_space);
-FileCache* buildCacheFromDisk (char* root_path, const int max_size);
+void recursivelyFillFolder (FileCache* cache, DIR* directory, Folder* folder,
+                            const char* current_folder_path, off_t* cache_free_space);
+Folder* recursivelyBuildFolder (FileCache* cache, const char* path, off_t* cache_free_space);
+void indexCacheFiles (FileCache* cache);
+void clearNegativeCache (FileCache* cache);
+FileCache* buildCacheFromDisk (char* root_path, const off_t max_size);
+void protectFileCache (FileCache* cache);
+void replicateFileCache (FileCache* cache, const int nb_nodes);
+void useFileCacheReplica (FileCache* cache, const int node);
 
 Folder* findSubfolderInFolder (const Folder* folder, const char* subfolder_name);
 File* findFileInFolder (const Folder* folder, const char* file_name);
-File* findFileInCache (const FileCache* cache, char* path);
+uint64_t hashTargetPath (const char* target);
+File* findFileInCache (FileCache* cache, const char* target, CacheLookupResult* result);
 
 #endif
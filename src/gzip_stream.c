@@ -0,0 +1,412 @@
+// Macro definition required for using pipe2() and kill()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "toolbox.h"
+#include "file_cache.h"
+#include "gzip_stream.h"
+
+#define PIPE_IN  1
+#define PIPE_OUT 0
+
+#define NO_PIPE_FD -1
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON GZIP STREAM
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static void _deleteUnstartedGzipStream (GzipStream* stream)
+{
+    free(stream->chunk);
+    free(stream->output);
+    free(stream);
+}
+
+// Start compressing the file at the given path in a gzip process (at the given level)
+// Its output is kept as well, unless it grows larger than the given length
+// Return NULL if the process cannot be started (e.g. too many processes or open files)
+GzipStream* createGzipStream (const char* path, const int output_max_length,
+                              const int compression_level)
+{
+    GzipStream* new_stream = malloc(sizeof(GzipStream));
+    if (new_stream == NULL)
+        handleErrorAndExit("malloc() failed in createGzipStream()");
+
+    new_stream->chunk = malloc((GZIP_STREAM_CHUNK_PREFIX_SIZE + GZIP_STREAM_CHUNK_SIZE + 2)
+                               * sizeof(char));
+    if (new_stream->chunk == NULL)
+        handleErrorAndExit("malloc() failed in createGzipStream()");
+
+    new_stream->chunk_length = 0;
+    new_stream->chunk_offset = 0;
+    new_stream->is_finished  = false;
+
+    new_stream->output_length        = 0;
+    new_stream->output_max_length    = output_max_length;
+    new_stream->output_buffer_length = MIN(GZIP_STREAM_CHUNK_SIZE, output_max_length);
+    new_stream->output               = NULL;
+    if (new_stream->output_buffer_length > 0)
+    {
+        new_stream->output = malloc(new_stream->output_buffer_length * sizeof(char));
+        if (new_stream->output == NULL)
+            handleErrorAndExit("malloc() failed in createGzipStream()");
+    }
+
+    // The pipe must not be inherited by other processes (e.g. other gzip ones),
+    // otherwise the end of the output would not be noticed
+    int pipe_fds[2];
+    int return_value = pipe2(pipe_fds, O_CLOEXEC);
+    if (return_value < 0)
+    {
+        handleError("pipe2() failed in createGzipStream()");
+        _deleteUnstartedGzipStream(new_stream);
+        return NULL;
+    }
+
+    pid_t fork_pid = fork();
+    if (fork_pid < 0)
+    {
+        handleError("fork() failed in createGzipStream()");
+        close(pipe_fds[PIPE_IN]);
+        close(pipe_fds[PIPE_OUT]);
+        _deleteUnstartedGzipStream(new_stream);
+        return NULL;
+    }
+
+    // Child process
+    if (fork_pid == 0)
+    {
+        char level_option[8];
+        snprintf(level_option, sizeof(level_option), "-%d", compression_level);
+
+        char* execvp_argv[] = {
+            "gzip",         // Command name (as argv[0])
+            "--stdout",     // Output compressed data on stdout
+            level_option,   // Compression level
+            (char*) path,   // Path to the file
+            NULL
+        };
+
+        return_value = dup2(pipe_fds[PIPE_IN], 1);
+        if (return_value < 0)
+            handleErrorAndExit("dup2() failed in createGzipStream()");
+
+        execvp("gzip", execvp_argv);
+        handleErrorAndExit("exec() failed in createGzipStream()");
+    }
+
+    // Father process: the output is read as it is produced
+    return_value = close(pipe_fds[PIPE_IN]);
+    if (return_value < 0)
+        handleErrorAndExit("close() failed in createGzipStream()");
+
+    return_value = fcntl(pipe_fds[PIPE_OUT], F_SETFL, O_NONBLOCK);
+    if (return_value < 0)
+        handleErrorAndExit("fcntl() failed in createGzipStream()");
+
+    new_stream->pid = fork_pid;
+    new_stream->fd  = pipe_fds[PIPE_OUT];
+
+    return new_stream;
+}
+
+// If the compression is not over, the gzip process is killed
+void deleteGzipStream (GzipStream* stream)
+{
+    if (stream->fd != NO_PIPE_FD)
+        close(stream->fd);
+
+    if (stream->pid > 0)
+    {
+        kill(stream->pid, SIGKILL);
+        waitpid(stream->pid, NULL, 0);
+    }
+
+    free(stream->chunk);
+    free(stream->output);
+    free(stream);
+}
+
+// -----------------------------------------------------------------------------
+// CHUNKS READING
+// -----------------------------------------------------------------------------
+
+// Return true if the current chunk has been sent, and the next one must be read
+bool gzipStreamNeedsData (const GzipStream* stream)
+{
+    return ! stream->is_finished
+        && stream->chunk_offset == stream->chunk_length;
+}
+
+// Return true once the last chunk has been sent
+bool gzipStreamIsComplete (const GzipStream* stream)
+{
+    return stream->is_finished
+        && stream->chunk_offset == stream->chunk_length;
+}
+
+// Internal version only!
+static void _appendToOutput (GzipStream* stream, const char* data, const int length)
+{
+    if (stream->output == NULL)
+        return;
+
+    int new_length = stream->output_length + length;
+    if (new_length > stream->output_max_length)
+    {
+        free(stream->output);
+        stream->output = NULL;
+        return;
+    }
+
+    if (new_length > stream->output_buffer_length)
+    {
+        stream->output_buffer_length = MIN(MAX(2 * stream->output_buffer_length, new_length),
+                                           stream->output_max_length);
+        stream->output = realloc(stream->output, stream->output_buffer_length);
+        if (stream->output == NULL)
+            handleErrorAndExit("realloc() failed in _appendToOutput()");
+    }
+
+    memcpy(stream->output + stream->output_length, data, length);
+    stream->output_length = new_length;
+}
+
+// Internal version only!
+// Wait for the gzip process, and make the last (empty) chunk the current one
+static bool _finishGzipStream (GzipStream* stream)
+{
+    close(stream->fd);
+    stream->fd = NO_PIPE_FD;
+
+    int status;
+    int return_value = waitpid(stream->pid, &status, 0);
+    stream->pid = 0;
+    if (return_value < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printWarning("Warning: gzip failed in _finishGzipStream()");
+        return false;
+    }
+
+    memcpy(stream->chunk, "0\r\n\r\n", 5);
+    stream->chunk_length = 5;
+    stream->chunk_offset = 0;
+    stream->is_finished  = true;
+
+    return true;
+}
+
+// Read the next chunk from the gzip process (if it has produced some data already),
+// once the current chunk has been sent
+// Return false if the compression failed (the stream cannot be completed anymore)
+bool readGzipStreamChunk (GzipStream* stream)
+{
+    char* data = stream->chunk + GZIP_STREAM_CHUNK_PREFIX_SIZE;
+
+    int nb_bytes_read = read(stream->fd, data, GZIP_STREAM_CHUNK_SIZE);
+    if (nb_bytes_read < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+            return true;
+
+        handleError("read() failed in readGzipStreamChunk()");
+        return false;
+    }
+
+    if (nb_bytes_read == 0)
+        return _finishGzipStream(stream);
+
+    _appendToOutput(stream, data, nb_bytes_read);
+
+    // The size line (in hexadecimal) is written right before the data
+    char size_line[GZIP_STREAM_CHUNK_PREFIX_SIZE + 1];
+    int size_line_length = snprintf(size_line, sizeof(size_line), "%x\r\n", nb_bytes_read);
+
+    stream->chunk_offset = GZIP_STREAM_CHUNK_PREFIX_SIZE - size_line_length;
+    memcpy(stream->chunk + stream->chunk_offset, size_line, size_line_length);
+
+    memcpy(data + nb_bytes_read, "\r\n", 2);
+    stream->chunk_length = GZIP_STREAM_CHUNK_PREFIX_SIZE + nb_bytes_read + 2;
+
+    return true;
+}
+
+// Return the whole compressed output (or NULL if it has not been kept),
+// which must then be freed by the caller
+char* takeGzipStreamOutput (GzipStream* stream, int* length)
+{
+    char* output = stream->output;
+    if (output == NULL)
+        return NULL;
+
+    *length        = stream->output_length;
+    stream->output = NULL;
+
+    return realloc(output, MAX(*length, 1));
+}
+
+// -----------------------------------------------------------------------------
+// STORE OF COMPRESSED OUTPUTS
+// -----------------------------------------------------------------------------
+
+CompressedStore* createCompressedStore (const int max_size)
+{
+    CompressedStore* new_store = malloc(sizeof(CompressedStore));
+    if (new_store == NULL)
+        handleErrorAndExit("malloc() failed in createCompressedStore()");
+
+    new_store->most_recently_used  = NULL;
+    new_store->least_recently_used = NULL;
+    new_store->size                = 0;
+    new_store->max_size            = max_size;
+
+    return new_store;
+}
+
+// Warning: the outputs still in use are deleted as well!
+void deleteCompressedStore (CompressedStore* store)
+{
+    CompressedOutput* output = store->most_recently_used;
+    while (output != NULL)
+    {
+        CompressedOutput* next_output = output->next;
+
+        free(output->content);
+        free(output);
+
+        output = next_output;
+    }
+
+    free(store);
+}
+
+// Internal version only!
+static void _removeFromStore (CompressedStore* store, CompressedOutput* output)
+{
+    if (output->previous != NULL)
+        output->previous->next = output->next;
+    else
+        store->most_recently_used = output->next;
+
+    if (output->next != NULL)
+        output->next->previous = output->previous;
+    else
+        store->least_recently_used = output->previous;
+}
+
+// Internal version only!
+static void _insertInStore (CompressedStore* store, CompressedOutput* output)
+{
+    output->previous = NULL;
+    output->next     = store->most_recently_used;
+
+    if (store->most_recently_used != NULL)
+        store->most_recently_used->previous = output;
+    else
+        store->least_recently_used = output;
+
+    store->most_recently_used = output;
+}
+
+// Internal version only!
+static void _evictFromStore (CompressedStore* store, CompressedOutput* output)
+{
+    _removeFromStore(store, output);
+    store->size -= output->length;
+
+    free(output->content);
+    free(output);
+}
+
+// Internal version only!
+// Return the stored output of the given file (or NULL if there is none)
+// An output is stale once the file has been modified (its entity tag is then replaced,
+// see invalidateFilesWithPrefix()): it is evicted, unless it is in use
+static CompressedOutput* _findInStore (CompressedStore* store, const File* file)
+{
+    CompressedOutput* output = store->most_recently_used;
+    while (output != NULL && output->file != file)
+        output = output->next;
+
+    if (output != NULL && output->etag != file->etag && output->nb_users == 0)
+    {
+        _evictFromStore(store, output);
+        return NULL;
+    }
+
+    return output;
+}
+
+// Return the stored output of the current version of the given file (or NULL if there is none)
+// It cannot be evicted until it is released
+CompressedOutput* acquireCompressedOutput (CompressedStore* store, File* file)
+{
+    CompressedOutput* output = _findInStore(store, file);
+    if (output == NULL || output->etag != file->etag)
+        return NULL;
+
+    _removeFromStore(store, output);
+    _insertInStore(store, output);
+
+    output->nb_users++;
+    return output;
+}
+
+void releaseCompressedOutput (CompressedStore* store, CompressedOutput* output)
+{
+    (void) store;
+    output->nb_users--;
+}
+
+// Store the compressed output of a file (the store becomes the owner of the content),
+// by evicting the least recently used outputs (which are not in use) if required
+// If the output cannot fit, or if the file already has one, it is simply freed
+void storeCompressedOutput (CompressedStore* store, File* file, char* content, const int length)
+{
+    CompressedOutput* output = _findInStore(store, file);
+    if (output != NULL || length > store->max_size)
+    {
+        free(content);
+        return;
+    }
+
+    output = store->least_recently_used;
+    while (output != NULL && store->size + length > store->max_size)
+    {
+        CompressedOutput* previous_output = output->previous;
+
+        if (output->nb_users == 0)
+            _evictFromStore(store, output);
+
+        output = previous_output;
+    }
+
+    if (store->size + length > store->max_size)
+    {
+        free(content);
+        return;
+    }
+
+    output = malloc(sizeof(CompressedOutput));
+    if (output == NULL)
+        handleErrorAndExit("malloc() failed in storeCompressedOutput()");
+
+    output->file     = file;
+    output->etag     = file->etag;
+    output->content  = content;
+    output->length   = length;
+    output->nb_users = 0;
+
+    _insertInStore(store, output);
+    store->size += length;
+}
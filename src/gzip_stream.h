@@ -0,0 +1,74 @@
+#ifndef __H_GZIP_STREAM__
+#define __H_GZIP_STREAM__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "file_cache.h"
+
+// Structures representing files compressed on the fly (by a gzip process),
+// and a store of the complete compressed outputs, for the next requests
+
+// The compressed data is sent in chunks (as the chunked transfer coding),
+// one chunk being read from gzip each time the previous one has been sent
+typedef struct GzipStream {
+    pid_t pid; // 0 once the process has been waited for
+    int   fd;  // Read end of the output pipe of gzip (non-blocking)
+
+    // Current chunk (including its size line and final CRLF)
+    char* chunk;
+    int   chunk_length;
+    int   chunk_offset;
+    bool  is_finished; // True once the last (empty) chunk is the current one
+
+    // Whole compressed output, kept to be stored (NULL once it is too large)
+    char* output;
+    int   output_length;
+    int   output_buffer_length;
+    int   output_max_length;
+} GzipStream;
+
+// Stored outputs are shared by the answers using them, and evicted when unused
+typedef struct CompressedOutput {
+    File*       file; // Key
+    const char* etag; // Of the file when it was compressed (see acquireCompressedOutput())
+    char*       content;
+    int   length;
+    int   nb_users;
+
+    // Outputs form a LRU list (from the most to the least recently used one)
+    struct CompressedOutput* previous;
+    struct CompressedOutput* next;
+} CompressedOutput;
+
+typedef struct CompressedStore {
+    CompressedOutput* most_recently_used;
+    CompressedOutput* least_recently_used;
+
+    int size;     // Sum of the lengths of the outputs
+    int max_size;
+} CompressedStore;
+
+// -----------------------------------------------------------------------------
+
+#define GZIP_STREAM_CHUNK_SIZE        16384 // bytes (of compressed data per chunk)
+#define GZIP_STREAM_CHUNK_PREFIX_SIZE 8     // bytes (room for the size line)
+
+// -----------------------------------------------------------------------------
+
+GzipStream* createGzipStream (const char* path, const int output_max_length,
+                              const int compression_level);
+void deleteGzipStream (GzipStream* stream);
+
+bool gzipStreamNeedsData (const GzipStream* stream);
+bool gzipStreamIsComplete (const GzipStream* stream);
+bool readGzipStreamChunk (GzipStream* stream);
+char* takeGzipStreamOutput (GzipStream* stream, int* length);
+
+CompressedStore* createCompressedStore (const int max_size);
+void deleteCompressedStore (CompressedStore* store);
+
+CompressedOutput* acquireCompressedOutput (CompressedStore* store, File* file);
+void releaseCompressedOutput (CompressedStore* store, CompressedOutput* output);
+void storeCompressedOutput (CompressedStore* store, File* file, char* content, const int length);
+
+#endif
@@ -1,10 +1,18 @@
+// Macro definition required for using strptime() and timegm()
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
 #include <time.h>
 #include "toolbox.h"
 #include "file_cache.h"
 #include "parse_header.h"
+#include "metrics.h"
 #include "http.h"
 
 // -----------------------------------------------------------------------------
@@ -22,7 +30,8 @@ HttpHeader* createHttpHeader ()
 
 void deleteHttpHeader (HttpHeader* header)
 {
-    // TODO: free tons of strings (or other kinds of objects), used by header fields
+    // Only the request target is allocated; the other fields point to buffers owned by others
+    free(header->requestTarget);
     free(header);
 }
 
@@ -35,15 +44,34 @@ void initRequestHttpHeader (HttpHeader* header)
     
     header->requestType   = HTTP_NO_REQUEST_TYPE;
     
-    header->query            = NULL;
-    header->host             = NULL;
-    header->accept           = NULL;
-    header->requestTarget    = NULL;
-    header->content_length   = 0;
-    header->content_type     = NULL;
-    header->content_encoding = NULL;
-    header->date             = NULL;
-    header->server           = NULL;
+    header->query             = NULL;
+    header->host              = NULL;
+    header->accept            = NULL;
+    header->accept_encoding   = NULL;
+    header->requestTarget     = NULL;
+    header->target_in_buffer  = NULL;
+    header->content_length    = 0;
+    header->content_type      = NULL;
+    header->content_encoding  = NULL;
+    header->transfer_encoding = NULL;
+    header->vary              = NULL;
+    header->date              = NULL;
+    header->server            = NULL;
+    header->retry_after       = NULL;
+    header->connection        = NULL;
+
+    header->etag              = NULL;
+    header->last_modified     = NULL;
+    header->if_none_match     = NULL;
+    header->if_modified_since = NULL;
+
+    header->range         = NULL;
+    header->if_range      = NULL;
+    header->accept_ranges = NULL;
+    header->content_range = NULL;
+
+    header->prerendered        = NULL;
+    header->prerendered_length = 0;
 }
 
 // Made for headers of outgoing messages (i.e. built by the server to answer requests)
@@ -56,22 +84,41 @@ void initAnswerHttpHeader (HttpHeader* header,
 
     header->requestType = HTTP_NO_REQUEST_TYPE;
     
-    header->query            = NULL;
-    header->host             = NULL;
-    header->accept           = NULL;
-    header->requestTarget    = NULL;
-    header->content_length   = 0;
-    header->content_type     = NULL;
-    header->content_encoding = NULL;
-    header->date             = NULL;
-    header->server           = NULL;
+    header->query             = NULL;
+    header->host              = NULL;
+    header->accept            = NULL;
+    header->accept_encoding   = NULL;
+    header->requestTarget     = NULL;
+    header->target_in_buffer  = NULL;
+    header->content_length    = 0;
+    header->content_type      = NULL;
+    header->content_encoding  = NULL;
+    header->transfer_encoding = NULL;
+    header->vary              = NULL;
+    header->date              = NULL;
+    header->server            = NULL;
+    header->retry_after       = NULL;
+    header->connection        = NULL;
+
+    header->etag              = NULL;
+    header->last_modified     = NULL;
+    header->if_none_match     = NULL;
+    header->if_modified_since = NULL;
+
+    header->range         = NULL;
+    header->if_range      = NULL;
+    header->accept_ranges = NULL;
+    header->content_range = NULL;
+
+    header->prerendered        = NULL;
+    header->prerendered_length = 0;
 }
 
 // -----------------------------------------------------------------------------
 
 HttpContent* createHttpContent ()
 {
-    HttpContent* new_content = malloc(sizeof(HttpContent));
+    HttpContent* new_content = calloc(1, sizeof(HttpContent));
     if (new_content == NULL)
         handleErrorAndExit("malloc() failed in createHttpContent()");
 
@@ -80,9 +127,12 @@ HttpContent* createHttpContent ()
 
 void deleteHttpContent (HttpContent* content)
 {
+    free(content->parts);
+    free(content->parts_headers);
     free(content);
 }
 
+// The parts of a previous content are freed
 void initEmptyHttpContent (HttpContent* content)
 {
     content->length = 0;
@@ -90,9 +140,18 @@ void initEmptyHttpContent (HttpContent* content)
     content->body   = NULL;
 
     content->content_is_loaded = false;
+    content->file              = NULL;
     content->file_path         = NULL;
     content->file_fd           = NO_FD;
     content->file_offset       = 0;
+
+    free(content->parts);
+    free(content->parts_headers);
+
+    content->parts         = NULL;
+    content->nb_parts      = 0;
+    content->current_part  = 0;
+    content->parts_headers = NULL;
 }
 
 // -----------------------------------------------------------------------------
@@ -149,6 +208,10 @@ char* getHttpCodeDescription (const HttpCode http_code)
     {
         case HTTP_200:
             return "OK";
+        case HTTP_206:
+            return "Partial content";
+        case HTTP_304:
+            return "Not modified";
         case HTTP_400:
             return "Bad request";
         case HTTP_401:
@@ -161,6 +224,10 @@ char* getHttpCodeDescription (const HttpCode http_code)
             return "Length required";
         case HTTP_414:
             return "Too-long URI";
+        case HTTP_416:
+            return "Range not satisfiable";
+        case HTTP_429:
+            return "Too many requests";
         case HTTP_500:
             return "Internal server error";
         case HTTP_501:
@@ -210,17 +277,22 @@ char* getHttpMethodAsString (const HttpMethod http_method)
 // HTTP OPTION FIELDS-RELATED FUNCTIONS
 // -----------------------------------------------------------------------------
 
-// TODO: improve this
+// The date is only formatted again when the current second changes
 char* getHttpServerDate ()
 {
-    static char date_string[256];
+    static char   date_string[256];
+    static time_t date_string_time = -1;
 
     // Get current GMT/UTC time and date
-    time_t     current_time = time(NULL);
+    time_t current_time = time(NULL);
+    if (current_time == date_string_time)
+        return date_string;
+
     struct tm* current_date = gmtime(&current_time);
 
     // Print them according to a specified format
     strftime(date_string, 256, HTTP_TIME_FORMAT_STR, current_date);
+    date_string_time = current_time;
 
     return date_string;
 }
@@ -240,13 +312,77 @@ void prepareGeneralHttpAnswer (HttpMessage* answer, HttpCode http_code)
     answer->header->date   = getHttpServerDate();
 }
 
+// Internal version only!
+// The header of the answer is rendered once per code and per second (for its date),
+// and then shared by all the answers with this code (unless too many codes are used)
+static void _usePrerenderedHttpError (HttpMessage* answer)
+{
+    static PrerenderedHttpError prerendered_errors[HTTP_NB_PRERENDERED_ERRORS];
+
+    HttpCode http_code = answer->header->code;
+    PrerenderedHttpError* prerendered_error = NULL;
+
+    for (int i = 0; i < HTTP_NB_PRERENDERED_ERRORS; i++)
+    {
+        if (prerendered_errors[i].header_length == 0)
+        {
+            prerendered_errors[i].code      = http_code;
+            prerendered_errors[i].date_time = -1;
+        }
+
+        if (prerendered_errors[i].code == http_code)
+        {
+            prerendered_error = &prerendered_errors[i];
+            break;
+        }
+    }
+
+    if (prerendered_error == NULL)
+        return;
+
+    time_t current_time = time(NULL);
+    if (prerendered_error->date_time != current_time)
+    {
+        int header_length = renderHttpAnswerHeader(answer->header, prerendered_error->header,
+                                                   HTTP_PRERENDERED_ERROR_MAX_LENGTH);
+        if (header_length < 0)
+            return;
+
+        prerendered_error->header_length = header_length;
+        prerendered_error->date_time     = current_time;
+    }
+
+    answer->header->prerendered        = prerendered_error->header;
+    answer->header->prerendered_length = prerendered_error->header_length;
+}
+
 // Set fields required for a (generic) HTTP error answer
+// Its header is pre-rendered: no other field can be set afterwards
 void prepareHttpError (HttpMessage* answer, HttpCode http_code)
 {
     prepareGeneralHttpAnswer(answer, http_code);
 
     // Set header fields
     answer->header->content_length = 0;
+
+    _usePrerenderedHttpError(answer);
+}
+
+// Set fields required for an answer refusing a client (503 when the server is overloaded,
+// 429 when the client exceeds its limits): it should retry after the given delay,
+// and the connection is closed right after the answer
+// Its header is pre-rendered like the ones of errors (no other answer with the same code
+// must be produced)
+void prepareHttpRefusal (HttpMessage* answer, HttpCode http_code, char* retry_after)
+{
+    prepareGeneralHttpAnswer(answer, http_code);
+
+    // Set header fields
+    answer->header->content_length = 0;
+    answer->header->retry_after    = retry_after;
+    answer->header->connection     = "close";
+
+    _usePrerenderedHttpError(answer);
 }
 
 // Set fields required for a (generic) HTTP valid answer
@@ -257,9 +393,19 @@ void prepareHttpValidAnswer (HttpMessage* request, HttpMessage* answer, File* fi
     // Set header fields
     answer->header->content_length   = file->size;
     answer->header->content_type     = file->type;
-    answer->header->content_encoding = file->encoding == ENCODING_GZIP
-                                     ? "gzip"
-                                     : "identity";
+    answer->header->content_encoding = file->encoding != ENCODING_NONE
+                                     ? getFileEncodingName(file->encoding)
+                                     : NULL;
+    answer->header->etag             = file->etag;
+    answer->header->last_modified    = file->last_modified;
+    answer->header->accept_ranges    = "bytes";
+
+    // The answer depends on the encodings accepted by the client if there are sidecars
+    if (file->is_negotiated)
+        answer->header->vary = "Accept-Encoding";
+
+    // The file of the answer is always known (e.g. to send it differently)
+    answer->content->file = file;
 
     // Set body fields (HEAD requests expect no body)
     // Curently, only GET and HEAD are supported
@@ -281,6 +427,434 @@ void prepareHttpValidAnswer (HttpMessage* request, HttpMessage* answer, File* fi
     }
 }
 
+// Set fields required for a 304 answer: only the validators (pre-computed
+// when the cache was built) are sent, and neither a body nor its length
+void prepareHttpNotModifiedAnswer (HttpMessage* answer, File* file)
+{
+    prepareGeneralHttpAnswer(answer, HTTP_304);
+
+    answer->header->content_length = -1;
+    answer->header->etag           = file->etag;
+    answer->header->last_modified  = file->last_modified;
+
+    if (file->is_negotiated)
+        answer->header->vary = "Accept-Encoding";
+}
+
+// Set fields required for a 206 answer, whose body only contains the given ranges of the file
+// Several ranges are sent as a multipart/byteranges body, each part having its own header
+// (only for a representation without encoding: see produceHttpAnswerFromRequest())
+void prepareHttpPartialAnswer (HttpMessage* request, HttpMessage* answer, File* file,
+                               const HttpRange ranges[], const int nb_ranges)
+{
+    prepareHttpValidAnswer(request, answer, file);
+    answer->header->code = HTTP_206;
+
+    HttpHeader*  header  = answer->header;
+    HttpContent* content = answer->content;
+
+    // Case 1: a single range is sent as is
+    if (nb_ranges == 1)
+    {
+        off_t range_length = ranges[0].last - ranges[0].first + 1;
+
+        snprintf(header->content_range_buffer, sizeof(header->content_range_buffer),
+                 "bytes %lld-%lld/%lld", (long long) ranges[0].first, (long long) ranges[0].last,
+                 (long long) file->size);
+        header->content_range  = header->content_range_buffer;
+        header->content_length = range_length;
+
+        content->length = range_length;
+        if (content->content_is_loaded)
+            content->body        = file->content + ranges[0].first;
+        else
+            content->file_offset = ranges[0].first;
+
+        return;
+    }
+
+    // Case 2: each range is preceded by a part header, and the body ends with a last boundary
+    // (each part header is sized from the type it contains, so that it cannot be truncated)
+    char*  type             = file->type != NULL ? file->type : "application/octet-stream";
+    size_t part_header_size = strlen(type) + HTTP_MULTIPART_HEADER_SIZE;
+
+    content->nb_parts      = 2 * nb_ranges + 1;
+    content->parts         = malloc(content->nb_parts * sizeof(HttpContentPart));
+    content->parts_headers = malloc((nb_ranges + 1) * part_header_size * sizeof(char));
+    if (content->parts == NULL || content->parts_headers == NULL)
+        handleErrorAndExit("malloc() failed in prepareHttpPartialAnswer()");
+
+    char* part_header = content->parts_headers;
+    off_t body_length = 0;
+
+    for (int i = 0; i < nb_ranges; i++)
+    {
+        HttpContentPart* header_part = &content->parts[2 * i];
+        HttpContentPart* data_part   = &content->parts[2 * i + 1];
+
+        header_part->body        = part_header;
+        header_part->file_offset = 0;
+        header_part->length      = snprintf(part_header, part_header_size,
+                                            "\r\n--%s\r\nContent-Type: %s\r\n"
+                                            "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                            HTTP_MULTIPART_BOUNDARY, type,
+                                            (long long) ranges[i].first, (long long) ranges[i].last,
+                                            (long long) file->size);
+        part_header += header_part->length;
+
+        data_part->length      = ranges[i].last - ranges[i].first + 1;
+        data_part->file_offset = ranges[i].first;
+        data_part->body        = content->content_is_loaded
+                               ? file->content + ranges[i].first
+                               : NULL;
+
+        body_length += header_part->length + data_part->length;
+    }
+
+    HttpContentPart* last_part = &content->parts[content->nb_parts - 1];
+    last_part->body        = part_header;
+    last_part->file_offset = 0;
+    last_part->length      = snprintf(part_header, part_header_size,
+                                      "\r\n--%s--\r\n", HTTP_MULTIPART_BOUNDARY);
+    body_length += last_part->length;
+
+    // The parts are not encoded (and neither is the multipart body)
+    header->content_type     = "multipart/byteranges; boundary=" HTTP_MULTIPART_BOUNDARY;
+    header->content_encoding = NULL;
+    header->content_length   = body_length;
+    content->length        = body_length;
+}
+
+// Set fields required for a 416 answer, which gives the current length of the file
+void prepareHttpRangeNotSatisfiable (HttpMessage* answer, File* file)
+{
+    prepareGeneralHttpAnswer(answer, HTTP_416);
+    answer->header->content_length = 0;
+
+    snprintf(answer->header->content_range_buffer, sizeof(answer->header->content_range_buffer),
+             "bytes */%lld", (long long) file->size);
+    answer->header->content_range = answer->header->content_range_buffer;
+}
+
+// Turn a valid answer for a file into an answer whose body is compressed with gzip,
+// which is streamed in chunks (unless its compressed content is set afterwards)
+// The compressed representation has its own entity tag, so it may actually be
+// the one the client has: return false if a 304 answer has been prepared instead
+bool prepareHttpCompressedAnswer (HttpMessage* request, HttpMessage* answer, File* file)
+{
+    HttpHeader* header = answer->header;
+
+    // The entity tag of the file is suffixed (inside its quotes)
+    char* etag = NULL;
+    if (file->etag != NULL)
+    {
+        snprintf(header->etag_buffer, sizeof(header->etag_buffer),
+                 "%.*s-gzip\"", (int) strlen(file->etag) - 1, file->etag);
+        etag = header->etag_buffer;
+    }
+
+    if (request->header->if_none_match != NULL
+    &&  entityTagListMatches(request->header->if_none_match, etag))
+    {
+        prepareHttpNotModifiedAnswer(answer, file);
+        header->etag = etag;
+        header->vary = "Accept-Encoding";
+        return false;
+    }
+
+    header->content_length    = -1;
+    header->content_encoding  = "gzip";
+    header->transfer_encoding = "chunked";
+    header->vary              = "Accept-Encoding";
+    header->etag              = etag;
+
+    // The body is not the file anymore: it is produced by the caller
+    answer->content->length            = 0;
+    answer->content->body              = NULL;
+    answer->content->file_path         = NULL;
+    answer->content->content_is_loaded = true;
+
+    return true;
+}
+
+// Use an already compressed content as the body of a compressed answer,
+// which is then sent as a whole (and not in chunks)
+void setHttpCompressedContent (HttpMessage* request, HttpMessage* answer,
+                               char* compressed_content, const int length)
+{
+    answer->header->content_length    = length;
+    answer->header->transfer_encoding = NULL;
+
+    if (request->header->method == HTTP_GET)
+    {
+        answer->content->length = length;
+        answer->content->body   = compressed_content;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CONDITIONAL REQUESTS
+// -----------------------------------------------------------------------------
+
+// Return true if the given If-None-Match value is "*", or contains the given entity tag
+// The weak comparison is used, as required for If-None-Match ("W/" prefixes are ignored)
+bool entityTagListMatches (const char* entity_tag_list, const char* etag)
+{
+    if (etag == NULL)
+        return false;
+
+    int etag_length = strlen(etag);
+
+    const char* current_tag = entity_tag_list;
+    for (;;)
+    {
+        // Skip the separators
+        while (current_tag[0] == ' ' || current_tag[0] == '\t' || current_tag[0] == ',')
+            current_tag++;
+
+        if (current_tag[0] == '\0')
+            return false;
+
+        if (current_tag[0] == '*')
+            return true;
+
+        if (strncmp(current_tag, "W/", 2) == 0)
+            current_tag += 2;
+
+        // Find the end of the current entity tag
+        const char* tag_end = current_tag;
+        while (tag_end[0] != '\0' && tag_end[0] != ',' && tag_end[0] != ' ' && tag_end[0] != '\t')
+            tag_end++;
+
+        if (tag_end - current_tag == etag_length
+        &&  strncmp(current_tag, etag, etag_length) == 0)
+            return true;
+
+        current_tag = tag_end;
+    }
+}
+
+// Return true if the given content coding is acceptable according to the
+// Accept-Encoding field of the request (i.e. it is listed, or covered by "*",
+// with a non-zero weight), false otherwise (including when there is no such field)
+bool requestAcceptsEncoding (const HttpMessage* request, const char* encoding)
+{
+    const char* current_coding = request->header->accept_encoding;
+    if (current_coding == NULL)
+        return false;
+
+    int  encoding_length    = strlen(encoding);
+    bool wildcard_is_listed = false;
+    bool wildcard_accepts   = false;
+
+    for (;;)
+    {
+        // Skip the separators
+        while (current_coding[0] == ' ' || current_coding[0] == '\t' || current_coding[0] == ',')
+            current_coding++;
+
+        if (current_coding[0] == '\0')
+            break;
+
+        const char* coding_end = current_coding;
+        while (coding_end[0] != '\0' && coding_end[0] != ',' && coding_end[0] != ';'
+           &&  coding_end[0] != ' '  && coding_end[0] != '\t')
+            coding_end++;
+
+        // Look for a weight in the parameters of the coding (the default one is 1)
+        bool        has_zero_weight = false;
+        const char* parameter       = coding_end;
+        while (parameter[0] != '\0' && parameter[0] != ',')
+        {
+            if (parameter[0] == ';')
+            {
+                parameter++;
+                while (parameter[0] == ' ' || parameter[0] == '\t')
+                    parameter++;
+
+                if ((parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=')
+                    has_zero_weight = strtod(parameter + 2, NULL) <= 0;
+            }
+            else
+                parameter++;
+        }
+
+        int coding_length = coding_end - current_coding;
+        if (coding_length == encoding_length
+        &&  strncasecmp(current_coding, encoding, encoding_length) == 0)
+            return ! has_zero_weight;
+
+        // An explicitly listed coding takes precedence over the wildcard
+        if (coding_length == 1 && current_coding[0] == '*')
+        {
+            wildcard_is_listed = true;
+            wildcard_accepts   = ! has_zero_weight;
+        }
+
+        current_coding = parameter;
+    }
+
+    return wildcard_is_listed && wildcard_accepts;
+}
+
+// Return the precompressed version of the file the client prefers (according to
+// the preferences of the server), or the file itself if none is accepted
+File* selectFileRepresentation (const HttpMessage* request, File* file)
+{
+    static const FileEncoding preferred_encodings[] = {
+        ENCODING_BROTLI,
+        ENCODING_ZSTD,
+        ENCODING_GZIP
+    };
+
+    if (! file->is_negotiated)
+        return file;
+
+    for (int i = 0; i < NB_COMPRESSED_ENCODINGS; i++)
+    {
+        File* sidecar = file->sidecars[preferred_encodings[i]];
+        if (sidecar != NULL
+        &&  requestAcceptsEncoding(request, getFileEncodingName(preferred_encodings[i])))
+            return sidecar;
+    }
+
+    return file;
+}
+
+// Return true if the file has been modified after the given date,
+// or if the date is not valid (in which case the condition must be ignored)
+bool fileIsModifiedSince (const File* file, const char* http_date)
+{
+    struct tm date;
+    memset(&date, 0, sizeof(struct tm));
+
+    char* date_end = strptime(http_date, HTTP_TIME_FORMAT_STR, &date);
+    if (date_end == NULL || date_end[0] != '\0')
+        return true;
+
+    return file->modification_time > timegm(&date);
+}
+
+// Return true if the full answer must be sent, false if a 304 answer is enough
+// (RFC 7232: If-Modified-Since is ignored when If-None-Match is present)
+bool requestConditionsAreMet (const HttpMessage* request, const File* file)
+{
+    const HttpHeader* header = request->header;
+
+    if (header->if_none_match != NULL)
+        return ! entityTagListMatches(header->if_none_match, file->etag);
+
+    if (header->if_modified_since != NULL)
+        return fileIsModifiedSince(file, header->if_modified_since);
+
+    return true;
+}
+
+// Return true if the ranges must be sent, i.e. if there is no If-Range field,
+// or if it matches the current version of the file (strong comparison, or exact date)
+bool ifRangeConditionIsMet (const HttpMessage* request, const File* file)
+{
+    const char* if_range = request->header->if_range;
+
+    if (if_range == NULL)
+        return true;
+
+    // Weak entity tags never match
+    if (strncmp(if_range, "W/", 2) == 0)
+        return false;
+
+    if (if_range[0] == '"')
+        return file->etag != NULL && stringsAreEqual(if_range, file->etag);
+
+    return file->last_modified != NULL && stringsAreEqual(if_range, file->last_modified);
+}
+
+// Internal version only!
+// Parse a non-negative integer, and update the given pointer to the first character after it
+// Return -1 if there is no digit
+static long long _parseRangeBound (const char** string)
+{
+    if (! isdigit((unsigned char) (*string)[0]))
+        return -1;
+
+    long long value = 0;
+    while (isdigit((unsigned char) (*string)[0]))
+    {
+        // Any bound too large to be an offset is larger than the representation
+        if (value < LLONG_MAX / 10 - 1)
+            value = value * 10 + ((*string)[0] - '0');
+
+        (*string)++;
+    }
+
+    return value;
+}
+
+// Parse the value of a Range field ("bytes=<first>-<last>, <first>-, -<suffix length>, ...")
+// Unsatisfiable ranges are skipped, and the last positions are bounded by the representation
+// Return the number of ranges written in the given array, or HTTP_INVALID_RANGES if the field
+// must be ignored (unknown unit, bad syntax, or too many ranges)
+int parseHttpRanges (const char* range_value, const off_t representation_length,
+                     HttpRange ranges[], const int max_nb_ranges)
+{
+    if (strncasecmp(range_value, "bytes=", 6) != 0)
+        return HTTP_INVALID_RANGES;
+
+    const char* current_range = range_value + 6;
+    int         nb_ranges     = 0;
+
+    for (;;)
+    {
+        while (current_range[0] == ' ' || current_range[0] == '\t')
+            current_range++;
+
+        long long first = _parseRangeBound(&current_range);
+        if (current_range[0] != '-')
+            return HTTP_INVALID_RANGES;
+        current_range++;
+
+        long long last = _parseRangeBound(&current_range);
+
+        // Suffix range: the last bytes are requested
+        if (first < 0)
+        {
+            if (last < 0)
+                return HTTP_INVALID_RANGES;
+
+            first = MAX(representation_length - last, 0);
+            last  = representation_length - 1;
+
+            if (last < first)
+                first = representation_length; // Empty suffix: not satisfiable
+        }
+        else if (last < 0 || last >= representation_length)
+            last = representation_length - 1;
+        else if (last < first)
+            return HTTP_INVALID_RANGES;
+
+        // Keep the range if at least one of its bytes exists
+        if (first < representation_length)
+        {
+            if (nb_ranges == max_nb_ranges)
+                return HTTP_INVALID_RANGES;
+
+            ranges[nb_ranges].first = first;
+            ranges[nb_ranges].last  = last;
+            nb_ranges++;
+        }
+
+        while (current_range[0] == ' ' || current_range[0] == '\t')
+            current_range++;
+
+        if (current_range[0] == '\0')
+            return nb_ranges;
+
+        if (current_range[0] != ',')
+            return HTTP_INVALID_RANGES;
+        current_range++;
+    }
+}
+
 // -----------------------------------------------------------------------------
 // HTTP REQUEST PARSING AND ANSWERING
 // -----------------------------------------------------------------------------
@@ -290,11 +864,14 @@ void prepareHttpValidAnswer (HttpMessage* request, HttpMessage* answer, File* fi
 
 HttpCode parseHttpRequest (HttpMessage* request, char* buffer)
 {
-    // Clear the request message structure
+    // Clear the request message structure (the target of the previous request is freed)
+    free(request->header->requestTarget);
     initRequestHttpMessage(request);
 
     int http_code = parseHttpHeaderFirstLine(request->header, buffer);
-    // TODO: handle the rest of the header
+    if (http_code == HTTP_200)
+        http_code = parseHttpHeaderFields(request->header, buffer);
+
     // TODO: handle more of HTTP 1.1
     // TODO: handle body data
 
@@ -302,13 +879,15 @@ HttpCode parseHttpRequest (HttpMessage* request, char* buffer)
 }
 
 // Produce a HTTP answer from a parsed request
-void produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, FileCache* cache)
+// Return the requested file if its content must be loaded before answering
+// (the answer is then left unprepared), or NULL otherwise
+File* produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, FileCache* cache)
 {
     // If there has been an error while parsing the request, produce an error message
     if (request->header->code != HTTP_200)
     {
         prepareHttpError(answer, request->header->code);
-        return;
+        return NULL;
     }
 
     // If the HTTP version is 1.0 or 2.0, it is not supported by the server
@@ -316,14 +895,14 @@ void produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, Fi
     if (request->header->version != HTTP_V1_1)
     {
         prepareHttpError(answer, HTTP_505);
-        return;
+        return NULL;
     }
 
     // If the method is unknown, answer with an error 400
     if (request->header->method == HTTP_UNKNOWN_METHOD)
     {
         prepareHttpError(answer, HTTP_400);
-        return;
+        return NULL;
     }
 
     // If the method is neither GET nor HEAD, it is not implemented (yet)
@@ -332,46 +911,116 @@ void produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, Fi
     &&  request->header->method != HTTP_HEAD)
     {
         prepareHttpError(answer, HTTP_501);
-        return;
+        return NULL;
     }
 
     // If the specified path is not the standard one, answer with an error 400
     if (request->header->requestType != HTTP_ORIGIN_FORM)
     {
         prepareHttpError(answer, HTTP_400);
-        return;
+        return NULL;
     }
 
     // Otherwise, try to fetch the requested file
-    File* requested_file = findFileInCache(cache, request->header->requestTarget);
+    // (the target is matched where it is, in the request line)
+    CacheLookupResult lookup_result;
+    File* requested_file = findFileInCache(cache, request->header->target_in_buffer, &lookup_result);
+
+    countCacheLookup(lookup_result == LOOKUP_HIT);
+    if (lookup_result == LOOKUP_MISS_FILTERED || lookup_result == LOOKUP_MISS_NEGATIVE)
+        countCacheMissShortcut(lookup_result == LOOKUP_MISS_FILTERED);
 
     // If the file is not found, answer with an error 404
     if (requested_file == NOT_FOUND)
     {
         prepareHttpError(answer, HTTP_404);
-        return;
+        return NULL;
+    }
+
+    // If the client accepts a precompressed version of the file, send it instead
+    requested_file = selectFileRepresentation(request, requested_file);
+
+    // If the client already has the current version of the file, answer with a 304 code
+    if (! requestConditionsAreMet(request, requested_file))
+    {
+        prepareHttpNotModifiedAnswer(answer, requested_file);
+        return NULL;
+    }
+
+    // If the content of the file has not been loaded yet, the answer must wait for it
+    if (fileContentIsPending(requested_file))
+        return requested_file;
+
+    // If only some ranges of the file are requested (for its current version),
+    // answer with a 206 code, or a 416 one if none of these ranges exists
+    if (request->header->method == HTTP_GET
+    &&  request->header->range != NULL
+    &&  ifRangeConditionIsMet(request, requested_file))
+    {
+        HttpRange ranges[HTTP_MAX_NB_RANGES];
+        int nb_ranges = parseHttpRanges(request->header->range, requested_file->size,
+                                        ranges, HTTP_MAX_NB_RANGES);
+
+        if (nb_ranges == 0)
+        {
+            prepareHttpRangeNotSatisfiable(answer, requested_file);
+            return NULL;
+        }
+
+        // The Content-Encoding of an encoded representation would apply to a whole
+        // multipart body: several ranges of it are ignored (it is sent entirely)
+        if (nb_ranges != HTTP_INVALID_RANGES
+        &&  (nb_ranges == 1 || requested_file->encoding == ENCODING_NONE))
+        {
+            prepareHttpPartialAnswer(request, answer, requested_file, ranges, nb_ranges);
+            return NULL;
+        }
     }
 
-    // If it is found, correctly answer with a 200 code
+    // Otherwise, correctly answer with a 200 code
     prepareHttpValidAnswer(request, answer, requested_file);
+    return NULL;
 }
 
 // -----------------------------------------------------------------------------
 // HTTP ANSWER HEADER FILLING
 // -----------------------------------------------------------------------------
 
-// Return the number of bytes actually written in the given buffer
+// Internal version only!
+// Append a formatted field to the header in the buffer, and return its new length
+// Once a field does not fit, the buffer is full: its whole length is returned
+static int _appendToHttpHeader (char* buffer, const int buffer_length, const int buffer_max_length,
+                                const char* format, ...)
+{
+    if (buffer_length >= buffer_max_length)
+        return buffer_max_length;
+
+    va_list args;
+    va_start(args, format);
+
+    int nb_bytes_written = vsnprintf(buffer + buffer_length, buffer_max_length - buffer_length,
+                                     format, args);
+
+    va_end(args);
+
+    if (nb_bytes_written < 0 || nb_bytes_written >= buffer_max_length - buffer_length)
+        return buffer_max_length;
+
+    return buffer_length + nb_bytes_written;
+}
+
+// Return the number of bytes actually written in the given buffer (or its length, if it is full)
 int writeHttpAnswerFirstLine (const HttpHeader* answer_header,
                               char* answer_header_buffer, const int buffer_max_length)
 {
     // Expected format: <version> <code> <message> (CLRF)
-    return snprintf(answer_header_buffer, buffer_max_length, "%s %d %s\r\n",
-                    HTTP_SERVER_VERSION,
-                    getHttpCodeValue(answer_header->code),
-                    getHttpCodeDescription(answer_header->code)); 
+    return _appendToHttpHeader(answer_header_buffer, 0, buffer_max_length, "%s %d %s\r\n",
+                               HTTP_SERVER_VERSION,
+                               getHttpCodeValue(answer_header->code),
+                               getHttpCodeDescription(answer_header->code));
 }
 
-// Return the number of bytes actually written in the given buffer
+// Return the number of bytes actually written in the given buffer (or its length, if it is full)
 int writeHttpOptionFields (const HttpHeader* answer_header,
                            char* answer_header_buffer, const int buffer_max_length)
 {
@@ -379,48 +1028,99 @@ int writeHttpOptionFields (const HttpHeader* answer_header,
 
     // Any answer field whose value is not NULL/>=0 is written in the buffer, each ending by (CLRF)
     if (answer_header->content_length >= 0)
-        nb_bytes_written += snprintf(answer_header_buffer,
-                                     buffer_max_length - nb_bytes_written,
-                                     "Content-Length: %d\r\n", answer_header->content_length);
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Content-Length: %lld\r\n",
+                                               (long long) answer_header->content_length);
 
     if (answer_header->content_type != NULL)
-        nb_bytes_written += snprintf(answer_header_buffer + nb_bytes_written,
-                                     buffer_max_length - nb_bytes_written,
-                                     "Content-Type: %s\r\n", answer_header->content_type);
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Content-Type: %s\r\n", answer_header->content_type);
 
     if (answer_header->content_encoding != NULL)
-        nb_bytes_written += snprintf(answer_header_buffer + nb_bytes_written,
-                                     buffer_max_length - nb_bytes_written,
-                                     "Content-Encoding: %s\r\n", answer_header->content_encoding);
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Content-Encoding: %s\r\n", answer_header->content_encoding);
+
+    if (answer_header->transfer_encoding != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Transfer-Encoding: %s\r\n", answer_header->transfer_encoding);
+
+    if (answer_header->vary != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Vary: %s\r\n", answer_header->vary);
+
+    if (answer_header->content_range != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Content-Range: %s\r\n", answer_header->content_range);
+
+    if (answer_header->accept_ranges != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Accept-Ranges: %s\r\n", answer_header->accept_ranges);
+
+    if (answer_header->etag != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "ETag: %s\r\n", answer_header->etag);
+
+    if (answer_header->last_modified != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Last-Modified: %s\r\n", answer_header->last_modified);
+
+    if (answer_header->retry_after != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Retry-After: %s\r\n", answer_header->retry_after);
+
+    if (answer_header->connection != NULL)
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Connection: %s\r\n", answer_header->connection);
 
     if (answer_header->date != NULL)
-        nb_bytes_written += snprintf(answer_header_buffer + nb_bytes_written,
-                                     buffer_max_length - nb_bytes_written,
-                                     "Date: %s\r\n", answer_header->date);
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Date: %s\r\n", answer_header->date);
 
     if (answer_header->server != NULL)
-        nb_bytes_written += snprintf(answer_header_buffer + nb_bytes_written,
-                                     buffer_max_length - nb_bytes_written,
-                                     "Server: %s\r\n", answer_header->server);
+        nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                               "Server: %s\r\n", answer_header->server);
 
-    return nb_bytes_written;   
+    return nb_bytes_written;
 }
 
-// Return the number of bytes actually written in the given buffer
-int fillHttpAnswerHeaderBuffer (HttpMessage* answer,
-                                char* answer_header_buffer, const int buffer_max_length)
+// Return the number of bytes actually written in the given buffer,
+// or -1 if the header does not fit in it (it must not be sent then)
+int renderHttpAnswerHeader (const HttpHeader* answer_header,
+                            char* answer_header_buffer, const int buffer_max_length)
 {
     // Fill the buffer with the (special) first line + all the filled option fields
     int nb_bytes_written = 0;
 
-    nb_bytes_written += writeHttpAnswerFirstLine(answer->header, answer_header_buffer, buffer_max_length);
-    nb_bytes_written += writeHttpOptionFields(answer->header, answer_header_buffer + nb_bytes_written,
+    nb_bytes_written += writeHttpAnswerFirstLine(answer_header, answer_header_buffer, buffer_max_length);
+    nb_bytes_written += writeHttpOptionFields(answer_header, answer_header_buffer + nb_bytes_written,
                                               buffer_max_length - nb_bytes_written);
 
     // Add a blank line separating the header from the body
-    nb_bytes_written += snprintf(answer_header_buffer + nb_bytes_written,
-                                 buffer_max_length - nb_bytes_written,
-                                 "\r\n");
+    nb_bytes_written = _appendToHttpHeader(answer_header_buffer, nb_bytes_written, buffer_max_length,
+                                           "\r\n");
+
+    if (nb_bytes_written >= buffer_max_length)
+        return -1;
 
     return nb_bytes_written;
 }
+
+// Return the number of bytes actually written in the given buffer,
+// or -1 if the header does not fit in it (it must not be sent then)
+// (the pre-rendered header of the answer is copied, if it has one)
+int fillHttpAnswerHeaderBuffer (HttpMessage* answer,
+                                char* answer_header_buffer, const int buffer_max_length)
+{
+    const HttpHeader* answer_header = answer->header;
+
+    if (answer_header->prerendered != NULL)
+    {
+        if (answer_header->prerendered_length > buffer_max_length)
+            return -1;
+
+        memcpy(answer_header_buffer, answer_header->prerendered, answer_header->prerendered_length);
+        return answer_header->prerendered_length;
+    }
+
+    return renderHttpAnswerHeader(answer_header, answer_header_buffer, buffer_max_length);
+}
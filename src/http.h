@@ -29,12 +29,16 @@ typedef enum HttpMethod {
 // Note: there are many more methods, but we are not supporting them yet
 typedef enum HttpCode {
     HTTP_200 = 200, // OK
+    HTTP_206 = 206, // Partial content
+    HTTP_304 = 304, // Not modified
     HTTP_400 = 400, // Bad request
     HTTP_401 = 401, // Unauthorized
     HTTP_404 = 404, // Not found
     HTTP_405 = 405, // Method not allowed
     HTTP_411 = 411, // Length required
     HTTP_414 = 414, // Too-long URI
+    HTTP_416 = 416, // Range not satisfiable
+    HTTP_429 = 429, // Too many requests
     HTTP_500 = 500, // Internal server error
     HTTP_501 = 501, // Not implemented
     HTTP_503 = 503, // Service unavailable
@@ -54,6 +58,7 @@ typedef enum HttpRequestType {
 
 // Structure representing a HTTP header
 // It can be used for both incomming and outgoing messages!
+// Note: the field values of a request point inside the buffer it has been parsed from
 typedef struct HttpHeader {
     HttpVersion version;
     HttpMethod  method;
@@ -61,31 +66,76 @@ typedef struct HttpHeader {
 
     HttpRequestType requestType; 
     char*           requestTarget;
+    char*           target_in_buffer; // Start of the target in the request buffer (requests only)
 
     char* query;
     char* host;
     char* accept;
-    int   content_length;
+    char* accept_encoding;
+    off_t content_length; // Not written if negative
     char* content_type;
     char* content_encoding;
+    char* transfer_encoding;
+    char* vary;
     char* date;
     char* server;
+    char* retry_after;
+    char* connection;
+
+    // Validators (answers) and conditions (requests)
+    char* etag;
+    char  etag_buffer[MAX_VALIDATOR_LENGTH + 8]; // Storage of derived etags (answers only)
+    char* last_modified;
+    char* if_none_match;
+    char* if_modified_since;
+
+    // Byte ranges
+    char* range;
+    char* if_range;
+    char* accept_ranges;
+    char* content_range;
+    char  content_range_buffer[80]; // Storage of content_range (answers only)
+
+    // Whole header rendered beforehand, sent instead of the above fields (answers only)
+    const char* prerendered;
+    int         prerendered_length;
 } HttpHeader;
 
+// A part of a body made of several pieces (e.g. a multipart/byteranges one),
+// either in memory or in the file of the content
+typedef struct HttpContentPart {
+    char* body;        // NULL if the part must be read from the file
+    off_t file_offset;
+    off_t length;      // Number of bytes remaining to send
+} HttpContentPart;
+
 // Structure representing a chunk of (text) data
 typedef struct HttpContent {
-    int   length;
-    int   offset;
+    off_t length;
+    off_t offset;
     char* body;
 
     // In case the content is not in memory
     bool  content_is_loaded;
 
+    File* file;
     char* file_path;
     int   file_fd;
     off_t file_offset;
+
+    // In case the content is made of several parts (owned by the content)
+    HttpContentPart* parts;
+    int              nb_parts;
+    int              current_part;
+    char*            parts_headers;
 } HttpContent;
 
+// A range of bytes (both bounds are included)
+typedef struct HttpRange {
+    off_t first;
+    off_t last;
+} HttpRange;
+
 // Struture represeting a full HTTP message
 typedef struct HttpMessage {
     HttpHeader*  header;
@@ -94,11 +144,30 @@ typedef struct HttpMessage {
 
 // -----------------------------------------------------------------------------
 
+#define HTTP_NB_PRERENDERED_ERRORS        16  // Other error headers are rendered each time
+#define HTTP_PRERENDERED_ERROR_MAX_LENGTH 256 // bytes
+
+// Enough for the largest answer header (a type, entity tag and date of maximal lengths)
+#define HTTP_ANSWER_HEADER_MIN_BUFFER_SIZE 1024 // bytes
+
 #define HTTP_TIME_FORMAT_STR "%a, %d %b %Y %X GMT"
 #define HTTP_SERVER_VERSION  "HTTP/1.1"
 
 #define NO_FD -1
 
+#define HTTP_MAX_NB_RANGES         16 // More ranges are ignored (the full content is sent)
+#define HTTP_INVALID_RANGES        -1
+#define HTTP_MULTIPART_BOUNDARY    "MyAwesomeWebServerByteRanges"
+#define HTTP_MULTIPART_HEADER_SIZE 160 // bytes, without the type (fits three 64-bit offsets)
+
+// Header of the error answers with a given code, which only changes with the date
+typedef struct PrerenderedHttpError {
+    HttpCode code;
+    time_t   date_time; // Time of the date of the rendered header
+    char     header[HTTP_PRERENDERED_ERROR_MAX_LENGTH];
+    int      header_length;
+} PrerenderedHttpError;
+
 // -----------------------------------------------------------------------------
 
 HttpHeader* createHttpHeader ();
@@ -125,12 +194,31 @@ char* getHttpServerDate ();
 
 void prepareGeneralHttpAnswer (HttpMessage* answer, HttpCode http_code);
 void prepareHttpError (HttpMessage* answer, HttpCode http_code);
+void prepareHttpRefusal (HttpMessage* answer, HttpCode http_code, char* retry_after);
 void prepareHttpValidAnswer (HttpMessage* request, HttpMessage* answer, File* file);
+void prepareHttpNotModifiedAnswer (HttpMessage* answer, File* file);
+void prepareHttpPartialAnswer (HttpMessage* request, HttpMessage* answer, File* file,
+                               const HttpRange ranges[], const int nb_ranges);
+void prepareHttpRangeNotSatisfiable (HttpMessage* answer, File* file);
+bool prepareHttpCompressedAnswer (HttpMessage* request, HttpMessage* answer, File* file);
+void setHttpCompressedContent (HttpMessage* request, HttpMessage* answer,
+                               char* compressed_content, const int length);
+
+bool entityTagListMatches (const char* entity_tag_list, const char* etag);
+bool requestAcceptsEncoding (const HttpMessage* request, const char* encoding);
+File* selectFileRepresentation (const HttpMessage* request, File* file);
+bool fileIsModifiedSince (const File* file, const char* http_date);
+bool requestConditionsAreMet (const HttpMessage* request, const File* file);
+bool ifRangeConditionIsMet (const HttpMessage* request, const File* file);
+int parseHttpRanges (const char* range_value, const off_t representation_length,
+                     HttpRange ranges[], const int max_nb_ranges);
 
 HttpCode parseHttpRequest (HttpMessage* request, char* buffer);
-void produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, FileCache* cache);
+File* produceHttpAnswerFromRequest (HttpMessage* answer, HttpMessage* request, FileCache* cache);
 
 
+int renderHttpAnswerHeader (const HttpHeader* answer_header,
+                            char* answer_header_buffer, const int buffer_max_length);
 int writeHttpAnswerFirstLine (const HttpHeader* answer_header,
                               char* answer_header_buffer, const int buffer_max_length);
 int writeHttpOptionFields (const HttpHeader* answer_header,
@@ -0,0 +1,194 @@
+// Macro definition required for using eventfd() and pthreads
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include "toolbox.h"
+#include "file_cache.h"
+#include "io_pool.h"
+
+// -----------------------------------------------------------------------------
+// LOADING THREADS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// The content is loaded in a copy of the file structure, since the main thread
+// may read the file in the meantime: it only gets the result once it is complete
+// A failure is only reported in the job (the main thread decides how to answer)
+static void _loadFileContent (FileLoadingJob* job)
+{
+    File loaded_file = *(job->file);
+
+    job->is_loaded = loadFileContent(&loaded_file);
+    job->content  = loaded_file.content;
+    job->size     = loaded_file.size;
+    job->state    = loaded_file.state;
+    job->encoding = loaded_file.encoding;
+}
+
+// Internal version only!
+static void* _runLoadingThread (void* pool_pointer)
+{
+    IoPool* pool = pool_pointer;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->first_pending_job == NULL && ! pool->is_stopping)
+            pthread_cond_wait(&pool->job_is_pending, &pool->lock);
+
+        if (pool->is_stopping)
+            break;
+
+        FileLoadingJob* job = pool->first_pending_job;
+        pool->first_pending_job = job->next;
+        if (pool->first_pending_job == NULL)
+            pool->last_pending_job = NULL;
+
+        // The disk is only accessed without holding the lock
+        pthread_mutex_unlock(&pool->lock);
+        _loadFileContent(job);
+        pthread_mutex_lock(&pool->lock);
+
+        job->next            = pool->completed_jobs;
+        pool->completed_jobs = job;
+
+        // Wake the main loop up
+        uint64_t nb_events = 1;
+        if (write(pool->event_fd, &nb_events, sizeof(uint64_t)) < 0)
+            handleErrorAndExit("write() failed in _runLoadingThread()");
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON IO POOL
+// -----------------------------------------------------------------------------
+
+IoPool* createIoPool (const int nb_threads)
+{
+    IoPool* new_pool = malloc(sizeof(IoPool));
+    if (new_pool == NULL)
+        handleErrorAndExit("malloc() failed in createIoPool()");
+
+    new_pool->first_pending_job = NULL;
+    new_pool->last_pending_job  = NULL;
+    new_pool->completed_jobs    = NULL;
+    new_pool->is_stopping       = false;
+
+    new_pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (new_pool->event_fd < 0)
+        handleErrorAndExit("eventfd() failed in createIoPool()");
+
+    if (pthread_mutex_init(&new_pool->lock, NULL) != 0
+    ||  pthread_cond_init(&new_pool->job_is_pending, NULL) != 0)
+        handleErrorAndExit("pthread_mutex/cond_init() failed in createIoPool()");
+
+    new_pool->nb_threads = nb_threads;
+    new_pool->threads    = malloc(nb_threads * sizeof(pthread_t));
+    if (new_pool->threads == NULL)
+        handleErrorAndExit("malloc() failed in createIoPool()");
+
+    // Signals must be handled by the main thread only (they interrupt its polling):
+    // they are blocked in the loading threads, which inherit the current mask
+    sigset_t all_signals, previous_signal_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &previous_signal_mask);
+
+    for (int i = 0; i < nb_threads; i++)
+    {
+        int return_value = pthread_create(&new_pool->threads[i], NULL, _runLoadingThread, new_pool);
+        if (return_value != 0)
+            handleErrorAndExit("pthread_create() failed in createIoPool()");
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous_signal_mask, NULL);
+
+    return new_pool;
+}
+
+// Pending jobs are dropped, but the jobs being run are waited for
+void deleteIoPool (IoPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->is_stopping = true;
+    pthread_cond_broadcast(&pool->job_is_pending);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nb_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    FileLoadingJob* job_lists[] = { pool->first_pending_job, pool->completed_jobs };
+    for (int i = 0; i < 2; i++)
+    {
+        FileLoadingJob* job = job_lists[i];
+        while (job != NULL)
+        {
+            FileLoadingJob* next_job = job->next;
+            if (i == 1)
+                free(job->content);
+            free(job);
+            job = next_job;
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_is_pending);
+
+    close(pool->event_fd);
+    free(pool->threads);
+    free(pool);
+}
+
+// -----------------------------------------------------------------------------
+// JOBS HANDLING (MAIN THREAD)
+// -----------------------------------------------------------------------------
+
+// Jobs are run in submission order
+void submitFileLoading (IoPool* pool, FileCache* cache, File* file)
+{
+    FileLoadingJob* job = malloc(sizeof(FileLoadingJob));
+    if (job == NULL)
+        handleErrorAndExit("malloc() failed in submitFileLoading()");
+
+    job->file  = file;
+    job->cache = cache;
+    job->next  = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->last_pending_job != NULL)
+        pool->last_pending_job->next = job;
+    else
+        pool->first_pending_job = job;
+    pool->last_pending_job = job;
+
+    pthread_cond_signal(&pool->job_is_pending);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Return the list of all the jobs completed since the last call (or NULL),
+// which must be freed by the caller
+FileLoadingJob* collectCompletedFileLoadings (IoPool* pool)
+{
+    // Reset the event counter
+    uint64_t nb_events;
+    if (read(pool->event_fd, &nb_events, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+        handleErrorAndExit("read() failed in collectCompletedFileLoadings()");
+
+    pthread_mutex_lock(&pool->lock);
+    FileLoadingJob* completed_jobs = pool->completed_jobs;
+    pool->completed_jobs = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    return completed_jobs;
+}
@@ -0,0 +1,50 @@
+#ifndef __H_IO_POOL__
+#define __H_IO_POOL__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "file_cache.h"
+
+// Structures representing a pool of threads loading file contents from the disk,
+// so that the main loop never waits for the disk
+
+// A file to load, and the loaded content (only read by the main thread once completed)
+typedef struct FileLoadingJob {
+    File*      file;
+    FileCache* cache; // Of the file (whose size changes once the content is stored)
+
+    bool         is_loaded; // False if the file cannot be read anymore (e.g. it has been removed)
+    char*        content;
+    off_t        size;
+    FileState    state;
+    FileEncoding encoding;
+
+    struct FileLoadingJob* next;
+} FileLoadingJob;
+
+typedef struct IoPool {
+    pthread_t* threads;
+    int        nb_threads;
+
+    // Both queues are protected by the same lock
+    pthread_mutex_t lock;
+    pthread_cond_t  job_is_pending;
+
+    FileLoadingJob* first_pending_job;
+    FileLoadingJob* last_pending_job;
+    FileLoadingJob* completed_jobs;
+
+    // Written once per completed job, and polled by the main loop
+    int  event_fd;
+    bool is_stopping;
+} IoPool;
+
+// -----------------------------------------------------------------------------
+
+IoPool* createIoPool (const int nb_threads);
+void deleteIoPool (IoPool* pool);
+
+void submitFileLoading (IoPool* pool, FileCache* cache, File* file);
+FileLoadingJob* collectCompletedFileLoadings (IoPool* pool);
+
+#endif
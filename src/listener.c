@@ -0,0 +1,355 @@
+// Macro definition required for using strtok_r()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "toolbox.h"
+#include "affinity.h"
+#include "listener.h"
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON LISTENERS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return false if the port is not a number between 1 and 65535
+static bool _parsePort (const char* string, int* port)
+{
+    char* end   = NULL;
+    long  value = strtol(string, &end, 10);
+    if (end == string || *end != '\0' || value < 1 || value > 65535)
+        return false;
+
+    *port = (int) value;
+    return true;
+}
+
+// Internal version only!
+// The description is made of the type and the address of the listener (e.g. "tcp6:8080"),
+// possibly followed by its own options (e.g. ",backlog=64,v6only,fast-open")
+static bool _parseListener (Listener* listener, char* description, const int default_backlog,
+                            const SocketOptions* default_options)
+{
+    listener->path           = NULL;
+    listener->port           = 0;
+    listener->backlog        = default_backlog;
+    listener->v6_only        = false;
+    listener->socket_options = *default_options;
+    listener->sockfd         = LISTENER_NO_SOCKET;
+
+    char* address = strchr(description, ':');
+    if (address == NULL)
+    {
+        printError("Invalid listener (its type and address are separated by ':'): %s", description);
+        return false;
+    }
+    *address = '\0';
+    address++;
+
+    char* options = strchr(address, LISTENER_OPTIONS_SEPARATOR[0]);
+    if (options != NULL)
+    {
+        *options = '\0';
+        options++;
+    }
+
+    if (stringsAreEqual(description, "tcp4") || stringsAreEqual(description, "tcp6"))
+    {
+        listener->type = stringsAreEqual(description, "tcp4") ? LISTENER_TCP4 : LISTENER_TCP6;
+
+        if (! _parsePort(address, &listener->port))
+        {
+            printError("Invalid port of a listener: %s", address);
+            return false;
+        }
+    }
+    else if (stringsAreEqual(description, "unix"))
+    {
+        listener->type = LISTENER_UNIX;
+
+        // The path of the socket must fit in its address (including the final '\0')
+        if (address[0] == '\0' || strlen(address) >= sizeof(((struct sockaddr_un*) NULL)->sun_path))
+        {
+            printError("Invalid path of a Unix listener: %s", address);
+            return false;
+        }
+        listener->path = getFreshStringCopy(address);
+    }
+    else
+    {
+        printError("Unknown type of listener: %s (tcp4, tcp6 or unix)", description);
+        return false;
+    }
+
+    // The options of the listener (if any), on top of the common ones
+    char* position = NULL;
+    for (char* option = options != NULL ? strtok_r(options, LISTENER_OPTIONS_SEPARATOR, &position)
+                                        : NULL;
+         option != NULL;
+         option = strtok_r(NULL, LISTENER_OPTIONS_SEPARATOR, &position))
+    {
+        if (strncmp(option, "backlog=", strlen("backlog=")) == 0)
+        {
+            listener->backlog = atoi(option + strlen("backlog="));
+            if (listener->backlog <= 0)
+            {
+                printError("Invalid backlog of a listener: %s", option);
+                return false;
+            }
+        }
+        else if (stringsAreEqual(option, "v6only") && listener->type == LISTENER_TCP6)
+            listener->v6_only = true;
+        else if (listener->type == LISTENER_UNIX)
+        {
+            printError("Unknown option of a Unix listener: %s (backlog only)", option);
+            return false;
+        }
+        else if (! parseSocketOptions(&listener->socket_options, option))
+            return false;
+    }
+
+    return true;
+}
+
+// The list is made of listeners separated by spaces (see listener.h); their sockets are only
+// opened when started (see startListener())
+// Return NULL if the list is empty or invalid
+Listener* parseListeners (const char* list, const int default_backlog,
+                          const SocketOptions* default_options, int* nb_listeners)
+{
+    char*     list_copy = getFreshStringCopy(list);
+    char*     position  = NULL;
+    Listener* listeners = NULL;
+    *nb_listeners = 0;
+
+    for (char* description = strtok_r(list_copy, LISTENERS_SEPARATORS, &position);
+         description != NULL;
+         description = strtok_r(NULL, LISTENERS_SEPARATORS, &position))
+    {
+        Listener* new_listeners = realloc(listeners, (*nb_listeners + 1) * sizeof(Listener));
+        if (new_listeners == NULL)
+            handleErrorAndExit("realloc() failed in parseListeners()");
+        listeners = new_listeners;
+
+        Listener* listener = &listeners[*nb_listeners];
+        bool success = _parseListener(listener, description, default_backlog, default_options);
+        (*nb_listeners)++;
+
+        if (! success)
+        {
+            deleteListeners(listeners, *nb_listeners);
+            listeners = NULL;
+            break;
+        }
+    }
+
+    free(list_copy);
+
+    if (listeners == NULL)
+        *nb_listeners = 0;
+
+    return listeners;
+}
+
+// The sockets are not closed (see disconnectServer()), and the path of a Unix socket
+// is never removed: the process it has been handed over to (after an upgrade) still uses it
+void deleteListeners (Listener* listeners, const int nb_listeners)
+{
+    for (int i = 0; i < nb_listeners; i++)
+        free(listeners[i].path);
+
+    free(listeners);
+}
+
+// The name must have room for LISTENER_MAX_NAME_LENGTH characters
+void getListenerName (const Listener* listener, char* name)
+{
+    switch (listener->type)
+    {
+        case LISTENER_TCP4:
+            snprintf(name, LISTENER_MAX_NAME_LENGTH, "tcp4:%d", listener->port);
+            break;
+
+        case LISTENER_TCP6:
+            snprintf(name, LISTENER_MAX_NAME_LENGTH, "tcp6:%d%s", listener->port,
+                     listener->v6_only ? " (v6only)" : "");
+            break;
+
+        case LISTENER_UNIX:
+            snprintf(name, LISTENER_MAX_NAME_LENGTH, "unix:%s", listener->path);
+            break;
+    }
+}
+
+void printListeners (const Listener* listeners, const int nb_listeners)
+{
+    for (int i = 0; i < nb_listeners; i++)
+    {
+        char name[LISTENER_MAX_NAME_LENGTH];
+        getListenerName(&listeners[i], name);
+
+        printf("Listening on %s (fd: %d, backlog: %d)\n", name, listeners[i].sockfd,
+               listeners[i].backlog);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// LISTENING SOCKETS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the length of the local address of the listener
+static socklen_t _getListenerAddress (const Listener* listener, struct sockaddr_storage* address)
+{
+    memset(address, 0, sizeof(*address));
+
+    if (listener->type == LISTENER_TCP4)
+    {
+        struct sockaddr_in* ipv4_address = (struct sockaddr_in*) address;
+        ipv4_address->sin_family      = AF_INET;
+        ipv4_address->sin_port        = htons(listener->port);
+        ipv4_address->sin_addr.s_addr = INADDR_ANY;
+        return sizeof(struct sockaddr_in);
+    }
+
+    if (listener->type == LISTENER_TCP6)
+    {
+        struct sockaddr_in6* ipv6_address = (struct sockaddr_in6*) address;
+        ipv6_address->sin6_family = AF_INET6;
+        ipv6_address->sin6_port   = htons(listener->port);
+        ipv6_address->sin6_addr   = in6addr_any;
+        return sizeof(struct sockaddr_in6);
+    }
+
+    struct sockaddr_un* unix_address = (struct sockaddr_un*) address;
+    unix_address->sun_family = AF_UNIX;
+    strcpy(unix_address->sun_path, listener->path);
+    return sizeof(struct sockaddr_un);
+}
+
+// Internal version only!
+// The path of a Unix socket remains after its server has exited (e.g. if it has crashed):
+// it is removed if no server accepts connections on it anymore
+static void _removeStaleUnixSocket (const Listener* listener)
+{
+    struct stat file_status;
+    if (lstat(listener->path, &file_status) < 0 || ! S_ISSOCK(file_status.st_mode))
+        return;
+
+    struct sockaddr_storage address;
+    socklen_t address_length = _getListenerAddress(listener, &address);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0)
+        handleErrorAndExit("socket() failed in _removeStaleUnixSocket()");
+
+    if (connect(sockfd, (struct sockaddr*) &address, address_length) < 0 && errno == ECONNREFUSED)
+    {
+        printf("Removing the stale Unix socket %s\n", listener->path);
+        unlink(listener->path);
+    }
+
+    close(sockfd);
+}
+
+// The socket is opened, bound and made a listener, unless it has been handed over
+// by the previous process (after an upgrade): its options and backlog are then updated
+// It is non-blocking in both cases: all the processes sharing it (workers, or the previous
+// and the upgraded ones) are woken up by a new client, but only one of them can accept it
+void startListener (Listener* listener, const bool joins_steering_group)
+{
+    bool is_new_socket = listener->sockfd == LISTENER_NO_SOCKET;
+
+    if (is_new_socket)
+    {
+        int family = listener->type == LISTENER_TCP4 ? AF_INET
+                   : listener->type == LISTENER_TCP6 ? AF_INET6
+                   :                                   AF_UNIX;
+
+        listener->sockfd = socket(family, SOCK_STREAM, 0);
+        if (listener->sockfd < 0)
+            handleErrorAndExit("socket() failed in startListener()");
+    }
+
+    setListenerSocketOptions(listener);
+
+    if (is_new_socket)
+    {
+        if (joins_steering_group)
+            joinSteeringGroup(listener->sockfd);
+
+        // Otherwise, the IPv4 clients are accepted as well (with IPv4-mapped IPv6 addresses),
+        // whatever the system default (net.ipv6.bindv6only)
+        if (listener->type == LISTENER_TCP6)
+        {
+            int is_v6_only = listener->v6_only;
+            if (setsockopt(listener->sockfd, IPPROTO_IPV6, IPV6_V6ONLY,
+                           &is_v6_only, sizeof(is_v6_only)) < 0)
+                handleErrorAndExit("setsockopt() failed in startListener()");
+        }
+
+        if (listener->type == LISTENER_UNIX)
+            _removeStaleUnixSocket(listener);
+
+        struct sockaddr_storage address;
+        socklen_t address_length = _getListenerAddress(listener, &address);
+        if (bind(listener->sockfd, (struct sockaddr*) &address, address_length) < 0)
+            handleErrorAndExit("bind() failed in startListener()");
+    }
+
+    if (listen(listener->sockfd, listener->backlog) < 0)
+        handleErrorAndExit("listen() failed in startListener()");
+
+    int success = fcntl(listener->sockfd, F_SETFL, fcntl(listener->sockfd, F_GETFL) | O_NONBLOCK);
+    if (success < 0)
+        handleErrorAndExit("fcntl() failed in startListener()");
+}
+
+// The TCP options are inherited by the clients (see socket_options.h); the Unix sockets have none
+void setListenerSocketOptions (const Listener* listener)
+{
+    if (listener->type != LISTENER_UNIX)
+        setListeningSocketOptions(listener->sockfd, &listener->socket_options);
+}
+
+// Return true if the socket is listening on the address of the listener
+// (e.g. to find the socket of a listener among the ones handed over after an upgrade)
+bool listenerMatchesSocket (const Listener* listener, const int sockfd)
+{
+    struct sockaddr_storage socket_address;
+    socklen_t socket_address_length = sizeof(socket_address);
+    if (getsockname(sockfd, (struct sockaddr*) &socket_address, &socket_address_length) < 0)
+        return false;
+
+    struct sockaddr_storage listener_address;
+    _getListenerAddress(listener, &listener_address);
+    if (socket_address.ss_family != listener_address.ss_family)
+        return false;
+
+    switch (listener->type)
+    {
+        case LISTENER_TCP4:
+            return ((struct sockaddr_in*) &socket_address)->sin_port
+                == ((struct sockaddr_in*) &listener_address)->sin_port;
+
+        case LISTENER_TCP6:
+            return ((struct sockaddr_in6*) &socket_address)->sin6_port
+                == ((struct sockaddr_in6*) &listener_address)->sin6_port;
+
+        case LISTENER_UNIX:
+            return stringsAreEqual(((struct sockaddr_un*) &socket_address)->sun_path,
+                                   listener->path);
+    }
+
+    return false;
+}
@@ -0,0 +1,55 @@
+#ifndef __H_LISTENER__
+#define __H_LISTENER__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "socket_options.h"
+
+// Listening sockets of the server: TCP over IPv4, TCP over IPv6 (dual-stack, unless v6only),
+// or Unix stream sockets (e.g. for a local reverse proxy, which then skips the TCP stack)
+// They are given as a list separated by spaces, each one being made of its type and address,
+// possibly followed by its own options (after commas): its backlog, and socket options
+// completing the common ones (see socket_options.h), e.g.
+// "tcp4:80 tcp6:8080,v6only,fast-open unix:/run/webserver.sock,backlog=1024"
+// The clients of all the listeners are handled by the same loop(s)
+
+typedef enum ListenerType {
+    LISTENER_TCP4,
+    LISTENER_TCP6,
+    LISTENER_UNIX
+} ListenerType;
+
+typedef struct Listener {
+    ListenerType  type;
+    int           port;    // TCP listeners only
+    char*         path;    // Unix listeners only (NULL otherwise)
+    int           backlog; // Connections waiting to be accepted
+    bool          v6_only; // TCP6 listeners only: IPv4 clients are not accepted
+    SocketOptions socket_options; // TCP listeners only
+    int           sockfd;  // LISTENER_NO_SOCKET until started
+} Listener;
+
+// -----------------------------------------------------------------------------
+
+#define LISTENERS_SEPARATORS       " \t"
+#define LISTENER_OPTIONS_SEPARATOR ","
+#define LISTENER_MAX_NAME_LENGTH   (sizeof(((struct sockaddr_un*) NULL)->sun_path) + 16)
+
+// Named, useful constants
+#define LISTENER_NO_SOCKET -1
+
+// -----------------------------------------------------------------------------
+
+Listener* parseListeners (const char* list, const int default_backlog,
+                          const SocketOptions* default_options, int* nb_listeners);
+void deleteListeners (Listener* listeners, const int nb_listeners);
+void getListenerName (const Listener* listener, char* name);
+void printListeners (const Listener* listeners, const int nb_listeners);
+
+void startListener (Listener* listener, const bool joins_steering_group);
+void setListenerSocketOptions (const Listener* listener);
+bool listenerMatchesSocket (const Listener* listener, const int sockfd);
+
+#endif
@@ -4,9 +4,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <signal.h>
 #include "toolbox.h"
 #include "server.h"
+#include "trace.h"
+#include "upgrade.h"
+#include "config.h"
 #include "main.h"
 
 // -----------------------------------------------------------------------------
@@ -51,23 +55,170 @@ void installSIGINTHandler ()
         handleErrorAndExit("sigaction() failed in installSIGINTHandler()");
 }
 
-int main (/*const int argc, const char* argv[]*/)
+void handleSIGUSR1 (int signal_id)
 {
+    (void) signal_id;
+
+    // The tracing is actually toggled (and dumped) by the main server loop
+    requestTracingToggle();
+}
+
+void installSIGUSR1Handler ()
+{
+    // Handle SIGUSR1, to enable/disable the tracing of the requests at runtime
+    struct sigaction sigusr1_handler;
+
+    sigset_t signal_mask;
+    sigfillset(&signal_mask);
+
+    sigusr1_handler.sa_handler = handleSIGUSR1;
+    sigusr1_handler.sa_flags   = 0;
+    sigusr1_handler.sa_mask    = signal_mask;
+
+    int success = sigaction(SIGUSR1, &sigusr1_handler, NULL);
+    if (success < 0)
+        handleErrorAndExit("sigaction() failed in installSIGUSR1Handler()");
+}
+
+void handleSIGUSR2 (int signal_id)
+{
+    (void) signal_id;
+
+    // The upgrade is actually started by the main server loop (or by the prefork master)
+    requestUpgrade();
+}
+
+void installSIGUSR2Handler ()
+{
+    // Handle SIGUSR2, to upgrade the server binary without closing the listening socket
+    struct sigaction sigusr2_handler;
+
+    sigset_t signal_mask;
+    sigfillset(&signal_mask);
+
+    sigusr2_handler.sa_handler = handleSIGUSR2;
+    sigusr2_handler.sa_flags   = 0;
+    sigusr2_handler.sa_mask    = signal_mask;
+
+    int success = sigaction(SIGUSR2, &sigusr2_handler, NULL);
+    if (success < 0)
+        handleErrorAndExit("sigaction() failed in installSIGUSR2Handler()");
+}
+
+void handleSIGTERM (int signal_id)
+{
+    (void) signal_id;
+
+    // The clients are actually drained by the main server loop (or by the prefork master)
+    requestServerDrain();
+}
+
+void installSIGTERMHandler ()
+{
+    // Handle SIGTERM, to stop accepting clients and exit once the current ones are served
+    struct sigaction sigterm_handler;
+
+    sigset_t signal_mask;
+    sigfillset(&signal_mask);
+
+    sigterm_handler.sa_handler = handleSIGTERM;
+    sigterm_handler.sa_flags   = 0;
+    sigterm_handler.sa_mask    = signal_mask;
+
+    int success = sigaction(SIGTERM, &sigterm_handler, NULL);
+    if (success < 0)
+        handleErrorAndExit("sigaction() failed in installSIGTERMHandler()");
+}
+
+void handleSIGHUP (int signal_id)
+{
+    (void) signal_id;
+
+    // The configuration is actually reloaded by the main server loop (or by the prefork master)
+    requestConfigReload();
+}
+
+void installSIGHUPHandler ()
+{
+    // Handle SIGHUP, to reload the configuration without restarting the server
+    struct sigaction sighup_handler;
+
+    sigset_t signal_mask;
+    sigfillset(&signal_mask);
+
+    sighup_handler.sa_handler = handleSIGHUP;
+    sighup_handler.sa_flags   = 0;
+    sighup_handler.sa_mask    = signal_mask;
+
+    int success = sigaction(SIGHUP, &sighup_handler, NULL);
+    if (success < 0)
+        handleErrorAndExit("sigaction() failed in installSIGHUPHandler()");
+}
+
+void ignoreSIGPIPE ()
+{
+    // Writing to a socket closed by a client must not kill the server
+    // (write() fails with EPIPE instead, which is handled by the caller)
+    struct sigaction sigpipe_handler;
+
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+
+    sigpipe_handler.sa_handler = SIG_IGN;
+    sigpipe_handler.sa_flags   = 0;
+    sigpipe_handler.sa_mask    = signal_mask;
+
+    int success = sigaction(SIGPIPE, &sigpipe_handler, NULL);
+    if (success < 0)
+        handleErrorAndExit("sigaction() failed in ignoreSIGPIPE()");
+}
+
+int main (const int argc, const char* argv[])
+{
+    // The parameters are set from the configuration file given with -c <file> (or --config <file>),
+    // if any, and from the command line (e.g. --workers 4, see config.h): option -h (or --help)
+    // lists them, and option -q (or --quiet) disables the debug printing
+    setConfigCommandLine(argc, argv);
+
     // If there is a server, disconnect and close it at exit
     atexit(cleanClosing);
 
     // Handle SIGINT signal for clean server closing
     installSIGINTHandler();
 
-    // Create, start and run the server
+    // Handle SIGTERM signal for graceful server closing
+    installSIGTERMHandler();
+
+    // Handle SIGHUP signal for reloading the configuration
+    installSIGHUPHandler();
+
+    // Handle SIGUSR1 signal for toggling the tracing of the requests
+    installSIGUSR1Handler();
+
+    // Handle SIGUSR2 signal for upgrading the server (with the same arguments)
+    setUpgradeCommand(argv);
+    installSIGUSR2Handler();
+
+    // Ignore SIGPIPE signal, raised when writing to disconnected clients
+    ignoreSIGPIPE();
+
+    // Create, configure, start and run the server
     _main_server = createServer();
     defaultInitServer(_main_server);
+    if (! loadConfiguration(_main_server->parameters))
+        printUsageAndExit(argv);
     startServer(_main_server);
 
+    // After an upgrade, the previous server can now stop accepting clients
+    notifyUpgradeReadiness();
+
     printServer(_main_server);
 
-    // Start the main server loop
-    handleClientRequests(_main_server);
+    // Start the main server loop (or the workers running it, in prefork mode)
+    if (_main_server->parameters->nb_workers > 0)
+        superviseWorkers(_main_server);
+    else
+        handleClientRequests(_main_server);
 
     return 0;
 }
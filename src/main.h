@@ -4,5 +4,14 @@
 void cleanClosing ();
 void handleSIGINT (int signal_id);
 void installSIGINTHandler ();
+void handleSIGTERM (int signal_id);
+void installSIGTERMHandler ();
+void handleSIGHUP (int signal_id);
+void installSIGHUPHandler ();
+void handleSIGUSR1 (int signal_id);
+void installSIGUSR1Handler ();
+void handleSIGUSR2 (int signal_id);
+void installSIGUSR2Handler ();
+void ignoreSIGPIPE ();
 
 #endif
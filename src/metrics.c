@@ -0,0 +1,436 @@
+// Macro definition required for using clock_gettime() and MAP_ANONYMOUS
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "toolbox.h"
+#include "http.h"
+#include "server.h"
+#include "metrics.h"
+
+// -----------------------------------------------------------------------------
+
+// Metrics structure the current worker writes in (only one per process/thread)
+static Metrics* _worker_metrics = NULL;
+
+// -----------------------------------------------------------------------------
+// TIME MEASUREMENT
+// -----------------------------------------------------------------------------
+
+uint64_t getMonotonicTimeInNanoseconds ()
+{
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+    return (uint64_t) current_time.tv_sec * 1000000000 + current_time.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+// LATENCY HISTOGRAMS
+// -----------------------------------------------------------------------------
+
+void initLatencyHistogram (LatencyHistogram* histogram)
+{
+    memset(histogram, 0, sizeof(LatencyHistogram));
+}
+
+// Values smaller than the number of sub-buckets are exactly counted;
+// larger ones are counted in the sub-bucket of their magnitude (i.e. highest bit)
+int getLatencyBucketIndex (const uint64_t value)
+{
+    if (value < LATENCY_NB_SUB_BUCKETS)
+        return (int) value;
+
+    int highest_bit = 63 - __builtin_clzll(value);
+    int shift       = highest_bit - LATENCY_SUB_BUCKET_BITS;
+    int index       = shift * LATENCY_NB_SUB_BUCKETS + (int) (value >> shift);
+
+    return MIN(index, LATENCY_NB_BUCKETS - 1);
+}
+
+// Return the largest value which is counted in the given bucket
+uint64_t getLatencyBucketUpperBound (const int bucket_index)
+{
+    if (bucket_index < LATENCY_NB_SUB_BUCKETS)
+        return (uint64_t) bucket_index;
+
+    int      shift      = bucket_index / LATENCY_NB_SUB_BUCKETS - 1;
+    uint64_t sub_bucket = bucket_index % LATENCY_NB_SUB_BUCKETS + LATENCY_NB_SUB_BUCKETS;
+
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+// Only meant to be called by the owner of the histogram
+void recordLatency (LatencyHistogram* histogram, const uint64_t value)
+{
+    int index = getLatencyBucketIndex(value);
+
+    METRICS_ADD(histogram->counts[index], 1);
+    METRICS_ADD(histogram->total_count, 1);
+    METRICS_ADD(histogram->total_sum, value);
+
+    if (value > histogram->max)
+        __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+void addLatencyHistogram (LatencyHistogram* total, const LatencyHistogram* histogram)
+{
+    for (int i = 0; i < LATENCY_NB_BUCKETS; i++)
+        total->counts[i] += METRICS_READ(histogram->counts[i]);
+
+    total->total_count += METRICS_READ(histogram->total_count);
+    total->total_sum   += METRICS_READ(histogram->total_sum);
+    total->max          = MAX(total->max, METRICS_READ(histogram->max));
+}
+
+// Return (an upper bound of) the value below which the given percentage of values fall
+// Return 0 if the histogram is empty
+uint64_t getLatencyPercentile (const LatencyHistogram* histogram, const double percentile)
+{
+    if (histogram->total_count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t) ((percentile / 100.0) * histogram->total_count + 0.5);
+    rank = MAX(rank, 1);
+
+    uint64_t cumulated_count = 0;
+    for (int i = 0; i < LATENCY_NB_BUCKETS; i++)
+    {
+        cumulated_count += histogram->counts[i];
+        if (cumulated_count >= rank)
+            return MIN(getLatencyBucketUpperBound(i), histogram->max);
+    }
+
+    return histogram->max;
+}
+
+// -----------------------------------------------------------------------------
+// METRICS STRUCTURES HANDLING
+// -----------------------------------------------------------------------------
+
+// The slots are mapped in shared memory, so that they can be written by workers
+// forked afterwards (each one in its own slot), and read by all of them
+Metrics* createMetricsSlots (const int nb_slots)
+{
+    Metrics* new_slots = mmap(NULL, nb_slots * sizeof(Metrics), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (new_slots == MAP_FAILED)
+        handleErrorAndExit("mmap() failed in createMetricsSlots()");
+
+    for (int i = 0; i < nb_slots; i++)
+        initMetrics(&new_slots[i]);
+
+    return new_slots;
+}
+
+void deleteMetricsSlots (Metrics* slots, const int nb_slots)
+{
+    munmap(slots, nb_slots * sizeof(Metrics));
+}
+
+void initMetrics (Metrics* metrics)
+{
+    memset(metrics, 0, sizeof(Metrics));
+    initLatencyHistogram(&metrics->request_latency);
+}
+
+void setWorkerMetrics (Metrics* metrics)
+{
+    _worker_metrics = metrics;
+}
+
+Metrics* getWorkerMetrics ()
+{
+    return _worker_metrics;
+}
+
+// Sum up the metrics of all the workers in the given total structure
+// This is the only place where the slots of other workers are read
+void aggregateMetrics (Metrics* total, const Metrics* slots, const int nb_slots)
+{
+    initMetrics(total);
+
+    for (int i = 0; i < nb_slots; i++)
+    {
+        const Metrics* slot = &slots[i];
+
+        for (int code = 0; code < METRICS_NB_HTTP_CODES; code++)
+            total->requests_by_code[code] += METRICS_READ(slot->requests_by_code[code]);
+
+        total->bytes_sent_cached        += METRICS_READ(slot->bytes_sent_cached);
+        total->bytes_sent_sendfile      += METRICS_READ(slot->bytes_sent_sendfile);
+        total->zerocopy_sends_completed += METRICS_READ(slot->zerocopy_sends_completed);
+        total->zerocopy_sends_copied    += METRICS_READ(slot->zerocopy_sends_copied);
+        total->cache_hits               += METRICS_READ(slot->cache_hits);
+        total->cache_misses             += METRICS_READ(slot->cache_misses);
+        total->cache_misses_filtered    += METRICS_READ(slot->cache_misses_filtered);
+        total->cache_misses_negative    += METRICS_READ(slot->cache_misses_negative);
+        total->accept_drops             += METRICS_READ(slot->accept_drops);
+        total->client_timeouts          += METRICS_READ(slot->client_timeouts);
+
+        for (int state = 0; state < METRICS_NB_CLIENT_STATES; state++)
+            total->clients_by_state[state] += METRICS_READ(slot->clients_by_state[state]);
+
+        addLatencyHistogram(&total->request_latency, &slot->request_latency);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// COUNTING EVENTS (HOT PATH)
+// -----------------------------------------------------------------------------
+
+// All the following functions do nothing if no metrics structure is set
+
+void countHttpAnswer (const int http_code)
+{
+    if (_worker_metrics == NULL
+    ||  http_code < METRICS_MIN_HTTP_CODE
+    ||  http_code > METRICS_MAX_HTTP_CODE)
+        return;
+
+    METRICS_ADD(_worker_metrics->requests_by_code[http_code - METRICS_MIN_HTTP_CODE], 1);
+}
+
+void countBytesSent (const bool from_cache, const int nb_bytes)
+{
+    if (_worker_metrics == NULL || nb_bytes <= 0)
+        return;
+
+    if (from_cache)
+        METRICS_ADD(_worker_metrics->bytes_sent_cached, nb_bytes);
+    else
+        METRICS_ADD(_worker_metrics->bytes_sent_sendfile, nb_bytes);
+}
+
+void countCacheLookup (const bool is_hit)
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    if (is_hit)
+        METRICS_ADD(_worker_metrics->cache_hits, 1);
+    else
+        METRICS_ADD(_worker_metrics->cache_misses, 1);
+}
+
+// Count a miss answered without searching the path index
+void countCacheMissShortcut (const bool from_bloom_filter)
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    if (from_bloom_filter)
+        METRICS_ADD(_worker_metrics->cache_misses_filtered, 1);
+    else
+        METRICS_ADD(_worker_metrics->cache_misses_negative, 1);
+}
+
+void countAcceptDrop ()
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    METRICS_ADD(_worker_metrics->accept_drops, 1);
+}
+
+void countClientTimeout ()
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    METRICS_ADD(_worker_metrics->client_timeouts, 1);
+}
+
+void countZeroCopyCompletions (const int nb_completed_sends, const int nb_copied_sends)
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    METRICS_ADD(_worker_metrics->zerocopy_sends_completed, nb_completed_sends);
+    METRICS_ADD(_worker_metrics->zerocopy_sends_copied, nb_copied_sends);
+}
+
+// Use METRICS_NO_CLIENT_STATE as the old (resp. new) state of a new (resp. removed) client
+void countClientStateChange (const int old_state, const int new_state)
+{
+    if (_worker_metrics == NULL || old_state == new_state)
+        return;
+
+    if (old_state >= 0 && old_state < METRICS_NB_CLIENT_STATES)
+        METRICS_ADD(_worker_metrics->clients_by_state[old_state], -1);
+    if (new_state >= 0 && new_state < METRICS_NB_CLIENT_STATES)
+        METRICS_ADD(_worker_metrics->clients_by_state[new_state], 1);
+}
+
+// The start time must have been given by getMonotonicTimeInNanoseconds()
+void countRequestLatency (const uint64_t start_time)
+{
+    if (_worker_metrics == NULL)
+        return;
+
+    uint64_t latency = (getMonotonicTimeInNanoseconds() - start_time) / 1000;
+    recordLatency(&_worker_metrics->request_latency, latency);
+}
+
+// -----------------------------------------------------------------------------
+// METRICS RENDERING (PROMETHEUS TEXT FORMAT)
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Append formatted text to the buffer, and return its new length
+// The text is silently truncated if the buffer is too small
+static int _appendToBuffer (char* buffer, const int buffer_length, const int buffer_max_length,
+                            const char* format, ...)
+{
+    if (buffer_length >= buffer_max_length - 1)
+        return buffer_length;
+
+    va_list args;
+    va_start(args, format);
+
+    int nb_bytes_written = vsnprintf(buffer + buffer_length, buffer_max_length - buffer_length,
+                                     format, args);
+
+    va_end(args);
+
+    return MIN(buffer_length + nb_bytes_written, buffer_max_length - 1);
+}
+
+// Return the number of bytes written in the given buffer
+int renderMetrics (const Metrics* slots, const int nb_slots,
+                   char* buffer, const int buffer_max_length)
+{
+    Metrics* total = malloc(sizeof(Metrics));
+    if (total == NULL)
+        handleErrorAndExit("malloc() failed in renderMetrics()");
+
+    aggregateMetrics(total, slots, nb_slots);
+
+    int length = 0;
+
+    // Requests, by answer code
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_http_requests_total Answered HTTP requests, by code.\n"
+                             "# TYPE webserver_http_requests_total counter\n");
+    for (int i = 0; i < METRICS_NB_HTTP_CODES; i++)
+    {
+        if (total->requests_by_code[i] == 0)
+            continue;
+
+        length = _appendToBuffer(buffer, length, buffer_max_length,
+                                 "webserver_http_requests_total{code=\"%d\"} %llu\n",
+                                 i + METRICS_MIN_HTTP_CODE,
+                                 (unsigned long long) total->requests_by_code[i]);
+    }
+
+    // Body bytes, by sending path
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_sent_bytes_total Body bytes sent, by sending path.\n"
+                             "# TYPE webserver_sent_bytes_total counter\n"
+                             "webserver_sent_bytes_total{path=\"cached\"} %llu\n"
+                             "webserver_sent_bytes_total{path=\"sendfile\"} %llu\n",
+                             (unsigned long long) total->bytes_sent_cached,
+                             (unsigned long long) total->bytes_sent_sendfile);
+
+    // Zero-copy sends
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_zerocopy_sends_total Completed zero-copy sends of cached bodies, by whether the kernel had to copy the data anyway.\n"
+                             "# TYPE webserver_zerocopy_sends_total counter\n"
+                             "webserver_zerocopy_sends_total{copied=\"false\"} %llu\n"
+                             "webserver_zerocopy_sends_total{copied=\"true\"} %llu\n",
+                             (unsigned long long) (total->zerocopy_sends_completed - total->zerocopy_sends_copied),
+                             (unsigned long long) total->zerocopy_sends_copied);
+
+    // File cache lookups
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_cache_lookups_total File cache lookups, by result.\n"
+                             "# TYPE webserver_cache_lookups_total counter\n"
+                             "webserver_cache_lookups_total{result=\"hit\"} %llu\n"
+                             "webserver_cache_lookups_total{result=\"miss\"} %llu\n",
+                             (unsigned long long) total->cache_hits,
+                             (unsigned long long) total->cache_misses);
+
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_cache_miss_shortcuts_total File cache misses answered without searching the index, by shortcut.\n"
+                             "# TYPE webserver_cache_miss_shortcuts_total counter\n"
+                             "webserver_cache_miss_shortcuts_total{shortcut=\"bloom_filter\"} %llu\n"
+                             "webserver_cache_miss_shortcuts_total{shortcut=\"negative_cache\"} %llu\n",
+                             (unsigned long long) total->cache_misses_filtered,
+                             (unsigned long long) total->cache_misses_negative);
+
+    // Dropped connections
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_accept_drops_total Connections refused (with a 503 or a 429 answer) for lack of a free slot, when overloaded, or over the limits of their address.\n"
+                             "# TYPE webserver_accept_drops_total counter\n"
+                             "webserver_accept_drops_total %llu\n",
+                             (unsigned long long) total->accept_drops);
+
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_client_timeouts_total Clients disconnected for sending their request or reading their answer too slowly, or for staying idle too long.\n"
+                             "# TYPE webserver_client_timeouts_total counter\n"
+                             "webserver_client_timeouts_total %llu\n",
+                             (unsigned long long) total->client_timeouts);
+
+    // Active clients, by state
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_clients Connected clients, by state.\n"
+                             "# TYPE webserver_clients gauge\n");
+    for (int state = STATE_WAITING_FOR_REQUEST; state <= STATE_ANSWERING; state++)
+    {
+        length = _appendToBuffer(buffer, length, buffer_max_length,
+                                 "webserver_clients{state=\"%s\"} %lld\n",
+                                 getClientStateAsString(state),
+                                 (long long) total->clients_by_state[state]);
+    }
+
+    // Request latency, as a histogram (with one bucket per magnitude)...
+    LatencyHistogram* latency = &total->request_latency;
+
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_request_duration_seconds Time from the first byte read to the last byte written.\n"
+                             "# TYPE webserver_request_duration_seconds histogram\n");
+
+    uint64_t cumulated_count = 0;
+    for (int i = 0; i < LATENCY_NB_BUCKETS; i++)
+    {
+        cumulated_count += latency->counts[i];
+
+        if ((i + 1) % LATENCY_NB_SUB_BUCKETS != 0)
+            continue;
+
+        length = _appendToBuffer(buffer, length, buffer_max_length,
+                                 "webserver_request_duration_seconds_bucket{le=\"%g\"} %llu\n",
+                                 (double) getLatencyBucketUpperBound(i) / 1e6,
+                                 (unsigned long long) cumulated_count);
+    }
+
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "webserver_request_duration_seconds_bucket{le=\"+Inf\"} %llu\n"
+                             "webserver_request_duration_seconds_sum %g\n"
+                             "webserver_request_duration_seconds_count %llu\n",
+                             (unsigned long long) latency->total_count,
+                             (double) latency->total_sum / 1e6,
+                             (unsigned long long) latency->total_count);
+
+    // ...and as (full resolution) percentiles
+    const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+
+    length = _appendToBuffer(buffer, length, buffer_max_length,
+                             "# HELP webserver_request_duration_percentile_seconds Percentiles of the request duration.\n"
+                             "# TYPE webserver_request_duration_percentile_seconds gauge\n");
+    for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(double); i++)
+    {
+        length = _appendToBuffer(buffer, length, buffer_max_length,
+                                 "webserver_request_duration_percentile_seconds{percentile=\"%g\"} %g\n",
+                                 percentiles[i],
+                                 (double) getLatencyPercentile(latency, percentiles[i]) / 1e6);
+    }
+
+    free(total);
+    return length;
+}
@@ -0,0 +1,98 @@
+#ifndef __H_METRICS__
+#define __H_METRICS__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// HDR-style latency histogram: values (in microseconds) are grouped by
+// power-of-two magnitudes, each one being split into linear sub-buckets
+// The relative error of any recorded value is thus bounded (1/8 here)
+#define LATENCY_SUB_BUCKET_BITS  3
+#define LATENCY_NB_SUB_BUCKETS   (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_NB_MAGNITUDES    30 // values up to ~2^32 us are distinguished
+#define LATENCY_NB_BUCKETS       (LATENCY_NB_MAGNITUDES * LATENCY_NB_SUB_BUCKETS)
+
+typedef struct LatencyHistogram {
+    uint64_t counts[LATENCY_NB_BUCKETS];
+    uint64_t total_count;
+    uint64_t total_sum; // us
+    uint64_t max;       // us
+} LatencyHistogram;
+
+// Counters of a single worker
+// Each worker only writes in its own structure (with no lock nor atomic RMW);
+// all the structures are only summed up when the metrics are read
+#define METRICS_MIN_HTTP_CODE    100
+#define METRICS_MAX_HTTP_CODE    599
+#define METRICS_NB_HTTP_CODES    (METRICS_MAX_HTTP_CODE - METRICS_MIN_HTTP_CODE + 1)
+#define METRICS_NB_CLIENT_STATES 8 // must be larger than the number of ClientState values
+#define METRICS_NO_CLIENT_STATE  -1
+
+typedef struct Metrics {
+    uint64_t requests_by_code[METRICS_NB_HTTP_CODES];
+
+    uint64_t bytes_sent_cached;
+    uint64_t bytes_sent_sendfile;
+
+    uint64_t zerocopy_sends_completed;
+    uint64_t zerocopy_sends_copied; // Completed, but copied anyway by the kernel
+
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t cache_misses_filtered; // Rejected by the Bloom filter of the paths
+    uint64_t cache_misses_negative; // Found in the negative cache
+
+    uint64_t accept_drops;
+    uint64_t client_timeouts; // Clients disconnected after being inactive for too long
+
+    int64_t  clients_by_state[METRICS_NB_CLIENT_STATES];
+
+    LatencyHistogram request_latency;
+} Metrics;
+
+// -----------------------------------------------------------------------------
+
+#define METRICS_PATH             "/server-metrics"
+#define METRICS_CONTENT_TYPE     "text/plain; version=0.0.4"
+#define METRICS_BUFFER_SIZE      65536 // bytes
+
+// Single-writer update of a counter: a relaxed load + store is enough,
+// and much cheaper than a locked read-modify-write instruction
+#define METRICS_ADD(counter, value) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (value), \
+                     __ATOMIC_RELAXED)
+
+#define METRICS_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+// -----------------------------------------------------------------------------
+
+uint64_t getMonotonicTimeInNanoseconds ();
+
+void initLatencyHistogram (LatencyHistogram* histogram);
+int getLatencyBucketIndex (const uint64_t value);
+uint64_t getLatencyBucketUpperBound (const int bucket_index);
+void recordLatency (LatencyHistogram* histogram, const uint64_t value);
+void addLatencyHistogram (LatencyHistogram* total, const LatencyHistogram* histogram);
+uint64_t getLatencyPercentile (const LatencyHistogram* histogram, const double percentile);
+
+Metrics* createMetricsSlots (const int nb_slots);
+void deleteMetricsSlots (Metrics* slots, const int nb_slots);
+void initMetrics (Metrics* metrics);
+void setWorkerMetrics (Metrics* metrics);
+Metrics* getWorkerMetrics ();
+void aggregateMetrics (Metrics* total, const Metrics* slots, const int nb_slots);
+
+void countHttpAnswer (const int http_code);
+void countBytesSent (const bool from_cache, const int nb_bytes);
+void countCacheLookup (const bool is_hit);
+void countCacheMissShortcut (const bool from_bloom_filter);
+void countAcceptDrop ();
+void countClientTimeout ();
+void countZeroCopyCompletions (const int nb_completed_sends, const int nb_copied_sends);
+void countClientStateChange (const int old_state, const int new_state);
+void countRequestLatency (const uint64_t start_time);
+
+int renderMetrics (const Metrics* slots, const int nb_slots,
+                   char* buffer, const int buffer_max_length);
+
+#endif
@@ -44,6 +44,11 @@ typedef struct Option
 typedef enum HttpHeaderField {
     HEAD_HOST,
     HEAD_ACCEPT,
+    HEAD_ACCEPT_ENCODING,
+    HEAD_IF_NONE_MATCH,
+    HEAD_IF_MODIFIED_SINCE,
+    HEAD_RANGE,
+    HEAD_IF_RANGE,
 
     HEAD_UNKNOWN
 } HttpHeaderField;
@@ -71,9 +76,14 @@ Option accepted_versions[] = {
 };
 
 Option accepted_option_fields[] = {
-    { "HOST",   HEAD_HOST },
-    { "ACCEPT", HEAD_ACCEPT },
-    { NULL,     HEAD_UNKNOWN }
+    { "HOST",              HEAD_HOST },
+    { "ACCEPT",            HEAD_ACCEPT },
+    { "ACCEPT-ENCODING",   HEAD_ACCEPT_ENCODING },
+    { "IF-NONE-MATCH",     HEAD_IF_NONE_MATCH },
+    { "IF-MODIFIED-SINCE", HEAD_IF_MODIFIED_SINCE },
+    { "RANGE",             HEAD_RANGE },
+    { "IF-RANGE",          HEAD_IF_RANGE },
+    { NULL,                HEAD_UNKNOWN }
 };
 
 // -----------------------------------------------------------------------------
@@ -84,38 +94,44 @@ Option accepted_option_fields[] = {
 // It corresponds to the minimum-length of a buffer with just a first and a blank line
 #define HTTP_HEADER_MIN_LENGTH 18 // bytes
 
-// Return true if a full HTTP header is supposedly contained in the given buffer, false otherwise
+// Return the length of the first HTTP header contained in the given buffer
+// (including the final blank line), or 0 if it has not been fully received yet
+// Bytes before start_offset are assumed to have been checked already
 // Note: only the double-CRLF is searched; no syntax is checked here!
-bool bufferContainsFullHttpHeader (const char* buffer, const int start_offset, const int content_length)
+int getHttpHeaderLength (const char* buffer, const int start_offset, const int content_length)
 {
-    // If buffer contains less than 4 characters, immediately return false
+    // If buffer contains less than the minimum header length, immediately return 0
     if (content_length < HTTP_HEADER_MIN_LENGTH)
-        return false;
+        return 0;
 
-    // Search for an empty line (CRLF two times)
-    int     index = content_length - 1;
-    int end_index = start_offset - 3 >= 0
-                  ? start_offset - 3
-                  : 3;
+    // The pattern may straddle the previously checked bytes and the new ones
+    int index = MAX(start_offset - 3, 0);
 
-    // The loop is done backwards, since there are high chances that
-    // the pattern will be found at the end (e.g. if the header contains no body and is fully read)
-    while (index >= end_index)
+    // Search for an empty line (CRLF two times), only stopping on '\n' characters
+    for (;;)
     {
-        // Ignore chunks of 2 bytes if the first '\n' or '\n' are not found
-        if (buffer[index - 3] == '\r'
+        const char* line_feed = memchr(buffer + index, '\n', content_length - index);
+        if (line_feed == NULL)
+            return 0;
+
+        index = line_feed - buffer;
+        if (index >= 3
+        &&  buffer[index - 3] == '\r'
         &&  buffer[index - 2] == '\n'
-        &&  buffer[index - 1] == '\r'
-        &&  buffer[index    ] == '\n')
+        &&  buffer[index - 1] == '\r')
         {
-            return true;
+            return index + 1;
         }
 
-        index -= 2;
+        index++;
     }
+}
 
-    return false;
-}  
+// Return true if a full HTTP header is supposedly contained in the given buffer, false otherwise
+bool bufferContainsFullHttpHeader (const char* buffer, const int start_offset, const int content_length)
+{
+    return getHttpHeaderLength(buffer, start_offset, content_length) > 0;
+}
 
 // -----------------------------------------------------------------------------
 // HEADER PARSING
@@ -158,15 +174,17 @@ HttpCode parseHttpHeaderFirstLine (HttpHeader* header, char* buffer)
     }
 
     header->method = findOptionValueFromString(accepted_methods, http_method_string, false);
-    if (header->method == HTTP_UNKNOWN_METHOD)
-        return HTTP_501; // Not implemented
 
     int method_length = strlen(http_method_string);
     free(http_method_string);
 
+    if (header->method == HTTP_UNKNOWN_METHOD)
+        return HTTP_501; // Not implemented
+
     buffer = consumeLeadingStringWhiteSpace(buffer + method_length);
 
     // Find HTTP target
+    header->target_in_buffer = buffer;
     nb_values_found = sscanf(buffer, "%ms", &http_target_string);
     if (nb_values_found != 1)
     {
@@ -195,12 +213,13 @@ HttpCode parseHttpHeaderFirstLine (HttpHeader* header, char* buffer)
     }
 
     header->version = findOptionValueFromString(accepted_versions, http_version_string, false);
-    if (header->version == HTTP_UNKNOWN_VERSION)
-        return HTTP_505; // Version not supported
 
     int version_length = strlen(http_version_string);
     free(http_version_string);
 
+    if (header->version == HTTP_UNKNOWN_VERSION)
+        return HTTP_505; // Version not supported
+
     buffer = consumeLeadingStringWhiteSpace(buffer + version_length);
 
     if (buffer[0] != '\r' && buffer[1] != '\n')
@@ -208,10 +227,79 @@ HttpCode parseHttpHeaderFirstLine (HttpHeader* header, char* buffer)
 
     return HTTP_200;
 
-    // TODO: parse option fields
     // TODO: Check for more issues
 }
 
+// Parse the option fields following the first line of a full header
+// The buffer is modified in place: names and values are null-terminated,
+// and the values of the handled fields point inside the buffer
+// (thus, they are only valid as long as the buffer content is)
+HttpCode parseHttpHeaderFields (HttpHeader* header, char* buffer)
+{
+    // Skip the first line
+    char* line = strstr(buffer, "\r\n");
+    if (line == NULL)
+        return HTTP_400;
+    line += 2;
+
+    // Each line has the form <name>:<OWS><value><OWS>(CRLF), until a blank line
+    while (line[0] != '\r' || line[1] != '\n')
+    {
+        char* line_end = strstr(line, "\r\n");
+        if (line_end == NULL)
+            return HTTP_400;
+
+        char* name_end = memchr(line, ':', line_end - line);
+        if (name_end == NULL || name_end == line || name_end[-1] == ' ' || name_end[-1] == '\t')
+            return HTTP_400; // Bad syntax (no whitespace is allowed before ':')
+
+        char* value     = name_end + 1;
+        char* value_end = line_end;
+
+        while (value < value_end && (value[0] == ' ' || value[0] == '\t'))
+            value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+
+        char* next_line = line_end + 2;
+        *name_end  = '\0';
+        *value_end = '\0';
+
+        // Field names are case-insensitive
+        switch (findOptionValueFromString(accepted_option_fields, line, true))
+        {
+            case HEAD_HOST:
+                header->host = value;
+                break;
+            case HEAD_ACCEPT:
+                header->accept = value;
+                break;
+            case HEAD_ACCEPT_ENCODING:
+                header->accept_encoding = value;
+                break;
+            case HEAD_IF_NONE_MATCH:
+                header->if_none_match = value;
+                break;
+            case HEAD_IF_MODIFIED_SINCE:
+                header->if_modified_since = value;
+                break;
+            case HEAD_RANGE:
+                header->range = value;
+                break;
+            case HEAD_IF_RANGE:
+                header->if_range = value;
+                break;
+
+            default:
+                break;
+        }
+
+        line = next_line;
+    }
+
+    return HTTP_200;
+}
+
 /**
  * In @opt, last Option is default, it has NULL for key.
  * If case_unsensitive is set to true, the @key entries of @opt should be UPPERCASE or won't be recognized.
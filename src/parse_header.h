@@ -3,9 +3,11 @@
 
 #include "http.h"
 
+int getHttpHeaderLength (const char* buffer, const int start_offset, const int content_length);
 bool bufferContainsFullHttpHeader (const char* buffer, const int start_offset, const int content_length);
 
 HttpCode parseHttpHeaderFirstLine (HttpHeader* header, char* buffer);
+HttpCode parseHttpHeaderFields (HttpHeader* header, char* buffer);
 //HttpCode fillHttpHeaderWith (HttpHeader* header, char* buffer);
 
 #endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "toolbox.h"
+#include "arena.h"
+#include "path_index.h"
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON PATH INDEX
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static PathIndexNode* _createPathIndexNode (Arena* arena, char* label, const int label_length,
+                                            void* value)
+{
+    PathIndexNode* new_node = allocateFromArena(arena, sizeof(PathIndexNode));
+
+    new_node->label        = label;
+    new_node->label_length = label_length;
+    new_node->value        = value;
+
+    new_node->child_bytes     = NULL;
+    new_node->children        = NULL;
+    new_node->nb_children     = 0;
+    new_node->max_nb_children = 0;
+
+    return new_node;
+}
+
+PathIndex* createPathIndex (Arena* arena)
+{
+    PathIndex* new_index = allocateFromArena(arena, sizeof(PathIndex));
+
+    new_index->root      = _createPathIndexNode(arena, "", 0, NULL);
+    new_index->arena     = arena;
+    new_index->nb_values = 0;
+
+    return new_index;
+}
+
+// -----------------------------------------------------------------------------
+// INSERTION
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the index of the child whose label starts with the given byte, or -1
+static int _findChild (const PathIndexNode* node, const unsigned char byte)
+{
+    if (node->nb_children == 0)
+        return -1;
+
+    unsigned char* child_byte = memchr(node->child_bytes, byte, node->nb_children);
+    if (child_byte == NULL)
+        return -1;
+
+    return child_byte - node->child_bytes;
+}
+
+// Internal version only!
+// The arrays of children are replaced by larger ones when they are full
+// (the previous ones are only freed with the arena)
+static void _addChild (Arena* arena, PathIndexNode* node, PathIndexNode* child)
+{
+    if (node->nb_children == node->max_nb_children)
+    {
+        int new_max_nb_children = MAX(2 * node->max_nb_children, PATH_INDEX_MIN_NB_CHILDREN);
+
+        unsigned char*  new_child_bytes = allocateFromArena(arena, new_max_nb_children);
+        PathIndexNode** new_children    = allocateFromArena(arena, new_max_nb_children
+                                                                 * sizeof(PathIndexNode*));
+        if (node->nb_children > 0)
+        {
+            memcpy(new_child_bytes, node->child_bytes, node->nb_children);
+            memcpy(new_children, node->children, node->nb_children * sizeof(PathIndexNode*));
+        }
+
+        node->child_bytes     = new_child_bytes;
+        node->children        = new_children;
+        node->max_nb_children = new_max_nb_children;
+    }
+
+    node->child_bytes[node->nb_children] = child->label[0];
+    node->children[node->nb_children]    = child;
+    node->nb_children++;
+}
+
+// The path must be normalized (no leading '/', nor repeated '/')
+// If the path is already in the index, its value is replaced
+void insertInPathIndex (PathIndex* index, const char* path, const int path_length, void* value)
+{
+    PathIndexNode* node = index->root;
+    int position = 0;
+
+    while (position < path_length)
+    {
+        int child_index = _findChild(node, path[position]);
+
+        // No key shares the next byte: the rest of the path becomes a new leaf
+        if (child_index < 0)
+        {
+            char* label = copyBytesToArena(index->arena, path + position, path_length - position);
+            _addChild(index->arena, node,
+                      _createPathIndexNode(index->arena, label, path_length - position, value));
+            index->nb_values++;
+            return;
+        }
+
+        PathIndexNode* child = node->children[child_index];
+
+        int common_length = 0;
+        while (common_length < child->label_length
+           &&  position + common_length < path_length
+           &&  child->label[common_length] == path[position + common_length])
+            common_length++;
+
+        // The label of the child is only partially shared: it is split in two nodes
+        // (which share the storage of the label)
+        if (common_length < child->label_length)
+        {
+            PathIndexNode* middle = _createPathIndexNode(index->arena, child->label,
+                                                         common_length, NULL);
+            child->label        += common_length;
+            child->label_length -= common_length;
+
+            _addChild(index->arena, middle, child);
+            node->children[child_index] = middle;
+
+            child = middle;
+        }
+
+        node      = child;
+        position += common_length;
+    }
+
+    if (node->value == NULL)
+        index->nb_values++;
+    node->value = value;
+}
+
+// -----------------------------------------------------------------------------
+// MATCHING
+// -----------------------------------------------------------------------------
+
+// A request target ends with its path: at the end of the string,
+// at the white space following it (in a request line), or at its query
+bool targetEndsAt (const char* target)
+{
+    switch (target[0])
+    {
+        case '\0':
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+        case '?':
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void initPathIndexCursor (PathIndexCursor* cursor, const PathIndex* index)
+{
+    cursor->node          = index->root;
+    cursor->label_offset  = 0;
+    cursor->previous_byte = '/'; // Leading '/' of targets are ignored
+}
+
+// Match the target byte by byte from the position of the cursor, where repeated '/' count as one
+// Return the end of the target, or NULL if no path of the index starts with it
+// If longest_prefix_value is not NULL, it is set to the value of the longest path of the index
+// which is a prefix of the target (if any; it is left untouched otherwise)
+const char* advancePathIndexCursor (PathIndexCursor* cursor, const char* target,
+                                    void** longest_prefix_value)
+{
+    PathIndexNode* node         = cursor->node;
+    int            label_offset = cursor->label_offset;
+
+    for (; ! targetEndsAt(target); target++)
+    {
+        char byte = target[0];
+        if (byte == '/' && cursor->previous_byte == '/')
+            continue;
+
+        // Move to the child whose label starts with the byte
+        if (label_offset == node->label_length)
+        {
+            if (longest_prefix_value != NULL && node->value != NULL)
+                *longest_prefix_value = node->value;
+
+            int child_index = _findChild(node, byte);
+            if (child_index < 0)
+                return NULL;
+
+            node         = node->children[child_index];
+            label_offset = 0;
+        }
+
+        if (node->label[label_offset] != byte)
+            return NULL;
+
+        label_offset++;
+        cursor->previous_byte = byte;
+    }
+
+    if (longest_prefix_value != NULL && label_offset == node->label_length && node->value != NULL)
+        *longest_prefix_value = node->value;
+
+    cursor->node         = node;
+    cursor->label_offset = label_offset;
+
+    return target;
+}
+
+// Return the value of the path matched so far (or NULL if it is not in the index)
+void* getPathIndexCursorValue (const PathIndexCursor* cursor)
+{
+    if (cursor->label_offset != cursor->node->label_length)
+        return NULL;
+
+    return cursor->node->value;
+}
+
+// Return the value of the path of the target, or NULL if it is not in the index
+void* findInPathIndex (const PathIndex* index, const char* target)
+{
+    PathIndexCursor cursor;
+    initPathIndexCursor(&cursor, index);
+
+    if (advancePathIndexCursor(&cursor, target, NULL) == NULL)
+        return NULL;
+
+    return getPathIndexCursorValue(&cursor);
+}
+
+// Return the value of the longest path of the index which is a prefix of the target
+// (e.g. the one of "docs/" for "/docs/api/index.html"), or NULL if there is none
+// The paths are compared byte by byte: the ones standing for directories must end with '/'
+void* findLongestPrefixInPathIndex (const PathIndex* index, const char* target)
+{
+    PathIndexCursor cursor;
+    initPathIndexCursor(&cursor, index);
+
+    void* longest_prefix_value = NULL;
+    advancePathIndexCursor(&cursor, target, &longest_prefix_value);
+
+    return longest_prefix_value;
+}
+
+// -----------------------------------------------------------------------------
+// PREFIX OPERATIONS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+static int _recursivelyApplyToNode (const PathIndexNode* node,
+                                    void (*function)(void* value, void* context), void* context)
+{
+    int nb_values = 0;
+    if (node->value != NULL)
+    {
+        function(node->value, context);
+        nb_values++;
+    }
+
+    for (int i = 0; i < node->nb_children; i++)
+        nb_values += _recursivelyApplyToNode(node->children[i], function, context);
+
+    return nb_values;
+}
+
+// Apply a function to the values of all the paths starting with the given prefix,
+// and return their number
+// The prefix only ends at a '/': "/docs" (like "/docs/") applies to the paths of the
+// directory (and to "docs" itself), but not to the ones of "/docs2/" or "/docs-old/"
+int applyToPathIndexPrefix (const PathIndex* index, const char* prefix,
+                            void (*function)(void* value, void* context), void* context)
+{
+    PathIndexCursor cursor;
+    initPathIndexCursor(&cursor, index);
+
+    if (advancePathIndexCursor(&cursor, prefix, NULL) == NULL)
+        return 0;
+
+    // All the paths below the reached node start with the prefix (even if its label
+    // is only partially matched)
+    if (cursor.previous_byte == '/')
+        return _recursivelyApplyToNode(cursor.node, function, context);
+
+    // Otherwise, only the path equal to the prefix and the ones continuing it with a '/'
+    int   nb_values = 0;
+    void* value     = getPathIndexCursorValue(&cursor);
+    if (value != NULL)
+    {
+        function(value, context);
+        nb_values++;
+    }
+
+    if (advancePathIndexCursor(&cursor, "/", NULL) != NULL)
+        nb_values += _recursivelyApplyToNode(cursor.node, function, context);
+
+    return nb_values;
+}
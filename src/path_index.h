@@ -0,0 +1,58 @@
+#ifndef __H_PATH_INDEX__
+#define __H_PATH_INDEX__
+
+#include <stdbool.h>
+#include "arena.h"
+
+// Structures representing a compressed radix tree over paths (relative to the root,
+// i.e. without leading '/'), mapping them to values (e.g. files)
+// Nodes are allocated in an arena, and thus freed with it
+
+typedef struct PathIndexNode {
+    // Bytes between the parent node and this one (never empty, except for the root)
+    char* label;
+    int   label_length;
+
+    void* value; // NULL if no path ends at this node
+
+    // Children are found through the first byte of their label (all different)
+    unsigned char*         child_bytes;
+    struct PathIndexNode** children;
+    int                    nb_children;
+    int                    max_nb_children;
+} PathIndexNode;
+
+typedef struct PathIndex {
+    PathIndexNode* root;
+    Arena*         arena;
+    int            nb_values;
+} PathIndex;
+
+// Position reached while matching a target, byte by byte
+typedef struct PathIndexCursor {
+    PathIndexNode* node;
+    int            label_offset; // Number of bytes of the label of node already matched
+    char           previous_byte;
+} PathIndexCursor;
+
+// -----------------------------------------------------------------------------
+
+#define PATH_INDEX_MIN_NB_CHILDREN 2
+
+// -----------------------------------------------------------------------------
+
+PathIndex* createPathIndex (Arena* arena);
+void insertInPathIndex (PathIndex* index, const char* path, const int path_length, void* value);
+
+bool targetEndsAt (const char* target);
+void initPathIndexCursor (PathIndexCursor* cursor, const PathIndex* index);
+const char* advancePathIndexCursor (PathIndexCursor* cursor, const char* target,
+                                    void** longest_prefix_value);
+void* getPathIndexCursorValue (const PathIndexCursor* cursor);
+
+void* findInPathIndex (const PathIndex* index, const char* target);
+void* findLongestPrefixInPathIndex (const PathIndex* index, const char* target);
+int applyToPathIndexPrefix (const PathIndex* index, const char* prefix,
+                            void (*function)(void* value, void* context), void* context);
+
+#endif
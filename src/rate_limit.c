@@ -0,0 +1,208 @@
+// Macro definition required for using posix_memalign()
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "toolbox.h"
+#include "rate_limit.h"
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON RATE LIMITER
+// -----------------------------------------------------------------------------
+
+// A limit set to RATE_LIMIT_NO_LIMIT is not enforced
+// The number of entries should be a few times the maximum number of clients
+RateLimiter* createRateLimiter (const int nb_entries, const int max_nb_requests_per_second,
+                                const int max_nb_burst_requests, const int max_nb_connections)
+{
+    RateLimiter* new_limiter = malloc(sizeof(RateLimiter));
+    if (new_limiter == NULL)
+        handleErrorAndExit("malloc() failed in createRateLimiter()");
+
+    uint32_t nb_sets = RATE_LIMIT_MIN_NB_SETS;
+    while (nb_sets * RATE_LIMIT_NB_WAYS < (uint32_t) nb_entries)
+        nb_sets *= 2;
+
+    // Each set is aligned on a cache line
+    size_t entries_size = nb_sets * RATE_LIMIT_NB_WAYS * sizeof(RateLimitEntry);
+    if (posix_memalign((void**) &new_limiter->entries, 64, entries_size) != 0)
+        handleErrorAndExit("posix_memalign() failed in createRateLimiter()");
+    memset(new_limiter->entries, 0, entries_size);
+
+    new_limiter->nb_sets_mask = nb_sets - 1;
+
+    setRateLimits(new_limiter, max_nb_requests_per_second, max_nb_burst_requests,
+                  max_nb_connections);
+
+    return new_limiter;
+}
+
+void deleteRateLimiter (RateLimiter* limiter)
+{
+    free(limiter->entries);
+    free(limiter);
+}
+
+// The limits can be changed at any time (e.g. when the configuration is reloaded):
+// the entries are kept, and the new limits apply to their next connections and requests
+// (the connections admitted while no limit was enforced at all are not counted though)
+void setRateLimits (RateLimiter* limiter, const int max_nb_requests_per_second,
+                    const int max_nb_burst_requests, const int max_nb_connections)
+{
+    limiter->request_interval = 0;
+    limiter->burst_duration   = 0;
+    if (max_nb_requests_per_second != RATE_LIMIT_NO_LIMIT)
+    {
+        limiter->request_interval = 1000000000 / max_nb_requests_per_second;
+        limiter->burst_duration   = limiter->request_interval
+                                  * (MAX(max_nb_burst_requests, 1) - 1);
+    }
+
+    limiter->max_nb_connections = max_nb_connections;
+}
+
+// -----------------------------------------------------------------------------
+// ENTRIES
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the entry of the address, or NULL if it has none
+static RateLimitEntry* _findEntry (const RateLimiter* limiter, const uint32_t address)
+{
+    uint32_t        set_index = (uint32_t) ((address * 0x9E3779B97F4A7C15) >> 32)
+                              & limiter->nb_sets_mask;
+    RateLimitEntry* set       = limiter->entries + set_index * RATE_LIMIT_NB_WAYS;
+
+    for (int i = 0; i < RATE_LIMIT_NB_WAYS; i++)
+        if (set[i].address == address)
+            return &set[i];
+
+    return NULL;
+}
+
+// Internal version only!
+// Return the entry of the address, which replaces another one of its set if it has none:
+// the least recently used one (approximately: the one whose bucket is full the soonest),
+// preferably among the addresses with no connection left
+// A recycled entry whose bucket is already full holds no information anymore; otherwise,
+// the limits of its address are only forgotten (i.e. loosened), never tightened
+static RateLimitEntry* _findOrAddEntry (RateLimiter* limiter, const uint32_t address)
+{
+    uint32_t        set_index = (uint32_t) ((address * 0x9E3779B97F4A7C15) >> 32)
+                              & limiter->nb_sets_mask;
+    RateLimitEntry* set       = limiter->entries + set_index * RATE_LIMIT_NB_WAYS;
+    RateLimitEntry* victim    = &set[0];
+
+    for (int i = 0; i < RATE_LIMIT_NB_WAYS; i++)
+    {
+        if (set[i].address == address)
+            return &set[i];
+
+        bool is_better_victim = (set[i].nb_connections == 0) != (victim->nb_connections == 0)
+                              ? set[i].nb_connections == 0
+                              : set[i].bucket_full_time < victim->bucket_full_time;
+        if (is_better_victim)
+            victim = &set[i];
+    }
+
+    victim->address          = address;
+    victim->nb_connections   = 0;
+    victim->bucket_full_time = 0;
+
+    return victim;
+}
+
+// -----------------------------------------------------------------------------
+// LIMITS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return true if the bucket of the entry has a token left (without taking it)
+static bool _bucketHasToken (const RateLimiter* limiter, const RateLimitEntry* entry,
+                             const uint64_t current_time)
+{
+    return entry->bucket_full_time <= current_time
+        || entry->bucket_full_time - current_time <= limiter->burst_duration;
+}
+
+// The key of an IPv4 address is the address itself (as in sin_addr), as well as the one
+// of an IPv4-mapped IPv6 address (from a dual-stack socket); the key of another IPv6 address
+// is a hash of its prefix (never RATE_LIMIT_NO_ADDRESS)
+uint32_t getRateLimitKey (const struct sockaddr* address)
+{
+    if (address->sa_family == AF_INET)
+        return ((const struct sockaddr_in*) address)->sin_addr.s_addr;
+
+    if (address->sa_family != AF_INET6)
+        return RATE_LIMIT_NO_ADDRESS;
+
+    const struct in6_addr* ipv6_address = &((const struct sockaddr_in6*) address)->sin6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(ipv6_address))
+    {
+        uint32_t ipv4_address;
+        memcpy(&ipv4_address, &ipv6_address->s6_addr[12], sizeof(ipv4_address));
+        return ipv4_address;
+    }
+
+    // FNV-1a
+    uint32_t key = 2166136261u;
+    for (int i = 0; i < RATE_LIMIT_IPV6_PREFIX_LENGTH; i++)
+        key = (key ^ ipv6_address->s6_addr[i]) * 16777619u;
+
+    return key != RATE_LIMIT_NO_ADDRESS ? key : 1;
+}
+
+// A new connection is refused if the address has too many of them,
+// or if it has exhausted its requests (it would only be refused them anyway)
+// An admitted connection must be released with releaseConnection() once closed
+bool admitConnection (RateLimiter* limiter, const uint32_t address, const uint64_t current_time)
+{
+    if (address == RATE_LIMIT_NO_ADDRESS
+    || (limiter->max_nb_connections == RATE_LIMIT_NO_LIMIT
+    &&  limiter->request_interval   == RATE_LIMIT_NO_LIMIT))
+        return true;
+
+    RateLimitEntry* entry = _findOrAddEntry(limiter, address);
+
+    if (limiter->max_nb_connections != RATE_LIMIT_NO_LIMIT
+    &&  entry->nb_connections >= limiter->max_nb_connections)
+        return false;
+
+    if (limiter->request_interval != RATE_LIMIT_NO_LIMIT
+    &&  ! _bucketHasToken(limiter, entry, current_time))
+        return false;
+
+    entry->nb_connections++;
+    return true;
+}
+
+void releaseConnection (RateLimiter* limiter, const uint32_t address)
+{
+    if (address == RATE_LIMIT_NO_ADDRESS)
+        return;
+
+    RateLimitEntry* entry = _findEntry(limiter, address);
+
+    // The entry may have been recycled since the connection was admitted
+    if (entry != NULL && entry->nb_connections > 0)
+        entry->nb_connections--;
+}
+
+// Take a token from the bucket of the address, if it has one left
+bool admitRequest (RateLimiter* limiter, const uint32_t address, const uint64_t current_time)
+{
+    if (address == RATE_LIMIT_NO_ADDRESS || limiter->request_interval == RATE_LIMIT_NO_LIMIT)
+        return true;
+
+    RateLimitEntry* entry = _findOrAddEntry(limiter, address);
+    if (! _bucketHasToken(limiter, entry, current_time))
+        return false;
+
+    entry->bucket_full_time = MAX(entry->bucket_full_time, current_time)
+                            + limiter->request_interval;
+    return true;
+}
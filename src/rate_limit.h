@@ -0,0 +1,55 @@
+#ifndef __H_RATE_LIMIT__
+#define __H_RATE_LIMIT__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// Structure limiting the number of connections and the rate of requests of each client address
+// It is a fixed-size, set-associative table (allocated once): an address is only looked for
+// in the few entries of its set, and an entry of the set is recycled for a new address
+// The rate is limited by a token bucket, represented by the time at which it will be full again
+// (GCRA: the "theoretical arrival time" of the next request, in ns)
+
+typedef struct RateLimitEntry {
+    uint32_t address;        // Key of the address (see getRateLimitKey()), or 0 if the entry is unused
+    uint32_t nb_connections;
+    uint64_t bucket_full_time;
+} RateLimitEntry;
+
+typedef struct RateLimiter {
+    RateLimitEntry* entries;
+    uint32_t        nb_sets_mask; // Number of sets - 1 (it is a power of two)
+
+    uint64_t request_interval; // ns (one token is added to the bucket after each interval)
+    uint64_t burst_duration;   // ns (time to refill all the tokens of the bucket but one)
+    uint32_t max_nb_connections;
+} RateLimiter;
+
+// -----------------------------------------------------------------------------
+
+// A set fills a cache line
+#define RATE_LIMIT_NB_WAYS     4
+#define RATE_LIMIT_MIN_NB_SETS 16
+
+// IPv6 clients are limited by /64 prefix (which a single host may own entirely)
+#define RATE_LIMIT_IPV6_PREFIX_LENGTH 8 // bytes
+
+// Named, useful constants
+#define RATE_LIMIT_NO_LIMIT   0
+#define RATE_LIMIT_NO_ADDRESS 0 // Clients with no address (e.g. on a Unix socket) are not limited
+
+// -----------------------------------------------------------------------------
+
+RateLimiter* createRateLimiter (const int nb_entries, const int max_nb_requests_per_second,
+                                const int max_nb_burst_requests, const int max_nb_connections);
+void deleteRateLimiter (RateLimiter* limiter);
+void setRateLimits (RateLimiter* limiter, const int max_nb_requests_per_second,
+                    const int max_nb_burst_requests, const int max_nb_connections);
+
+uint32_t getRateLimitKey (const struct sockaddr* address);
+bool admitConnection (RateLimiter* limiter, const uint32_t address, const uint64_t current_time);
+void releaseConnection (RateLimiter* limiter, const uint32_t address);
+bool admitRequest (RateLimiter* limiter, const uint32_t address, const uint64_t current_time);
+
+#endif
@@ -6,7 +6,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <poll.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
@@ -14,62 +16,39 @@
 #include "toolbox.h"
 #include "http.h"
 #include "file_cache.h"
+#include "io_pool.h"
+#include "gzip_stream.h"
 #include "parse_header.h"
+#include "metrics.h"
+#include "trace.h"
+#include "upgrade.h"
+#include "affinity.h"
+#include "config.h"
+#include "listener.h"
+#include "virtual_hosts.h"
 #include "server.h"
 
+// Set from a signal handler, and handled later in the main loop (or by the prefork master)
+static volatile sig_atomic_t _server_drain_is_requested = false;
+
 // -----------------------------------------------------------------------------
 // BASIC WEB SOCKET FUNCTIONS
 // -----------------------------------------------------------------------------
 
-int createWebSocket ()
-{
-    int sockfd = socket(AF_INET,     /* IPv4 */
-                        SOCK_STREAM, /* TCP  */
-                        0);
-    if (sockfd < 0)
-        handleErrorAndExit("socket() failed");
-
-    return sockfd;
-}
-
-struct sockaddr_in getLocalAddress (const int port)
-{
-    struct sockaddr_in address;
-
-    address.sin_family      = AF_INET;
-    address.sin_port        = htons(port);
-    address.sin_addr.s_addr = INADDR_ANY;
-    memset(address.sin_zero, 0, 8);
-
-    return address;
-}
-
-void bindWebSocket (const int sockfd, const struct sockaddr_in *address)
-{
-/*
-    printf("In bindWebScoket:\n");
-    printf("sockfd: %d\nport: %d\naddr_ip: %d (%d)\naddr_family: %d (AF_INET = %d)\n",
-            sockfd, ntohs(address->sin_port), address->sin_addr.s_addr, INADDR_ANY, address->sin_family, AF_INET);
-*/
-    int return_value = bind(sockfd, (const struct sockaddr*) address, sizeof(struct sockaddr_in));
-    if (return_value < 0)
-        handleErrorAndExit("bind() failed");
-}
-
-void listenWebSocket (const int sockfd, const int queue_max_length)
-{
-    int return_value = listen(sockfd, queue_max_length);
-    if (return_value < 0)
-        handleErrorAndExit("listen() failed");
-}
-
-int acceptWebSocket (const int sockfd, struct sockaddr_in* address)
+// Return -1 if no client is waiting anymore (the listening socket is non-blocking,
+// since it may be shared by several processes trying to accept the clients it signals)
+int acceptWebSocket (const int sockfd, struct sockaddr_storage* address)
 {
-    socklen_t address_length = sizeof address;
+    socklen_t address_length = sizeof(*address);
 
     int clientfd = accept(sockfd, (struct sockaddr*) address, &address_length);
     if (clientfd < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -1;
+
         handleErrorAndExit("accept() failed");
+    }
 
     return clientfd;
 }
@@ -89,7 +68,7 @@ Client* createClient ()
 
 void disconnectClient (Client* client)
 {
-    printf("Disconnecting client (fd: %d)\n", client->fd);
+    printDebug("Disconnecting client (fd: %d)\n", client->fd);
 
     int success = close(client->fd);
     if (success < 0)
@@ -108,20 +87,26 @@ void deleteClient (Client* client)
     free(client->answer_header_buffer);
     deleteHttpMessage(client->http_answer);
 
+    free(client->generated_body);
+
     free(client);
 }
 
-void initClient (Client* client, const int fd, const struct sockaddr_in address,
+void initClient (Client* client, const int fd, const struct sockaddr_storage* address,
                  const ServParameters* parameters)
 {
     client->fd      = fd;
-    client->address = address;
+    client->address = *address;
 
     client->previous = NULL;
     client->next     = NULL;
 
+    client->state = STATE_WAITING_FOR_REQUEST;
+    countClientStateChange(METRICS_NO_CLIENT_STATE, client->state);
+
     client->request_buffer_length = 0;
     client->request_buffer_offset = 0;
+    client->request_header_length = 0;
 
     client->request_buffer = malloc(parameters->request_buffer_size * sizeof(char));
     if (client->request_buffer == NULL)
@@ -139,6 +124,46 @@ void initClient (Client* client, const int fd, const struct sockaddr_in address,
 
     client->http_answer = createHttpMessage();
     initAnswerHttpMessage(client->http_answer, HTTP_V1_1, HTTP_NO_CODE);
+
+    client->generated_body     = NULL;
+    client->awaited_file       = NULL;
+    client->open_file          = NULL;
+    client->gzip_stream        = NULL;
+    client->compressed_output  = NULL;
+    client->cache              = NULL;
+    client->request_start_time = 0;
+    client->last_activity_time = getMonotonicTimeInNanoseconds();
+
+    client->zerocopy_state            = ZEROCOPY_NOT_ENABLED;
+    client->zerocopy_nb_pending_sends = 0;
+    client->zerocopy_pinned_cache     = NULL;
+
+    client->nb_answered_requests = 0;
+    client->is_refused           = false;
+}
+
+// Always use this function to change the state of a client (states are counted)
+void setClientState (Client* client, const ClientState state)
+{
+    countClientStateChange(client->state, state);
+    client->state = state;
+}
+
+// Remove the last processed request from the request buffer
+// Bytes following its header (i.e. pipelined requests) are moved to the beginning
+void resetClientRequest (Client* client)
+{
+    int nb_remaining_bytes = client->request_buffer_length - client->request_header_length;
+    if (nb_remaining_bytes > 0)
+        memmove(client->request_buffer, client->request_buffer + client->request_header_length,
+                nb_remaining_bytes);
+    else
+        nb_remaining_bytes = 0;
+
+    client->request_buffer_length = nb_remaining_bytes;
+    client->request_buffer_offset = 0;
+    client->request_header_length = 0;
+    client->request_buffer[nb_remaining_bytes] = '\0';
 }
 
 char* getClientStateAsString (const ClientState state)
@@ -149,6 +174,8 @@ char* getClientStateAsString (const ClientState state)
             return "WAITING_FOR_REQUEST";
         case STATE_PROCESSING_REQUEST:
             return "PROCESSING_REQUEST";
+        case STATE_WAITING_FOR_FILE:
+            return "WAITING_FOR_FILE";
         case STATE_ANSWERING:
             return "ANSWERING";
 
@@ -167,17 +194,18 @@ void printClient (const Client* client)
         client->request_buffer_length, client->request_buffer_offset);
     printf("| answer header: ofs = %d, length = %d\n",
         client->answer_header_buffer_length, client->answer_header_buffer_offset);
-    printf("| answer body  : ofs = %d, length = %d\n",
-        client->http_answer->content->offset, client->http_answer->content->length);
+    printf("| answer body  : ofs = %lld, length = %lld\n",
+        (long long) client->http_answer->content->offset,
+        (long long) client->http_answer->content->length);
     printf("| request      : target = %s, method = %s, code = %d\n",
            client->http_request->header->requestTarget != NULL ?
            client->http_request->header->requestTarget : "",
            getHttpMethodAsString(client->http_request->header->method),
            getHttpCodeValue(client->http_request->header->code));
-    printf("| answer       : method = %s, code = %d, content_length = %d\n",
+    printf("| answer       : method = %s, code = %d, content_length = %lld\n",
            getHttpMethodAsString(client->http_answer->header->method),
            getHttpCodeValue(client->http_answer->header->code),
-           client->http_answer->content->length);
+           (long long) client->http_answer->content->length);
 }
 
 // -----------------------------------------------------------------------------
@@ -195,18 +223,39 @@ Server* createServer ()
 
 void disconnectServer (Server* server)
 {
-    printf("Disconnecting server (fd: %d)\n", server->sockfd);
+    for (int i = 0; i < server->nb_listeners; i++)
+    {
+        if (server->listeners[i].sockfd == LISTENER_NO_SOCKET)
+            continue;
 
-    int success = close(server->sockfd);
-    if (success < 0)
-        handleErrorAndExit("close() failed in disconnectServer()");
+        printf("Disconnecting server (fd: %d)\n", server->listeners[i].sockfd);
+
+        int success = close(server->listeners[i].sockfd);
+        if (success < 0)
+            handleErrorAndExit("close() failed in disconnectServer()");
+
+        server->listeners[i].sockfd = LISTENER_NO_SOCKET;
+    }
+
+    // The sockets handed over by the previous process, if the server has not been started
+    for (int i = 0; i < server->nb_received_sockfds; i++)
+        close(server->received_sockfds[i]);
+    server->nb_received_sockfds = 0;
+
+    // The other sockets of the group (if any) are only still open in the prefork master
+    for (int i = 1; i < server->nb_steering_sockfds; i++)
+        close(server->steering_sockfds[i]);
 
     server->is_started = false;
 }
 
 void deleteServer (Server* server)
 {
-    // Start by disconnecting the server (i.e. closing the listening socket)
+    // In prefork mode, the master stops its workers first
+    if (server->workers != NULL)
+        stopWorkers(server, SIGINT);
+
+    // Start by disconnecting the server (i.e. closing the listening sockets)
     disconnectServer(server);
 
     // Delete all the clients
@@ -219,23 +268,51 @@ void deleteServer (Server* server)
     }
 
     // Delete the parameters structure
-    free(server->parameters);
-
-    // Delete the file cache, if any
-    if (server->cache != NULL)
-        deleteFileCache(server->cache);
+    deleteServParameters(server->parameters);
+    deleteListeners(server->listeners, server->nb_listeners);
+    free(server->received_sockfds);
+    free(server->steering_sockfds);
+
+    deleteHttpMessage(server->overload_answer);
+    if (server->rate_limiter != NULL)
+        deleteRateLimiter(server->rate_limiter);
+
+    // Delete the metrics structures
+    setWorkerMetrics(NULL);
+    deleteMetricsSlots(server->metrics_slots, server->nb_metrics_slots);
+
+    // Stop loading files before deleting the file cache
+    if (server->io_pool != NULL)
+        deleteIoPool(server->io_pool);
+
+    // Delete the sites and their file caches, if any, and close the files which are still open
+    if (server->virtual_hosts != NULL)
+        deleteVirtualHosts(server->virtual_hosts);
+    if (server->fd_cache != NULL)
+        deleteFdCache(server->fd_cache);
+    if (server->compressed_store != NULL)
+        deleteCompressedStore(server->compressed_store);
 
     // Finally delete the main structure
     free(server);
 }
 
-void initServer (Server* server, const int sockfd, const struct sockaddr_in address,
-                 ServParameters* parameters)
+void initServer (Server* server, ServParameters* parameters)
 {
-    server->sockfd     = sockfd;
-    server->address    = address;
     server->parameters = parameters;
 
+    // The listeners are only known when started (from the parameters)
+    server->listeners    = NULL;
+    server->nb_listeners = 0;
+
+    // ...as well as the sockets the previous process may have handed over
+    server->received_sockfds    = NULL;
+    server->nb_received_sockfds = 0;
+
+    // The clients are only steered to the workers when started (if enabled)
+    server->steering_sockfds    = NULL;
+    server->nb_steering_sockfds = 0;
+
     // When initialized, the server is considered non-active
     server->is_started = false;
 
@@ -243,28 +320,196 @@ void initServer (Server* server, const int sockfd, const struct sockaddr_in addr
     server->clients    = NULL;
     server->nb_clients = 0;
 
-    // ...nor has it any file cache
-    server->cache = NULL;
+    // ...nor has it any file cache (the caches are only sized when started,
+    // once the parameters are known)
+    server->virtual_hosts    = NULL;
+    server->fd_cache         = NULL;
+    server->compressed_store = NULL;
+
+    // Files are only loaded by a pool of threads if lazy loading is enabled (when started)
+    server->io_pool = NULL;
+
+    // Only one worker is handling the clients: its metrics are the only ones
+    server->metrics_slots    = createMetricsSlots(1);
+    server->nb_metrics_slots = 1;
+    setWorkerMetrics(&server->metrics_slots[0]);
+
+    // There are other workers in prefork mode only (when started)
+    server->workers    = NULL;
+    server->nb_workers = 0;
+
+    // No upgrade is in progress
+    server->upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+    server->upgraded_pid       = 0;
+    server->upgrade_deadline   = 0;
+    server->is_draining        = false;
+    server->drain_deadline     = 0;
+
+    // The inactive clients are first looked for once started
+    server->timeout_check_time = 0;
+
+    // ...and it is not overloaded
+    server->is_overloaded   = false;
+    server->recent_latency  = 0;
+    server->overload_answer = createHttpMessage();
+
+    // The limits of the client addresses are only known when started
+    server->rate_limiter = NULL;
 }
 
 // Initialize a server with default values
+// Its parameters can then be changed (e.g. from the configuration), until it is started
 void defaultInitServer (Server* server)
 {
-    int                sockfd  = createWebSocket();
-    struct sockaddr_in address = getLocalAddress(SERV_DEFAULT_PORT);
+    ServParameters* parameters = createServParameters();
+    defaultInitServParameters(parameters);
+
+    initServer(server, parameters);
+
+    // After an upgrade, the listening sockets of the previous process are used instead
+    // of new ones: they are kept until the server is started (see startListeners())
+    int received_sockfds[UPGRADE_MAX_NB_SOCKETS];
+    int nb_received_sockfds = receiveListeningSockets(received_sockfds);
+    if (nb_received_sockfds > 0)
+    {
+        server->received_sockfds = malloc(nb_received_sockfds * sizeof(int));
+        if (server->received_sockfds == NULL)
+            handleErrorAndExit("malloc() failed in defaultInitServer()");
+
+        memcpy(server->received_sockfds, received_sockfds, nb_received_sockfds * sizeof(int));
+        server->nb_received_sockfds = nb_received_sockfds;
+    }
+}
+
+// The structure is zeroed, so that two of them can be compared (see reloadConfiguration())
+ServParameters* createServParameters ()
+{
+    ServParameters* new_parameters = calloc(1, sizeof(ServParameters));
+    if (new_parameters == NULL)
+        handleErrorAndExit("calloc() failed in createServParameters()");
+
+    return new_parameters;
+}
+
+void deleteServParameters (ServParameters* parameters)
+{
+    free(parameters->listeners);
+    free(parameters->root_data_directory);
+    free(parameters->virtual_hosts);
+    free(parameters);
+}
+
+// The strings are copies, which can be replaced (and are freed with the structure)
+void defaultInitServParameters (ServParameters* parameters)
+{
+    parameters->listeners                  = getFreshStringCopy(SERV_DEFAULT_LISTENERS);
+    parameters->port                       = SERV_DEFAULT_PORT;
+    parameters->queue_max_length           = SERV_DEFAULT_QUEUE_MAX_LENGTH;
+    parameters->max_nb_clients             = SERV_DEFAULT_MAX_NB_CLIENTS;
+    parameters->request_buffer_size        = SERV_DEFAULT_REQUEST_BUF_SIZE;
+    parameters->answer_header_buffer_size  = SERV_DEFAULT_ANS_HEADER_BUF_SIZE;
+    parameters->root_data_directory        = getFreshStringCopy(SERV_DEFAULT_ROOT_DATA_DIR);
+    parameters->virtual_hosts              = getFreshStringCopy(SERV_DEFAULT_VIRTUAL_HOSTS);
+    parameters->cache_max_size             = SERV_DEFAULT_CACHE_MAX_SIZE;
+    parameters->cache_max_file_size        = SERV_DEFAULT_CACHE_MAX_FILE_SIZE;
+    parameters->fd_cache_max_nb_entries    = SERV_DEFAULT_FD_CACHE_SIZE;
+    parameters->lazy_loading               = SERV_DEFAULT_LAZY_LOADING;
+    parameters->nb_io_threads              = SERV_DEFAULT_NB_IO_THREADS;
+    parameters->stream_compression         = SERV_DEFAULT_STREAM_COMPRESSION;
+    parameters->compressed_store_max_size  = SERV_DEFAULT_COMP_STORE_MAX_SIZE;
+    parameters->compressed_output_max_size = SERV_DEFAULT_COMP_OUT_MAX_SIZE;
+    parameters->compression_level          = SERV_DEFAULT_COMPRESSION_LEVEL;
+    parameters->zerocopy_min_size          = SERV_DEFAULT_ZEROCOPY_MIN_SIZE;
+    parameters->nb_workers                 = SERV_DEFAULT_NB_WORKERS;
+    parameters->cpu_affinity               = SERV_DEFAULT_CPU_AFFINITY;
+    parameters->numa_replication           = SERV_DEFAULT_NUMA_REPLICATION;
+    parameters->high_watermark_nb_clients  = SERV_DEFAULT_HIGH_WM_NB_CLIENTS;
+    parameters->low_watermark_nb_clients   = SERV_DEFAULT_LOW_WM_NB_CLIENTS;
+    parameters->high_watermark_queue_depth = SERV_DEFAULT_HIGH_WM_QUEUE_DEPTH;
+    parameters->low_watermark_queue_depth  = SERV_DEFAULT_LOW_WM_QUEUE_DEPTH;
+    parameters->high_watermark_latency     = SERV_DEFAULT_HIGH_WM_LATENCY;
+    parameters->low_watermark_latency      = SERV_DEFAULT_LOW_WM_LATENCY;
+    parameters->retry_after                = SERV_DEFAULT_RETRY_AFTER;
+    parameters->rate_limit_nb_entries      = SERV_DEFAULT_RATE_NB_ENTRIES;
+    parameters->rate_limit_connections     = SERV_DEFAULT_RATE_NB_CONNS;
+    parameters->rate_limit_requests        = SERV_DEFAULT_RATE_NB_REQS;
+    parameters->rate_limit_burst           = SERV_DEFAULT_RATE_NB_BURST;
+    parameters->idle_timeout               = SERV_DEFAULT_IDLE_TIMEOUT;
+    parameters->request_timeout            = SERV_DEFAULT_REQUEST_TIMEOUT;
+    parameters->send_timeout               = SERV_DEFAULT_SEND_TIMEOUT;
+    initSocketOptions(&parameters->socket_options);
+}
+
+// Internal version only!
+// A watermark which is not given is a share of the maximum number of clients (at least 1)
+static void _deriveWatermark (int* watermark, const int max_nb_clients, const double share)
+{
+    if (*watermark == SERV_DERIVED_WATERMARK)
+        *watermark = MAX(1, (int) (max_nb_clients * share));
+}
+
+// Internal version only!
+// The low watermark must not be above the high one, which must not be above the given maximum
+// (if any): they are lowered otherwise (with a note)
+static void _checkWatermarks (int* low_watermark, int* high_watermark, const int max_value,
+                              const char* name)
+{
+    if (max_value > 0 && *high_watermark > max_value)
+    {
+        printWarning("Note: the high watermark of the %s (%d) is lowered to max-clients (%d)!",
+                     name, *high_watermark, max_value);
+        *high_watermark = max_value;
+    }
+
+    if (*low_watermark > *high_watermark)
+    {
+        printWarning("Note: the low watermark of the %s (%d) is lowered to the high one (%d)!",
+                     name, *low_watermark, *high_watermark);
+        *low_watermark = *high_watermark;
+    }
+}
 
-    ServParameters* parameters = malloc(sizeof(ServParameters));
-    if (parameters == NULL)
-        handleErrorAndExit("malloc() failed in defaultInitServer()");
+// Some parameters cannot be used together, or on this machine: they are then disabled
+// (with a note), before the server is started and whenever the configuration is reloaded
+// The watermarks which are not given are derived from the maximum number of clients
+void adjustServParameters (ServParameters* parameters)
+{
+    int max_nb_clients = parameters->max_nb_clients;
+    _deriveWatermark(&parameters->high_watermark_nb_clients, max_nb_clients,
+                     SERV_HIGH_WM_NB_CLIENTS_SHARE);
+    _deriveWatermark(&parameters->low_watermark_nb_clients, max_nb_clients,
+                     SERV_LOW_WM_NB_CLIENTS_SHARE);
+    _deriveWatermark(&parameters->high_watermark_queue_depth, max_nb_clients,
+                     SERV_HIGH_WM_QUEUE_DEPTH_SHARE);
+    _deriveWatermark(&parameters->low_watermark_queue_depth, max_nb_clients,
+                     SERV_LOW_WM_QUEUE_DEPTH_SHARE);
+
+    // Requests are only in progress for connected clients
+    _checkWatermarks(&parameters->low_watermark_nb_clients, &parameters->high_watermark_nb_clients,
+                     max_nb_clients, "clients");
+    _checkWatermarks(&parameters->low_watermark_queue_depth, &parameters->high_watermark_queue_depth,
+                     max_nb_clients, "queue");
+    _checkWatermarks(&parameters->low_watermark_latency, &parameters->high_watermark_latency,
+                     0, "latency");
+
+    if (parameters->nb_workers > 0 && parameters->lazy_loading)
+    {
+        printWarning("Note: lazy loading is disabled in prefork mode!");
+        parameters->lazy_loading = false;
+    }
 
-    parameters->queue_max_length          = SERV_DEFAULT_QUEUE_MAX_LENGTH;
-    parameters->max_nb_clients            = SERV_DEFAULT_MAX_NB_CLIENTS;
-    parameters->request_buffer_size       = SERV_DEFAULT_REQUEST_BUF_SIZE;
-    parameters->answer_header_buffer_size = SERV_DEFAULT_ANS_HEADER_BUF_SIZE;
-    parameters->root_data_directory       = SERV_DEFAULT_ROOT_DATA_DIR;
-    parameters->cache_max_size            = SERV_DEFAULT_CACHE_MAX_SIZE;
+    if (parameters->nb_workers == 0 && (parameters->cpu_affinity || parameters->numa_replication))
+    {
+        printWarning("Note: CPU affinity and NUMA replication require the prefork mode!");
+        parameters->cpu_affinity     = false;
+        parameters->numa_replication = false;
+    }
 
-    initServer(server, sockfd, address, parameters);
+    if (parameters->numa_replication && getNbNumaNodes() <= 1)
+    {
+        printWarning("Note: there is a single NUMA node: the cache is not replicated!");
+        parameters->numa_replication = false;
+    }
 }
 
 bool serverIsStarted (const Server* server)
@@ -276,7 +521,8 @@ void printServer (const Server* server)
 {
     printf("\n");
     printTitle("SERVER");
-    printf("sockfd    : %d\n", server->sockfd);
+    for (int i = 0; i < server->nb_listeners; i++)
+        printf("sockfd    : %d\n", server->listeners[i].sockfd);
     printf("is started: %s\n", server->is_started ? "true" : "false");
     printf("nb_clients: %d\n", server->nb_clients);
     printf("\n");
@@ -295,6 +541,26 @@ void printServer (const Server* server)
 // BASIC SERVER AND CLIENT-HANDLING FUNCTIONS
 // -----------------------------------------------------------------------------
 
+// Internal version only!
+// Return the listeners of the parameters (a single TCP4 one on the port, if none is given)
+static Listener* _parseServerListeners (const ServParameters* parameters, int* nb_listeners)
+{
+    char default_listener[LISTENER_MAX_NAME_LENGTH];
+    snprintf(default_listener, sizeof(default_listener), "tcp4:%d", parameters->port);
+
+    const char* list = parameters->listeners[0] != '\0' ? parameters->listeners : default_listener;
+    return parseListeners(list, parameters->queue_max_length, &parameters->socket_options,
+                          nb_listeners);
+}
+
+// Internal version only!
+// Without a burst size, as many requests as per second are admitted in a burst
+static int _getRateLimitBurst (const ServParameters* parameters)
+{
+    return parameters->rate_limit_burst > 0 ? parameters->rate_limit_burst
+                                            : parameters->rate_limit_requests;
+}
+
 // Once a server is created and initialized, this must be called in order
 // to make it active (i.e. listening for requests and waiting for clients)
 void startServer (Server* server)
@@ -302,19 +568,204 @@ void startServer (Server* server)
     if (serverIsStarted(server))
         handleErrorAndExit("startServer() failed: server is already started");
 
-    // Load the files in the cache
-    server->cache = buildCacheFromDisk(server->parameters->root_data_directory,
-                                       server->parameters->cache_max_size);
-    printFileCache(server->cache);
+    adjustServParameters(server->parameters);
+
+    // The listeners and the sites are checked before the caches are built
+    // (but the listeners are only started afterwards)
+    server->listeners = _parseServerListeners(server->parameters, &server->nb_listeners);
+    if (server->listeners == NULL)
+        handleErrorAndExit("startServer() failed: no valid listener is given");
+
+    server->virtual_hosts = parseVirtualHosts(server->parameters->virtual_hosts,
+                                              server->parameters->root_data_directory);
+    if (server->virtual_hosts == NULL)
+        handleErrorAndExit("startServer() failed: the virtual hosts are invalid");
+
+    // In prefork mode, the cache is built in shared memory and entirely loaded (the threads
+    // of a pool would not survive the forks), and each worker gets its own metrics slot
+    int nb_workers = server->parameters->nb_workers;
+    if (nb_workers > 0)
+    {
+        setCacheSharedMemory(true);
+
+        deleteMetricsSlots(server->metrics_slots, server->nb_metrics_slots);
+        server->metrics_slots    = createMetricsSlots(nb_workers);
+        server->nb_metrics_slots = nb_workers;
+        setWorkerMetrics(&server->metrics_slots[0]);
+
+        server->workers = calloc(nb_workers, sizeof(Worker));
+        if (server->workers == NULL)
+            handleErrorAndExit("calloc() failed in startServer()");
+        server->nb_workers = nb_workers;
+    }
+
+    // Load the files in the cache (or only their metadata, if lazy loading is enabled:
+    // their contents are then loaded by the pool of threads on first request)
+    setCacheLazyLoading(server->parameters->lazy_loading);
+    setCacheCompressionLevel(server->parameters->compression_level);
+    setCacheMaxFileSize(server->parameters->cache_max_file_size);
+    if (server->parameters->lazy_loading)
+        server->io_pool = createIoPool(server->parameters->nb_io_threads);
+
+    // Each site gets its own cache, sized from its share of the total size
+    VirtualHosts* virtual_hosts = server->virtual_hosts;
+    buildSiteCaches(virtual_hosts, server->parameters->cache_max_size);
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+        printFileCache(virtual_hosts->sites[i].cache);
+    printVirtualHosts(virtual_hosts);
+
+    // Each worker then reads the copy of its own node
+    if (server->parameters->numa_replication)
+    {
+        int nb_nodes = getNbNumaNodes();
+        for (int i = 0; i < virtual_hosts->nb_sites; i++)
+            replicateFileCache(virtual_hosts->sites[i].cache, nb_nodes);
+        printf("File cache(s) replicated on %d NUMA nodes\n", nb_nodes);
+    }
+
+    // Open files are shared by the answers sending the same uncached file,
+    // and the compressed outputs of uncached files are kept for the next requests
+    ServParameters* parameters = server->parameters;
+    server->fd_cache         = createFdCache(parameters->fd_cache_max_nb_entries);
+    server->compressed_store = createCompressedStore(parameters->compressed_store_max_size);
+
+    // In prefork mode, each worker gets its own copy of the table (and thus enforces its own limits)
+    server->rate_limiter = createRateLimiter(parameters->rate_limit_nb_entries,
+                                             parameters->rate_limit_requests,
+                                             _getRateLimitBurst(parameters),
+                                             parameters->rate_limit_connections);
 
-    // Attach the local adress to the socket, and make it a listener
-    bindWebSocket(server->sockfd, &server->address);
-    listenWebSocket(server->sockfd, server->parameters->queue_max_length);
+    printSocketOptions(&parameters->socket_options);
+    startListeners(server);
+    startSteeringSockets(server);
 
     // Once started, update the internal state of the server
     server->is_started = true;
 }
 
+// Internal version only!
+// Return the first socket handed over by the previous process with the address of the listener
+// (and forget it), or LISTENER_NO_SOCKET if there is none
+static int _takeReceivedSocket (Server* server, const Listener* listener)
+{
+    for (int i = 0; i < server->nb_received_sockfds; i++)
+    {
+        int sockfd = server->received_sockfds[i];
+        if (! listenerMatchesSocket(listener, sockfd))
+            continue;
+
+        memmove(&server->received_sockfds[i], &server->received_sockfds[i + 1],
+                (server->nb_received_sockfds - i - 1) * sizeof(int));
+        server->nb_received_sockfds--;
+        return sockfd;
+    }
+
+    return LISTENER_NO_SOCKET;
+}
+
+// Open the listening sockets, or reuse the ones with the same addresses handed over
+// by the previous process (after an upgrade): the other ones it has handed over are the rest
+// of the steering group of the first listener (see startSteeringSockets()), or are closed
+void startListeners (Server* server)
+{
+    // The clients of the first listener only are steered to the workers (if enabled)
+    bool is_steered = server->parameters->cpu_affinity
+                   && server->listeners[0].type != LISTENER_UNIX;
+
+    for (int i = 0; i < server->nb_listeners; i++)
+    {
+        Listener* listener = &server->listeners[i];
+        listener->sockfd = _takeReceivedSocket(server, listener);
+        startListener(listener, i == 0 && is_steered);
+    }
+
+    int nb_steering_sockfds = 0;
+    int steering_sockfds[UPGRADE_MAX_NB_SOCKETS];
+    steering_sockfds[nb_steering_sockfds++] = server->listeners[0].sockfd;
+
+    for (int sockfd = _takeReceivedSocket(server, &server->listeners[0]);
+         sockfd != LISTENER_NO_SOCKET;
+         sockfd = _takeReceivedSocket(server, &server->listeners[0]))
+        steering_sockfds[nb_steering_sockfds++] = sockfd;
+
+    if (nb_steering_sockfds > 1)
+    {
+        server->steering_sockfds = malloc(nb_steering_sockfds * sizeof(int));
+        if (server->steering_sockfds == NULL)
+            handleErrorAndExit("malloc() failed in startListeners()");
+
+        memcpy(server->steering_sockfds, steering_sockfds, nb_steering_sockfds * sizeof(int));
+        server->nb_steering_sockfds = nb_steering_sockfds;
+    }
+
+    // E.g. the sockets of the listeners which have been removed from the configuration
+    for (int i = 0; i < server->nb_received_sockfds; i++)
+        close(server->received_sockfds[i]);
+
+    free(server->received_sockfds);
+    server->received_sockfds    = NULL;
+    server->nb_received_sockfds = 0;
+
+    printListeners(server->listeners, server->nb_listeners);
+}
+
+// With CPU affinity, a listening socket is opened for each worker, in the SO_REUSEPORT group
+// of the first listener, and a program attached to the group steers each client to the socket
+// of the worker running on the CPU which received it (see affinity.h)
+// After an upgrade, the sockets of the group are reused (and completed if required)
+void startSteeringSockets (Server* server)
+{
+    Listener* steered_listener = &server->listeners[0];
+
+    int nb_sockfds = server->parameters->cpu_affinity ? server->parameters->nb_workers : 1;
+    if (nb_sockfds > 1 && steered_listener->type == LISTENER_UNIX)
+    {
+        printWarning("Warning: the clients of a Unix listener cannot be steered to the workers!");
+        nb_sockfds = 1;
+    }
+
+    // All the sockets are handed over to the upgraded process
+    if (nb_sockfds > 1 && server->nb_listeners + nb_sockfds - 1 > UPGRADE_MAX_NB_SOCKETS)
+    {
+        printWarning("Warning: the clients cannot be steered to more than %d workers!",
+                     UPGRADE_MAX_NB_SOCKETS - server->nb_listeners + 1);
+        nb_sockfds = 1;
+    }
+
+    // Unneeded sockets (e.g. received from a previous process steering more workers)
+    // are closed from the last one, so that the positions of the others in the group are kept
+    for (int i = server->nb_steering_sockfds - 1; i >= MAX(nb_sockfds, 1); i--)
+        close(server->steering_sockfds[i]);
+
+    if (nb_sockfds == 1)
+    {
+        free(server->steering_sockfds);
+        server->steering_sockfds    = NULL;
+        server->nb_steering_sockfds = 0;
+        return;
+    }
+
+    int* sockfds = realloc(server->steering_sockfds, nb_sockfds * sizeof(int));
+    if (sockfds == NULL)
+        handleErrorAndExit("realloc() failed in startSteeringSockets()");
+    sockfds[0] = steered_listener->sockfd;
+
+    // The position of a socket in the group is the order in which it started listening
+    for (int i = MAX(server->nb_steering_sockfds, 1); i < nb_sockfds; i++)
+    {
+        Listener group_listener = *steered_listener;
+        group_listener.sockfd = LISTENER_NO_SOCKET;
+
+        startListener(&group_listener, true);
+        sockfds[i] = group_listener.sockfd;
+    }
+
+    server->steering_sockfds    = sockfds;
+    server->nb_steering_sockfds = nb_sockfds;
+
+    attachCpuSteeringProgram(steered_listener->sockfd, nb_sockfds);
+}
+
 void addClientToServer (Server* server, Client* client)
 {
     // Case 1: it is the first client
@@ -345,7 +796,7 @@ void addClientToServer (Server* server, Client* client)
 
 void removeClientFromServer (Server* server, Client* client)
 {
-    printf("Client (fd: %d) is being removed.\n", client->fd);
+    printDebug("Client (fd: %d) is being removed.\n", client->fd);
 
     // Remove the client from the doubly-linked list
     if (client->next     != NULL)
@@ -359,6 +810,20 @@ void removeClientFromServer (Server* server, Client* client)
         server->clients = client->next;
 
     (server->nb_clients)--;
+    countClientStateChange(client->state, METRICS_NO_CLIENT_STATE);
+    releaseConnection(server->rate_limiter, getRateLimitKey((struct sockaddr*) &client->address));
+
+    // Release the file (or compressed output) being sent, if any
+    releaseAnswerContent(server, client);
+
+    // The last sends of the client may not be completed: they are given a grace period
+    if (client->zerocopy_pinned_cache != NULL)
+    {
+        handleZeroCopyCompletions(server, client);
+
+        if (client->zerocopy_pinned_cache != NULL)
+            unpinFileCache(client->zerocopy_pinned_cache, getMonotonicTimeInNanoseconds(), false);
+    }
     
     // Actually delete the Client structure
     deleteClient(client);
@@ -367,53 +832,262 @@ void removeClientFromServer (Server* server, Client* client)
 // Return a new, initialized client structure by using accept()
 // The Server structure is also modified accordingly!
 
-// TODO: improve this!
-// If the server has no more free client slot, fails, print an error, and return NULL
-Client* acceptNewClient (Server* server)
+// If the server is overloaded or has no more free client slot, or if the address of the client
+// exceeds its limits, the client is refused (see refuseNewClient()), and NULL is returned
+// (as well as if no client is waiting anymore)
+Client* acceptNewClient (Server* server, const Listener* listener)
 {
     ServParameters* parameters = server->parameters;
 
     if (! serverIsStarted(server))
         handleErrorAndExit("acceptNewClient() failed: server is not started");
 
-    if (server->nb_clients == parameters->max_nb_clients)
+    // Refused clients are accepted as well: leaving them in the queue would keep
+    // the listening socket ready (and the loop spinning)
+    struct sockaddr_storage address;
+    int clientfd = acceptWebSocket(listener->sockfd, &address);
+    if (clientfd < 0)
+        return NULL;
+
+    if (server->is_overloaded || server->nb_clients == parameters->max_nb_clients)
     {
-        printError("Warning: acceptNewClient() failed: no more free slot!\n");
+        refuseNewClient(server, clientfd, HTTP_503);
         return NULL;
     }
 
-    struct sockaddr_in address;
-    int clientfd = acceptWebSocket(server->sockfd, &address);
+    if (! admitConnection(server->rate_limiter, getRateLimitKey((struct sockaddr*) &address),
+                          getMonotonicTimeInNanoseconds()))
+    {
+        refuseNewClient(server, clientfd, HTTP_429);
+        return NULL;
+    }
 
     // Create and initialize a Client structure, and add it to the server
     Client* new_client = createClient();
-    initClient(new_client, clientfd, address, parameters);
+    initClient(new_client, clientfd, &address, parameters);
     addClientToServer(server, new_client);
 
     return new_client;
 }
 
+// Internal version only!
+// Unread bytes (e.g. of the request) would make close() reset the connection,
+// and the answer could be discarded before the client reads it
+static void _shutdownRefusedSocket (const int fd)
+{
+    char discarded_bytes[1024];
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, discarded_bytes, sizeof(discarded_bytes), MSG_DONTWAIT) > 0)
+        continue;
+}
+
+// Answer an accepted client with a 503 or a 429 (whose header is pre-rendered), and disconnect it
+void refuseNewClient (Server* server, const int clientfd, const HttpCode http_code)
+{
+    char retry_after[16];
+    snprintf(retry_after, sizeof(retry_after), "%d", server->parameters->retry_after);
+    prepareHttpRefusal(server->overload_answer, http_code, retry_after);
+
+    char answer_header[HTTP_PRERENDERED_ERROR_MAX_LENGTH];
+    int  answer_header_length = fillHttpAnswerHeaderBuffer(server->overload_answer, answer_header,
+                                                           HTTP_PRERENDERED_ERROR_MAX_LENGTH);
+
+    // The socket buffer of a new connection is empty: the answer is sent at once (or not at all)
+    if (answer_header_length > 0)
+        send(clientfd, answer_header, answer_header_length, MSG_DONTWAIT);
+    countHttpAnswer(getHttpCodeValue(http_code));
+    countAcceptDrop();
+
+    _shutdownRefusedSocket(clientfd);
+    close(clientfd);
+    printDebug("New client (fd = %d) has been refused.\n", clientfd);
+}
+
+// The server becomes overloaded when any high watermark is reached (number of clients,
+// number of requests in progress, or recent latency), and only stops being overloaded
+// when all of them are below their low watermarks
+void updateOverloadState (Server* server)
+{
+    ServParameters* parameters = server->parameters;
+
+    int queue_depth = 0;
+    for (Client* client = server->clients; client != NULL; client = client->next)
+        if (client->state != STATE_WAITING_FOR_REQUEST)
+            queue_depth++;
+
+    // The latency of the last requests is forgotten once no request is in progress
+    if (queue_depth == 0)
+        server->recent_latency = 0;
+
+    bool was_overloaded = server->is_overloaded;
+    if (! was_overloaded)
+        server->is_overloaded = server->nb_clients     >= parameters->high_watermark_nb_clients
+                             || queue_depth            >= parameters->high_watermark_queue_depth
+                             || server->recent_latency >= parameters->high_watermark_latency;
+    else
+        server->is_overloaded = server->nb_clients     >= parameters->low_watermark_nb_clients
+                             || queue_depth            >= parameters->low_watermark_queue_depth
+                             || server->recent_latency >= parameters->low_watermark_latency;
+
+    if (server->is_overloaded != was_overloaded)
+        printWarning(server->is_overloaded ? "Note: the server is overloaded (%d clients)!"
+                                           : "Note: the server is not overloaded anymore (%d clients).",
+                     server->nb_clients);
+}
+
+// Internal version only!
+static bool _timeoutIsExpired (const int timeout, const uint64_t start_time,
+                               const uint64_t current_time)
+{
+    return timeout != SERV_NO_TIMEOUT
+        && current_time - start_time > (uint64_t) timeout * 1000000000;
+}
+
+// Internal version only!
+static bool _clientsCanTimeOut (const ServParameters* parameters)
+{
+    return parameters->idle_timeout    != SERV_NO_TIMEOUT
+        || parameters->request_timeout != SERV_NO_TIMEOUT
+        || parameters->send_timeout    != SERV_NO_TIMEOUT;
+}
+
+// Internal version only!
+// A client waiting for the server itself (e.g. for a file being loaded, or for gzip) never times out
+static bool _clientIsInactive (const ServParameters* parameters, const Client* client,
+                               const uint64_t current_time)
+{
+    switch (client->state)
+    {
+        case STATE_WAITING_FOR_REQUEST:
+            if (client->request_buffer_length == 0)
+                return _timeoutIsExpired(parameters->idle_timeout,
+                                         client->last_activity_time, current_time);
+            else
+                return _timeoutIsExpired(parameters->request_timeout,
+                                         client->request_start_time, current_time);
+
+        case STATE_ANSWERING:
+            return ! clientWaitsForCompressedData(client)
+                && _timeoutIsExpired(parameters->send_timeout,
+                                     client->last_activity_time, current_time);
+
+        default:
+            return false;
+    }
+}
+
+// Disconnect the clients which have been inactive for too long: the kept-alive ones idle
+// between two requests, the ones sending their request too slowly (they would hold
+// a client slot forever), and the ones not reading their answer
+// The clients are only checked once per SERV_TIMEOUT_CHECK_INTERVAL
+void expireInactiveClients (Server* server)
+{
+    uint64_t current_time = getMonotonicTimeInNanoseconds();
+    if (current_time < server->timeout_check_time || ! _clientsCanTimeOut(server->parameters))
+        return;
+
+    server->timeout_check_time = current_time + (uint64_t) SERV_TIMEOUT_CHECK_INTERVAL * 1000000;
+
+    Client* current_client = server->clients;
+    while (current_client != NULL)
+    {
+        Client* next_client = current_client->next;
+        if (_clientIsInactive(server->parameters, current_client, current_time))
+        {
+            printDebug("Client %d has been inactive for too long.\n", current_client->fd);
+
+            countClientTimeout();
+            removeClientFromServer(server, current_client);
+        }
+
+        current_client = next_client;
+    }
+}
+
+// Internal version only!
+// Return true if an answer being sent reads (part of) the content
+static bool _contentIsBeingSent (const char* content, const off_t size, void* server_pointer)
+{
+    const Server* server = server_pointer;
+
+    for (const Client* client = server->clients; client != NULL; client = client->next)
+    {
+        if (client->state != STATE_ANSWERING)
+            continue;
+
+        const HttpContent* answer_content = client->http_answer->content;
+        if (answer_content->body >= content && answer_content->body <= content + size)
+            return true;
+
+        for (int i = 0; i < answer_content->nb_parts; i++)
+            if (answer_content->parts[i].body >= content
+            &&  answer_content->parts[i].body <= content + size)
+                return true;
+    }
+
+    return false;
+}
+
+// Free the contents of the caches which have been invalidated (see reloadServerConfiguration()),
+// once they are not sent anymore
+void freeRetiredContents (Server* server)
+{
+    uint64_t current_time = getMonotonicTimeInNanoseconds();
+
+    for (int i = 0; i < server->virtual_hosts->nb_sites; i++)
+    {
+        FileCache* cache = server->virtual_hosts->sites[i].cache;
+        if (cache->retired_contents != NULL)
+            freeUnusedRetiredContents(cache, current_time, _contentIsBeingSent, server);
+    }
+}
+
 // -----------------------------------------------------------------------------
 // READING FROM AND WRITING TO CLIENTS
 // -----------------------------------------------------------------------------
 
 void readFromClient (Server* server, Client* client)
 {
-    // Read data from the socket, and null-terminate the buffer
-    printf("Reading up to %d bytes from client %d...\n",
-           server->parameters->request_buffer_size - 1, client->fd);
+    client->last_activity_time = getMonotonicTimeInNanoseconds();
+
+    // If the buffer is empty, this is the first byte of a new request
+    if (client->request_buffer_length == 0)
+        client->request_start_time = client->last_activity_time;
+
+    // Read data from the socket (after the data already in the buffer),
+    // and null-terminate the buffer
+    // The offset marks the new data, which has not been checked yet
+    int nb_bytes_to_read = server->parameters->request_buffer_size - client->request_buffer_length - 1;
+    printDebug("Reading up to %d bytes from client %d...\n", nb_bytes_to_read, client->fd);
+
+    uint64_t trace_start = startTraceStage();
     int nb_bytes_read = read(client->fd,
-                             client->request_buffer + client->request_buffer_offset,
-                             server->parameters->request_buffer_size - client->request_buffer_length - 1);
-    client->request_buffer[client->request_buffer_offset + nb_bytes_read] = '\0';
+                             client->request_buffer + client->request_buffer_length,
+                             nb_bytes_to_read);
+    endTraceStage(TRACE_READ, client->fd, trace_start);
+
+    if (nb_bytes_read < 0)
+    {
+        if (errno == ECONNRESET)
+        {
+            removeClientFromServer(server, client);
+            return;
+        }
+        else
+            handleErrorAndExit("read() failed in readFromClient()");
+    }
+
+    client->request_buffer_offset  = client->request_buffer_length;
     client->request_buffer_length += nb_bytes_read;
+    client->request_buffer[client->request_buffer_length] = '\0';
 
     // Debug printing
-    printf("***** Buffer content below (%d bytes) *****\n", nb_bytes_read);
-    printf("%s\n", client->request_buffer);
+    printDebug("***** Buffer content below (%d bytes) *****\n", nb_bytes_read);
+    printDebug("%s\n", client->request_buffer);
 
     // If the read() call returned 0 (no byte has been read), it means the
     // client has ended the connection, and can be removed from the list of clients
+    // (this also happens if the buffer is full without containing a full header)
     if (nb_bytes_read == 0)
     {
         removeClientFromServer(server, client);
@@ -424,66 +1098,355 @@ void readFromClient (Server* server, Client* client)
     processClientRequest(server, client);
 }
 
+// Return true if the request targets the (reserved) metrics path
+bool isMetricsRequest (const HttpMessage* request)
+{
+    return request->header->code == HTTP_200
+        && (request->header->method == HTTP_GET || request->header->method == HTTP_HEAD)
+        && request->header->requestTarget != NULL
+        && stringsAreEqual(request->header->requestTarget, METRICS_PATH);
+}
+
+// Render the metrics of all the workers in the generated body buffer of the client,
+// and produce an answer whose body is this buffer
+void produceMetricsAnswer (Server* server, Client* client)
+{
+    if (client->generated_body == NULL)
+    {
+        client->generated_body = malloc(METRICS_BUFFER_SIZE * sizeof(char));
+        if (client->generated_body == NULL)
+            handleErrorAndExit("malloc() failed in produceMetricsAnswer()");
+    }
+
+    int body_length = renderMetrics(server->metrics_slots, server->nb_metrics_slots,
+                                    client->generated_body, METRICS_BUFFER_SIZE);
+
+    HttpMessage* answer = client->http_answer;
+    prepareGeneralHttpAnswer(answer, HTTP_200);
+
+    answer->header->content_length = body_length;
+    answer->header->content_type   = METRICS_CONTENT_TYPE;
+
+    if (client->http_request->header->method == HTTP_GET)
+    {
+        answer->content->length            = body_length;
+        answer->content->body              = client->generated_body;
+        answer->content->content_is_loaded = true;
+    }
+}
+
 // TODO: do this in another thread?
 void processClientRequest (Server* server, Client* client)
 {
-    client->state = STATE_PROCESSING_REQUEST;
+    setClientState(client, STATE_PROCESSING_REQUEST);
 
     // TODO: check it more thoroughly (what about body, etc)
     // Check whether the header has been fully received
-    if (! bufferContainsFullHttpHeader(client->request_buffer,
-                                       client->request_buffer_offset,
-                                       client->request_buffer_length))
+    uint64_t trace_start = startTraceStage();
+    client->request_header_length = getHttpHeaderLength(client->request_buffer,
+                                                        client->request_buffer_offset,
+                                                        client->request_buffer_length);
+    endTraceStage(TRACE_HEADER_CHECK, client->fd, trace_start);
+
+    if (client->request_header_length == 0)
     {
-        printf("Header is incomplete: reading more...\n");
+        printDebug("Header is incomplete: reading more...\n");
 
-        client->state = STATE_WAITING_FOR_REQUEST;
+        setClientState(client, STATE_WAITING_FOR_REQUEST);
         return;
     }
 
     // Step 1: analyze the request
+    trace_start = startTraceStage();
     HttpCode http_code = parseHttpRequest(client->http_request, client->request_buffer);
     client->http_request->header->code = http_code;
+    endTraceStage(TRACE_PARSE, client->fd, trace_start);
+
+    // Step 2: answer it, unless the address of the client has exhausted its requests
+    if (! admitRequest(server->rate_limiter, getRateLimitKey((struct sockaddr*) &client->address),
+                       client->request_start_time))
+    {
+        refuseClientRequest(server, client);
+        return;
+    }
 
-    // Step 2.1: produce the answer message
-    produceHttpAnswerFromRequest(client->http_answer, client->http_request, server->cache);
+    produceClientAnswer(server, client);
+}
+
+// Answer the request with a 429, after which the client is disconnected (see writeToClient()):
+// its slot is freed for the other clients
+void refuseClientRequest (Server* server, Client* client)
+{
+    char retry_after[16];
+    snprintf(retry_after, sizeof(retry_after), "%d", server->parameters->retry_after);
+    prepareHttpRefusal(client->http_answer, HTTP_429, retry_after);
+    client->is_refused = true;
+
+    countHttpAnswer(HTTP_429);
 
-    // Step 2.2: fill the answer message header buffer
     int buffer_length = fillHttpAnswerHeaderBuffer(client->http_answer,
                                                    client->answer_header_buffer,
                                                    server->parameters->answer_header_buffer_size);
     client->answer_header_buffer_length = buffer_length;
     client->answer_header_buffer_offset = 0;
 
-    client->state = STATE_ANSWERING;
+    setClientState(client, STATE_ANSWERING);
 }
 
-// Only write the HTTP header buffer on the socket
-// Returns true if the buffer has been entirely written, false otherwise
-bool writeHttpHeaderToClient (Server* server, Client* client)
+// Produce the answer to the parsed request of a client, and prepare its sending,
+// unless the content of the requested file must be loaded first
+void produceClientAnswer (Server* server, Client* client)
 {
-    // Write the header data on the socket
-    printf("(HEAD) Writing up to %lu bytes to client %d...\n",
-           strlen(client->answer_header_buffer), client->fd);
-
+    // Step 2.1: produce the answer message (the metrics path is reserved),
+    // from the cache of the site of the requested host
+    uint64_t trace_start = startTraceStage();
+    File* pending_file = NULL;
+    if (isMetricsRequest(client->http_request))
+        produceMetricsAnswer(server, client);
+    else
+    {
+        Site* site = findVirtualHostSite(server->virtual_hosts, client->http_request->header->host);
+        client->cache = site->cache;
+
+        pending_file = produceHttpAnswerFromRequest(client->http_answer, client->http_request,
+                                                    client->cache);
+    }
+    endTraceStage(TRACE_PRODUCE_ANSWER, client->fd, trace_start);
+
+    if (pending_file != NULL)
+    {
+        waitForFileContent(server, client, pending_file);
+        return;
+    }
+
+    // Uncached files may be sent compressed
+    if (answerCanBeCompressed(server, client))
+        produceCompressedAnswer(server, client);
+
+    // Step 2.2: fill the answer message header buffer
+    trace_start = startTraceStage();
+    int buffer_length = fillHttpAnswerHeaderBuffer(client->http_answer,
+                                                   client->answer_header_buffer,
+                                                   server->parameters->answer_header_buffer_size);
+    endTraceStage(TRACE_FILL_HEADER, client->fd, trace_start);
+
+    // A header which does not fit in the buffer is replaced by a (much shorter) error one
+    if (buffer_length < 0)
+    {
+        releaseAnswerContent(server, client);
+        answerClientWithError(server, client, HTTP_500);
+        return;
+    }
+
+    countHttpAnswer(getHttpCodeValue(client->http_answer->header->code));
+    client->answer_header_buffer_length = buffer_length;
+    client->answer_header_buffer_offset = 0;
+
+    setClientState(client, STATE_ANSWERING);
+}
+
+// Make the client wait until the content of the file is loaded
+// A file is only loaded once, however many clients are waiting for it
+void waitForFileContent (Server* server, Client* client, File* file)
+{
+    if (file->state == STATE_TO_LOAD)
+    {
+        file->state = STATE_LOADING;
+        submitFileLoading(server->io_pool, client->cache, file);
+    }
+
+    client->awaited_file = file;
+    setClientState(client, STATE_WAITING_FOR_FILE);
+}
+
+// Return true if the answer sends a file which is not in the cache,
+// and which is worth being compressed on the fly (if the client accepts it)
+bool answerCanBeCompressed (const Server* server, const Client* client)
+{
+    HttpMessage* answer = client->http_answer;
+    File*        file   = answer->content->file;
+
+    return server->parameters->stream_compression
+        && answer->header->code == HTTP_200
+        && file != NULL
+        && file->state == STATE_NOT_LOADED
+        && file->encoding == ENCODING_NONE
+        && fileIsCompressible(file);
+}
+
+// Send the stored compressed output of the file if there is one,
+// or start compressing it on the fly otherwise
+// (if the compression cannot be started, the file is sent uncompressed)
+void produceCompressedAnswer (Server* server, Client* client)
+{
+    HttpMessage* request = client->http_request;
+    HttpMessage* answer  = client->http_answer;
+    File*        file    = answer->content->file;
+
+    // The chunked transfer coding requires HTTP/1.1
+    if (request->header->version != HTTP_V1_1 || ! requestAcceptsEncoding(request, "gzip"))
+    {
+        answer->header->vary = "Accept-Encoding";
+        return;
+    }
+
+    if (! prepareHttpCompressedAnswer(request, answer, file))
+        return;
+
+    CompressedOutput* output = acquireCompressedOutput(server->compressed_store, file);
+    if (output != NULL)
+    {
+        setHttpCompressedContent(request, answer, output->content, output->length);
+
+        // The output must be kept until it is sent (HEAD requests only need its length)
+        if (request->header->method == HTTP_GET)
+            client->compressed_output = output;
+        else
+            releaseCompressedOutput(server->compressed_store, output);
+
+        return;
+    }
+
+    if (request->header->method != HTTP_GET)
+        return;
+
+    client->gzip_stream = createGzipStream(file->path,
+                                           server->parameters->compressed_output_max_size,
+                                           server->parameters->compression_level);
+    if (client->gzip_stream == NULL)
+    {
+        prepareHttpValidAnswer(request, answer, file);
+        answer->header->vary = "Accept-Encoding";
+    }
+}
+
+// Answer the request with an error (e.g. if its file has been removed since the cache was built)
+void answerClientWithError (Server* server, Client* client, const HttpCode http_code)
+{
+    prepareHttpError(client->http_answer, http_code);
+
+    countHttpAnswer(http_code);
+
+    int buffer_length = fillHttpAnswerHeaderBuffer(client->http_answer,
+                                                   client->answer_header_buffer,
+                                                   server->parameters->answer_header_buffer_size);
+    client->answer_header_buffer_length = buffer_length;
+    client->answer_header_buffer_offset = 0;
+
+    setClientState(client, STATE_ANSWERING);
+}
+
+// Store the contents loaded by the pool of threads in the cache,
+// and answer the clients which were waiting for them
+// If a file cannot be read anymore, the space reserved for it is released, and it is sent
+// from the disk from now on: its clients get a 404 if it has been removed
+void handleCompletedFileLoadings (Server* server)
+{
+    FileLoadingJob* job = collectCompletedFileLoadings(server->io_pool);
+    while (job != NULL)
+    {
+        File* file = job->file;
+        bool  file_is_removed = false;
+
+        if (job->is_loaded)
+        {
+            // The size of the file in the cache may differ once compressed
+            job->cache->size += job->size - file->size;
+
+            file->content  = job->content;
+            file->size     = job->size;
+            file->state    = job->state;
+            file->encoding = job->encoding;
+        }
+        else
+        {
+            job->cache->size -= file->size;
+
+            file->content     = NULL;
+            file->state       = STATE_NOT_LOADED;
+            file->must_unload = true;
+
+            file_is_removed = access(file->path, F_OK) < 0;
+        }
+
+        Client* current_client = server->clients;
+        while (current_client != NULL)
+        {
+            if (current_client->state == STATE_WAITING_FOR_FILE
+            &&  current_client->awaited_file == file)
+            {
+                current_client->awaited_file = NULL;
+                setClientState(current_client, STATE_PROCESSING_REQUEST);
+
+                if (file_is_removed)
+                    answerClientWithError(server, current_client, HTTP_404);
+                else
+                    produceClientAnswer(server, current_client);
+            }
+
+            current_client = current_client->next;
+        }
+
+        FileLoadingJob* next_job = job->next;
+        free(job);
+        job = next_job;
+    }
+}
+
+// Internal version only!
+// Return true if the body of the answer is written right after its header
+// (i.e. it is not empty, and it is not compressed on the fly)
+static bool _answerBodyFollowsHeader (const Client* client)
+{
+    const HttpContent* answer_content = client->http_answer->content;
+
+    if (answer_content->nb_parts > 0)
+        return true;
+
+    if (client->gzip_stream != NULL || answer_content->offset >= answer_content->length)
+        return false;
+
+    return answer_content->content_is_loaded ? answer_content->body != NULL
+                                             : answer_content->file_path != NULL;
+}
+
+// Only write the HTTP header buffer on the socket
+// Returns true if the buffer has been entirely written, false otherwise
+bool writeHttpHeaderToClient (Server* server, Client* client)
+{
+    // Write the header data on the socket
+    printDebug("(HEAD) Writing up to %d bytes to client %d...\n",
+               client->answer_header_buffer_length - client->answer_header_buffer_offset,
+               client->fd);
+
     int nb_bytes_to_send = client->answer_header_buffer_length
                          - client->answer_header_buffer_offset;
-    int nb_bytes_sent = write(client->fd, client->answer_header_buffer,
-                              nb_bytes_to_send);
+    // With TCP_NODELAY, the header would be sent alone in a segment: it is rather corked
+    // until the body is written, which sends both of them in as few segments as possible
+    int flags = _answerBodyFollowsHeader(client) ? MSG_MORE : 0;
+
+    uint64_t trace_start = startTraceStage();
+    int nb_bytes_sent = send(client->fd,
+                             client->answer_header_buffer + client->answer_header_buffer_offset,
+                             nb_bytes_to_send, flags);
+    endTraceStage(TRACE_WRITE_HEADER, client->fd, trace_start);
     if (nb_bytes_sent < 0)
     {
-        if (errno == ECONNRESET)
+        if (errno == ECONNRESET || errno == EPIPE)
         {
             removeClientFromServer(server, client);
             return false;
         }
         else
-            handleErrorAndExit("write() failed in writeHttpHeaderToClient()");
+            handleErrorAndExit("send() failed in writeHttpHeaderToClient()");
     }
 
     // Debug printing
-    printSubtitle("***** (HEAD) Buffer content below (%d bytes) *****\n", nb_bytes_sent);
-    printf("%.*s\n", nb_bytes_sent, client->answer_header_buffer);
+    if (debugPrintingIsEnabled())
+    {
+        printSubtitle("***** (HEAD) Buffer content below (%d bytes) *****\n", nb_bytes_sent);
+        printf("%.*s\n", nb_bytes_sent, client->answer_header_buffer);
+    }
 
     // Update the header buffer offset
     client->answer_header_buffer_offset += nb_bytes_sent;
@@ -492,14 +1455,137 @@ bool writeHttpHeaderToClient (Server* server, Client* client)
         == client->answer_header_buffer_length;
 }
 
+// Get a file descriptor of the file of the answer (shared with the other answers
+// sending the same file, if any)
+// If the file cannot be opened anymore, the client is removed and false is returned
+bool openAnswerFile (Server* server, Client* client)
+{
+    HttpContent* answer_content = client->http_answer->content;
+
+    client->open_file = acquireFileDescriptor(server->fd_cache, answer_content->file);
+    if (client->open_file == NULL)
+    {
+        printWarning("Warning: %s cannot be opened anymore", answer_content->file_path);
+        removeClientFromServer(server, client);
+        return false;
+    }
+
+    answer_content->file_fd = client->open_file->fd;
+    return true;
+}
+
+// Release the file descriptor of the file of the answer, if any
+void closeAnswerFile (Server* server, Client* client)
+{
+    if (client->open_file == NULL)
+        return;
+
+    releaseFileDescriptor(server->fd_cache, client->open_file);
+
+    client->open_file                     = NULL;
+    client->http_answer->content->file_fd = NO_FD;
+}
+
+// Internal version only!
+// Return true if the body must be sent with MSG_ZEROCOPY: it is (part of) the content
+// of a cached file (which is only freed with the cache), and it is large enough
+// SO_ZEROCOPY is set on the socket of the client on its first such answer
+static bool _answerUsesZeroCopy (Server* server, Client* client)
+{
+    HttpContent* answer_content = client->http_answer->content;
+    File*        file           = answer_content->file;
+    off_t        min_size       = server->parameters->zerocopy_min_size;
+
+    if (min_size <= 0 || answer_content->length < min_size
+    ||  client->zerocopy_state == ZEROCOPY_UNAVAILABLE)
+        return false;
+
+    // E.g. compressed outputs (which may be evicted from their store) are always copied,
+    // as well as the contents of another cache than the one pinned by the pending sends
+    if (client->zerocopy_pinned_cache != NULL && client->zerocopy_pinned_cache != client->cache)
+        return false;
+
+    if (file == NULL || file->content == NULL
+    ||  answer_content->body <  file->content
+    ||  answer_content->body >= file->content + file->size)
+        return false;
+
+    if (client->zerocopy_state == ZEROCOPY_NOT_ENABLED)
+        client->zerocopy_state = enableZeroCopy(client->fd) ? ZEROCOPY_ENABLED
+                                                            : ZEROCOPY_UNAVAILABLE;
+
+    return client->zerocopy_state == ZEROCOPY_ENABLED;
+}
+
+// Internal version only!
+// Same as write(), but the pages of the cache are sent as they are: the cache is pinned
+// by the client until the sends are completed (see handleZeroCopyCompletions())
+static ssize_t _writeWithoutCopy (Client* client, const char* buffer, const size_t length)
+{
+    ssize_t nb_bytes_sent = sendZeroCopy(client->fd, buffer, length);
+
+    // Without enough memory for pinning the pages, the data is copied (as usual)
+    if (nb_bytes_sent < 0 && errno == ENOBUFS)
+        return write(client->fd, buffer, length);
+
+    if (nb_bytes_sent < 0)
+        return nb_bytes_sent;
+
+    if (client->zerocopy_pinned_cache == NULL)
+    {
+        client->zerocopy_pinned_cache = client->cache;
+        pinFileCache(client->cache);
+    }
+
+    client->zerocopy_nb_pending_sends++;
+    return nb_bytes_sent;
+}
+
+// Read the completions of the zero-copy sends of the client (reported as socket errors)
+// Once all of them are completed, the cache is not pinned by the client anymore
+// If the kernel had to copy the data anyway, the next answers are simply copied
+// Return false if there was no completion to read (i.e. the socket has an actual error)
+bool handleZeroCopyCompletions (Server* server, Client* client)
+{
+    (void) server;
+
+    int nb_copied_sends    = 0;
+    int nb_completed_sends = readZeroCopyCompletions(client->fd, &nb_copied_sends);
+    if (nb_completed_sends <= 0)
+        return false;
+
+    countZeroCopyCompletions(nb_completed_sends, nb_copied_sends);
+    if (nb_copied_sends > 0)
+        client->zerocopy_state = ZEROCOPY_UNAVAILABLE;
+
+    client->zerocopy_nb_pending_sends -= nb_completed_sends;
+    if (client->zerocopy_nb_pending_sends <= 0 && client->zerocopy_pinned_cache != NULL)
+    {
+        unpinFileCache(client->zerocopy_pinned_cache, getMonotonicTimeInNanoseconds(), true);
+
+        client->zerocopy_nb_pending_sends = 0;
+        client->zerocopy_pinned_cache     = NULL;
+    }
+
+    return true;
+}
+
 // Only write the HTTP body on the socket (or nothing if the content is NULL)
 // Returns true if the buffer has been entirely written, false otherwise
 bool writeHttpContentToClient (Server* server, Client* client)
 {
     HttpContent* answer_content = client->http_answer->content;
 
-    int nb_bytes_to_send = answer_content->length - answer_content->offset;
-    int nb_bytes_sent    = 0;
+    // Bodies made of several parts are sent part by part
+    if (answer_content->nb_parts > 0)
+        return writeHttpContentPartToClient(server, client);
+
+    // Files compressed on the fly are sent chunk by chunk
+    if (client->gzip_stream != NULL)
+        return writeGzipStreamToClient(server, client);
+
+    off_t nb_bytes_to_send = answer_content->length - answer_content->offset;
+    int   nb_bytes_sent    = 0;
 
     // If content is loaded and not NULL, directly read it from the body buffer
     if (answer_content->content_is_loaded)
@@ -510,14 +1596,20 @@ bool writeHttpContentToClient (Server* server, Client* client)
 
         // Write the body data on the socket
         nb_bytes_to_send = answer_content->length - answer_content->offset;
-        printf("(BODY) Writing up to %d bytes to client %d...\n",
-               nb_bytes_to_send, client->fd);
+        printDebug("(BODY) Writing up to %lld bytes to client %d...\n",
+                   (long long) nb_bytes_to_send, client->fd);
 
-        int nb_bytes_sent = write(client->fd, answer_content->body,
-                                   nb_bytes_to_send);
+        uint64_t trace_start = startTraceStage();
+        if (_answerUsesZeroCopy(server, client))
+            nb_bytes_sent = _writeWithoutCopy(client, answer_content->body + answer_content->offset,
+                                              nb_bytes_to_send);
+        else
+            nb_bytes_sent = write(client->fd, answer_content->body + answer_content->offset,
+                                  nb_bytes_to_send);
+        endTraceStage(TRACE_WRITE_BODY, client->fd, trace_start);
         if (nb_bytes_sent < 0)
         {
-            if (errno == ECONNRESET)
+            if (errno == ECONNRESET || errno == EPIPE)
             {
                 removeClientFromServer(server, client);
                 return false;
@@ -526,6 +1618,10 @@ bool writeHttpContentToClient (Server* server, Client* client)
                 handleErrorAndExit("write() failed in writeHttpContentToClient()");
         }
 
+        // Update the message body offset
+        answer_content->offset += nb_bytes_sent;
+        countBytesSent(true, nb_bytes_sent);
+
         return answer_content->offset == answer_content->length;
     }
     
@@ -536,39 +1632,207 @@ bool writeHttpContentToClient (Server* server, Client* client)
         if (answer_content->file_path == NULL)
             return true;
 
-        // Open the file, and save the file descriptor until it's fully written
-        answer_content->file_fd = open(answer_content->file_path, O_RDONLY);
-        if (answer_content->file_fd < 0)
-            handleErrorAndExit("open() failed in writeHttpContentToClient()");
+        // Get a file descriptor once, and keep it until the file is fully sent
+        if (answer_content->file_fd == NO_FD && ! openAnswerFile(server, client))
+            return false;
 
+        uint64_t trace_start = startTraceStage();
         nb_bytes_sent = sendfile(client->fd, answer_content->file_fd, &(answer_content->file_offset),
                                  answer_content->length - answer_content->offset);
-        if (nb_bytes_sent < 0 && errno != ECONNRESET)
-            handleErrorAndExit("write() failed in writeHttpContentToClient()");
+        endTraceStage(TRACE_WRITE_BODY, client->fd, trace_start);
+        if (nb_bytes_sent < 0)
+        {
+            if (errno == ECONNRESET || errno == EPIPE)
+            {
+                removeClientFromServer(server, client);
+                return false;
+            }
+            else
+                handleErrorAndExit("sendfile() failed in writeHttpContentToClient()");
+        }
 
-        // Once the file is fully sent, close it
-        if (client->answer_header_buffer_offset == client->answer_header_buffer_length
-        || (nb_bytes_sent < 0 && errno == ECONNRESET))
+        // If nothing can be read anymore, the file has been truncated in the meantime:
+        // the announced length cannot be sent, and the client must be dropped
+        if (nb_bytes_sent == 0 && nb_bytes_to_send > 0)
         {
-            int return_value = close(answer_content->file_fd);
-            if (return_value < 0)
-                handleErrorAndExit("close() failed in writeHttpContentToClient()");
+            printWarning("Warning: %s has been truncated while being sent", answer_content->file_path);
+            removeClientFromServer(server, client);
+            return false;
+        }
+
+        // Update the message body offset
+        answer_content->offset += nb_bytes_sent;
+        countBytesSent(false, nb_bytes_sent);
+
+        // Once the file is fully sent, release its file descriptor
+        if (answer_content->offset == answer_content->length)
+        {
+            closeAnswerFile(server, client);
+            return true;
+        }
+
+        return false;
+    }
+}
+
+// Write (some of) the current part of a body made of several parts,
+// which is either in memory or in the file of the content
+// Returns true if all the parts have been entirely written, false otherwise
+bool writeHttpContentPartToClient (Server* server, Client* client)
+{
+    HttpContent*     answer_content = client->http_answer->content;
+    HttpContentPart* part           = &answer_content->parts[answer_content->current_part];
+    bool             part_is_loaded = part->body != NULL;
+
+    printDebug("(PART) Writing up to %lld bytes to client %d...\n",
+               (long long) part->length, client->fd);
 
+    uint64_t trace_start = startTraceStage();
+    int nb_bytes_sent;
+    if (part_is_loaded)
+        nb_bytes_sent = write(client->fd, part->body, part->length);
+    else
+    {
+        // Get a file descriptor once, and keep it until all the parts are sent
+        if (answer_content->file_fd == NO_FD && ! openAnswerFile(server, client))
+            return false;
+
+        nb_bytes_sent = sendfile(client->fd, answer_content->file_fd, &(part->file_offset),
+                                 part->length);
+    }
+    endTraceStage(TRACE_WRITE_BODY, client->fd, trace_start);
+
+    if (nb_bytes_sent < 0)
+    {
+        if (errno == ECONNRESET || errno == EPIPE)
+        {
             removeClientFromServer(server, client);
             return false;
         }
+        else
+            handleErrorAndExit("write() failed in writeHttpContentPartToClient()");
     }
 
-    // Update the message body offset
+    // If nothing can be read anymore, the file has been truncated in the meantime
+    if (nb_bytes_sent == 0 && ! part_is_loaded)
+    {
+        printWarning("Warning: %s has been truncated while being sent", answer_content->file_path);
+        removeClientFromServer(server, client);
+        return false;
+    }
+
+    // Update the part (the file offset is updated by sendfile())
+    if (part_is_loaded)
+        part->body += nb_bytes_sent;
+    part->length           -= nb_bytes_sent;
     answer_content->offset += nb_bytes_sent;
+    countBytesSent(part_is_loaded, nb_bytes_sent);
 
-    return client->answer_header_buffer_offset
-        == client->answer_header_buffer_length;
+    if (part->length > 0)
+        return false;
+
+    answer_content->current_part++;
+    if (answer_content->current_part < answer_content->nb_parts)
+        return false;
+
+    // Once all the parts are sent, release the file descriptor (if any)
+    closeAnswerFile(server, client);
+
+    return true;
+}
+
+// Return true if the client must wait for the next chunk of the file compressed
+// on the fly (instead of waiting for its socket to be writable)
+bool clientWaitsForCompressedData (const Client* client)
+{
+    return client->state == STATE_ANSWERING
+        && client->gzip_stream != NULL
+        && client->answer_header_buffer_offset == client->answer_header_buffer_length
+        && gzipStreamNeedsData(client->gzip_stream);
+}
+
+// Either read the next chunk of the file compressed on the fly (once the previous one
+// has been sent), or write (some of) the current chunk
+// Returns true if the last chunk has been entirely written, false otherwise
+bool writeGzipStreamToClient (Server* server, Client* client)
+{
+    GzipStream* stream = client->gzip_stream;
+
+    // The new chunk (if any) is only sent once the socket is writable
+    if (gzipStreamNeedsData(stream))
+    {
+        uint64_t trace_start = startTraceStage();
+        bool stream_is_valid = readGzipStreamChunk(stream);
+        endTraceStage(TRACE_WRITE_BODY, client->fd, trace_start);
+
+        // The answer cannot be completed anymore: the client must be dropped
+        if (! stream_is_valid)
+            removeClientFromServer(server, client);
+
+        return false;
+    }
+
+    printDebug("(GZIP) Writing up to %d bytes to client %d...\n",
+               stream->chunk_length - stream->chunk_offset, client->fd);
+
+    uint64_t trace_start = startTraceStage();
+    int nb_bytes_sent = write(client->fd, stream->chunk + stream->chunk_offset,
+                              stream->chunk_length - stream->chunk_offset);
+    endTraceStage(TRACE_WRITE_BODY, client->fd, trace_start);
+    if (nb_bytes_sent < 0)
+    {
+        if (errno == ECONNRESET || errno == EPIPE)
+        {
+            removeClientFromServer(server, client);
+            return false;
+        }
+        else
+            handleErrorAndExit("write() failed in writeGzipStreamToClient()");
+    }
+
+    stream->chunk_offset += nb_bytes_sent;
+    countBytesSent(false, nb_bytes_sent);
+
+    if (! gzipStreamIsComplete(stream))
+        return false;
+
+    // Keep the whole compressed output (if it is not too large) for the next requests
+    int   output_length;
+    char* output = takeGzipStreamOutput(stream, &output_length);
+    if (output != NULL)
+        storeCompressedOutput(server->compressed_store, client->http_answer->content->file,
+                              output, output_length);
+
+    deleteGzipStream(stream);
+    client->gzip_stream = NULL;
+
+    return true;
+}
+
+// Release everything the answer may still use to send its body
+// (open file, compressed output or compression process)
+void releaseAnswerContent (Server* server, Client* client)
+{
+    closeAnswerFile(server, client);
+
+    if (client->compressed_output != NULL)
+    {
+        releaseCompressedOutput(server->compressed_store, client->compressed_output);
+        client->compressed_output = NULL;
+    }
+
+    if (client->gzip_stream != NULL)
+    {
+        deleteGzipStream(client->gzip_stream);
+        client->gzip_stream = NULL;
+    }
 }
 
 // This function assumes the answer message is correctly filled
 void writeToClient (Server* server, Client* client)
 {
+    client->last_activity_time = getMonotonicTimeInNanoseconds();
+
     // In a first time, send the HTTP header data
     bool header_is_sent = writeHttpHeaderToClient(server, client);
 
@@ -580,7 +1844,33 @@ void writeToClient (Server* server, Client* client)
     // If the whole HTTP answer has been sent (header + body),
     // the server is done answering the client, and waits for new requets from it
     if (header_is_sent && body_is_sent)
-        client->state = STATE_WAITING_FOR_REQUEST;
+    {
+        countRequestLatency(client->request_start_time);
+        client->nb_answered_requests++;
+
+        int64_t latency = (getMonotonicTimeInNanoseconds() - client->request_start_time) / 1000;
+        server->recent_latency += (latency - server->recent_latency) / SERV_LATENCY_SMOOTHING;
+
+        // A refused client is disconnected once it has been told so
+        if (client->is_refused)
+        {
+            _shutdownRefusedSocket(client->fd);
+            removeClientFromServer(server, client);
+            return;
+        }
+
+        releaseAnswerContent(server, client);
+        resetClientRequest(client);
+        setClientState(client, STATE_WAITING_FOR_REQUEST);
+
+        // If the client has already sent (part of) its next request, process it now,
+        // since no more data may arrive on the socket
+        if (client->request_buffer_length > 0)
+        {
+            client->request_start_time = getMonotonicTimeInNanoseconds();
+            processClientRequest(server, client);
+        }
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -600,15 +1890,40 @@ void handleClientRequests (Server* server)
     // Indefinitely loop, waiting for new/ready clients
     for (;;)
     {
-        struct pollfd* polled_sockets = calloc(server->nb_clients + 1,
+        // An upgrade, a drain or a reload of the configuration may have been requested
+        // (by a signal, which also interrupts the polling)
+        if (takeUpgradeRequest())
+            startServerUpgrade(server);
+        if (takeServerDrainRequest())
+            startServerDraining(server);
+        if (takeConfigReloadRequest())
+            reloadServerConfiguration(server);
+
+        int nb_server_fds = POLL_NB_SERVER_FDS + server->nb_listeners;
+        struct pollfd* polled_sockets = calloc(server->nb_clients + nb_server_fds,
                                                sizeof(struct pollfd));
         if (polled_sockets == NULL)
             handleErrorAndExit("calloc() failed in handleClientRequests");
 
-        // Always poll the socket listening for new clients IN FIRST POSITION
-        int nb_polled_sockets    = 1;
-        polled_sockets[0].fd     = server->sockfd;
-        polled_sockets[0].events = POLLIN;
+        // Always poll the event signaling loaded files (if any) IN FIRST POSITION
+        polled_sockets[POLL_INDEX_IO_POOL_EVENT].fd     = server->io_pool != NULL ? server->io_pool->event_fd
+                                                                                  : POLL_NO_POLLING;
+        polled_sockets[POLL_INDEX_IO_POOL_EVENT].events = POLLIN;
+
+        // ...the channel of an upgraded server being started (if any) IN SECOND POSITION
+        polled_sockets[POLL_INDEX_UPGRADE_CHANNEL].fd     = server->upgrade_channel_fd;
+        polled_sockets[POLL_INDEX_UPGRADE_CHANNEL].events = POLLIN;
+
+        // ...and the sockets listening for new clients NEXT
+        // (unless the server is draining its clients: the upgraded one accepts the new ones)
+        for (int i = 0; i < server->nb_listeners; i++)
+        {
+            polled_sockets[POLL_INDEX_FIRST_LISTENER + i].fd     = server->is_draining
+                                                                 ? POLL_NO_POLLING
+                                                                 : server->listeners[i].sockfd;
+            polled_sockets[POLL_INDEX_FIRST_LISTENER + i].events = POLLIN;
+        }
+        int nb_polled_sockets = nb_server_fds;
 
         current_client = server->clients;
         while (current_client != NULL)
@@ -622,8 +1937,17 @@ void handleClientRequests (Server* server)
                     break;
 
                 case STATE_ANSWERING:
-                    polled_sockets[nb_polled_sockets].fd     = current_client->fd;
-                    polled_sockets[nb_polled_sockets].events = POLLOUT;
+                    // The output of gzip is polled instead when a new chunk is expected
+                    if (clientWaitsForCompressedData(current_client))
+                    {
+                        polled_sockets[nb_polled_sockets].fd     = current_client->gzip_stream->fd;
+                        polled_sockets[nb_polled_sockets].events = POLLIN;
+                    }
+                    else
+                    {
+                        polled_sockets[nb_polled_sockets].fd     = current_client->fd;
+                        polled_sockets[nb_polled_sockets].events = POLLOUT;
+                    }
                     break;
 
                 default:
@@ -636,21 +1960,43 @@ void handleClientRequests (Server* server)
             current_client = current_client->next;
         }
 
-        printf("Before poll() [sockfd = %d, nb_clients = %d]:\n",
-               server->sockfd, server->nb_clients);
+        printDebug("Before poll() [nb_listeners = %d, nb_clients = %d]:\n",
+                   server->nb_listeners, server->nb_clients);
 
-        int nb_ready_sockets = poll(polled_sockets, nb_polled_sockets, POLL_NO_TIMEOUT);
+        // While draining (or upgrading), the deadline must be checked even if no client
+        // is ready, and so must the inactive clients
+        int poll_timeout = POLL_NO_TIMEOUT;
+        if (server->is_draining)
+            poll_timeout = SERV_DRAIN_POLL_TIMEOUT;
+        else if (server->upgrade_channel_fd != UPGRADE_NO_CHANNEL)
+            poll_timeout = SERV_UPGRADE_POLL_TIMEOUT;
+        else if (server->nb_clients > 0 && _clientsCanTimeOut(server->parameters))
+            poll_timeout = SERV_TIMEOUT_CHECK_INTERVAL;
+
+        int nb_ready_sockets = poll(polled_sockets, nb_polled_sockets, poll_timeout);
         if (nb_ready_sockets < 0)
+        {
+            // A signal may interrupt the polling: handle it, and poll again
+            if (errno == EINTR)
+            {
+                handlePendingTracingToggle();
+
+                free(polled_sockets);
+                continue;
+            }
+
             handleErrorAndExit("poll() failed");
+        }
 
         // Keep track of the position in the pollfd array
-        // The first one must be checked in the end, as it listens for new clients
-        int polled_sockets_index = 1; 
+        // The first ones must be checked in the end, as they are not related to clients
+        int polled_sockets_index = nb_server_fds;
 
         int nb_handled_sockets   = 0;
 
         // Some debug printing :)
-        printServer(server);
+        if (debugPrintingIsEnabled())
+            printServer(server);
 
         // Read/write from/to ready clients, according to poll() revents fields
         current_client = server->clients;
@@ -664,8 +2010,25 @@ void handleClientRequests (Server* server)
 */
             current_state = current_client->state;
 
+            // The end of the output of gzip is not a disconnection
+            bool polls_gzip_output = clientWaitsForCompressedData(current_client);
+            short ready_events     = polls_gzip_output ? POLLIN | POLLHUP : POLLOUT;
+
+            // Errors of the socket are reported whatever the polled events are: they are either
+            // completions of zero-copy sends, which must be read for the error to be cleared,
+            // or actual errors (e.g. a reset connection), after which the client is removed
+            int  nb_previously_handled_sockets = nb_handled_sockets;
+            bool has_socket_error              = ! polls_gzip_output
+                                              && (POLLERR & polled_sockets[polled_sockets_index].revents);
+            bool has_zerocopy_completions      = has_socket_error
+                                              && handleZeroCopyCompletions(server, current_client);
+
             // Check if the client closed the socket (meaning it should be removed)
-            if (POLLHUP & polled_sockets[polled_sockets_index].revents)
+            if (! polls_gzip_output && (POLLHUP & polled_sockets[polled_sockets_index].revents))
+            {
+                removeClientFromServer(server, current_client);
+            }
+            else if (has_socket_error && ! has_zerocopy_completions)
             {
                 removeClientFromServer(server, current_client);
             }
@@ -684,7 +2047,7 @@ void handleClientRequests (Server* server)
                         break;
 
                     case STATE_ANSWERING:
-                        if (POLLOUT & polled_sockets[polled_sockets_index].revents) {
+                        if (ready_events & polled_sockets[polled_sockets_index].revents) {
                             writeToClient(server, current_client);
                         
                             nb_handled_sockets++;
@@ -696,6 +2059,9 @@ void handleClientRequests (Server* server)
                 }
             }
 
+            if (has_socket_error && nb_handled_sockets == nb_previously_handled_sockets)
+                nb_handled_sockets++;
+
             // If all ready clients have been handled, exit this loop
             if (nb_handled_sockets == nb_ready_sockets)
                 break;
@@ -704,13 +2070,422 @@ void handleClientRequests (Server* server)
             current_client = next_client;
         }
 
-        // If the server's sockfd is ready, accept a new client
-        if (POLLIN & polled_sockets[0].revents)
+        // If some files have been loaded, answer the clients waiting for them
+        if (POLLIN & polled_sockets[POLL_INDEX_IO_POOL_EVENT].revents)
+            handleCompletedFileLoadings(server);
+
+        // If a listening socket is ready, accept a new client (or refuse it, if overloaded)
+        for (int i = 0; i < server->nb_listeners; i++)
         {
-            Client* new_client = acceptNewClient(server);
-            printf("New client (fd = %d) has been accepted.\n", new_client->fd);
+            if (! (POLLIN & polled_sockets[POLL_INDEX_FIRST_LISTENER + i].revents))
+                continue;
+
+            updateOverloadState(server);
+
+            Client* new_client = acceptNewClient(server, &server->listeners[i]);
+            if (new_client != NULL)
+                printDebug("New client (fd = %d) has been accepted.\n", new_client->fd);
         }
 
+        // If the upgraded server is ready (or has failed), stop accepting clients (or go on)
+        if (((POLLIN | POLLHUP) & polled_sockets[POLL_INDEX_UPGRADE_CHANNEL].revents)
+        &&  finishServerUpgrade(server))
+            startServerDraining(server);
+
         free(polled_sockets);
+
+        expireServerUpgrade(server);
+        expireInactiveClients(server);
+        freeRetiredContents(server);
+
+        // Once draining, the server exits as soon as it has no client left
+        if (server->is_draining)
+            drainServer(server);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CONFIGURATION RELOADING
+// -----------------------------------------------------------------------------
+
+// Load the configuration again (e.g. on SIGHUP), and apply the new values of the reloadable
+// parameters (see config.h): the clients are kept, and so are the cache and the buffers
+// The cached files modified on the disk are invalidated as well (except in a shared cache)
+// In prefork mode, the master reloads it for the workers it will start,
+// and asks the running ones to reload it as well
+void reloadServerConfiguration (Server* server)
+{
+    printf("Reloading the configuration...\n");
+
+    if (! reloadConfiguration(server->parameters))
+    {
+        printError("Warning: the configuration could not be reloaded!");
+        return;
+    }
+
+    ServParameters* parameters = server->parameters;
+    setCacheCompressionLevel(parameters->compression_level);
+    setRateLimits(server->rate_limiter, parameters->rate_limit_requests,
+                  _getRateLimitBurst(parameters), parameters->rate_limit_connections);
+
+    // The listeners cannot change, but their options (completing the common ones) can
+    // The sockets of a steering group are only known by the master
+    int nb_listeners = 0;
+    Listener* listeners = _parseServerListeners(parameters, &nb_listeners);
+    for (int i = 0; i < MIN(nb_listeners, server->nb_listeners); i++)
+    {
+        server->listeners[i].socket_options = listeners[i].socket_options;
+        setListenerSocketOptions(&server->listeners[i]);
+    }
+    deleteListeners(listeners, nb_listeners);
+
+    for (int i = 0; i < server->nb_steering_sockfds; i++)
+        setListeningSocketOptions(server->steering_sockfds[i], &server->listeners[0].socket_options);
+
+    // The timeouts may have been enabled
+    server->timeout_check_time = 0;
+
+    for (int i = 0; i < server->virtual_hosts->nb_sites; i++)
+    {
+        Site* site = &server->virtual_hosts->sites[i];
+
+        int nb_invalidated_files = invalidateFilesWithPrefix(site->cache, "/");
+        if (nb_invalidated_files > 0)
+            printf("%d modified file(s) of %s invalidated\n", nb_invalidated_files,
+                   site->root_directory);
+    }
+
+    for (int i = 0; i < server->nb_workers; i++)
+        kill(server->workers[i].pid, SIGHUP);
+}
+
+// -----------------------------------------------------------------------------
+// BINARY UPGRADE
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// The sockets of all the listeners are handed over, followed by the other sockets
+// of the steering group (if any), in their order (see startListeners())
+static void _startUpgradedServer (Server* server)
+{
+    int nb_sockfds = 0;
+    int sockfds[UPGRADE_MAX_NB_SOCKETS];
+
+    for (int i = 0; i < server->nb_listeners && nb_sockfds < UPGRADE_MAX_NB_SOCKETS; i++)
+        sockfds[nb_sockfds++] = server->listeners[i].sockfd;
+    for (int i = 1; i < server->nb_steering_sockfds && nb_sockfds < UPGRADE_MAX_NB_SOCKETS; i++)
+        sockfds[nb_sockfds++] = server->steering_sockfds[i];
+
+    server->upgrade_channel_fd = startUpgradedProcess(sockfds, nb_sockfds, &server->upgraded_pid);
+    server->upgrade_deadline   = getMonotonicTimeInNanoseconds()
+                               + (uint64_t) SERV_MAX_UPGRADE_DURATION * 1000000;
+}
+
+// Start the new binary, which receives the listening socket (see upgrade.h)
+// This server keeps accepting clients until the new one is ready
+void startServerUpgrade (Server* server)
+{
+    if (server->upgrade_channel_fd != UPGRADE_NO_CHANNEL || server->is_draining)
+    {
+        printWarning("Note: an upgrade is already in progress!");
+        return;
+    }
+
+    // The workers are drained by their master, once it has started the upgrade
+    if (server->parameters->nb_workers > 0 && server->workers == NULL)
+    {
+        printWarning("Note: the upgrades are started by the prefork master!");
+        return;
+    }
+
+    printf("Upgrading the server...\n");
+    _startUpgradedServer(server);
+}
+
+// Called when the channel of the upgraded server is ready: it has either started or failed
+// Return true if it has started (this server must then stop accepting clients)
+bool finishServerUpgrade (Server* server)
+{
+    UpgradeReadiness readiness = readUpgradeReadiness(server->upgrade_channel_fd);
+    if (readiness == UPGRADE_PENDING)
+        return false;
+
+    // The channel has been closed, and the new process has either started or exited
+    server->upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+    server->upgraded_pid       = 0;
+
+    if (readiness == UPGRADE_FAILED)
+    {
+        printError("Warning: the upgraded server failed to start!");
+        return false;
+    }
+
+    return true;
+}
+
+// Abort the upgrade in progress (if any) if the new process is not ready in time:
+// it is killed, and this server goes on as before
+void expireServerUpgrade (Server* server)
+{
+    if (server->upgrade_channel_fd == UPGRADE_NO_CHANNEL
+    ||  getMonotonicTimeInNanoseconds() <= server->upgrade_deadline)
+        return;
+
+    printError("Warning: the upgraded server was not ready in time!");
+
+    close(server->upgrade_channel_fd);
+    kill(server->upgraded_pid, SIGKILL);
+
+    server->upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+    server->upgraded_pid       = 0;
+}
+
+// Async-signal-safe: only remember that the server must be drained (e.g. on SIGTERM)
+void requestServerDrain ()
+{
+    _server_drain_is_requested = true;
+}
+
+// Return true (only once) if a drain has been requested
+bool takeServerDrainRequest ()
+{
+    if (! _server_drain_is_requested)
+        return false;
+
+    _server_drain_is_requested = false;
+    return true;
+}
+
+// Stop accepting clients, and exit once the current ones have been served
+void startServerDraining (Server* server)
+{
+    if (server->is_draining)
+        return;
+
+    printf("Draining the clients (%d) before exiting...\n", server->nb_clients);
+
+    server->is_draining    = true;
+    server->drain_deadline = getMonotonicTimeInNanoseconds()
+                           + (uint64_t) SERV_MAX_DRAIN_DURATION * 1000000;
+}
+
+// Disconnect the kept-alive clients waiting between two requests, and exit once there is
+// no client left (or once the drain deadline is reached)
+// A client which has not been answered yet may have sent its first request already:
+// it is thus only disconnected after its answer (or at the deadline)
+void drainServer (Server* server)
+{
+    Client* current_client = server->clients;
+    while (current_client != NULL)
+    {
+        Client* next_client = current_client->next;
+        if (current_client->state == STATE_WAITING_FOR_REQUEST
+        &&  current_client->request_buffer_length == 0
+        &&  current_client->nb_answered_requests > 0)
+            removeClientFromServer(server, current_client);
+
+        current_client = next_client;
     }
+
+    if (server->nb_clients == 0)
+    {
+        printf("All the clients have been served.\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    if (getMonotonicTimeInNanoseconds() > server->drain_deadline)
+    {
+        printError("Warning: %d client(s) still connected at the end of the drain!",
+                   server->nb_clients);
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// PREFORK MODE
+// -----------------------------------------------------------------------------
+
+// Fork a worker, which handles clients until it exits (the master returns right away)
+// It inherits the listening socket and the cache of the master, which it cannot modify
+void startWorker (Server* server, const int worker_index)
+{
+    // Otherwise, the buffered output would be printed again by the worker
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        handleErrorAndExit("fork() failed in startWorker()");
+
+    // Worker process: it never returns
+    if (pid == 0)
+    {
+        // The readiness of an upgrade in progress is only read by the master
+        if (server->upgrade_channel_fd != UPGRADE_NO_CHANNEL)
+        {
+            close(server->upgrade_channel_fd);
+            server->upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+        }
+
+        free(server->workers);
+        server->workers    = NULL;
+        server->nb_workers = 0;
+
+        setWorkerMetrics(&server->metrics_slots[worker_index]);
+
+        // The worker only accepts the clients steered to its own socket, on its own CPU(s)
+        if (server->steering_sockfds != NULL)
+        {
+            for (int i = 0; i < server->nb_steering_sockfds; i++)
+                if (i != worker_index)
+                    close(server->steering_sockfds[i]);
+
+            server->listeners[0].sockfd = server->steering_sockfds[worker_index];
+
+            free(server->steering_sockfds);
+            server->steering_sockfds    = NULL;
+            server->nb_steering_sockfds = 0;
+        }
+
+        if (server->parameters->cpu_affinity)
+            pinToWorkerCpus(worker_index, server->parameters->nb_workers);
+
+        // Once pinned, the worker reads the copies of the caches on its node (if any)
+        VirtualHosts* virtual_hosts = server->virtual_hosts;
+        for (int i = 0; i < virtual_hosts->nb_sites; i++)
+        {
+            if (server->parameters->numa_replication)
+                useFileCacheReplica(virtual_hosts->sites[i].cache, getCurrentNumaNode());
+            protectFileCache(virtual_hosts->sites[i].cache);
+        }
+
+        handleClientRequests(server);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Master process
+    server->workers[worker_index].pid        = pid;
+    server->workers[worker_index].start_time = time(NULL);
+
+    printf("Worker %d started (pid: %d)\n", worker_index, (int) pid);
+}
+
+// Start all the workers, and restart the ones which exit (e.g. crash), forever
+// The cache is not built again: the new workers share the one of the master
+void superviseWorkers (Server* server)
+{
+    for (int i = 0; i < server->nb_workers; i++)
+        startWorker(server, i);
+
+    for (;;)
+    {
+        if (takeUpgradeRequest())
+            upgradeSupervisedWorkers(server);
+
+        if (takeConfigReloadRequest())
+            reloadServerConfiguration(server);
+
+        if (takeServerDrainRequest())
+        {
+            printf("Draining the workers before exiting...\n");
+            stopWorkers(server, SIGTERM);
+            exit(EXIT_SUCCESS);
+        }
+
+        // While an upgrade is in progress, the exited workers are only looked for
+        // between two checks of the readiness of the new process
+        bool is_upgrading = server->upgrade_channel_fd != UPGRADE_NO_CHANNEL;
+        if (is_upgrading)
+            checkSupervisedUpgrade(server);
+
+        int   status;
+        pid_t pid = waitpid(-1, &status, is_upgrading ? WNOHANG : 0);
+        if (pid == 0)
+            continue;
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            handleErrorAndExit("waitpid() failed in superviseWorkers()");
+        }
+
+        // E.g. the upgraded process, if it has failed
+        int worker_index = 0;
+        while (worker_index < server->nb_workers && server->workers[worker_index].pid != pid)
+            worker_index++;
+
+        if (worker_index == server->nb_workers)
+            continue;
+
+        if (WIFSIGNALED(status))
+            printError("Worker %d (pid: %d) killed by signal %d!",
+                       worker_index, (int) pid, WTERMSIG(status));
+        else
+            printError("Worker %d (pid: %d) exited with status %d!",
+                       worker_index, (int) pid, WEXITSTATUS(status));
+
+        // The clients of the worker are gone (but its counters are kept)
+        Metrics* worker_metrics = &server->metrics_slots[worker_index];
+        memset(worker_metrics->clients_by_state, 0, sizeof(worker_metrics->clients_by_state));
+
+        // A worker crashing right away is not restarted in a loop
+        if (time(NULL) - server->workers[worker_index].start_time < SERV_MIN_WORKER_LIFETIME)
+            sleep(SERV_MIN_WORKER_LIFETIME);
+
+        startWorker(server, worker_index);
+    }
+}
+
+// Start the new binary, while the workers keep serving (and are restarted if they crash)
+// until it is ready (see checkSupervisedUpgrade())
+void upgradeSupervisedWorkers (Server* server)
+{
+    if (server->upgrade_channel_fd != UPGRADE_NO_CHANNEL)
+    {
+        printWarning("Note: an upgrade is already in progress!");
+        return;
+    }
+
+    printf("Upgrading the server...\n");
+    _startUpgradedServer(server);
+}
+
+// Wait a little for the upgraded server to be ready (or to fail, or to be too late)
+// Once it is, the workers are asked to drain their clients: they are not restarted anymore,
+// and the master exits once they have all exited
+void checkSupervisedUpgrade (Server* server)
+{
+    struct pollfd polled_channel = {
+        .fd     = server->upgrade_channel_fd,
+        .events = POLLIN
+    };
+
+    if (poll(&polled_channel, 1, SERV_UPGRADE_POLL_TIMEOUT) < 0 && errno != EINTR)
+        handleErrorAndExit("poll() failed in checkSupervisedUpgrade()");
+
+    if (((POLLIN | POLLHUP) & polled_channel.revents) && finishServerUpgrade(server))
+    {
+        stopWorkers(server, SIGTERM);
+
+        printf("All the workers have drained their clients.\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    expireServerUpgrade(server);
+}
+
+// Ask all the workers to exit, and wait for them
+// With SIGINT, they exit right away; with SIGTERM, they drain their clients first
+void stopWorkers (Server* server, const int signal_id)
+{
+    for (int i = 0; i < server->nb_workers; i++)
+        kill(server->workers[i].pid, signal_id);
+
+    for (int i = 0; i < server->nb_workers; i++)
+        while (waitpid(server->workers[i].pid, NULL, 0) < 0 && errno == EINTR)
+            continue;
+
+    free(server->workers);
+    server->workers    = NULL;
+    server->nb_workers = 0;
 }
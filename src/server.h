@@ -7,17 +7,27 @@
 #include <sys/time.h>
 #include <poll.h>
 #include "http.h"
+#include "fd_cache.h"
+#include "io_pool.h"
+#include "gzip_stream.h"
+#include "metrics.h"
+#include "rate_limit.h"
+#include "socket_options.h"
+#include "listener.h"
+#include "virtual_hosts.h"
+#include "zerocopy.h"
 
 // Structure represeting a client (server-side)
 typedef enum ClientState {
     STATE_WAITING_FOR_REQUEST,
     STATE_PROCESSING_REQUEST,
+    STATE_WAITING_FOR_FILE,
     STATE_ANSWERING
 } ClientState;
 
 typedef struct Client {
-    int                fd;
-    struct sockaddr_in address;
+    int                     fd;
+    struct sockaddr_storage address; // AF_INET, AF_INET6 or AF_UNIX (see listener.h)
 
     // Clients form a doubly-linked list
     struct Client* previous;
@@ -29,10 +39,14 @@ typedef struct Client {
     char* request_buffer;
     int   request_buffer_length;
     int   request_buffer_offset;
+    int   request_header_length; // 0 until a full header has been received
 
     // Related HTTP request
     HttpMessage* http_request;
 
+    // Cache of the site of the request, selected by its Host header (see virtual_hosts.h)
+    FileCache* cache;
+
     // Buffer to write header data to send
     char* answer_header_buffer;
     int   answer_header_buffer_length;
@@ -41,28 +55,150 @@ typedef struct Client {
     // Related HTTP answer 
     // Note: it contains a pointer to the body data to send
     HttpMessage* http_answer;
+
+    // File whose content is being loaded before answering (or NULL)
+    File* awaited_file;
+
+    // Open file descriptor of the file being sent with sendfile() (or NULL)
+    FdCacheEntry* open_file;
+
+    // File being compressed on the fly, or stored compressed output being sent (or NULL)
+    GzipStream*       gzip_stream;
+    CompressedOutput* compressed_output;
+
+    // Buffer for answer bodies produced by the server itself (or NULL)
+    char* generated_body;
+
+    // Zero-copy sends of cached bodies (see zerocopy.h): the cache is pinned
+    // until all of them are completed
+    ZeroCopyState zerocopy_state;
+    int           zerocopy_nb_pending_sends;
+    FileCache*    zerocopy_pinned_cache; // NULL if no send is pending
+
+    // Time at which the first byte of the current request has been read
+    uint64_t request_start_time;
+
+    // Time of the last read or write on the socket (see expireInactiveClients())
+    uint64_t last_activity_time;
+
+    int nb_answered_requests;
+
+    // Whether the client is disconnected once its answer is sent (see refuseClientRequest())
+    bool is_refused;
 } Client;
 
 // Structures used to represent a server
+// The parameters are set from a configuration file and from the command line (see config.h)
 typedef struct ServParameters {
+    char* listeners; // See listener.h (a single TCP4 listener on the port if empty)
+    int   port;
     int   queue_max_length;
     int   max_nb_clients;
     int   request_buffer_size;
     int   answer_header_buffer_size;
-    char* root_data_directory;
-    int   cache_max_size;
+    char* root_data_directory; // Of the default site
+    char* virtual_hosts;       // See virtual_hosts.h (only the default site if empty)
+    off_t cache_max_size;      // Shared by the caches of all the sites
+    off_t cache_max_file_size; // Larger files are never cached (NO_MAX_FILE_SIZE: no limit)
+    int   fd_cache_max_nb_entries;
+    bool  lazy_loading;  // Load the contents of the files on first request only
+    int   nb_io_threads; // Threads loading the contents (if lazy loading is enabled)
+    bool  stream_compression;         // Compress uncached text files on the fly
+    int   compressed_store_max_size;  // Total size of the stored compressed outputs
+    int   compressed_output_max_size; // Larger compressed outputs are not stored
+    int   compression_level;          // gzip level (of the cache and of the streams)
+    off_t zerocopy_min_size; // Smaller cached bodies are copied by the kernel (0: never zero-copy)
+    int   nb_workers; // Prefork mode if > 0: processes sharing the (read-only) cache
+    bool  cpu_affinity;     // Prefork mode only: pin the workers, and steer the clients to them
+    bool  numa_replication; // Prefork mode only: copy the cache on each NUMA node
+
+    // Overload shedding: above any high watermark, new clients are answered with a 503,
+    // until the load is below all the low watermarks (see updateOverloadState())
+    int   high_watermark_nb_clients;
+    int   low_watermark_nb_clients;
+    int   high_watermark_queue_depth; // Requests being processed or answered
+    int   low_watermark_queue_depth;
+    int   high_watermark_latency;     // us (recent request latency)
+    int   low_watermark_latency;
+    int   retry_after;                // s (advised to the refused clients)
+
+    // Limits of each client address: above them, clients are answered with a 429
+    // (RATE_LIMIT_NO_LIMIT disables a limit)
+    int   rate_limit_nb_entries;      // Addresses remembered at once
+    int   rate_limit_connections;     // Connections at once
+    int   rate_limit_requests;        // Requests per second (on average)...
+    int   rate_limit_burst;           // ...or in a burst (as many as per second if 0)
+
+    // Inactive clients are disconnected (see expireInactiveClients()),
+    // unless the timeout is SERV_NO_TIMEOUT
+    int   idle_timeout;               // s (between two requests)
+    int   request_timeout;            // s (to send a whole request header)
+    int   send_timeout;               // s (to read some data of the answer)
+
+    // TCP options of the listening sockets, inherited by the clients (see socket_options.h)
+    // Each listener can complete them with its own ones
+    SocketOptions socket_options;
     // ...
 } ServParameters;
 
+// Process forked by the master in prefork mode (see superviseWorkers())
+typedef struct Worker {
+    pid_t  pid;
+    time_t start_time;
+} Worker;
+
 typedef struct Server {
-    int                sockfd;
-    struct sockaddr_in address;
-    bool               is_started;
+    // Listening sockets, whose clients are all handled by the same loop (see listener.h)
+    Listener* listeners;
+    int       nb_listeners;
+    bool      is_started;
+
+    // Listening sockets handed over by the previous process (after an upgrade),
+    // until they are given to the listeners with the same addresses when started
+    int* received_sockfds;
+    int  nb_received_sockfds;
+
+    // Sockets of the SO_REUSEPORT group steering the clients of the first listener
+    // to the workers by CPU (one per worker, the first one being the one of the listener),
+    // or NULL (see affinity.h)
+    int* steering_sockfds;
+    int  nb_steering_sockfds;
 
     Client*            clients;
     int                nb_clients;
 
-    FileCache* cache;
+    VirtualHosts* virtual_hosts; // Sites (and their file caches)
+    FdCache*      fd_cache;
+    IoPool*       io_pool; // NULL if lazy loading is disabled
+
+    CompressedStore* compressed_store;
+
+    // Metrics of all the workers (in shared memory; the i-th worker writes in the i-th slot)
+    Metrics* metrics_slots;
+    int      nb_metrics_slots;
+
+    // Prefork mode only: workers supervised by the master (NULL in the workers themselves)
+    Worker* workers;
+    int     nb_workers;
+
+    // Binary upgrade (see upgrade.h): the new process signals it is ready through the channel
+    // (UPGRADE_NO_CHANNEL if none is started), and this one then drains its clients and exits
+    int      upgrade_channel_fd;
+    pid_t    upgraded_pid;
+    uint64_t upgrade_deadline; // The new process is killed if it is not ready then
+    bool     is_draining;
+    uint64_t drain_deadline; // Clients still connected then are dropped
+
+    // Next time at which the inactive clients are looked for
+    uint64_t timeout_check_time;
+
+    // Overload shedding
+    bool         is_overloaded;
+    int64_t      recent_latency;   // us (moving average of the latencies of the last requests)
+    HttpMessage* overload_answer;  // 503 (or 429) answer sent to the refused clients
+
+    // Limits of each client address (per process, in prefork mode)
+    RateLimiter* rate_limiter;
 
     ServParameters* parameters;
 } Server;
@@ -70,6 +206,7 @@ typedef struct Server {
 // -----------------------------------------------------------------------------
 
 // Default values concerning the server
+#define SERV_DEFAULT_LISTENERS           "" // A single TCP4 listener on the port
 #define SERV_DEFAULT_PORT                4242
 
 #define SERV_DEFAULT_QUEUE_MAX_LENGTH    5
@@ -77,49 +214,136 @@ typedef struct Server {
 #define SERV_DEFAULT_REQUEST_BUF_SIZE    16384 // bytes
 #define SERV_DEFAULT_ANS_HEADER_BUF_SIZE 2048  // bytes
 #define SERV_DEFAULT_CACHE_MAX_SIZE      3200000 // bytes
+#define SERV_DEFAULT_CACHE_MAX_FILE_SIZE NO_MAX_FILE_SIZE
+#define SERV_DEFAULT_FD_CACHE_SIZE       64 // open files
+#define SERV_DEFAULT_LAZY_LOADING        false
+#define SERV_DEFAULT_NB_IO_THREADS       2
+#define SERV_DEFAULT_STREAM_COMPRESSION  true
+#define SERV_DEFAULT_COMP_STORE_MAX_SIZE 8000000 // bytes
+#define SERV_DEFAULT_COMP_OUT_MAX_SIZE   1000000 // bytes
+#define SERV_DEFAULT_COMPRESSION_LEVEL   DEFAULT_GZIP_LEVEL
+#define SERV_DEFAULT_ZEROCOPY_MIN_SIZE   0 // bytes (disabled)
+#define SERV_DEFAULT_NB_WORKERS          0 // no prefork mode
+#define SERV_DEFAULT_CPU_AFFINITY        false
+#define SERV_DEFAULT_NUMA_REPLICATION    false
+#define SERV_MIN_WORKER_LIFETIME         1 // s (a worker crashing faster is restarted later)
+#define SERV_MAX_DRAIN_DURATION          30000 // ms
+#define SERV_DRAIN_POLL_TIMEOUT          100   // ms
+#define SERV_MAX_UPGRADE_DURATION        120000 // ms (the upgrade is aborted if not ready by then)
+#define SERV_UPGRADE_POLL_TIMEOUT        100    // ms
+#define SERV_DEFAULT_HIGH_WM_NB_CLIENTS  SERV_DERIVED_WATERMARK
+#define SERV_DEFAULT_LOW_WM_NB_CLIENTS   SERV_DERIVED_WATERMARK
+#define SERV_DEFAULT_HIGH_WM_QUEUE_DEPTH SERV_DERIVED_WATERMARK
+#define SERV_DEFAULT_LOW_WM_QUEUE_DEPTH  SERV_DERIVED_WATERMARK
+#define SERV_HIGH_WM_NB_CLIENTS_SHARE    0.875 // of the maximum number of clients (if derived)
+#define SERV_LOW_WM_NB_CLIENTS_SHARE     0.75
+#define SERV_HIGH_WM_QUEUE_DEPTH_SHARE   0.5
+#define SERV_LOW_WM_QUEUE_DEPTH_SHARE    0.25
+#define SERV_DEFAULT_HIGH_WM_LATENCY     200000 // us
+#define SERV_DEFAULT_LOW_WM_LATENCY      50000  // us
+#define SERV_DEFAULT_RETRY_AFTER         1 // s
+#define SERV_LATENCY_SMOOTHING           8 // Each new latency weighs 1/8 of the moving average
+#define SERV_DEFAULT_RATE_NB_ENTRIES     1024
+#define SERV_DEFAULT_RATE_NB_CONNS       32 // per address (half of the client slots)
+#define SERV_DEFAULT_RATE_NB_REQS        RATE_LIMIT_NO_LIMIT // req/s per address
+#define SERV_DEFAULT_RATE_NB_BURST       0
+#define SERV_DEFAULT_IDLE_TIMEOUT        60 // s
+#define SERV_DEFAULT_REQUEST_TIMEOUT     30 // s
+#define SERV_DEFAULT_SEND_TIMEOUT        60 // s
+#define SERV_TIMEOUT_CHECK_INTERVAL      1000 // ms
 
 #define SERV_DEFAULT_ROOT_DATA_DIR    "./www"
+#define SERV_DEFAULT_VIRTUAL_HOSTS    "" // Only the default site
 
 // Named, useful constants
 #define POLL_NO_TIMEOUT  -1
 #define POLL_NO_POLLING  -1
+#define SERV_NO_TIMEOUT  0
+#define SERV_DERIVED_WATERMARK 0 // Derived from the maximum number of clients
+
+// Positions of the polled file descriptors which are not related to clients (see below):
+// the listening sockets come next (from POLL_INDEX_FIRST_LISTENER), and then the clients
+#define POLL_INDEX_IO_POOL_EVENT    0
+#define POLL_INDEX_UPGRADE_CHANNEL  1
+#define POLL_INDEX_FIRST_LISTENER   2
+#define POLL_NB_SERVER_FDS          2
 
 // -----------------------------------------------------------------------------
 
-int createWebSocket ();
-struct sockaddr_in getLocalAddress (const int port);
-void bindWebSocket (const int sockfd, const struct sockaddr_in *address);
-void listenWebSocket (const int sockfd, const int queue_max_length);
-int acceptWebSocket (const int sockfd, struct sockaddr_in* address);
+int acceptWebSocket (const int sockfd, struct sockaddr_storage* address);
 
 Client* createClient ();
 void disconnectClient (Client* client);
 void deleteClient (Client* client);
-void initClient (Client* client, const int fd, const struct sockaddr_in address,
+void initClient (Client* client, const int fd, const struct sockaddr_storage* address,
                  const ServParameters* parameters);
+void setClientState (Client* client, const ClientState state);
+void resetClientRequest (Client* client);
 char* getClientStateAsString (const ClientState state);
 void printClient (const Client* client);
 
 Server* createServer ();
 void disconnectServer (Server* server);
 void deleteServer (Server* server);
-void initServer (Server* server, const int sockfd, const struct sockaddr_in address,
-                 ServParameters* parameters);
+void initServer (Server* server, ServParameters* parameters);
 void defaultInitServer (Server* server);
+ServParameters* createServParameters ();
+void deleteServParameters (ServParameters* parameters);
+void defaultInitServParameters (ServParameters* parameters);
+void adjustServParameters (ServParameters* parameters);
 bool serverIsStarted (const Server* server);
 void printServer (const Server* server);
 
 void startServer (Server* server);
+void startListeners (Server* server);
+void startSteeringSockets (Server* server);
 void addClientToServer (Server* server, Client* client);
 void removeClientFromServer (Server* server, Client* client);
-Client* acceptNewClient (Server* server);
+Client* acceptNewClient (Server* server, const Listener* listener);
+void refuseNewClient (Server* server, const int clientfd, const HttpCode http_code);
+void updateOverloadState (Server* server);
+void expireInactiveClients (Server* server);
+void freeRetiredContents (Server* server);
 
 void readFromClient (Server* server, Client* client);
+bool isMetricsRequest (const HttpMessage* request);
+void produceMetricsAnswer (Server* server, Client* client);
 void processClientRequest (Server* server, Client* client);
+void refuseClientRequest (Server* server, Client* client);
+void answerClientWithError (Server* server, Client* client, const HttpCode http_code);
+void produceClientAnswer (Server* server, Client* client);
+void waitForFileContent (Server* server, Client* client, File* file);
+bool answerCanBeCompressed (const Server* server, const Client* client);
+void produceCompressedAnswer (Server* server, Client* client);
+void handleCompletedFileLoadings (Server* server);
 bool writeHttpHeaderToClient (Server* server, Client* client);
+bool openAnswerFile (Server* server, Client* client);
+void closeAnswerFile (Server* server, Client* client);
 bool writeHttpContentToClient (Server* server, Client* client);
+bool writeHttpContentPartToClient (Server* server, Client* client);
+bool clientWaitsForCompressedData (const Client* client);
+bool writeGzipStreamToClient (Server* server, Client* client);
+bool handleZeroCopyCompletions (Server* server, Client* client);
+void releaseAnswerContent (Server* server, Client* client);
 void writeToClient (Server* server, Client* client);
 
 void handleClientRequests (Server* server);
 
+void requestServerDrain ();
+bool takeServerDrainRequest ();
+
+void reloadServerConfiguration (Server* server);
+
+void startServerUpgrade (Server* server);
+bool finishServerUpgrade (Server* server);
+void expireServerUpgrade (Server* server);
+void startServerDraining (Server* server);
+void drainServer (Server* server);
+
+void startWorker (Server* server, const int worker_index);
+void superviseWorkers (Server* server);
+void upgradeSupervisedWorkers (Server* server);
+void checkSupervisedUpgrade (Server* server);
+void stopWorkers (Server* server, const int signal_id);
+
 #endif
@@ -0,0 +1,151 @@
+// Macro definition required for using strtok_r() and the TCP options
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "toolbox.h"
+#include "socket_options.h"
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON SOCKET OPTIONS
+// -----------------------------------------------------------------------------
+
+// Only the options without any cost are enabled by default
+void initSocketOptions (SocketOptions* options)
+{
+    options->reuse_address    = true;
+    options->defer_accept     = 0;
+    options->fast_open        = 0;
+    options->no_delay         = true;
+    options->busy_poll        = 0;
+    options->prefer_busy_poll = false;
+}
+
+// Internal version only!
+// Return the value of an option ("name=value"), or the default one if it has none ("name")
+static int _parseOptionValue (const char* value, const int default_value)
+{
+    if (value == NULL)
+        return default_value;
+
+    return atoi(value);
+}
+
+// The list is made of options separated by commas, e.g. "defer-accept=2,fast-open,no-delay=0"
+// (an option without a value is enabled with a default value, and disabled with 0),
+// and "none" disables all the options listed so far (e.g. as a baseline)
+// Return false if an option is unknown (the options are then partially set)
+bool parseSocketOptions (SocketOptions* options, const char* list)
+{
+    char* list_copy = getFreshStringCopy(list);
+    char* position  = NULL;
+    bool  success   = true;
+
+    for (char* option = strtok_r(list_copy, SOCKET_OPTIONS_SEPARATOR, &position);
+         option != NULL && success;
+         option = strtok_r(NULL, SOCKET_OPTIONS_SEPARATOR, &position))
+    {
+        char* value = strchr(option, '=');
+        if (value != NULL)
+        {
+            *value = '\0';
+            value++;
+        }
+
+        if (stringsAreEqual(option, "none"))
+        {
+            options->reuse_address    = false;
+            options->defer_accept     = 0;
+            options->fast_open        = 0;
+            options->no_delay         = false;
+            options->busy_poll        = 0;
+            options->prefer_busy_poll = false;
+        }
+        else if (stringsAreEqual(option, "reuse-address"))
+            options->reuse_address = _parseOptionValue(value, true) != 0;
+        else if (stringsAreEqual(option, "defer-accept"))
+            options->defer_accept = _parseOptionValue(value, SOCKET_DEFAULT_DEFER_ACCEPT);
+        else if (stringsAreEqual(option, "fast-open"))
+            options->fast_open = _parseOptionValue(value, SOCKET_DEFAULT_FAST_OPEN);
+        else if (stringsAreEqual(option, "no-delay"))
+            options->no_delay = _parseOptionValue(value, true) != 0;
+        else if (stringsAreEqual(option, "busy-poll"))
+            options->busy_poll = _parseOptionValue(value, SOCKET_DEFAULT_BUSY_POLL);
+        else if (stringsAreEqual(option, "prefer-busy-poll"))
+            options->prefer_busy_poll = _parseOptionValue(value, true) != 0;
+        else
+        {
+            printError("Unknown socket option: %s", option);
+            success = false;
+        }
+    }
+
+    free(list_copy);
+    return success;
+}
+
+void printSocketOptions (const SocketOptions* options)
+{
+    printf("Socket options: reuse-address=%d, defer-accept=%d, fast-open=%d, no-delay=%d, "
+           "busy-poll=%d, prefer-busy-poll=%d\n",
+           options->reuse_address, options->defer_accept, options->fast_open,
+           options->no_delay, options->busy_poll, options->prefer_busy_poll);
+}
+
+// Write the options as a list which can be parsed again (e.g. to compare two sets of options)
+void formatSocketOptions (const SocketOptions* options, char* buffer, const int buffer_length)
+{
+    snprintf(buffer, buffer_length,
+             "reuse-address=%d,defer-accept=%d,fast-open=%d,no-delay=%d,"
+             "busy-poll=%d,prefer-busy-poll=%d",
+             options->reuse_address, options->defer_accept, options->fast_open,
+             options->no_delay, options->busy_poll, options->prefer_busy_poll);
+}
+
+// -----------------------------------------------------------------------------
+// SETTING THE OPTIONS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// A failure is not fatal: the server works without the option (e.g. on an older kernel)
+static void _setSocketOption (const int sockfd, const int level, const int option_name,
+                              const int value, const char* description)
+{
+    if (setsockopt(sockfd, level, option_name, &value, sizeof(value)) < 0)
+        printWarning("Warning: the socket option %s cannot be set!", description);
+}
+
+// Internal version only!
+// The options which are not supported everywhere are only reported if they cannot be enabled
+static void _setOptionalSocketOption (const int sockfd, const int level, const int option_name,
+                                      const int value, const char* description)
+{
+    if (value > 0)
+        _setSocketOption(sockfd, level, option_name, value, description);
+    else
+        setsockopt(sockfd, level, option_name, &value, sizeof(value));
+}
+
+// The options can be set before binding the socket, or once it is listening (e.g. after an
+// upgrade, or when the configuration is reloaded): all of them are set, so that the previous
+// ones are overwritten
+void setListeningSocketOptions (const int sockfd, const SocketOptions* options)
+{
+    _setSocketOption(sockfd, SOL_SOCKET, SO_REUSEADDR, options->reuse_address, "SO_REUSEADDR");
+    _setSocketOption(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options->defer_accept,
+                     "TCP_DEFER_ACCEPT");
+    _setSocketOption(sockfd, IPPROTO_TCP, TCP_NODELAY, options->no_delay, "TCP_NODELAY");
+
+    _setOptionalSocketOption(sockfd, IPPROTO_TCP, TCP_FASTOPEN, options->fast_open,
+                             "TCP_FASTOPEN");
+    _setOptionalSocketOption(sockfd, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll,
+                             "SO_BUSY_POLL");
+    _setOptionalSocketOption(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, options->prefer_busy_poll,
+                             "SO_PREFER_BUSY_POLL");
+}
@@ -0,0 +1,58 @@
+#ifndef __H_SOCKET_OPTIONS__
+#define __H_SOCKET_OPTIONS__
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+// Options of the listening socket, trading CPU (or memory) for latency: the sockets
+// of the clients inherit them when accepted (on Linux), which saves system calls per client
+// They can be changed from the command line (see parseSocketOptions()), e.g. to compare
+// the latencies with and without each of them (see bench/socket_options_bench.sh)
+
+typedef struct SocketOptions {
+    bool reuse_address;    // Bind while connections of a previous run are in TIME_WAIT
+    int  defer_accept;     // s (TCP_DEFER_ACCEPT): only accept clients once they have sent data
+    int  fast_open;        // Pending handshakes (TCP_FASTOPEN): requests of known clients in the SYN
+    bool no_delay;         // TCP_NODELAY (the headers are still corked until their body is sent)
+    int  busy_poll;        // us (SO_BUSY_POLL): poll the NIC queue instead of sleeping
+    bool prefer_busy_poll; // SO_PREFER_BUSY_POLL: defer the interrupts while busy polling
+} SocketOptions;
+
+// -----------------------------------------------------------------------------
+
+// Headers may be older than the running kernel
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN 23
+#endif
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+// Only declared with _GNU_SOURCE (which the server does not require otherwise)
+#ifndef MSG_MORE
+#define MSG_MORE 0x8000
+#endif
+
+// Values of the options enabled without one (e.g. "defer-accept" instead of "defer-accept=2")
+#define SOCKET_DEFAULT_DEFER_ACCEPT 1   // s
+#define SOCKET_DEFAULT_FAST_OPEN    256 // pending handshakes
+#define SOCKET_DEFAULT_BUSY_POLL    50  // us
+
+#define SOCKET_OPTIONS_SEPARATOR ","
+
+// -----------------------------------------------------------------------------
+
+void initSocketOptions (SocketOptions* options);
+bool parseSocketOptions (SocketOptions* options, const char* list);
+void printSocketOptions (const SocketOptions* options);
+void formatSocketOptions (const SocketOptions* options, char* buffer, const int buffer_length);
+
+void setListeningSocketOptions (const int sockfd, const SocketOptions* options);
+
+#endif
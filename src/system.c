@@ -15,8 +15,8 @@
 // Run a command in a child process, and read from its output channel
 // through an anonymous pipe, in the given buffer, before waiting for the child
 // The function returns how many bytes have been actually read
-int runReadableProcess (char* command, char* execvp_argv[],
-                        char* output_buffer, int output_buffer_length)
+off_t runReadableProcess (char* command, char* execvp_argv[],
+                          char* output_buffer, off_t output_buffer_length)
 {
     pid_t pipe_fds[2];
     int return_value = pipe(pipe_fds);
@@ -49,11 +49,14 @@ int runReadableProcess (char* command, char* execvp_argv[],
         handleErrorAndExit("close() failed in runReadableProcess()");
 
     // TODO: clean this part
-    int nb_bytes_read = 0;
+    off_t nb_bytes_read = 0;
     while (nb_bytes_read < output_buffer_length)
     {
-        int current_nb_bytes_read = read(pipe_fds[PIPE_OUT], output_buffer,
-                                         output_buffer_length - nb_bytes_read);
+        ssize_t current_nb_bytes_read = read(pipe_fds[PIPE_OUT], output_buffer,
+                                             output_buffer_length - nb_bytes_read);
+        if (current_nb_bytes_read < 0)
+            handleErrorAndExit("read() failed in runReadableProcess()");
+
         nb_bytes_read += current_nb_bytes_read;
 
         if (current_nb_bytes_read == 0)
@@ -62,9 +65,6 @@ int runReadableProcess (char* command, char* execvp_argv[],
             output_buffer += current_nb_bytes_read;
     }
 
-    if (nb_bytes_read < 0)
-        handleErrorAndExit("read() failed in runReadableProcess()");
-
     return_value = close(pipe_fds[PIPE_OUT]);
     if (return_value < 0)
         handleErrorAndExit("close() failed in runReadableProcess()");
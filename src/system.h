@@ -1,7 +1,9 @@
 #ifndef __H_SYSTEM__
 #define __H_SYSTEM__
 
-int runReadableProcess (char* command, char* execvp_argv[],
-                        char* output_buffer, int output_buffer_length);
+#include <sys/types.h>
+
+off_t runReadableProcess (char* command, char* execvp_argv[],
+                          char* output_buffer, off_t output_buffer_length);
 
 #endif
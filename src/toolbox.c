@@ -36,7 +36,9 @@ void handleErrorAndExit (const char* message)
 void printUsage (const char* argv[])
 {
     printColor(COLOR_BOLD_GREEN,
-               "Usage: %s ...", argv[0]);
+               "Usage: %s [-h|--help] [-q|--quiet] [-c|--config <file>] [--<parameter> <value>]...\n"
+               "       (e.g. [-l|--lazy] [-w|--workers <nb>] [-a|--affinity] [-n|--numa] [-p|--port <nb>]\n"
+               "       [-r|--rate-limit <nb>] [-s|--socket-options <list>] [-z|--zerocopy <bytes>])\n", argv[0]);
 }
 
 void printUsageAndExit (const char* argv[])
@@ -49,6 +51,9 @@ void printUsageAndExit (const char* argv[])
 // FORMATTED PRINTING
 // -----------------------------------------------------------------------------
 
+// Debug printing can be disabled at runtime (e.g. when benchmarking the server)
+static bool _debug_printing_is_enabled = true;
+
 // Internal version only! 
 // Allows a cascade of functions calls using a variable number of arguments :)
 static void _printColor (const char* color, const char* format, va_list args)
@@ -138,6 +143,30 @@ void printWarning (const char* format, ...)
     va_end(args);
 }
 
+void setDebugPrinting (const bool enabled)
+{
+    _debug_printing_is_enabled = enabled;
+}
+
+bool debugPrintingIsEnabled ()
+{
+    return _debug_printing_is_enabled;
+}
+
+// Only print if the debug printing is enabled
+void printDebug (const char* format, ...)
+{
+    if (! _debug_printing_is_enabled)
+        return;
+
+    va_list args;
+    va_start(args, format);
+
+    vprintf(format, args);
+
+    va_end(args);
+}
+
 // -----------------------------------------------------------------------------
 // STRING AND PATHS-RELATED FUNCTIONS
 // -----------------------------------------------------------------------------
@@ -212,7 +241,10 @@ char* convertStringToUppercase (char* string)
 {
     int index = 0;
     while (string[index] != '\0')
+    {
         string[index] = toupper(string[index]);
+        index++;
+    }
 
     return string;
 }
@@ -50,6 +50,9 @@ void printSubtitle (const char* format, ...);
 void printTitle (const char* format, ...);
 void printError (const char* format, ...);
 void printWarning (const char* format, ...);
+void setDebugPrinting (const bool enabled);
+bool debugPrintingIsEnabled ();
+void printDebug (const char* format, ...);
 
 bool stringsAreEqual (const char* string_1, const char* string_2);
 char* getFreshStringCopy (const char* source_string);
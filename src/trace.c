@@ -0,0 +1,217 @@
+// Macro definition required for using clock_gettime() and CLOCK_MONOTONIC_RAW
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "toolbox.h"
+#include "trace.h"
+
+// -----------------------------------------------------------------------------
+
+volatile int _tracing_is_enabled = false;
+
+// Set from a signal handler, and handled later in the main loop
+static volatile sig_atomic_t _tracing_toggle_is_pending = false;
+
+// Each thread lazily registers (and then only writes in) its own buffer
+static TraceBuffer  _trace_buffers[TRACE_MAX_NB_THREADS];
+static int          _nb_trace_buffers = 0;
+
+static __thread TraceBuffer* _thread_trace_buffer = NULL;
+
+// -----------------------------------------------------------------------------
+// RECORDING EVENTS
+// -----------------------------------------------------------------------------
+
+// The raw clock is not affected by NTP adjustments, and is cheap to read (vDSO)
+uint64_t getTraceTimestamp ()
+{
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &current_time);
+
+    return (uint64_t) current_time.tv_sec * 1000000000 + current_time.tv_nsec;
+}
+
+// Internal version only!
+// Return the buffer of the calling thread, or NULL if no more buffer is available
+static TraceBuffer* _getThreadTraceBuffer ()
+{
+    if (_thread_trace_buffer != NULL)
+        return _thread_trace_buffer;
+
+    int buffer_index = __atomic_fetch_add(&_nb_trace_buffers, 1, __ATOMIC_RELAXED);
+    if (buffer_index >= TRACE_MAX_NB_THREADS)
+    {
+        printWarning("Warning: too many threads to trace, some events are ignored");
+        return NULL;
+    }
+
+    TraceBuffer* buffer = &_trace_buffers[buffer_index];
+
+    buffer->events = malloc(TRACE_BUFFER_MAX_NB_EVENTS * sizeof(TraceEvent));
+    if (buffer->events == NULL)
+        handleErrorAndExit("malloc() failed in _getThreadTraceBuffer()");
+
+    buffer->nb_events     = 0;
+    buffer->max_nb_events = TRACE_BUFFER_MAX_NB_EVENTS;
+    buffer->thread_id     = buffer_index;
+
+    _thread_trace_buffer = buffer;
+    return buffer;
+}
+
+// When the buffer is full, the oldest events are overwritten
+void recordTraceEvent (const TraceStage stage, const int client_fd, const uint64_t start)
+{
+    uint64_t end = getTraceTimestamp();
+
+    TraceBuffer* buffer = _getThreadTraceBuffer();
+    if (buffer == NULL)
+        return;
+
+    TraceEvent* event = &buffer->events[buffer->nb_events % buffer->max_nb_events];
+    event->start     = start;
+    event->duration  = end - start;
+    event->client_fd = client_fd;
+    event->stage     = stage;
+
+    __atomic_store_n(&buffer->nb_events, buffer->nb_events + 1, __ATOMIC_RELEASE);
+}
+
+char* getTraceStageAsString (const TraceStage stage)
+{
+    switch (stage)
+    {
+        case TRACE_READ:
+            return "read";
+        case TRACE_HEADER_CHECK:
+            return "header_check";
+        case TRACE_PARSE:
+            return "parse_request";
+        case TRACE_PRODUCE_ANSWER:
+            return "produce_answer";
+        case TRACE_FILL_HEADER:
+            return "fill_header";
+        case TRACE_WRITE_HEADER:
+            return "write_header";
+        case TRACE_WRITE_BODY:
+            return "write_body";
+
+        default:
+            return "unknown";
+    }
+}
+
+// -----------------------------------------------------------------------------
+// RUNTIME SWITCH
+// -----------------------------------------------------------------------------
+
+void enableTracing ()
+{
+    _tracing_is_enabled = true;
+}
+
+void disableTracing ()
+{
+    _tracing_is_enabled = false;
+}
+
+bool tracingIsEnabled ()
+{
+    return _tracing_is_enabled;
+}
+
+// Async-signal-safe: only remember that the tracing must be toggled
+void requestTracingToggle ()
+{
+    _tracing_toggle_is_pending = true;
+}
+
+// If a toggle has been requested, either enable the tracing,
+// or disable it and dump all the recorded events in a file named after the PID
+void handlePendingTracingToggle ()
+{
+    if (! _tracing_toggle_is_pending)
+        return;
+
+    _tracing_toggle_is_pending = false;
+
+    if (! tracingIsEnabled())
+    {
+        enableTracing();
+        printf("Tracing is now enabled.\n");
+        return;
+    }
+
+    disableTracing();
+
+    char file_path[64];
+    snprintf(file_path, sizeof(file_path), TRACE_FILE_NAME_FORMAT, getpid());
+
+    int nb_events_dumped = dumpTraceBuffers(file_path);
+    printf("Tracing is now disabled: %d events dumped in %s.\n", nb_events_dumped, file_path);
+}
+
+// -----------------------------------------------------------------------------
+// DUMPING EVENTS (CHROME TRACE-EVENT FORMAT)
+// -----------------------------------------------------------------------------
+
+// Write all the recorded events in a JSON file, and empty the buffers
+// Return the number of events written, or -1 if the file cannot be written
+int dumpTraceBuffers (const char* file_path)
+{
+    FILE* trace_file = fopen(file_path, "w");
+    if (trace_file == NULL)
+    {
+        handleError("fopen() failed in dumpTraceBuffers()");
+        return -1;
+    }
+
+    int pid              = getpid();
+    int nb_events_dumped = 0;
+    int nb_buffers       = MIN(__atomic_load_n(&_nb_trace_buffers, __ATOMIC_RELAXED),
+                               TRACE_MAX_NB_THREADS);
+
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (int i = 0; i < nb_buffers; i++)
+    {
+        TraceBuffer* buffer = &_trace_buffers[i];
+
+        // Only the most recent events remain in a buffer which has been filled
+        uint64_t nb_events   = __atomic_load_n(&buffer->nb_events, __ATOMIC_ACQUIRE);
+        uint64_t first_event = nb_events > buffer->max_nb_events
+                             ? nb_events - buffer->max_nb_events
+                             : 0;
+
+        for (uint64_t j = first_event; j < nb_events; j++)
+        {
+            TraceEvent* event = &buffer->events[j % buffer->max_nb_events];
+
+            fprintf(trace_file,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"fd\":%d}}",
+                    nb_events_dumped == 0 ? "" : ",",
+                    getTraceStageAsString(event->stage),
+                    (double) event->start / 1000.0, (double) event->duration / 1000.0,
+                    pid, buffer->thread_id, event->client_fd);
+
+            nb_events_dumped++;
+        }
+
+        buffer->nb_events = 0;
+    }
+
+    fprintf(trace_file, "\n]}\n");
+
+    int return_value = fclose(trace_file);
+    if (return_value < 0)
+        handleError("fclose() failed in dumpTraceBuffers()");
+
+    return nb_events_dumped;
+}
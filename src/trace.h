@@ -0,0 +1,74 @@
+#ifndef __H_TRACE__
+#define __H_TRACE__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Stages of the handling of a request which can be timed
+typedef enum TraceStage {
+    TRACE_READ,
+    TRACE_HEADER_CHECK,
+    TRACE_PARSE,
+    TRACE_PRODUCE_ANSWER,
+    TRACE_FILL_HEADER,
+    TRACE_WRITE_HEADER,
+    TRACE_WRITE_BODY,
+
+    NB_TRACE_STAGES
+} TraceStage;
+
+// A timed stage (timestamps are given in nanoseconds)
+typedef struct TraceEvent {
+    uint64_t   start;
+    uint64_t   duration;
+    int        client_fd;
+    TraceStage stage;
+} TraceEvent;
+
+// Ring buffer of events, owned by a single thread
+typedef struct TraceBuffer {
+    TraceEvent* events;
+    uint64_t    nb_events;     // Number of events recorded so far (may exceed the max)
+    uint64_t    max_nb_events;
+    int         thread_id;
+} TraceBuffer;
+
+// -----------------------------------------------------------------------------
+
+#define TRACE_BUFFER_MAX_NB_EVENTS 65536
+#define TRACE_MAX_NB_THREADS       64
+#define TRACE_FILE_NAME_FORMAT     "trace-%d.json" // %d is the PID
+#define TRACE_NOT_STARTED          0
+
+// Only written by enableTracing()/disableTracing(); read at every traced stage
+extern volatile int _tracing_is_enabled;
+
+// -----------------------------------------------------------------------------
+
+uint64_t getTraceTimestamp ();
+void recordTraceEvent (const TraceStage stage, const int client_fd, const uint64_t start);
+
+// Usage: uint64_t start = startTraceStage(); <stage>; endTraceStage(<stage>, <fd>, start);
+// When tracing is disabled, this only costs the test of a global flag
+static inline uint64_t startTraceStage ()
+{
+    return _tracing_is_enabled ? getTraceTimestamp() : TRACE_NOT_STARTED;
+}
+
+static inline void endTraceStage (const TraceStage stage, const int client_fd, const uint64_t start)
+{
+    if (start != TRACE_NOT_STARTED)
+        recordTraceEvent(stage, client_fd, start);
+}
+
+char* getTraceStageAsString (const TraceStage stage);
+
+void enableTracing ();
+void disableTracing ();
+bool tracingIsEnabled ();
+void requestTracingToggle ();
+void handlePendingTracingToggle ();
+
+int dumpTraceBuffers (const char* file_path);
+
+#endif
@@ -0,0 +1,235 @@
+// Macro definition required for using SCM_RIGHTS and setenv()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "toolbox.h"
+#include "upgrade.h"
+
+// -----------------------------------------------------------------------------
+
+// Arguments the server has been started with (the new binary is started with the same ones)
+static const char** _upgrade_command = NULL;
+
+// Set from a signal handler, and handled later in the main loop
+static volatile sig_atomic_t _upgrade_is_requested = false;
+
+// New process only: channel to the previous process, until it is notified
+static int _upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+
+// -----------------------------------------------------------------------------
+// UPGRADE REQUESTS
+// -----------------------------------------------------------------------------
+
+// The binary at the same path (e.g. replaced by a deployment) is started on upgrades
+void setUpgradeCommand (const char* argv[])
+{
+    _upgrade_command = argv;
+}
+
+// Async-signal-safe: only remember that an upgrade must be started
+void requestUpgrade ()
+{
+    _upgrade_is_requested = true;
+}
+
+// Return true (only once) if an upgrade has been requested
+bool takeUpgradeRequest ()
+{
+    if (! _upgrade_is_requested)
+        return false;
+
+    _upgrade_is_requested = false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// PREVIOUS PROCESS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// The sockets are sent along with a single (meaningless) byte
+static int _sendListeningSockets (const int channel_fd, const int listening_sockfds[],
+                                  const int nb_listening_sockfds)
+{
+    char         byte = 0;
+    struct iovec data = { .iov_base = &byte, .iov_len = 1 };
+
+    union {
+        char           buffer[CMSG_SPACE(UPGRADE_MAX_NB_SOCKETS * sizeof(int))];
+        struct cmsghdr alignment;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov        = &data;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = CMSG_SPACE(nb_listening_sockfds * sizeof(int));
+
+    struct cmsghdr* control_header = CMSG_FIRSTHDR(&message);
+    control_header->cmsg_level = SOL_SOCKET;
+    control_header->cmsg_type  = SCM_RIGHTS;
+    control_header->cmsg_len   = CMSG_LEN(nb_listening_sockfds * sizeof(int));
+    memcpy(CMSG_DATA(control_header), listening_sockfds, nb_listening_sockfds * sizeof(int));
+
+    return sendmsg(channel_fd, &message, 0);
+}
+
+// Start the new binary (with the same arguments), and send it the listening sockets
+// (at most UPGRADE_MAX_NB_SOCKETS; they are received in the same order)
+// Return the channel through which it signals it is ready (see readUpgradeReadiness()),
+// which is non-blocking, or UPGRADE_NO_CHANNEL if it could not be started (the server then
+// keeps running as before); the pid of the new process is written in upgraded_pid
+int startUpgradedProcess (const int listening_sockfds[], const int nb_listening_sockfds,
+                          pid_t* upgraded_pid)
+{
+    if (_upgrade_command == NULL)
+    {
+        printWarning("Warning: the upgrade command is not set!");
+        return UPGRADE_NO_CHANNEL;
+    }
+
+    int channel_fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel_fds) < 0)
+    {
+        handleError("socketpair() failed in startUpgradedProcess()");
+        return UPGRADE_NO_CHANNEL;
+    }
+
+    // Otherwise, the buffered output would be printed again by the new process
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        handleError("fork() failed in startUpgradedProcess()");
+        close(channel_fds[0]);
+        close(channel_fds[1]);
+        return UPGRADE_NO_CHANNEL;
+    }
+
+    // New process: only the channel is kept open (the sockets of the clients must only be
+    // closed by the previous process), and atexit's functions must not run if exec fails
+    if (pid == 0)
+    {
+        long max_nb_fds = sysconf(_SC_OPEN_MAX);
+        for (int fd = STDERR_FILENO + 1; fd < max_nb_fds; fd++)
+            if (fd != channel_fds[1])
+                close(fd);
+
+        char channel_fd_string[16];
+        snprintf(channel_fd_string, sizeof(channel_fd_string), "%d", channel_fds[1]);
+        setenv(UPGRADE_CHANNEL_ENV_VARIABLE, channel_fd_string, 1);
+
+        execv(_upgrade_command[0], (char* const*) _upgrade_command);
+
+        handleError("execv() failed in startUpgradedProcess()");
+        _exit(EXIT_FAILURE);
+    }
+
+    // Previous process
+    close(channel_fds[1]);
+    *upgraded_pid = pid;
+
+    if (_sendListeningSockets(channel_fds[0], listening_sockfds, nb_listening_sockfds) < 0)
+    {
+        handleError("sendmsg() failed in startUpgradedProcess()");
+        close(channel_fds[0]);
+        return UPGRADE_NO_CHANNEL;
+    }
+
+    // The channel is polled (by the main loop, or by the master in prefork mode)
+    if (fcntl(channel_fds[0], F_SETFL, fcntl(channel_fds[0], F_GETFL) | O_NONBLOCK) < 0)
+        handleError("fcntl() failed in startUpgradedProcess()");
+
+    printf("Upgraded server started (pid: %d)\n", (int) pid);
+    return channel_fds[0];
+}
+
+// Return whether the new process has signaled it is ready, or has failed (e.g. exited),
+// without waiting: the channel is closed unless the upgrade is still pending
+UpgradeReadiness readUpgradeReadiness (const int channel_fd)
+{
+    char    byte;
+    ssize_t nb_bytes_read = read(channel_fd, &byte, 1);
+
+    if (nb_bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return UPGRADE_PENDING;
+
+    close(channel_fd);
+
+    return nb_bytes_read == 1 && byte == UPGRADE_READY_BYTE ? UPGRADE_READY
+                                                            : UPGRADE_FAILED;
+}
+
+// -----------------------------------------------------------------------------
+// NEW PROCESS
+// -----------------------------------------------------------------------------
+
+// Fill the array with the listening sockets handed over by the previous process,
+// and return their number (0 if the server has not been started by an upgrade)
+int receiveListeningSockets (int listening_sockfds[])
+{
+    char* channel_fd_string = getenv(UPGRADE_CHANNEL_ENV_VARIABLE);
+    if (channel_fd_string == NULL)
+        return 0;
+
+    _upgrade_channel_fd = atoi(channel_fd_string);
+    unsetenv(UPGRADE_CHANNEL_ENV_VARIABLE);
+
+    char         byte;
+    struct iovec data = { .iov_base = &byte, .iov_len = 1 };
+
+    union {
+        char           buffer[CMSG_SPACE(UPGRADE_MAX_NB_SOCKETS * sizeof(int))];
+        struct cmsghdr alignment;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov        = &data;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    if (recvmsg(_upgrade_channel_fd, &message, 0) <= 0)
+        handleErrorAndExit("recvmsg() failed in receiveListeningSockets()");
+
+    struct cmsghdr* control_header = CMSG_FIRSTHDR(&message);
+    if (control_header == NULL
+    ||  control_header->cmsg_level != SOL_SOCKET
+    ||  control_header->cmsg_type  != SCM_RIGHTS)
+        handleErrorAndExit("receiveListeningSockets() failed: no socket received");
+
+    int nb_listening_sockfds = (control_header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(listening_sockfds, CMSG_DATA(control_header), nb_listening_sockfds * sizeof(int));
+
+    printf("Listening socket(s) received from the previous process (%d, first fd: %d)\n",
+           nb_listening_sockfds, listening_sockfds[0]);
+    return nb_listening_sockfds;
+}
+
+// Signal the previous process (if any) that it can stop accepting clients
+void notifyUpgradeReadiness ()
+{
+    if (_upgrade_channel_fd == UPGRADE_NO_CHANNEL)
+        return;
+
+    char byte = UPGRADE_READY_BYTE;
+    if (write(_upgrade_channel_fd, &byte, 1) < 0)
+        handleError("write() failed in notifyUpgradeReadiness()");
+
+    close(_upgrade_channel_fd);
+    _upgrade_channel_fd = UPGRADE_NO_CHANNEL;
+}
@@ -0,0 +1,43 @@
+#ifndef __H_UPGRADE__
+#define __H_UPGRADE__
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Upgrade of the server binary with no downtime (on SIGUSR2):
+// the running process starts the new binary, and hands its listening sockets over to it
+// through a Unix socket (as SCM_RIGHTS ancillary data), so that clients keep being accepted
+// (the new process finds the socket of each of its listeners by address, see listener.h;
+// all the sockets of the SO_REUSEPORT group are handed over, when connections are steered
+// to the workers, so that the group and its steering program are kept as they are)
+// The new process builds its cache, and then sends a single byte to signal it is ready:
+// only then does the previous one stop accepting clients, and exit once they are all served
+
+// What the previous process knows about the new one (see readUpgradeReadiness())
+typedef enum UpgradeReadiness {
+    UPGRADE_PENDING, // Still building its cache
+    UPGRADE_READY,
+    UPGRADE_FAILED   // E.g. it has exited
+} UpgradeReadiness;
+
+#define UPGRADE_CHANNEL_ENV_VARIABLE "WEBSERVER_UPGRADE_FD"
+#define UPGRADE_READY_BYTE           'R'
+#define UPGRADE_MAX_NB_SOCKETS       64 // Listening sockets handed over
+
+// Named, useful constants
+#define UPGRADE_NO_CHANNEL -1
+
+// -----------------------------------------------------------------------------
+
+void setUpgradeCommand (const char* argv[]);
+void requestUpgrade ();
+bool takeUpgradeRequest ();
+
+int startUpgradedProcess (const int listening_sockfds[], const int nb_listening_sockfds,
+                          pid_t* upgraded_pid);
+UpgradeReadiness readUpgradeReadiness (const int channel_fd);
+
+int receiveListeningSockets (int listening_sockfds[]);
+void notifyUpgradeReadiness ();
+
+#endif
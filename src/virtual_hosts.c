@@ -0,0 +1,295 @@
+// Macro definition required for using strtok_r() and strncasecmp()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "toolbox.h"
+#include "file_cache.h"
+#include "virtual_hosts.h"
+
+// -----------------------------------------------------------------------------
+// HOST NAMES
+// -----------------------------------------------------------------------------
+
+// Hash the name of a Host header value (or of a configured host name), case-insensitively
+// (FNV-1a), without copying it: the name stops before the port (if any), and before
+// the final dot of a fully qualified name (e.g. "Example.COM.:8080" is "example.com")
+// Its length is written in name_length
+uint32_t hashHostName (const char* host, int* name_length)
+{
+    // An IPv6 literal includes its brackets (and the colons inside them)
+    const char* name_end = host;
+    if (host[0] == '[')
+    {
+        while (*name_end != '\0' && *name_end != ']')
+            name_end++;
+        if (*name_end == ']')
+            name_end++;
+    }
+    else
+    {
+        while (*name_end != '\0' && *name_end != ':')
+            name_end++;
+    }
+
+    if (name_end > host && name_end[-1] == '.')
+        name_end--;
+
+    uint32_t hash = 2166136261u;
+    for (const char* c = host; c < name_end; c++)
+        hash = (hash ^ (uint32_t) tolower((unsigned char) *c)) * 16777619u;
+
+    *name_length = (int) (name_end - host);
+    return hash != VIRTUAL_HOST_NO_HASH ? hash : 1;
+}
+
+// Internal version only!
+// Return the entry of the name, or the unused entry where it can be added
+static VirtualHostEntry* _findEntry (const VirtualHosts* virtual_hosts, const char* name,
+                                     const int name_length, const uint32_t hash)
+{
+    uint32_t index = hash & virtual_hosts->nb_entries_mask;
+
+    for (;;)
+    {
+        VirtualHostEntry* entry = &virtual_hosts->entries[index];
+        if (entry->hash == VIRTUAL_HOST_NO_HASH)
+            return entry;
+
+        if (entry->hash == hash && entry->name_length == name_length
+        &&  strncasecmp(entry->name, name, name_length) == 0)
+            return entry;
+
+        index = (index + 1) & virtual_hosts->nb_entries_mask;
+    }
+}
+
+// Return the site of the Host header value (which may point inside a request buffer),
+// or the default site if it is NULL or unknown
+// The lookup does not depend on the number of host names (the table is at most half full)
+Site* findVirtualHostSite (const VirtualHosts* virtual_hosts, const char* host)
+{
+    if (host == NULL || virtual_hosts->nb_host_names == 0)
+        return &virtual_hosts->sites[0];
+
+    int      name_length = 0;
+    uint32_t hash        = hashHostName(host, &name_length);
+
+    VirtualHostEntry* entry = _findEntry(virtual_hosts, host, name_length, hash);
+    if (entry->hash == VIRTUAL_HOST_NO_HASH)
+        return &virtual_hosts->sites[0];
+
+    return &virtual_hosts->sites[entry->site_index];
+}
+
+// -----------------------------------------------------------------------------
+// BASIC OPERATIONS ON VIRTUAL HOSTS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the index of the site of the root (which is added if it is a new one)
+// The weight of a site given several times is the largest one
+static int _addSite (VirtualHosts* virtual_hosts, const char* root_directory, const int weight)
+{
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+    {
+        Site* site = &virtual_hosts->sites[i];
+        if (stringsAreEqual(site->root_directory, root_directory))
+        {
+            site->weight = MAX(site->weight, weight);
+            return i;
+        }
+    }
+
+    Site* sites = realloc(virtual_hosts->sites, (virtual_hosts->nb_sites + 1) * sizeof(Site));
+    if (sites == NULL)
+        handleErrorAndExit("realloc() failed in _addSite()");
+    virtual_hosts->sites = sites;
+
+    Site* new_site = &sites[virtual_hosts->nb_sites];
+    new_site->root_directory = getFreshStringCopy(root_directory);
+    new_site->weight         = weight;
+    new_site->cache          = NULL;
+
+    return virtual_hosts->nb_sites++;
+}
+
+// Internal version only!
+// The table must have a free entry
+static bool _addHostName (VirtualHosts* virtual_hosts, const char* name, const int site_index)
+{
+    int      name_length = 0;
+    uint32_t hash        = hashHostName(name, &name_length);
+    if (name_length == 0 || name_length > VIRTUAL_HOST_MAX_NAME_LENGTH)
+    {
+        printError("Invalid virtual host name: %s", name);
+        return false;
+    }
+
+    VirtualHostEntry* entry = _findEntry(virtual_hosts, name, name_length, hash);
+    if (entry->hash != VIRTUAL_HOST_NO_HASH)
+    {
+        printError("The virtual host %s is given twice!", name);
+        return false;
+    }
+
+    entry->hash        = hash;
+    entry->name_length = name_length;
+    entry->name        = getFreshStringCopy(name);
+    entry->name[name_length] = '\0';
+    for (int i = 0; i < name_length; i++)
+        entry->name[i] = (char) tolower((unsigned char) entry->name[i]);
+    entry->site_index  = site_index;
+
+    virtual_hosts->nb_host_names++;
+    return true;
+}
+
+// Internal version only!
+// The description is made of host names, of a root, and of an optional weight
+// (e.g. "example.com,www.example.com=./sites/example:3")
+static bool _parseVirtualHost (VirtualHosts* virtual_hosts, char* description)
+{
+    char* root_directory = strchr(description, VIRTUAL_HOST_ROOT_SEPARATOR);
+    if (root_directory == NULL || root_directory == description || root_directory[1] == '\0')
+    {
+        printError("Invalid virtual host (its names and root are separated by '%c'): %s",
+                   VIRTUAL_HOST_ROOT_SEPARATOR, description);
+        return false;
+    }
+    *root_directory = '\0';
+    root_directory++;
+
+    // The weight is only the part after the last colon if it is a number
+    // (a root may contain colons as well)
+    int   weight           = VIRTUAL_HOST_DEFAULT_WEIGHT;
+    char* weight_separator = strrchr(root_directory, VIRTUAL_HOST_WEIGHT_SEPARATOR);
+    if (weight_separator != NULL && weight_separator[1] != '\0'
+    &&  strspn(weight_separator + 1, "0123456789") == strlen(weight_separator + 1))
+    {
+        weight = atoi(weight_separator + 1);
+        *weight_separator = '\0';
+
+        if (weight <= 0)
+        {
+            printError("Invalid weight of the virtual host %s", description);
+            return false;
+        }
+    }
+
+    int site_index = _addSite(virtual_hosts, root_directory, weight);
+
+    char* position = NULL;
+    for (char* name = strtok_r(description, VIRTUAL_HOST_NAMES_SEPARATOR, &position);
+         name != NULL;
+         name = strtok_r(NULL, VIRTUAL_HOST_NAMES_SEPARATOR, &position))
+    {
+        if (! _addHostName(virtual_hosts, name, site_index))
+            return false;
+    }
+
+    return true;
+}
+
+// The list is made of virtual hosts separated by spaces (see virtual_hosts.h)
+// The caches of the sites are only built afterwards (see buildSiteCaches())
+// Return NULL if the list is invalid (an empty list only has the default site)
+VirtualHosts* parseVirtualHosts (const char* list, const char* default_root_directory)
+{
+    VirtualHosts* virtual_hosts = calloc(1, sizeof(VirtualHosts));
+    if (virtual_hosts == NULL)
+        handleErrorAndExit("calloc() failed in parseVirtualHosts()");
+
+    _addSite(virtual_hosts, default_root_directory, VIRTUAL_HOST_DEFAULT_WEIGHT);
+
+    // Each host name is separated from the next one by at least one character
+    uint32_t nb_entries = 8;
+    while (nb_entries < VIRTUAL_HOSTS_LOAD_FACTOR * (strlen(list) / 2 + 1))
+        nb_entries *= 2;
+
+    virtual_hosts->entries = calloc(nb_entries, sizeof(VirtualHostEntry));
+    if (virtual_hosts->entries == NULL)
+        handleErrorAndExit("calloc() failed in parseVirtualHosts()");
+    virtual_hosts->nb_entries_mask = nb_entries - 1;
+
+    char* list_copy = getFreshStringCopy(list);
+    char* position  = NULL;
+    bool  success   = true;
+
+    for (char* description = strtok_r(list_copy, VIRTUAL_HOSTS_SEPARATORS, &position);
+         description != NULL && success;
+         description = strtok_r(NULL, VIRTUAL_HOSTS_SEPARATORS, &position))
+        success = _parseVirtualHost(virtual_hosts, description);
+
+    free(list_copy);
+
+    if (! success)
+    {
+        deleteVirtualHosts(virtual_hosts);
+        return NULL;
+    }
+
+    return virtual_hosts;
+}
+
+void deleteVirtualHosts (VirtualHosts* virtual_hosts)
+{
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+    {
+        free(virtual_hosts->sites[i].root_directory);
+        if (virtual_hosts->sites[i].cache != NULL)
+            deleteFileCache(virtual_hosts->sites[i].cache);
+    }
+
+    for (uint32_t i = 0; i <= virtual_hosts->nb_entries_mask; i++)
+        free(virtual_hosts->entries[i].name);
+
+    free(virtual_hosts->sites);
+    free(virtual_hosts->entries);
+    free(virtual_hosts);
+}
+
+void printVirtualHosts (const VirtualHosts* virtual_hosts)
+{
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+    {
+        const Site* site = &virtual_hosts->sites[i];
+        printf("Site %s (weight: %d%s):", site->root_directory, site->weight,
+               i == 0 ? ", default" : "");
+
+        for (uint32_t j = 0; j <= virtual_hosts->nb_entries_mask; j++)
+        {
+            const VirtualHostEntry* entry = &virtual_hosts->entries[j];
+            if (entry->hash != VIRTUAL_HOST_NO_HASH && entry->site_index == i)
+                printf(" %s", entry->name);
+        }
+
+        printf("\n");
+    }
+}
+
+// -----------------------------------------------------------------------------
+// CACHES OF THE SITES
+// -----------------------------------------------------------------------------
+
+// Build the cache of each site, whose maximum size is its share of the total one
+// (in proportion to its weight)
+void buildSiteCaches (VirtualHosts* virtual_hosts, const off_t total_max_size)
+{
+    int total_weight = 0;
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+        total_weight += virtual_hosts->sites[i].weight;
+
+    for (int i = 0; i < virtual_hosts->nb_sites; i++)
+    {
+        Site* site = &virtual_hosts->sites[i];
+        off_t max_size = total_max_size / total_weight * site->weight;
+
+        site->cache = buildCacheFromDisk(site->root_directory, max_size);
+    }
+}
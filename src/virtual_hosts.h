@@ -0,0 +1,67 @@
+#ifndef __H_VIRTUAL_HOSTS__
+#define __H_VIRTUAL_HOSTS__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "file_cache.h"
+
+// Name-based virtual hosting: the Host header of a request selects the site it is answered from
+// Each site (i.e. document root) has its own file cache, whose size is its share
+// of the global budget (proportional to its weight), and is shared by all its host names
+// The sites are given as a list separated by spaces, each one being made of its host names
+// (separated by commas), its root and its weight (1 if none), e.g.
+// "example.com,www.example.com=./sites/example:3 blog.example.org=./sites/blog"
+// Requests without a Host header, or with an unknown one, are answered from the default site
+// (the root parameter of the server), which is also a site of the list if it has the same root
+
+typedef struct Site {
+    char*      root_directory;
+    int        weight;
+    FileCache* cache; // NULL until built (see buildSiteCaches())
+} Site;
+
+// Entry of the host names table (open addressing, with linear probing)
+typedef struct VirtualHostEntry {
+    uint32_t hash;        // See hashHostName() (VIRTUAL_HOST_NO_HASH if the entry is unused)
+    int      name_length;
+    char*    name;        // Lowercase, without port
+    int      site_index;
+} VirtualHostEntry;
+
+typedef struct VirtualHosts {
+    Site* sites; // The first one is the default site
+    int   nb_sites;
+
+    VirtualHostEntry* entries;
+    uint32_t          nb_entries_mask; // Number of entries - 1 (it is a power of two)
+    int               nb_host_names;
+} VirtualHosts;
+
+// -----------------------------------------------------------------------------
+
+#define VIRTUAL_HOSTS_SEPARATORS      " \t"
+#define VIRTUAL_HOST_NAMES_SEPARATOR  ","
+#define VIRTUAL_HOST_ROOT_SEPARATOR   '='
+#define VIRTUAL_HOST_WEIGHT_SEPARATOR ':'
+#define VIRTUAL_HOST_DEFAULT_WEIGHT   1
+#define VIRTUAL_HOST_MAX_NAME_LENGTH  255 // bytes (as a DNS name)
+
+// The table is at most half full, so that the probe sequences remain short
+#define VIRTUAL_HOSTS_LOAD_FACTOR     2
+
+// Named, useful constants
+#define VIRTUAL_HOST_NO_HASH 0
+
+// -----------------------------------------------------------------------------
+
+VirtualHosts* parseVirtualHosts (const char* list, const char* default_root_directory);
+void deleteVirtualHosts (VirtualHosts* virtual_hosts);
+void printVirtualHosts (const VirtualHosts* virtual_hosts);
+
+void buildSiteCaches (VirtualHosts* virtual_hosts, const off_t total_max_size);
+
+uint32_t hashHostName (const char* host, int* name_length);
+Site* findVirtualHostSite (const VirtualHosts* virtual_hosts, const char* host);
+
+#endif
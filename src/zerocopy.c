@@ -0,0 +1,96 @@
+// Macro definition required for using the error queue of the sockets
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include "toolbox.h"
+#include "zerocopy.h"
+
+// -----------------------------------------------------------------------------
+// SENDING
+// -----------------------------------------------------------------------------
+
+// Return false if the socket does not support it (e.g. on an older kernel)
+bool enableZeroCopy (const int sockfd)
+{
+    int is_enabled = 1;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &is_enabled, sizeof(is_enabled)) == 0;
+}
+
+// Same as write(), except that the buffer is pinned until the send is completed
+// If the socket has run out of memory for pinning buffers (errno is ENOBUFS),
+// the data must rather be copied (e.g. with write())
+ssize_t sendZeroCopy (const int sockfd, const void* buffer, const size_t length)
+{
+    return send(sockfd, buffer, length, MSG_ZEROCOPY);
+}
+
+// -----------------------------------------------------------------------------
+// COMPLETIONS
+// -----------------------------------------------------------------------------
+
+// Internal version only!
+// Return the number of sends completed by the notification of the message (0 if it is not one)
+static int _countCompletedSends (struct msghdr* message, int* nb_copied_sends)
+{
+    for (struct cmsghdr* control = CMSG_FIRSTHDR(message);
+         control != NULL;
+         control = CMSG_NXTHDR(message, control))
+    {
+        bool is_error = (control->cmsg_level == SOL_IP   && control->cmsg_type == IP_RECVERR)
+                     || (control->cmsg_level == SOL_IPV6 && control->cmsg_type == IPV6_RECVERR);
+        if (! is_error)
+            continue;
+
+        struct sock_extended_err* error = (struct sock_extended_err*) CMSG_DATA(control);
+        if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0)
+            continue;
+
+        // The sends from ee_info to ee_data (included) are completed
+        int nb_sends = (int) (error->ee_data - error->ee_info + 1);
+        if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            *nb_copied_sends += nb_sends;
+
+        return nb_sends;
+    }
+
+    return 0;
+}
+
+// Read all the pending notifications of the socket, and return the number of completed sends
+// (their buffers can then be freed), or -1 if the error queue cannot be read
+// The sends whose data had to be copied anyway are counted in nb_copied_sends as well
+int readZeroCopyCompletions (const int sockfd, int* nb_copied_sends)
+{
+    int nb_completed_sends = 0;
+    *nb_copied_sends = 0;
+
+    for (;;)
+    {
+        char control_buffer[ZEROCOPY_CONTROL_BUFFER_SIZE];
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control    = control_buffer;
+        message.msg_controllen = sizeof(control_buffer);
+
+        if (recvmsg(sockfd, &message, MSG_ERRQUEUE) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return nb_completed_sends;
+
+            handleError("recvmsg() failed in readZeroCopyCompletions()");
+            return -1;
+        }
+
+        nb_completed_sends += _countCompletedSends(&message, nb_copied_sends);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __H_ZEROCOPY__
+#define __H_ZEROCOPY__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Sending without copying the data in the kernel (MSG_ZEROCOPY): the pages of the buffer
+// are directly read by the NIC, so they must neither be modified nor freed until the kernel
+// reports that the send is completed, in the error queue of the socket
+// Each successful send of a socket gets the next number (from 0), and the completions
+// are reported as ranges of numbers (see readZeroCopyCompletions())
+// Only worth it for large buffers (the pinning of the pages and the completions have a cost),
+// and useless if the data is copied anyway (e.g. over loopback, or if the NIC cannot do it)
+
+typedef enum ZeroCopyState {
+    ZEROCOPY_NOT_ENABLED, // SO_ZEROCOPY is only set on the socket when first needed
+    ZEROCOPY_ENABLED,
+    ZEROCOPY_UNAVAILABLE  // Not supported, or the data has been copied anyway
+} ZeroCopyState;
+
+// -----------------------------------------------------------------------------
+
+// Headers may be older than the running kernel
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define ZEROCOPY_CONTROL_BUFFER_SIZE 128 // bytes (a single notification per message)
+
+// -----------------------------------------------------------------------------
+
+bool enableZeroCopy (const int sockfd);
+ssize_t sendZeroCopy (const int sockfd, const void* buffer, const size_t length);
+int readZeroCopyCompletions (const int sockfd, int* nb_copied_sends);
+
+#endif